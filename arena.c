@@ -0,0 +1,127 @@
+/**
+ * Copyright 2015 Chris Moos
+ * 
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and 
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+
+/* The first chunk is this big, each one after is twice the size up to ARENA_MAX_CHUNK */
+#define ARENA_MIN_CHUNK 4096
+#define ARENA_MAX_CHUNK (1 << 20)
+
+/**
+ * Chunks start with the link to the previous chunk. Chunks holding a single large block
+ * also record the block's size, in the header's second word.
+ */
+#define ARENA_CHUNK_HEADER ARENA_ALIGN
+
+#define ARENA_LARGE_SIZE(block) (((size_t*)(block))[-1])
+
+void arena_init(arena_t *arena) {
+    memset(arena, 0, sizeof(arena_t));
+    arena->chunkSize = ARENA_MIN_CHUNK;
+}
+
+/**
+ * Adds a chunk of size bytes to the arena, returns its first byte after the header.
+ */
+static uint8_t *arena_add_chunk(arena_t *arena, size_t size) {
+    uint8_t *chunk;
+    if(posix_memalign((void**)&chunk, ARENA_ALIGN, size) != 0) return NULL;
+    *(void**)chunk = arena->chunks;
+    arena->chunks = chunk;
+    arena->bytes += size;
+    arena->numMallocs++;
+    return chunk + ARENA_CHUNK_HEADER;
+}
+
+/**
+ * Large blocks are reused best fit first, so a small one doesn't take the place of a
+ * bigger one that is about to be needed again.
+ */
+static void *arena_alloc_large(arena_t *arena, size_t size) {
+    void **link = &arena->largeFreeList, **best = NULL;
+    while(*link != NULL) {
+        void *block = *link;
+        size_t blockSize = ARENA_LARGE_SIZE(block);
+        if(blockSize >= size && (best == NULL || blockSize < ARENA_LARGE_SIZE(*best))) {
+            best = link;
+            if(blockSize == size) break;
+        }
+        link = (void**)block;
+    }
+    if(best != NULL) {
+        void *block = *best;
+        *best = *(void**)block;
+        return block;
+    }
+
+    uint8_t *block = arena_add_chunk(arena, ARENA_CHUNK_HEADER + size);
+    if(block == NULL) return NULL;
+    ARENA_LARGE_SIZE(block) = size;
+    return block;
+}
+
+void *arena_alloc(arena_t *arena, size_t size) {
+    if(size == 0) size = 1;
+    if(size > ARENA_MAX_BLOCK) return arena_alloc_large(arena, size);
+
+    size_t sizeClass = (size - 1) / ARENA_ALIGN;
+    size = (sizeClass + 1) * ARENA_ALIGN;
+    void *block = arena->freeLists[sizeClass];
+    if(block != NULL) {
+        arena->freeLists[sizeClass] = *(void**)block;
+        return block;
+    }
+
+    if(arena->remaining < size) {
+        // What is left of the current chunk is too small for this block, it stays unused
+        uint8_t *start = arena_add_chunk(arena, arena->chunkSize);
+        if(start == NULL) return NULL;
+        arena->next = start;
+        arena->remaining = arena->chunkSize - ARENA_CHUNK_HEADER;
+        if(arena->chunkSize < ARENA_MAX_CHUNK) arena->chunkSize *= 2;
+    }
+
+    block = arena->next;
+    arena->next += size;
+    arena->remaining -= size;
+    return block;
+}
+
+void arena_release(arena_t *arena, void *block, size_t size) {
+    if(block == NULL) return;
+    if(size == 0) size = 1;
+    if(size > ARENA_MAX_BLOCK) {
+        *(void**)block = arena->largeFreeList;
+        arena->largeFreeList = block;
+        return;
+    }
+
+    size_t sizeClass = (size - 1) / ARENA_ALIGN;
+    *(void**)block = arena->freeLists[sizeClass];
+    arena->freeLists[sizeClass] = block;
+}
+
+void arena_free(arena_t *arena) {
+    while(arena->chunks != NULL) {
+        void *chunk = arena->chunks;
+        arena->chunks = *(void**)chunk;
+        free(chunk);
+    }
+    arena_init(arena);
+}
@@ -0,0 +1,79 @@
+/**
+ * Copyright 2015 Chris Moos
+ * 
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and 
+ * limitations under the License.
+ */
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Blocks are handed out in multiples of this many bytes, aligned to it */
+#define ARENA_ALIGN 16
+
+/* Blocks bigger than this get a chunk of their own */
+#define ARENA_MAX_BLOCK 1024
+
+#define ARENA_NUM_CLASSES (ARENA_MAX_BLOCK / ARENA_ALIGN)
+
+/**
+ * Hands out small blocks carved from large chunks. Blocks that are given back are kept on
+ * a free list for their size and reused, they are never returned to the system until the
+ * arena is freed, which frees every chunk at once.
+ */
+typedef struct arena_t {
+    /* The chunks, each starts with a pointer to the one allocated before it */
+    void *chunks;
+
+    /* The unused part of the newest chunk */
+    uint8_t *next;
+    size_t remaining;
+
+    /* The size of the next chunk */
+    size_t chunkSize;
+
+    /* freeLists[c] holds given back blocks of (c + 1) * ARENA_ALIGN bytes */
+    void *freeLists[ARENA_NUM_CLASSES];
+
+    /* Given back blocks bigger than ARENA_MAX_BLOCK, reused by any block that fits */
+    void *largeFreeList;
+
+    /* Bytes in chunks */
+    uint64_t bytes;
+
+    /* Calls made to malloc */
+    uint64_t numMallocs;
+} arena_t;
+
+void arena_init(arena_t *arena);
+
+/**
+ * Returns a block of at least size bytes aligned to ARENA_ALIGN, or NULL if memory
+ * couldn't be allocated.
+ */
+void *arena_alloc(arena_t *arena, size_t size);
+
+/**
+ * Gives back a block from arena_alloc, size must be the size it was allocated with.
+ */
+void arena_release(arena_t *arena, void *block, size_t size);
+
+/**
+ * Frees every chunk, and so every block. The arena can be used again afterwards.
+ */
+void arena_free(arena_t *arena);
+
+#endif
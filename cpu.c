@@ -0,0 +1,80 @@
+/**
+ * Copyright 2015 Chris Moos
+ * 
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and 
+ * limitations under the License.
+ */
+
+#include "cpu.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+
+static uint64_t cpu_xgetbv(void) {
+    uint32_t eax, edx;
+    __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    return ((uint64_t)edx << 32) | eax;
+}
+
+static uint32_t cpu_detect(void) {
+    uint32_t eax, ebx, ecx, edx;
+    uint32_t leaf7 = 0;
+    uint32_t features = 0;
+    
+    if(!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) return 0;
+    if(__get_cpuid_count(7, 0, &eax, &leaf7, &edx, &edx) == 0) leaf7 = 0;
+    if(ecx & bit_SSE4_2) features |= CPU_SSE42;
+    
+    // The SHA extensions only use the SSE registers
+    if((ecx & bit_SSE4_1) && (leaf7 & bit_SHA)) features |= CPU_SHA;
+    
+    // The AVX registers can only be used if the OS saves them on a context switch
+    if(!(ecx & bit_OSXSAVE)) return features;
+    uint64_t xcr0 = cpu_xgetbv();
+    if((xcr0 & 0x06) != 0x06) return features;
+    
+    if(leaf7 & bit_AVX2) features |= CPU_AVX2;
+    if((leaf7 & bit_AVX512F) && (xcr0 & 0xe0) == 0xe0) features |= CPU_AVX512F;
+    
+    return features;
+}
+#elif defined(__aarch64__) && defined(__linux__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+
+static uint32_t cpu_detect(void) {
+    return (getauxval(AT_HWCAP) & HWCAP_SHA1) ? CPU_SHA : 0;
+}
+#elif defined(__aarch64__) && defined(__APPLE__)
+static uint32_t cpu_detect(void) {
+    // Every Apple ARM CPU has the crypto extensions
+    return CPU_SHA;
+}
+#else
+static uint32_t cpu_detect(void) {
+    return 0;
+}
+#endif
+
+/* Set in the cached features once detection has run */
+#define CPU_DETECTED 0x80000000
+
+uint32_t cpu_features(void) {
+    static volatile uint32_t features = 0;
+    
+    // Detection always gives the same answer, so racing threads are harmless
+    if(!(features & CPU_DETECTED)) {
+        features = cpu_detect() | CPU_DETECTED;
+    }
+    return features & ~CPU_DETECTED;
+}
@@ -0,0 +1,38 @@
+/**
+ * Copyright 2015 Chris Moos
+ * 
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and 
+ * limitations under the License.
+ */
+
+#ifndef CPU_H
+#define CPU_H
+
+#include <stdint.h>
+
+/* Features reported by cpu_features */
+#define CPU_SSE42   0x01
+#define CPU_AVX2    0x02
+#define CPU_AVX512F 0x04
+
+/* SHA-1 instructions, the Intel SHA extensions or ARMv8 crypto */
+#define CPU_SHA     0x08
+
+/**
+ * Returns the CPU_* features that are supported by both the CPU and the
+ * operating system. Only CPU_SHA is detected on ARMv8, other platforms
+ * always return 0.
+ */
+uint32_t cpu_features(void);
+
+#endif
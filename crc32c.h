@@ -0,0 +1,40 @@
+/**
+ * Copyright 2015 Chris Moos
+ * 
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and 
+ * limitations under the License.
+ */
+
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <stdint.h>
+
+/**
+ * The CRC-32C (Castagnoli) checksum of data.
+ * The SSE4.2 crc32 instruction is used when the CPU supports it.
+ */
+uint32_t crc32c(const uint8_t *data, uint32_t len);
+
+/**
+ * The portable table driven CRC-32C, crc32c uses it when there is no hardware support.
+ */
+uint32_t crc32c_sw(const uint8_t *data, uint32_t len);
+
+/**
+ * The CRC-32C computed with the SSE4.2 crc32 instruction.
+ * This must only be called if cpu_features reports CPU_SSE42.
+ */
+uint32_t crc32c_hw(const uint8_t *data, uint32_t len);
+
+#endif
@@ -24,8 +24,146 @@
 #include "hash_ring.h"
 #include "sort.h"
 #include "md5.h"
+#include "search.h"
+#include "xxhash.h"
+#include "murmur3.h"
+#include "crc32c.h"
+#include "parallel.h"
+#include "arena.h"
+#include "rendezvous.h"
 
-static int item_sort(const void *a, const void *b);
+static void hash_ring_thaw(hash_ring_t *ring);
+static void hash_ring_build_index(hash_ring_t *ring);
+static int hash_ring_resize_items(hash_ring_t *ring, uint32_t numItems);
+static uint32_t hash_ring_find_index(hash_ring_t *ring, uint64_t num);
+static int hash_ring_alloc_anchor(hash_ring_t *ring);
+static void hash_ring_update_successors(hash_ring_t *ring, const uint64_t *keys, uint32_t count);
+
+/* Rings with fewer items than this are searched without a prefix index */
+#define HASH_RING_INDEX_MIN_ITEMS 64
+
+/* The number of keys a batched lookup hashes and searches together */
+#define HASH_RING_BATCH_GROUP 16
+
+/* The number of replicas hash_ring_hash_replicas hashes together */
+#define HASH_RING_HASH_GROUP 64
+
+/* The number of nodes hash_ring_find_nodes scores at once in rendezvous mode */
+#define HASH_RING_RENDEZVOUS_BLOCK 64
+
+/* Each thread used to add nodes gets at least this many new items */
+#define HASH_RING_THREAD_MIN_ITEMS 8192
+
+/* Replica names are built in a stack buffer of this many bytes */
+#define HASH_RING_REPLICA_BUF 4096
+
+/* Scratch space up to this size is kept for the next change to the ring */
+#define HASH_RING_SCRATCH_KEEP 65536
+
+/**
+ * The bytes used by each item in the ring's layout.
+ */
+static size_t hash_ring_item_size(hash_ring_t *ring) {
+    switch(ring->layout) {
+        case HASH_RING_LAYOUT_COMPACT32: return sizeof(uint32_t) + sizeof(uint32_t);
+        case HASH_RING_LAYOUT_COMPACT16: return sizeof(uint32_t) + sizeof(uint16_t);
+        default: return sizeof(uint64_t) + sizeof(uint32_t);
+    }
+}
+
+/**
+ * Whether rings in the mode keep items. The nodes of the other modes have no replicas and
+ * keys are mapped to them without searching.
+ */
+static inline int hash_ring_mode_has_items(HASH_MODE mode) {
+    return mode != HASH_RING_MODE_JUMP && mode != HASH_RING_MODE_MAGLEV && mode != HASH_RING_MODE_RENDEZVOUS &&
+        mode != HASH_RING_MODE_ANCHOR;
+}
+
+static inline int hash_ring_has_items(hash_ring_t *ring) {
+    return hash_ring_mode_has_items(ring->mode);
+}
+
+/**
+ * Converts a hashed number to the key the ring sorts and searches by: the number itself
+ * in the wide layout, its 32-bit position in the compact ones. Items and the keys looked
+ * up are converted the same way and the conversion keeps their order.
+ */
+static inline uint64_t hash_ring_key(hash_ring_t *ring, uint64_t number) {
+    if(ring->layout == HASH_RING_LAYOUT_WIDE || ring->mode == HASH_RING_MODE_LIBMEMCACHED_COMPAT) {
+        return number;
+    }
+    return number >> 32;
+}
+
+/**
+ * The number of bits to shift a key right by to get its prefix index bucket.
+ */
+static inline uint32_t hash_ring_index_shift(hash_ring_t *ring, uint8_t bits) {
+    return (ring->layout == HASH_RING_LAYOUT_WIDE ? 64 : 32) - bits;
+}
+
+static inline uint64_t hash_ring_item_key(hash_ring_t *ring, uint32_t pos) {
+    return ring->layout == HASH_RING_LAYOUT_WIDE ? ring->items[pos] : ring->positions[pos];
+}
+
+/**
+ * The number of the item at pos, as far as the layout keeps it. The bits a compact layout
+ * drops are 0.
+ */
+static inline uint64_t hash_ring_item_number(hash_ring_t *ring, uint32_t pos) {
+    uint64_t key = hash_ring_item_key(ring, pos);
+    if(ring->layout == HASH_RING_LAYOUT_WIDE || ring->mode == HASH_RING_MODE_LIBMEMCACHED_COMPAT) {
+        return key;
+    }
+    return key << 32;
+}
+
+static inline uint32_t hash_ring_item_node(hash_ring_t *ring, uint32_t pos) {
+    return ring->layout == HASH_RING_LAYOUT_COMPACT16 ? ring->itemNodes16[pos] : ring->itemNodes[pos];
+}
+
+static inline void hash_ring_set_item_node(hash_ring_t *ring, uint32_t pos, uint32_t node) {
+    if(ring->layout == HASH_RING_LAYOUT_COMPACT16) ring->itemNodes16[pos] = (uint16_t)node;
+    else ring->itemNodes[pos] = node;
+}
+
+static inline void hash_ring_set_item(hash_ring_t *ring, uint32_t pos, uint64_t key, uint32_t node) {
+    if(ring->layout == HASH_RING_LAYOUT_WIDE) ring->items[pos] = key;
+    else ring->positions[pos] = (uint32_t)key;
+    hash_ring_set_item_node(ring, pos, node);
+}
+
+/**
+ * Moves count items from position from to position to, the ranges may overlap.
+ */
+static void hash_ring_move_items(hash_ring_t *ring, uint32_t to, uint32_t from, uint32_t count) {
+    if(ring->layout == HASH_RING_LAYOUT_WIDE) {
+        memmove(ring->items + to, ring->items + from, sizeof(uint64_t) * count);
+    }
+    else {
+        memmove(ring->positions + to, ring->positions + from, sizeof(uint32_t) * count);
+    }
+    if(ring->layout == HASH_RING_LAYOUT_COMPACT16) {
+        memmove(ring->itemNodes16 + to, ring->itemNodes16 + from, sizeof(uint16_t) * count);
+    }
+    else {
+        memmove(ring->itemNodes + to, ring->itemNodes + from, sizeof(uint32_t) * count);
+    }
+    if(ring->successors != NULL) {
+        size_t width = ring->successorWidth;
+        memmove(ring->successors + to * width, ring->successors + from * width, sizeof(uint32_t) * width * count);
+    }
+}
+
+/**
+ * Returns the position of the first of the count items from start whose key is greater
+ * than key, or start + count if there is none.
+ */
+static inline uint32_t hash_ring_upper_bound(hash_ring_t *ring, uint32_t start, uint32_t count, uint64_t key) {
+    if(ring->layout == HASH_RING_LAYOUT_WIDE) return start + search_upper_bound(ring->items + start, count, key);
+    return start + search_upper_bound32(ring->positions + start, count, (uint32_t)key);
+}
 
 hash_ring_t *hash_ring_create(uint32_t numReplicas, HASH_FUNCTION hash_fn) {
     hash_ring_t *ring = NULL;
@@ -34,13 +172,43 @@ hash_ring_t *hash_ring_create(uint32_t numReplicas, HASH_FUNCTION hash_fn) {
     if(numReplicas <= 0) return NULL;
     
     // Make sure that the HASH_FUNCTION is supported
-    if(hash_fn != HASH_FUNCTION_MD5 && hash_fn != HASH_FUNCTION_SHA1) return NULL;
+    if(hash_fn != HASH_FUNCTION_MD5 && hash_fn != HASH_FUNCTION_SHA1 && hash_fn != HASH_FUNCTION_XXH3 &&
+        hash_fn != HASH_FUNCTION_MURMUR3 && hash_fn != HASH_FUNCTION_CRC32C) return NULL;
     
-    ring = (hash_ring_t*)malloc(sizeof(hash_ring_t));
+    // The arena lives in the same block as the ring
+    ring = (hash_ring_t*)malloc(sizeof(hash_ring_t) + sizeof(arena_t));
+    if(ring == NULL) return NULL;
+    ring->arena = (arena_t*)(ring + 1);
+    arena_init(ring->arena);
     
     ring->numReplicas = numReplicas;
-    ring->nodes = NULL;
+    ring->nodeTable = NULL;
+    ring->nodeSlots = NULL;
+    ring->nodeSlotsMask = 0;
+    ring->layout = HASH_RING_LAYOUT_WIDE;
     ring->items = NULL;
+    ring->positions = NULL;
+    ring->itemNodes = NULL;
+    ring->itemNodes16 = NULL;
+    ring->frozenItems = NULL;
+    ring->frozenRanks = NULL;
+    ring->index = NULL;
+    ring->indexBits = 0;
+    ring->maxIndexBits = HASH_RING_DEFAULT_MAX_INDEX_BITS;
+    ring->numThreads = 1;
+    ring->totalLoad = 0;
+    ring->loadFactor = HASH_RING_DEFAULT_LOAD_FACTOR;
+    ring->maglevTable = NULL;
+    ring->maglevSize = HASH_RING_DEFAULT_MAGLEV_SIZE;
+    ring->seeds = NULL;
+    ring->numProbes = HASH_RING_DEFAULT_PROBES;
+    ring->anchorNodes = NULL;
+    ring->anchorSize = HASH_RING_DEFAULT_ANCHOR_SIZE;
+    ring->successors = NULL;
+    ring->successorWidth = 0;
+    ring->numSuccessors = 0;
+    ring->scratch = NULL;
+    ring->scratchSize = 0;
     ring->numNodes = 0;
     ring->numItems = 0;
     ring->hash_fn = hash_fn;
@@ -49,339 +217,1875 @@ hash_ring_t *hash_ring_create(uint32_t numReplicas, HASH_FUNCTION hash_fn) {
     return ring;
 }
 
-void hash_ring_free(hash_ring_t *ring) {
-    if(ring == NULL) return;
+void hash_ring_free(hash_ring_t *ring) {
+    if(ring == NULL) return;
+
+    // The nodes are all in the arena
+    arena_free(ring->arena);
+    if(ring->nodeTable != NULL) free(ring->nodeTable);
+    if(ring->nodeSlots != NULL) free(ring->nodeSlots);
+    
+    // Clean up the items
+    hash_ring_resize_items(ring, 0);
+    hash_ring_thaw(ring);
+    if(ring->index != NULL) free(ring->index);
+    if(ring->maglevTable != NULL) free(ring->maglevTable);
+    if(ring->seeds != NULL) free(ring->seeds);
+    if(ring->anchorNodes != NULL) free(ring->anchorNodes);
+    if(ring->scratch != NULL) free(ring->scratch);
+    
+    free(ring);
+}
+
+/**
+ * Allocates a node, with its name copied in after it, from the ring's arena.
+ */
+static hash_ring_node_t *hash_ring_alloc_node(hash_ring_t *ring, uint8_t *name, uint32_t nameLen) {
+    hash_ring_node_t *node = (hash_ring_node_t*)arena_alloc(ring->arena, sizeof(hash_ring_node_t) + nameLen);
+    if(node == NULL) return NULL;
+
+    node->name = (uint8_t*)(node + 1);
+    memcpy(node->name, name, nameLen);
+    node->nameLen = nameLen;
+    node->load = 0;
+    return node;
+}
+
+static void hash_ring_release_node(hash_ring_t *ring, hash_ring_node_t *node) {
+    arena_release(ring->arena, node, sizeof(hash_ring_node_t) + node->nameLen);
+}
+
+/**
+ * Returns scratch space of at least size bytes, aligned for uint64_t, which stays the
+ * ring's until hash_ring_scratch_done. Returns NULL if memory couldn't be allocated.
+ */
+static void *hash_ring_scratch(hash_ring_t *ring, size_t size) {
+    if(size > ring->scratchSize) {
+        if(ring->scratch != NULL) free(ring->scratch);
+        ring->scratch = malloc(size);
+        ring->scratchSize = ring->scratch != NULL ? size : 0;
+    }
+    return ring->scratch;
+}
+
+/**
+ * Frees the scratch space if it is too big to keep around.
+ */
+static void hash_ring_scratch_done(hash_ring_t *ring) {
+    if(ring->scratchSize > HASH_RING_SCRATCH_KEEP) {
+        free(ring->scratch);
+        ring->scratch = NULL;
+        ring->scratchSize = 0;
+    }
+}
+
+hash_ring_t *hash_ring_copy(hash_ring_t *ring) {
+    if(ring == NULL) return NULL;
+
+    hash_ring_t *copy = hash_ring_create(ring->numReplicas, ring->hash_fn);
+    if(copy == NULL) return NULL;
+    copy->mode = ring->mode;
+    copy->layout = ring->layout;
+    copy->maxIndexBits = ring->maxIndexBits;
+    copy->numThreads = ring->numThreads;
+    copy->totalLoad = __atomic_load_n(&ring->totalLoad, __ATOMIC_RELAXED);
+    copy->loadFactor = ring->loadFactor;
+    copy->maglevSize = ring->maglevSize;
+    copy->numProbes = ring->numProbes;
+    copy->anchorSize = ring->anchorSize;
+    copy->successorWidth = ring->successorWidth;
+
+    uint32_t x;
+    if(ring->nodeSlots != NULL) {
+        copy->nodeTable = (hash_ring_node_t**)malloc(sizeof(hash_ring_node_t*) * (((size_t)ring->nodeSlotsMask + 1) / 2));
+        copy->nodeSlots = (uint64_t*)malloc(sizeof(uint64_t) * ((size_t)ring->nodeSlotsMask + 1));
+        if(copy->nodeTable == NULL || copy->nodeSlots == NULL) {
+            hash_ring_free(copy);
+            return NULL;
+        }
+        memcpy(copy->nodeSlots, ring->nodeSlots, sizeof(uint64_t) * ((size_t)ring->nodeSlotsMask + 1));
+        copy->nodeSlotsMask = ring->nodeSlotsMask;
+
+        for(x = 0; x < ring->numNodes; x++) {
+            hash_ring_node_t *node = hash_ring_alloc_node(copy, ring->nodeTable[x]->name, ring->nodeTable[x]->nameLen);
+            if(node == NULL) {
+                hash_ring_free(copy);
+                return NULL;
+            }
+            node->index = x;
+            node->numReplicas = ring->nodeTable[x]->numReplicas;
+            node->load = __atomic_load_n(&ring->nodeTable[x]->load, __ATOMIC_RELAXED);
+            copy->nodeTable[x] = node;
+            copy->numNodes++;
+        }
+    }
+
+    if(ring->numItems > 0) {
+        if(hash_ring_resize_items(copy, ring->numItems) != HASH_RING_OK) {
+            hash_ring_free(copy);
+            return NULL;
+        }
+        if(ring->layout == HASH_RING_LAYOUT_WIDE) {
+            memcpy(copy->items, ring->items, sizeof(uint64_t) * ring->numItems);
+        }
+        else {
+            memcpy(copy->positions, ring->positions, sizeof(uint32_t) * ring->numItems);
+        }
+        if(ring->layout == HASH_RING_LAYOUT_COMPACT16) {
+            memcpy(copy->itemNodes16, ring->itemNodes16, sizeof(uint16_t) * ring->numItems);
+        }
+        else {
+            memcpy(copy->itemNodes, ring->itemNodes, sizeof(uint32_t) * ring->numItems);
+        }
+        if(ring->successors != NULL) {
+            memcpy(copy->successors, ring->successors, sizeof(uint32_t) * ring->successorWidth * (size_t)ring->numItems);
+            copy->numSuccessors = ring->numSuccessors;
+        }
+        copy->numItems = ring->numItems;
+    }
+
+    if(ring->index != NULL) {
+        size_t indexSize = sizeof(uint32_t) * (((size_t)1 << ring->indexBits) + 1);
+        copy->index = (uint32_t*)malloc(indexSize);
+        if(copy->index == NULL) {
+            hash_ring_free(copy);
+            return NULL;
+        }
+        memcpy(copy->index, ring->index, indexSize);
+        copy->indexBits = ring->indexBits;
+    }
+
+    if(ring->maglevTable != NULL) {
+        copy->maglevTable = (uint32_t*)malloc(sizeof(uint32_t) * ring->maglevSize);
+        if(copy->maglevTable == NULL) {
+            hash_ring_free(copy);
+            return NULL;
+        }
+        memcpy(copy->maglevTable, ring->maglevTable, sizeof(uint32_t) * ring->maglevSize);
+    }
+
+    if(ring->seeds != NULL) {
+        copy->seeds = (uint64_t*)malloc(sizeof(uint64_t) * (((size_t)ring->nodeSlotsMask + 1) / 2));
+        if(copy->seeds == NULL) {
+            hash_ring_free(copy);
+            return NULL;
+        }
+        memcpy(copy->seeds, ring->seeds, sizeof(uint64_t) * ring->numNodes);
+    }
+
+    if(ring->anchorNodes != NULL) {
+        if(hash_ring_alloc_anchor(copy) != HASH_RING_OK) {
+            hash_ring_free(copy);
+            return NULL;
+        }
+        memcpy(copy->anchorRemoved, ring->anchorRemoved, sizeof(uint32_t) * 6 * (size_t)ring->anchorSize);
+
+        // The buckets of the copy hold the copy's nodes
+        for(x = 0; x < ring->anchorSize; x++) {
+            copy->anchorNodes[x] = NULL;
+        }
+        for(x = 0; x < ring->numNodes; x++) {
+            copy->anchorNodes[copy->anchorBuckets[x]] = copy->nodeTable[x];
+        }
+    }
+
+    return copy;
+}
+
+/**
+ * The ring number for an MD5 digest. abcd[0] is bytes 0-3 of the digest read as a little
+ * endian word, abcd[2] and abcd[3] are bytes 8-11 and 12-15.
+ */
+static uint64_t hash_ring_md5_number(hash_ring_t *ring, md5_word_t abcd[4]) {
+    if(ring->mode == HASH_RING_MODE_LIBMEMCACHED_COMPAT) {
+        uint64_t keyInt;
+        keyInt = abcd[0];
+        return keyInt;
+    }
+    else {
+        uint64_t keyInt;
+        
+        keyInt = abcd[3];
+        keyInt <<= 32;
+        keyInt |= abcd[2];
+        
+        return keyInt;
+    }
+}
+
+static uint64_t hash_ring_sha1_number(unsigned digest[5]) {
+    uint64_t keyInt = digest[3];
+    keyInt <<= 32;
+    keyInt |= digest[4];
+    return keyInt;
+}
+
+static int hash_ring_hash(hash_ring_t *ring, uint8_t *data, uint32_t dataLen, uint64_t *hash) {
+    if(ring->hash_fn == HASH_FUNCTION_MD5) {
+        md5_word_t abcd[4];
+        md5_hash((md5_byte_t*)data, dataLen, abcd);
+
+        *hash = hash_ring_md5_number(ring, abcd);
+        return 0;
+    }
+    else if(ring->hash_fn == HASH_FUNCTION_SHA1) {
+        unsigned digest[5];
+        SHA1Hash(data, dataLen, digest);
+        
+        *hash = hash_ring_sha1_number(digest);
+        return 0;
+    }
+    else if(ring->hash_fn == HASH_FUNCTION_XXH3) {
+        *hash = xxh3_64(data, dataLen);
+        return 0;
+    }
+    else if(ring->hash_fn == HASH_FUNCTION_MURMUR3) {
+        uint64_t out[2];
+        murmur3_x64_128(data, dataLen, 0, out);
+        *hash = out[0];
+        return 0;
+    }
+    else if(ring->hash_fn == HASH_FUNCTION_CRC32C) {
+        uint64_t keyInt = crc32c(data, dataLen);
+        *hash = keyInt << 32;
+        return 0;
+    }
+    else {
+        return -1;
+    }
+}
+
+/**
+ * Hashes up to HASH_RING_HASH_GROUP independent messages. MD5 and SHA1 use the multi-buffer
+ * kernels, which hash 8 or 16 messages at once and give the same numbers as hash_ring_hash.
+ */
+static int hash_ring_hash_multi(hash_ring_t *ring, uint8_t *data[], uint32_t dataLens[], uint32_t num,
+    uint64_t *hashes) {
+    uint32_t x;
+
+    if(ring->hash_fn == HASH_FUNCTION_MD5) {
+        md5_word_t digests[HASH_RING_HASH_GROUP][4];
+        md5_multi((const md5_byte_t**)data, dataLens, num, digests);
+        for(x = 0; x < num; x++) {
+            hashes[x] = hash_ring_md5_number(ring, digests[x]);
+        }
+        return 0;
+    }
+    else if(ring->hash_fn == HASH_FUNCTION_SHA1) {
+        unsigned digests[HASH_RING_HASH_GROUP][5];
+        SHA1Multi((const unsigned char**)data, dataLens, num, digests);
+        for(x = 0; x < num; x++) {
+            hashes[x] = hash_ring_sha1_number(digests[x]);
+        }
+        return 0;
+    }
+
+    for(x = 0; x < num; x++) {
+        if(hash_ring_hash(ring, data[x], dataLens[x], &hashes[x]) == -1) return -1;
+    }
+    return 0;
+}
+
+void hash_ring_print(hash_ring_t *ring) {
+    if(ring == NULL) return;
+    int x, y;
+    
+    printf("----------------------------------------\n");
+    printf("hash_ring\n\n");
+    printf("numReplicas:%8d\n", ring->numReplicas);
+    printf("Nodes: \n\n");
+    
+    for(x = 0; x < ring->numNodes; x++) {
+        printf("%d: ", x);
+        
+        hash_ring_node_t *node = ring->nodeTable[x];
+        
+        for(y = 0; y < node->nameLen; y++) {
+            printf("%c", node->name[y]);
+        }
+        printf("\n");
+    }
+    printf("\n");
+    hash_ring_stats_t stats;
+    hash_ring_get_stats(ring, &stats);
+    printf("Prefix index: %d bits, %" PRIu64 " bytes\n", ring->indexBits, stats.indexBytes);
+    printf("Nodes: %" PRIu64 " bytes\n", stats.nodeBytes);
+    printf("\n");
+    printf("Items (%d): \n\n", ring->numItems);
+    
+    for(x = 0; x < ring->numItems; x++) {
+        hash_ring_node_t *node = ring->nodeTable[hash_ring_item_node(ring, x)];
+        printf("%" PRIu64 " : ", hash_ring_item_number(ring, x));
+        for(y = 0; y < node->nameLen; y++) {
+            printf("%c", node->name[y]);
+        }
+        printf("\n");
+    }
+    
+    printf("\n");
+    printf("----------------------------------------\n");
+    
+}
+
+/**
+ * Resizes the item arrays to hold numItems items.
+ */
+static int hash_ring_resize_items(hash_ring_t *ring, uint32_t numItems) {
+    if(numItems == 0) {
+        if(ring->items != NULL) free(ring->items);
+        if(ring->positions != NULL) free(ring->positions);
+        if(ring->itemNodes != NULL) free(ring->itemNodes);
+        if(ring->itemNodes16 != NULL) free(ring->itemNodes16);
+        if(ring->successors != NULL) free(ring->successors);
+        ring->items = NULL;
+        ring->positions = NULL;
+        ring->itemNodes = NULL;
+        ring->itemNodes16 = NULL;
+        ring->successors = NULL;
+        ring->numSuccessors = 0;
+        return HASH_RING_OK;
+    }
+
+    void *resized;
+    if(ring->layout == HASH_RING_LAYOUT_WIDE) {
+        resized = realloc(ring->items, sizeof(uint64_t) * numItems);
+        if(resized == NULL) {
+            return HASH_RING_ERR;
+        }
+        ring->items = (uint64_t*)resized;
+    }
+    else {
+        resized = realloc(ring->positions, sizeof(uint32_t) * numItems);
+        if(resized == NULL) {
+            return HASH_RING_ERR;
+        }
+        ring->positions = (uint32_t*)resized;
+    }
+
+    if(ring->layout == HASH_RING_LAYOUT_COMPACT16) {
+        resized = realloc(ring->itemNodes16, sizeof(uint16_t) * numItems);
+        if(resized == NULL) {
+            return HASH_RING_ERR;
+        }
+        ring->itemNodes16 = (uint16_t*)resized;
+    }
+    else {
+        resized = realloc(ring->itemNodes, sizeof(uint32_t) * numItems);
+        if(resized == NULL) {
+            return HASH_RING_ERR;
+        }
+        ring->itemNodes = (uint32_t*)resized;
+    }
+
+    if(ring->successorWidth > 0) {
+        resized = realloc(ring->successors, sizeof(uint32_t) * ring->successorWidth * (size_t)numItems);
+        if(resized == NULL) {
+            return HASH_RING_ERR;
+        }
+        ring->successors = (uint32_t*)resized;
+    }
+    return HASH_RING_OK;
+}
+
+/**
+ * Sets the successor table row of the item at pos from the row of the item after it:
+ * the item's node, then that row without the item's node. Returns whether the row
+ * changed.
+ */
+static int hash_ring_set_successor_row(hash_ring_t *ring, uint32_t pos) {
+    uint32_t next = pos + 1 == ring->numItems ? 0 : pos + 1;
+    uint32_t *row = ring->successors + (size_t)pos * ring->successorWidth;
+    const uint32_t *nextRow = ring->successors + (size_t)next * ring->successorWidth;
+    uint32_t built[HASH_RING_MAX_SUCCESSORS], x, y = 1;
+
+    built[0] = hash_ring_item_node(ring, pos);
+    for(x = 0; y < ring->numSuccessors; x++) {
+        if(nextRow[x] != built[0]) built[y++] = nextRow[x];
+    }
+    if(memcmp(row, built, sizeof(uint32_t) * ring->numSuccessors) == 0) return 0;
+
+    memcpy(row, built, sizeof(uint32_t) * ring->numSuccessors);
+    return 1;
+}
+
+/**
+ * Builds the whole successor table, walking the ring from the last item for its row and
+ * deriving every other row from the one after it.
+ */
+static void hash_ring_build_successors(hash_ring_t *ring) {
+    uint32_t numItems = ring->numItems, pos = numItems - 1, found = 0, x;
+    uint32_t *row = ring->successors + (size_t)pos * ring->successorWidth;
+    ring->numSuccessors = ring->successorWidth < ring->numNodes ? ring->successorWidth : ring->numNodes;
+
+    // Every node has an item, so the walk finds numSuccessors distinct nodes
+    while(found < ring->numSuccessors) {
+        uint32_t node = hash_ring_item_node(ring, pos);
+        for(x = 0; x < found && row[x] != node; x++);
+        if(x == found) row[found++] = node;
+        pos = pos + 1 == numItems ? 0 : pos + 1;
+    }
+
+    for(pos = numItems - 1; pos-- > 0;) {
+        hash_ring_set_successor_row(ring, pos);
+    }
+}
+
+/**
+ * Brings the successor table up to date after the items with these sorted keys were
+ * added, removed or given another node. The items moved with their rows, so only the
+ * rows from the item at or before each key back need rebuilding, each from the row after
+ * it. The walk back stops at the first row that comes out as it was, since the rows
+ * before it can't have changed.
+ */
+static void hash_ring_update_successors(hash_ring_t *ring, const uint64_t *keys, uint32_t count) {
+    if(ring->successors == NULL || ring->numItems == 0) return;
+
+    // Rows of another length are all rebuilt
+    uint32_t numSuccessors = ring->successorWidth < ring->numNodes ? ring->successorWidth : ring->numNodes;
+    if(numSuccessors != ring->numSuccessors) {
+        hash_ring_build_successors(ring);
+        return;
+    }
+
+    uint32_t numItems = ring->numItems, x;
+    for(x = count; x-- > 0;) {
+        // The items sharing the key and the one before them are always rebuilt, that one
+        // may be before a removed item
+        uint32_t end = hash_ring_upper_bound(ring, 0, numItems, keys[x]);
+        uint32_t start = keys[x] > 0 ? hash_ring_upper_bound(ring, 0, end, keys[x] - 1) : 0;
+        uint32_t pos = end == 0 ? numItems - 1 : end - 1, forced = end - start + 1;
+
+        while(hash_ring_set_successor_row(ring, pos) || --forced > 0) {
+            pos = pos == 0 ? numItems - 1 : pos - 1;
+        }
+    }
+}
+
+/**
+ * Hashes count of the node's replicas, starting with replica first, into numbers in
+ * replica order.
+ */
+static int hash_ring_hash_replicas(hash_ring_t *ring, hash_ring_node_t *node, uint32_t first, uint32_t count,
+    uint64_t *numbers) {
+    uint32_t x, y;
+ 
+    // Room for "-%u" of UINT32_MAX and the terminator, a node may have that many replicas
+    char concat_buf[12];
+    int concat_len;
+    uint8_t *data[HASH_RING_HASH_GROUP];
+    uint32_t dataLens[HASH_RING_HASH_GROUP];
+    uint32_t slotLen = node->nameLen + sizeof(concat_buf);
+
+    // The replicas are independent, hash them a group at a time. The group is made
+    // smaller to fit long names on the stack, only names longer than the whole buffer
+    // need the heap.
+    uint8_t stackBuf[HASH_RING_REPLICA_BUF];
+    uint8_t *buf = stackBuf;
+    uint32_t maxGroup = HASH_RING_REPLICA_BUF / slotLen;
+    if(maxGroup > HASH_RING_HASH_GROUP) maxGroup = HASH_RING_HASH_GROUP;
+    if(maxGroup == 0) {
+        buf = (uint8_t*)malloc(slotLen);
+        if(buf == NULL) {
+            return HASH_RING_ERR;
+        }
+        maxGroup = 1;
+    }
+
+    // Every slot starts with the name, only the replica numbers change between groups
+    for(y = 0; y < maxGroup && y < count; y++) {
+        data[y] = buf + slotLen * y;
+        memcpy(data[y], node->name, node->nameLen);
+    }
+
+    for(x = 0; x < count; x += maxGroup) {
+        uint32_t groupSize = count - x < maxGroup ? count - x : maxGroup;
+
+        for(y = 0; y < groupSize; y++) {
+            if(ring->mode == HASH_RING_MODE_LIBMEMCACHED_COMPAT) {
+                concat_len = snprintf(concat_buf, sizeof(concat_buf), "-%u", first + x + y);
+            }
+            else {
+                concat_len = snprintf(concat_buf, sizeof(concat_buf), "%u", first + x + y);
+            }
+
+            memcpy(data[y] + node->nameLen, &concat_buf, concat_len);
+            dataLens[y] = concat_len + node->nameLen;
+        }
+
+        if(hash_ring_hash_multi(ring, data, dataLens, groupSize, numbers + x) == -1) {
+            if(buf != stackBuf) free(buf);
+            return HASH_RING_ERR;
+        }
+    }
+    if(buf != stackBuf) free(buf);
+
+    return HASH_RING_OK;
+}
+
+/**
+ * Returns the number of prefix index bits for a ring of numItems items, 0 for no index.
+ */
+static uint8_t hash_ring_index_bits(hash_ring_t *ring, uint32_t numItems) {
+    uint8_t bits = 0;
+
+    // Aim for about 2 items per bucket
+    while(bits < ring->maxIndexBits && ((uint64_t)4 << bits) <= numItems) bits++;
+
+    return numItems < HASH_RING_INDEX_MIN_ITEMS ? 0 : bits;
+}
+
+/**
+ * Brings the prefix index up to date after count items, whose sorted keys are given,
+ * were added to the ring (delta 1) or removed from it (delta -1). The start of every
+ * bucket after an item's bucket moves by one, so the index is shifted rather than rebuilt
+ * unless the number of buckets changes.
+ */
+static void hash_ring_shift_index(hash_ring_t *ring, const uint64_t *numbers, uint32_t count, int delta) {
+    if(ring->index == NULL || hash_ring_index_bits(ring, ring->numItems) != ring->indexBits) {
+        hash_ring_build_index(ring);
+        return;
+    }
+
+    uint64_t numBuckets = (uint64_t)1 << ring->indexBits;
+    uint32_t shift = hash_ring_index_shift(ring, ring->indexBits), adjust = 0, x;
+    uint64_t bucket = 0;
+    for(x = 0; x < count; x++) {
+        uint64_t end = (numbers[x] >> shift) + 1;
+        for(; bucket < end; bucket++) ring->index[bucket] += adjust;
+        adjust += delta;
+    }
+    for(; bucket <= numBuckets; bucket++) ring->index[bucket] += adjust;
+}
+
+/**
+ * The number of threads to use for count new items.
+ */
+static uint32_t hash_ring_threads_for(hash_ring_t *ring, uint32_t count) {
+    uint32_t numThreads = count / HASH_RING_THREAD_MIN_ITEMS;
+    if(numThreads > ring->numThreads) numThreads = ring->numThreads;
+    return numThreads == 0 ? 1 : numThreads;
+}
+
+/**
+ * Hashes count of the node's replicas, starting with replica first, into keys, see
+ * hash_ring_key.
+ */
+static int hash_ring_hash_replica_keys(hash_ring_t *ring, hash_ring_node_t *node, uint32_t first, uint32_t count,
+    uint64_t *keys) {
+    if(hash_ring_hash_replicas(ring, node, first, count, keys) != HASH_RING_OK) return HASH_RING_ERR;
+
+    uint32_t x;
+    if(ring->layout != HASH_RING_LAYOUT_WIDE) {
+        for(x = 0; x < count; x++) {
+            keys[x] = hash_ring_key(ring, keys[x]);
+        }
+    }
+    return HASH_RING_OK;
+}
+
+/**
+ * Hashes the replicas of a run of nodes, the job of one of the threads in hash_ring_hash_nodes.
+ */
+typedef struct hash_ring_hash_job_t {
+    hash_ring_t *ring;
+    uint32_t firstNode, lastNode;
+    uint64_t *keys;
+    uint32_t *nodes;
+    int result;
+} hash_ring_hash_job_t;
+
+static void hash_ring_hash_job(void *arg) {
+    hash_ring_hash_job_t *job = (hash_ring_hash_job_t*)arg;
+    hash_ring_t *ring = job->ring;
+    uint32_t x, y;
+    size_t item = 0;
+
+    job->result = HASH_RING_OK;
+    for(x = job->firstNode; x < job->lastNode; x++) {
+        hash_ring_node_t *node = ring->nodeTable[x];
+        if(hash_ring_hash_replica_keys(ring, node, 0, node->numReplicas, job->keys + item) != HASH_RING_OK) {
+            job->result = HASH_RING_ERR;
+            return;
+        }
+        for(y = 0; y < node->numReplicas; y++) {
+            job->nodes[item + y] = x;
+        }
+        item += node->numReplicas;
+    }
+}
+
+/**
+ * Hashes the replicas of the nodes from first on, count items in all, into keys and nodes
+ * in node order, and adds them to numItems. The nodes are split between the threads.
+ */
+static int hash_ring_hash_nodes(hash_ring_t *ring, uint32_t first, uint32_t count, uint64_t *keys,
+    uint32_t *nodes) {
+    uint32_t numNodes = ring->numNodes - first, x, node = first;
+    uint32_t numThreads = hash_ring_threads_for(ring, count);
+    if(numThreads > numNodes) numThreads = numNodes;
+
+    // The items of each job's nodes come after those of the nodes before them
+    hash_ring_hash_job_t jobs[HASH_RING_MAX_THREADS];
+    size_t item = 0;
+    for(x = 0; x < numThreads; x++) {
+        jobs[x].ring = ring;
+        jobs[x].firstNode = first + (uint32_t)((uint64_t)numNodes * x / numThreads);
+        jobs[x].lastNode = first + (uint32_t)((uint64_t)numNodes * (x + 1) / numThreads);
+        for(; node < jobs[x].firstNode; node++) item += ring->nodeTable[node]->numReplicas;
+        jobs[x].keys = keys + item;
+        jobs[x].nodes = nodes + item;
+    }
+    parallel_run(hash_ring_hash_job, jobs, sizeof(hash_ring_hash_job_t), numThreads);
+
+    for(x = 0; x < numThreads; x++) {
+        if(jobs[x].result != HASH_RING_OK) return HASH_RING_ERR;
+    }
+    ring->numItems += count;
+    return HASH_RING_OK;
+}
+
+/**
+ * Sorts the keys and nodes of the items from first on, which have just been added after
+ * the ring's sorted items, and merges them in. Only the new items are sorted, tempKeys and
+ * tempNodes are scratch space for the sort. The merge works back from the end and moves
+ * each run of old items between two new ones with a single memmove, so adding a node to
+ * a large ring is one pass over the items after its first position.
+ *
+ * In the wide layout the new keys and nodes are the ring's own items after first, in the
+ * compact layouts they are held apart and converted as they are merged in.
+ */
+static void hash_ring_merge_items(hash_ring_t *ring, uint32_t first, uint64_t *keys, uint32_t *nodes,
+    uint64_t *tempKeys, uint32_t *tempNodes) {
+    uint32_t count = ring->numItems - first;
+    if(count == 0) return;
+
+    sort_pairs_parallel(keys, nodes, count, tempKeys, tempNodes, hash_ring_threads_for(ring, count));
+
+    if(ring->layout == HASH_RING_LAYOUT_WIDE) {
+        if(first == 0) {
+            // There was nothing to merge with
+            hash_ring_shift_index(ring, keys, count, 1);
+            if(ring->successors != NULL) hash_ring_build_successors(ring);
+            return;
+        }
+
+        // The merge writes over the new items, read them from a copy
+        memcpy(tempKeys, keys, sizeof(uint64_t) * count);
+        memcpy(tempNodes, nodes, sizeof(uint32_t) * count);
+        keys = tempKeys;
+        nodes = tempNodes;
+    }
+
+    // The old items before end haven't moved yet, new item x goes after x other new items
+    uint32_t end = first, x = count, y;
+    while(x > 0 && end > 0) {
+        x--;
+        uint32_t pos = hash_ring_upper_bound(ring, 0, end, keys[x]);
+        hash_ring_move_items(ring, pos + x + 1, pos, end - pos);
+        hash_ring_set_item(ring, pos + x, keys[x], nodes[x]);
+        end = pos;
+    }
+
+    // The new items that are left come before every old item
+    for(y = 0; y < x; y++) {
+        hash_ring_set_item(ring, y, keys[y], nodes[y]);
+    }
+
+    hash_ring_shift_index(ring, keys, count, 1);
+    if(first == 0) {
+        if(ring->successors != NULL) hash_ring_build_successors(ring);
+    }
+    else {
+        hash_ring_update_successors(ring, keys, count);
+    }
+}
+
+/**
+ * Returns the position of an item with this number owned by the node at index, starting
+ * the search at position from, or numItems if there is no such item.
+ */
+static uint32_t hash_ring_find_item(hash_ring_t *ring, uint64_t number, uint32_t index, uint32_t from) {
+    uint32_t pos = hash_ring_upper_bound(ring, 0, ring->numItems, number);
+
+    // Other nodes may have items with the same number
+    while(pos > from && hash_ring_item_key(ring, pos - 1) == number) pos--;
+    for(; pos < ring->numItems && hash_ring_item_key(ring, pos) == number; pos++) {
+        if(hash_ring_item_node(ring, pos) == index) return pos;
+    }
+    return ring->numItems;
+}
+
+/**
+ * Finds the positions of count of the node's items, given their sorted numbers. The
+ * positions come out ascending. Returns HASH_RING_ERR if an item is missing.
+ */
+static int hash_ring_find_items(hash_ring_t *ring, const uint64_t *numbers, uint32_t count, uint32_t index,
+    uint32_t *positions) {
+    uint32_t x;
+
+    for(x = 0; x < count; x++) {
+        // Replicas with the same number take the positions in turn
+        uint32_t from = x > 0 && numbers[x] == numbers[x - 1] ? positions[x - 1] + 1 : 0;
+        positions[x] = hash_ring_find_item(ring, numbers[x], index, from);
+        if(positions[x] == ring->numItems) return HASH_RING_ERR;
+    }
+    return HASH_RING_OK;
+}
+
+/* The hash of a node name for the nodeSlots table, only the low 32 bits are used */
+#define HASH_RING_NAME_HASH(name, nameLen) ((uint32_t)xxh3_64(name, nameLen))
+
+/* A nodeSlots entry */
+#define HASH_RING_SLOT(hash, index) (((uint64_t)(hash) << 32) | ((uint64_t)(index) + 1))
+#define HASH_RING_SLOT_HASH(slot) ((uint32_t)((slot) >> 32))
+#define HASH_RING_SLOT_INDEX(slot) ((uint32_t)(slot) - 1)
+
+/**
+ * Returns the nodeSlots position of the node with this name, or of the empty slot
+ * where it would go.
+ */
+static uint32_t hash_ring_find_slot(hash_ring_t *ring, uint8_t *name, uint32_t nameLen, uint32_t hash) {
+    uint32_t pos = hash & ring->nodeSlotsMask;
+
+    while(1) {
+        uint64_t slot = ring->nodeSlots[pos];
+        if(slot == 0) return pos;
+        if(HASH_RING_SLOT_HASH(slot) == hash) {
+            hash_ring_node_t *node = ring->nodeTable[HASH_RING_SLOT_INDEX(slot)];
+            if(node->nameLen == nameLen && memcmp(node->name, name, nameLen) == 0) return pos;
+        }
+        pos = (pos + 1) & ring->nodeSlotsMask;
+    }
+}
+
+/**
+ * Makes sure that nodeSlots has room for count more nodes, growing and rehashing it if not.
+ * The nodeTable grows with it and always holds half as many nodes as there are slots.
+ */
+static int hash_ring_reserve_slots(hash_ring_t *ring, uint32_t count) {
+    uint32_t numSlots = ring->nodeSlots == NULL ? 0 : ring->nodeSlotsMask + 1;
+    uint64_t needed = ((uint64_t)ring->numNodes + count) * 2;
+    if(needed <= numSlots) return HASH_RING_OK;
+    if(needed > ((uint64_t)1 << 31)) return HASH_RING_ERR;
+
+    uint32_t newNumSlots = numSlots == 0 ? 16 : numSlots * 2;
+    while(newNumSlots < needed) newNumSlots *= 2;
+    hash_ring_node_t **nodeTable = (hash_ring_node_t**)realloc(ring->nodeTable,
+        sizeof(hash_ring_node_t*) * (newNumSlots / 2));
+    if(nodeTable == NULL) return HASH_RING_ERR;
+    ring->nodeTable = nodeTable;
+    uint64_t *slots = (uint64_t*)calloc(newNumSlots, sizeof(uint64_t));
+    if(slots == NULL) return HASH_RING_ERR;
+
+    uint64_t *oldSlots = ring->nodeSlots;
+    uint32_t x;
+    ring->nodeSlots = slots;
+    ring->nodeSlotsMask = newNumSlots - 1;
+    for(x = 0; x < numSlots; x++) {
+        if(oldSlots[x] == 0) continue;
+        uint32_t pos = HASH_RING_SLOT_HASH(oldSlots[x]) & ring->nodeSlotsMask;
+        while(slots[pos] != 0) pos = (pos + 1) & ring->nodeSlotsMask;
+        slots[pos] = oldSlots[x];
+    }
+    free(oldSlots);
+    return HASH_RING_OK;
+}
+
+/**
+ * Empties a nodeSlots position, moving later entries of the probe sequence back so
+ * that lookups never stop at a hole before reaching them.
+ */
+static void hash_ring_clear_slot(hash_ring_t *ring, uint32_t pos) {
+    uint32_t next = pos;
+
+    while(1) {
+        next = (next + 1) & ring->nodeSlotsMask;
+        uint64_t slot = ring->nodeSlots[next];
+        if(slot == 0) break;
+
+        // The entry can fill the hole unless its home position is after the hole
+        uint32_t home = HASH_RING_SLOT_HASH(slot) & ring->nodeSlotsMask;
+        if(((next - home) & ring->nodeSlotsMask) >= ((next - pos) & ring->nodeSlotsMask)) {
+            ring->nodeSlots[pos] = slot;
+            pos = next;
+        }
+    }
+    ring->nodeSlots[pos] = 0;
+}
+
+/**
+ * The number of replicas for a node of this weight, at least 1. Returns HASH_RING_ERR
+ * if the weight isn't positive or gives too many replicas.
+ */
+static int hash_ring_weight_replicas(hash_ring_t *ring, double weight, uint32_t *numReplicas) {
+    // Also false for NaN
+    if(!(weight > 0)) return HASH_RING_ERR;
+
+    double replicas = weight * ring->numReplicas + 0.5;
+    if(replicas >= (double)UINT32_MAX) return HASH_RING_ERR;
+    *numReplicas = replicas < 1 ? 1 : (uint32_t)replicas;
+    return HASH_RING_OK;
+}
+
+/**
+ * Makes room for count new items, which hash_ring_merge_items merges in from keys and
+ * nodes using tempKeys and tempNodes. In the wide layout the new items go straight after
+ * the ring's items, the compact layouts keep them in scratch space. The caller must call
+ * hash_ring_scratch_done once the items are merged.
+ */
+static int hash_ring_new_items(hash_ring_t *ring, size_t count, uint64_t **keys, uint32_t **nodes,
+    uint64_t **tempKeys, uint32_t **tempNodes) {
+    if(hash_ring_resize_items(ring, ring->numItems + count) != HASH_RING_OK) return HASH_RING_ERR;
+
+    int inPlace = ring->layout == HASH_RING_LAYOUT_WIDE;
+    *tempKeys = (uint64_t*)hash_ring_scratch(ring,
+        (sizeof(uint64_t) + sizeof(uint32_t)) * count * (inPlace ? 1 : 2));
+    if(*tempKeys == NULL) return HASH_RING_ERR;
+    *tempNodes = (uint32_t*)(*tempKeys + count * (inPlace ? 1 : 2));
+    *keys = inPlace ? ring->items + ring->numItems : *tempKeys + count;
+    *nodes = inPlace ? ring->itemNodes + ring->numItems : *tempNodes + count;
+    return HASH_RING_OK;
+}
+
+/**
+ * Removes count items of the node at index, given their sorted keys, closing the gaps
+ * they leave in one pass. positions is scratch space for count positions. Returns
+ * HASH_RING_ERR, leaving the ring as it was, if an item is missing.
+ */
+static int hash_ring_delete_items(hash_ring_t *ring, const uint64_t *keys, uint32_t count, uint32_t index,
+    uint32_t *positions) {
+    if(hash_ring_find_items(ring, keys, count, index, positions) != HASH_RING_OK) return HASH_RING_ERR;
+    hash_ring_thaw(ring);
+
+    // The remaining items stay sorted
+    uint32_t to = positions[0], x;
+    for(x = 0; x < count; x++) {
+        uint32_t from = positions[x] + 1;
+        uint32_t end = x + 1 < count ? positions[x + 1] : ring->numItems;
+        hash_ring_move_items(ring, to, from, end - from);
+        to += end - from;
+    }
+    ring->numItems = to;
+    hash_ring_shift_index(ring, keys, count, -1);
+    return HASH_RING_OK;
+}
+
+/**
+ * Takes back a partly done hash_ring_add_nodes, removing the nodes from index first on and
+ * the items after numItems. The items before numItems are untouched and still sorted.
+ */
+static void hash_ring_drop_nodes(hash_ring_t *ring, uint32_t first, uint32_t numItems) {
+    while(ring->numNodes > first) {
+        hash_ring_node_t *node = ring->nodeTable[--ring->numNodes];
+        uint32_t hash = HASH_RING_NAME_HASH(node->name, node->nameLen);
+        hash_ring_clear_slot(ring, hash_ring_find_slot(ring, node->name, node->nameLen, hash));
+        hash_ring_release_node(ring, node);
+    }
+    ring->numItems = numItems;
+}
+
+/**
+ * The scratch space hash_ring_build_maglev needs for numNodes nodes.
+ */
+static size_t hash_ring_maglev_scratch_size(uint32_t numNodes) {
+    return (sizeof(uint64_t) * 2 + sizeof(uint32_t) * 4) * (size_t)numNodes;
+}
+
+/**
+ * Fills the Maglev lookup table with the ring's nodes. Node x's permutation of the entries
+ * starts at offset = h mod M and steps by skip = (h >> 32) mod (M - 1) + 1, where h is the
+ * node's name hashed with the ring's hash function and M, the table size, is prime. The
+ * nodes take turns in the order of h, each taking the next entry of its permutation that
+ * is still free, until the table is full. Returns HASH_RING_ERR, leaving the table as it
+ * was, if memory couldn't be allocated.
+ */
+static int hash_ring_build_maglev(hash_ring_t *ring) {
+    uint32_t numNodes = ring->numNodes, size = ring->maglevSize, x;
+    if(numNodes == 0) return HASH_RING_OK;
+
+    if(ring->maglevTable == NULL) {
+        ring->maglevTable = (uint32_t*)malloc(sizeof(uint32_t) * size);
+        if(ring->maglevTable == NULL) return HASH_RING_ERR;
+    }
+    uint64_t *hashes = (uint64_t*)hash_ring_scratch(ring, hash_ring_maglev_scratch_size(numNodes));
+    if(hashes == NULL) return HASH_RING_ERR;
+    uint64_t *tempHashes = hashes + numNodes;
+    uint32_t *order = (uint32_t*)(tempHashes + numNodes), *tempOrder = order + numNodes;
+    uint32_t *next = tempOrder + numNodes, *skip = next + numNodes;
+
+    for(x = 0; x < numNodes; x++) {
+        hash_ring_node_t *node = ring->nodeTable[x];
+        if(hash_ring_hash(ring, node->name, node->nameLen, &hashes[x]) == -1) {
+            hash_ring_scratch_done(ring);
+            return HASH_RING_ERR;
+        }
+        order[x] = x;
+    }
+    sort_pairs(hashes, order, numNodes, tempHashes, tempOrder);
+    for(x = 0; x < numNodes; x++) {
+        next[x] = (uint32_t)(hashes[x] % size);
+        skip[x] = size > 1 ? (uint32_t)((hashes[x] >> 32) % (size - 1)) + 1 : 1;
+    }
+
+    uint32_t *table = ring->maglevTable, filled = 0;
+    memset(table, 0xff, sizeof(uint32_t) * size);
+    while(1) {
+        for(x = 0; x < numNodes; x++) {
+            // Step through the node's permutation to its next free entry
+            uint32_t entry = next[x];
+            while(table[entry] != UINT32_MAX) {
+                entry += skip[x];
+                if(entry >= size) entry -= size;
+            }
+            table[entry] = order[x];
+            entry += skip[x];
+            next[x] = entry >= size ? entry - size : entry;
+
+            if(++filled == size) {
+                hash_ring_scratch_done(ring);
+                return HASH_RING_OK;
+            }
+        }
+    }
+}
+
+/**
+ * Adds the node at nodeTable index x, the numNodes before it was added, to the anchor,
+ * giving it the bucket on top of the stack of removed buckets.
+ */
+static void hash_ring_anchor_add(hash_ring_t *ring, uint32_t x) {
+    uint32_t *working = ring->anchorWorking, *location = ring->anchorLocation;
+    uint32_t bucket = ring->anchorStack[ring->anchorSize - x - 1];
+
+    ring->anchorRemoved[bucket] = 0;
+    location[working[x]] = x;
+    working[location[bucket]] = bucket;
+    ring->anchorNext[bucket] = bucket;
+    ring->anchorNodes[bucket] = ring->nodeTable[x];
+    ring->anchorBuckets[x] = bucket;
+}
+
+/**
+ * Removes the bucket of the node at nodeTable index x from the anchor, pushing it on the
+ * stack of removed buckets. The working bucket in the last place takes its place.
+ */
+static void hash_ring_anchor_remove(hash_ring_t *ring, uint32_t x) {
+    uint32_t *working = ring->anchorWorking, *location = ring->anchorLocation;
+    uint32_t bucket = ring->anchorBuckets[x], numNodes = ring->numNodes - 1;
+
+    ring->anchorStack[ring->anchorSize - ring->numNodes] = bucket;
+    ring->anchorRemoved[bucket] = numNodes;
+    working[location[bucket]] = working[numNodes];
+    location[working[numNodes]] = location[bucket];
+    ring->anchorNext[bucket] = working[numNodes];
+    ring->anchorNodes[bucket] = NULL;
+}
+
+/**
+ * Allocates the buckets of HASH_RING_MODE_ANCHOR, all removed, in the order that gives
+ * the first node bucket 0, the second bucket 1 and so on.
+ */
+static int hash_ring_alloc_anchor(hash_ring_t *ring) {
+    size_t size = ring->anchorSize;
+    ring->anchorNodes = (hash_ring_node_t**)malloc((sizeof(hash_ring_node_t*) + sizeof(uint32_t) * 6) * size);
+    if(ring->anchorNodes == NULL) return HASH_RING_ERR;
+
+    ring->anchorRemoved = (uint32_t*)(ring->anchorNodes + size);
+    ring->anchorNext = ring->anchorRemoved + size;
+    ring->anchorLocation = ring->anchorNext + size;
+    ring->anchorWorking = ring->anchorLocation + size;
+    ring->anchorStack = ring->anchorWorking + size;
+    ring->anchorBuckets = ring->anchorStack + size;
+
+    uint32_t x;
+    for(x = 0; x < size; x++) {
+        ring->anchorNodes[x] = NULL;
+        ring->anchorRemoved[x] = x;
+        ring->anchorNext[x] = x;
+        ring->anchorLocation[x] = x;
+        ring->anchorWorking[x] = x;
+        ring->anchorStack[x] = size - 1 - x;
+    }
+    return HASH_RING_OK;
+}
+
+/**
+ * Brings the state of the modes that keep no items up to date after nodes from index
+ * first on were added, or a node was removed. Returns HASH_RING_ERR, leaving the state
+ * as it was, if memory couldn't be allocated.
+ */
+static int hash_ring_build_itemless(hash_ring_t *ring, uint32_t first) {
+    if(ring->mode == HASH_RING_MODE_MAGLEV) return hash_ring_build_maglev(ring);
+
+    if(ring->mode == HASH_RING_MODE_ANCHOR) {
+        if(ring->anchorNodes == NULL && hash_ring_alloc_anchor(ring) != HASH_RING_OK) return HASH_RING_ERR;
+
+        uint32_t x;
+        for(x = first; x < ring->numNodes; x++) {
+            hash_ring_anchor_add(ring, x);
+        }
+    }
+
+    if(ring->mode == HASH_RING_MODE_RENDEZVOUS) {
+        // The seeds have room for as many nodes as the nodeTable
+        uint64_t *seeds = (uint64_t*)realloc(ring->seeds, sizeof(uint64_t) * (((size_t)ring->nodeSlotsMask + 1) / 2));
+        if(seeds == NULL) return HASH_RING_ERR;
+        ring->seeds = seeds;
+
+        uint32_t x;
+        for(x = first; x < ring->numNodes; x++) {
+            hash_ring_node_t *node = ring->nodeTable[x];
+            if(hash_ring_hash(ring, node->name, node->nameLen, &seeds[x]) == -1) return HASH_RING_ERR;
+        }
+    }
+    return HASH_RING_OK;
+}
+
+/**
+ * hash_ring_add_nodes, giving node x replicas[x] replicas, or the ring's numReplicas if
+ * replicas is NULL.
+ */
+static int hash_ring_add_nodes_replicas(hash_ring_t *ring, uint8_t *names[], uint32_t nameLens[],
+    const uint32_t *replicas, uint32_t numNodes) {
+    if(ring == NULL || names == NULL || nameLens == NULL) return HASH_RING_ERR;
+    if(numNodes == 0) return HASH_RING_OK;
+
+    // Nodes in jump, Maglev, rendezvous and anchor mode have no items
+    uint32_t x, numReplicas = hash_ring_has_items(ring) ? ring->numReplicas : 0;
+    uint64_t count = 0;
+    for(x = 0; x < numNodes; x++) {
+        if(names[x] == NULL || nameLens[x] <= 0) return HASH_RING_ERR;
+        count += replicas != NULL ? replicas[x] : numReplicas;
+
+        // Rejecting a node already in the ring must leave the items and frozen layout alone
+        if(ring->nodeSlots != NULL) {
+            uint32_t pos = hash_ring_find_slot(ring, names[x], nameLens[x], HASH_RING_NAME_HASH(names[x], nameLens[x]));
+            if(ring->nodeSlots[pos] != 0) return HASH_RING_ERR;
+        }
+    }
+
+    uint64_t maxNodes = ring->layout == HASH_RING_LAYOUT_COMPACT16 ? HASH_RING_COMPACT16_MAX_NODES : UINT32_MAX;
+    if(ring->mode == HASH_RING_MODE_MAGLEV) maxNodes = ring->maglevSize;
+    if(ring->mode == HASH_RING_MODE_ANCHOR) maxNodes = ring->anchorSize;
+    if(ring->numItems + count > UINT32_MAX || (uint64_t)ring->numNodes + numNodes > maxNodes) return HASH_RING_ERR;
+
+    if(hash_ring_reserve_slots(ring, numNodes) != HASH_RING_OK) return HASH_RING_ERR;
+
+    uint32_t first = ring->numNodes;
+    uint32_t numItems = ring->numItems;
+
+    // Add the nodes, none of them may be repeated within the batch
+    for(x = 0; x < numNodes; x++) {
+        uint32_t hash = HASH_RING_NAME_HASH(names[x], nameLens[x]);
+        uint32_t pos = hash_ring_find_slot(ring, names[x], nameLens[x], hash);
+        if(ring->nodeSlots[pos] != 0) break;
+
+        hash_ring_node_t *node = hash_ring_alloc_node(ring, names[x], nameLens[x]);
+        if(node == NULL) break;
+        node->index = ring->numNodes;
+        node->numReplicas = replicas != NULL ? replicas[x] : numReplicas;
+
+        ring->nodeTable[node->index] = node;
+        ring->nodeSlots[pos] = HASH_RING_SLOT(hash, node->index);
+        ring->numNodes++;
+    }
+    if(x < numNodes) {
+        hash_ring_drop_nodes(ring, first, numItems);
+        return HASH_RING_ERR;
+    }
+
+    // Only size the items and thaw the ring once every node is known to be new
+    uint64_t *keys = NULL, *tempKeys = NULL;
+    uint32_t *nodes = NULL, *tempNodes = NULL;
+    if(count > 0 && hash_ring_new_items(ring, count, &keys, &nodes, &tempKeys, &tempNodes) != HASH_RING_OK) {
+        hash_ring_drop_nodes(ring, first, numItems);
+        hash_ring_scratch_done(ring);
+        return HASH_RING_ERR;
+    }
+    hash_ring_thaw(ring);
+
+    if(!hash_ring_has_items(ring)) {
+        hash_ring_scratch_done(ring);
+        if(hash_ring_build_itemless(ring, first) != HASH_RING_OK) {
+            hash_ring_drop_nodes(ring, first, numItems);
+            return HASH_RING_ERR;
+        }
+        return HASH_RING_OK;
+    }
+
+    // Hash every replica of the new nodes, then merge them in
+    if(count > 0 && hash_ring_hash_nodes(ring, first, count, keys, nodes) != HASH_RING_OK) {
+        hash_ring_drop_nodes(ring, first, numItems);
+        hash_ring_scratch_done(ring);
+        return HASH_RING_ERR;
+    }
+    hash_ring_merge_items(ring, numItems, keys, nodes, tempKeys, tempNodes);
+    hash_ring_scratch_done(ring);
+
+    return HASH_RING_OK;
+}
+
+int hash_ring_add_node(hash_ring_t *ring, uint8_t *name, uint32_t nameLen) {
+    return hash_ring_add_nodes_replicas(ring, &name, &nameLen, NULL, 1);
+}
+
+int hash_ring_add_nodes(hash_ring_t *ring, uint8_t *names[], uint32_t nameLens[], uint32_t numNodes) {
+    return hash_ring_add_nodes_replicas(ring, names, nameLens, NULL, numNodes);
+}
+
+int hash_ring_add_node_weighted(hash_ring_t *ring, uint8_t *name, uint32_t nameLen, double weight) {
+    uint32_t numReplicas;
+    if(ring == NULL || !hash_ring_has_items(ring) || hash_ring_weight_replicas(ring, weight, &numReplicas) != HASH_RING_OK) return HASH_RING_ERR;
+
+    return hash_ring_add_nodes_replicas(ring, &name, &nameLen, &numReplicas, 1);
+}
+
+int hash_ring_set_node_weight(hash_ring_t *ring, uint8_t *name, uint32_t nameLen, double weight) {
+    uint32_t numReplicas;
+    if(ring == NULL || !hash_ring_has_items(ring) || hash_ring_weight_replicas(ring, weight, &numReplicas) != HASH_RING_OK) return HASH_RING_ERR;
+
+    hash_ring_node_t *node = hash_ring_get_node(ring, name, nameLen);
+    if(node == NULL) return HASH_RING_ERR;
+    if(numReplicas == node->numReplicas) return HASH_RING_OK;
+
+    // Replicas keep their numbers, only those past the smaller count are added or removed
+    if(numReplicas > node->numReplicas) {
+        uint32_t count = numReplicas - node->numReplicas, x;
+        if((uint64_t)ring->numItems + count > UINT32_MAX) return HASH_RING_ERR;
+
+        uint64_t *keys, *tempKeys;
+        uint32_t *nodes, *tempNodes;
+        if(hash_ring_new_items(ring, count, &keys, &nodes, &tempKeys, &tempNodes) != HASH_RING_OK) {
+            return HASH_RING_ERR;
+        }
+        if(hash_ring_hash_replica_keys(ring, node, node->numReplicas, count, keys) != HASH_RING_OK) {
+            hash_ring_scratch_done(ring);
+            return HASH_RING_ERR;
+        }
+        for(x = 0; x < count; x++) {
+            nodes[x] = node->index;
+        }
+
+        hash_ring_thaw(ring);
+        uint32_t numItems = ring->numItems;
+        ring->numItems += count;
+        hash_ring_merge_items(ring, numItems, keys, nodes, tempKeys, tempNodes);
+        hash_ring_scratch_done(ring);
+    }
+    else {
+        uint32_t count = node->numReplicas - numReplicas;
+        uint64_t *keys = (uint64_t*)hash_ring_scratch(ring,
+            (sizeof(uint64_t) * 2 + sizeof(uint32_t)) * (size_t)count);
+        if(keys == NULL) return HASH_RING_ERR;
+        uint64_t *tempKeys = keys + count;
+        uint32_t *positions = (uint32_t*)(keys + (size_t)count * 2);
+
+        if(hash_ring_hash_replica_keys(ring, node, numReplicas, count, keys) != HASH_RING_OK) {
+            hash_ring_scratch_done(ring);
+            return HASH_RING_ERR;
+        }
+        sort_pairs(keys, NULL, count, tempKeys, NULL);
+        int result = hash_ring_delete_items(ring, keys, count, node->index, positions);
+        if(result == HASH_RING_OK) hash_ring_update_successors(ring, keys, count);
+        hash_ring_scratch_done(ring);
+        if(result != HASH_RING_OK) return HASH_RING_ERR;
+
+        // Give back the memory of the removed items, the ring is intact if this fails
+        hash_ring_resize_items(ring, ring->numItems);
+    }
+
+    node->numReplicas = numReplicas;
+    return HASH_RING_OK;
+}
+
+hash_ring_t *hash_ring_create_from_nodes(uint8_t *names[], uint32_t nameLens[], uint32_t numNodes,
+    uint32_t numReplicas, HASH_FUNCTION hash_fn, HASH_MODE mode) {
+    hash_ring_t *ring = hash_ring_create(numReplicas, hash_fn);
+    if(ring == NULL) return NULL;
+
+    if(hash_ring_set_mode(ring, mode) != HASH_RING_OK ||
+        hash_ring_add_nodes(ring, names, nameLens, numNodes) != HASH_RING_OK) {
+        hash_ring_free(ring);
+        return NULL;
+    }
+    return ring;
+}
+
+int hash_ring_remove_node(hash_ring_t *ring, uint8_t *name, uint32_t nameLen) {
+    if(ring == NULL || name == NULL || nameLen <= 0 || ring->numNodes == 0) return HASH_RING_ERR;
+
+    uint32_t hash = HASH_RING_NAME_HASH(name, nameLen);
+    uint32_t pos = hash_ring_find_slot(ring, name, nameLen, hash);
+    if(ring->nodeSlots[pos] == 0) return HASH_RING_ERR;
+
+    hash_ring_node_t *node = ring->nodeTable[HASH_RING_SLOT_INDEX(ring->nodeSlots[pos])];
+    uint32_t last = ring->numNodes - 1;
+    if(!hash_ring_has_items(ring)) {
+        // Removing any other jump bucket would renumber the ones after it
+        if(ring->mode == HASH_RING_MODE_JUMP && node->index != last) return HASH_RING_ERR;
+
+        // Make sure rebuilding the Maglev table can't fail once the node is gone
+        if(ring->mode == HASH_RING_MODE_MAGLEV &&
+            hash_ring_scratch(ring, hash_ring_maglev_scratch_size(last)) == NULL) return HASH_RING_ERR;
+
+        if(ring->mode == HASH_RING_MODE_ANCHOR) hash_ring_anchor_remove(ring, node->index);
+        hash_ring_clear_slot(ring, pos);
+        ring->totalLoad -= node->load;
+        if(node->index != last) {
+            hash_ring_node_t *moved = ring->nodeTable[last];
+            uint32_t movedHash = HASH_RING_NAME_HASH(moved->name, moved->nameLen);
+            pos = hash_ring_find_slot(ring, moved->name, moved->nameLen, movedHash);
+            ring->nodeSlots[pos] = HASH_RING_SLOT(movedHash, node->index);
+            ring->nodeTable[node->index] = moved;
+            if(ring->seeds != NULL) ring->seeds[node->index] = ring->seeds[last];
+            if(ring->anchorNodes != NULL) ring->anchorBuckets[node->index] = ring->anchorBuckets[last];
+            moved->index = node->index;
+        }
+        hash_ring_release_node(ring, node);
+        ring->numNodes--;
+        hash_ring_build_itemless(ring, ring->numNodes);
+        return HASH_RING_OK;
+    }
+
+    hash_ring_node_t *moved = node->index != last ? ring->nodeTable[last] : NULL;
+    uint32_t numReplicas = node->numReplicas, x;
+    uint32_t movedReplicas = moved != NULL ? moved->numReplicas : 0;
+    uint32_t maxReplicas = numReplicas > movedReplicas ? numReplicas : movedReplicas;
+
+    // Rehash the node's replicas to find its items, and those of the last node in the
+    // nodeTable, which takes the removed node's index
+    uint64_t *numbers = (uint64_t*)hash_ring_scratch(ring,
+        sizeof(uint64_t) * ((size_t)numReplicas + movedReplicas + maxReplicas) +
+        sizeof(uint32_t) * (size_t)maxReplicas);
+    if(numbers == NULL) return HASH_RING_ERR;
+    uint64_t *movedNumbers = numbers + numReplicas, *tempNumbers = movedNumbers + movedReplicas;
+    uint32_t *positions = (uint32_t*)(tempNumbers + maxReplicas);
+    if(hash_ring_hash_replica_keys(ring, node, 0, numReplicas, numbers) != HASH_RING_OK ||
+        (moved != NULL && hash_ring_hash_replica_keys(ring, moved, 0, movedReplicas, movedNumbers) != HASH_RING_OK)) {
+        hash_ring_scratch_done(ring);
+        return HASH_RING_ERR;
+    }
+    sort_pairs(numbers, NULL, numReplicas, tempNumbers, NULL);
+    if(hash_ring_delete_items(ring, numbers, numReplicas, node->index, positions) != HASH_RING_OK) {
+        hash_ring_scratch_done(ring);
+        return HASH_RING_ERR;
+    }
+
+    // Node found and its items removed, remove the node and the keys assigned to it
+    hash_ring_clear_slot(ring, pos);
+    ring->totalLoad -= node->load;
+
+    if(moved != NULL) {
+        // The moved node's items were found before, so they can't be missing
+        sort_pairs(movedNumbers, NULL, movedReplicas, tempNumbers, NULL);
+        hash_ring_find_items(ring, movedNumbers, movedReplicas, last, positions);
+        for(x = 0; x < movedReplicas; x++) {
+            hash_ring_set_item_node(ring, positions[x], node->index);
+        }
+
+        uint32_t movedHash = HASH_RING_NAME_HASH(moved->name, moved->nameLen);
+        pos = hash_ring_find_slot(ring, moved->name, moved->nameLen, movedHash);
+        ring->nodeSlots[pos] = HASH_RING_SLOT(movedHash, node->index);
+
+        ring->nodeTable[node->index] = moved;
+        moved->index = node->index;
+    }
+    ring->numNodes--;
+
+    // The rows before the removed items, and those holding the moved node's old index
+    hash_ring_update_successors(ring, numbers, numReplicas);
+    if(moved != NULL) hash_ring_update_successors(ring, movedNumbers, movedReplicas);
+    hash_ring_scratch_done(ring);
+
+    // Give back the memory of the removed items, the ring is intact if this fails
+    hash_ring_resize_items(ring, ring->numItems);
+    
+    hash_ring_release_node(ring, node);
+    
+    return HASH_RING_OK;
+}
+
+hash_ring_node_t *hash_ring_get_node(hash_ring_t *ring, uint8_t *name, uint32_t nameLen) {
+    if(ring == NULL || name == NULL || nameLen <= 0 || ring->numNodes == 0) return NULL;
+    
+    uint32_t hash = HASH_RING_NAME_HASH(name, nameLen);
+    uint64_t slot = ring->nodeSlots[hash_ring_find_slot(ring, name, nameLen, hash)];
+    if(slot == 0) return NULL;
+    
+    return ring->nodeTable[HASH_RING_SLOT_INDEX(slot)];
+}
+
+/**
+ * Copies the sorted items into Eytzinger order with an in-order walk of the implicit tree.
+ * Returns the next index into items to copy.
+ */
+static uint32_t hash_ring_build_frozen(hash_ring_t *ring, uint32_t index, uint64_t k) {
+    if(k > ring->numItems) return index;
+
+    index = hash_ring_build_frozen(ring, index, 2 * k);
+    ring->frozenItems[k] = ring->items[index];
+    ring->frozenRanks[k] = index;
+    return hash_ring_build_frozen(ring, index + 1, 2 * k + 1);
+}
+
+int hash_ring_freeze(hash_ring_t *ring) {
+    if(ring == NULL) return HASH_RING_ERR;
+    hash_ring_thaw(ring);
+    if(ring->numItems == 0 || ring->layout != HASH_RING_LAYOUT_WIDE) return HASH_RING_OK;
+
+    // Align to a cache line so that the 8 children 3 levels below a node share a line
+    void *frozenItems;
+    if(posix_memalign(&frozenItems, 64, sizeof(uint64_t) * ((size_t)ring->numItems + 1)) != 0) {
+        return HASH_RING_ERR;
+    }
+    ring->frozenItems = (uint64_t*)frozenItems;
+    ring->frozenRanks = (uint32_t*)malloc(sizeof(uint32_t) * ((size_t)ring->numItems + 1));
+    if(ring->frozenRanks == NULL) {
+        hash_ring_thaw(ring);
+        return HASH_RING_ERR;
+    }
+
+    ring->frozenItems[0] = 0;
+    ring->frozenRanks[0] = 0;
+    hash_ring_build_frozen(ring, 0, 1);
+    return HASH_RING_OK;
+}
+
+static void hash_ring_thaw(hash_ring_t *ring) {
+    if(ring->frozenItems != NULL) free(ring->frozenItems);
+    if(ring->frozenRanks != NULL) free(ring->frozenRanks);
+    ring->frozenItems = NULL;
+    ring->frozenRanks = NULL;
+}
+
+/**
+ * Searches the frozen layout. Each step moves to the left or right child without
+ * branching on the comparison, and the cache line holding the node's descendants
+ * 3 levels down is prefetched.
+ */
+static uint32_t hash_ring_find_next_highest_frozen(hash_ring_t *ring, uint64_t num) {
+    const uint64_t *frozenItems = ring->frozenItems;
+    uint64_t n = ring->numItems;
+    uint64_t k = 1;
+
+    while(k <= n) {
+        __builtin_prefetch(frozenItems + k * 8);
+        k = 2 * k + (frozenItems[k] <= num);
+    }
+
+    // Undo the right turns taken after the last left turn, that node is the next highest
+    k >>= __builtin_ffsll(~k);
+
+    // k is 0 if there was no left turn, wrap around to the first item
+    return ring->frozenRanks[k];
+}
+
+/**
+ * Rebuilds the prefix index after the items have changed.
+ * If memory for the index can't be allocated the ring is left without one.
+ */
+static void hash_ring_build_index(hash_ring_t *ring) {
+    uint8_t bits = hash_ring_index_bits(ring, ring->numItems);
+
+    if(bits == 0) {
+        if(ring->index != NULL) free(ring->index);
+        ring->index = NULL;
+        ring->indexBits = 0;
+        return;
+    }
+
+    uint64_t numBuckets = (uint64_t)1 << bits;
+    if(ring->index == NULL || ring->indexBits != bits) {
+        void *resized = realloc(ring->index, sizeof(uint32_t) * (numBuckets + 1));
+        if(resized == NULL) {
+            if(ring->index != NULL) free(ring->index);
+            ring->index = NULL;
+            ring->indexBits = 0;
+            return;
+        }
+        ring->index = (uint32_t*)resized;
+        ring->indexBits = bits;
+    }
+
+    // Each bucket starts at the first item whose top bits are at least the bucket's
+    uint32_t x = 0, shift = hash_ring_index_shift(ring, bits);
+    uint64_t bucket;
+    for(bucket = 0; bucket < numBuckets; bucket++) {
+        while(x < ring->numItems && (hash_ring_item_key(ring, x) >> shift) < bucket) x++;
+        ring->index[bucket] = x;
+    }
+    ring->index[numBuckets] = ring->numItems;
+}
+
+int hash_ring_set_max_index_bits(hash_ring_t *ring, uint8_t maxBits) {
+    if(ring == NULL || maxBits > 31) return HASH_RING_ERR;
+
+    ring->maxIndexBits = maxBits;
+    hash_ring_build_index(ring);
+    return HASH_RING_OK;
+}
+
+int hash_ring_set_threads(hash_ring_t *ring, uint32_t numThreads) {
+    if(ring == NULL || numThreads == 0 || numThreads > HASH_RING_MAX_THREADS) return HASH_RING_ERR;
+
+    ring->numThreads = numThreads;
+    return HASH_RING_OK;
+}
 
-    // Clean up the nodes
-    ll_t *tmp, *cur = ring->nodes;
-    while(cur != NULL) {
-        free(((hash_ring_node_t*)cur->data)->name);
-        free(cur->data);
-        tmp = cur;
-        cur = tmp->next;
-        free(tmp);
+int hash_ring_get_stats(hash_ring_t *ring, hash_ring_stats_t *stats) {
+    if(ring == NULL || stats == NULL) return HASH_RING_ERR;
+
+    stats->itemBytes = (uint64_t)hash_ring_item_size(ring) * ring->numItems;
+    stats->indexBytes = ring->index != NULL ?
+        (uint64_t)sizeof(uint32_t) * (((uint64_t)1 << ring->indexBits) + 1) : 0;
+    stats->frozenBytes = ring->frozenItems != NULL ?
+        (uint64_t)(sizeof(uint64_t) + sizeof(uint32_t)) * (ring->numItems + 1) : 0;
+    stats->nodeBytes = ring->arena->bytes + (ring->nodeSlots != NULL ?
+        (uint64_t)(sizeof(uint64_t) + sizeof(hash_ring_node_t*) / 2) * (ring->nodeSlotsMask + 1) : 0);
+    stats->successorBytes = ring->successors != NULL ?
+        (uint64_t)sizeof(uint32_t) * ring->successorWidth * ring->numItems : 0;
+    stats->tableBytes = ring->maglevTable != NULL ? (uint64_t)sizeof(uint32_t) * ring->maglevSize : 0;
+    if(ring->seeds != NULL) stats->tableBytes += (uint64_t)sizeof(uint64_t) * ((ring->nodeSlotsMask + 1) / 2);
+    if(ring->anchorNodes != NULL) {
+        stats->tableBytes += (uint64_t)(sizeof(hash_ring_node_t*) + sizeof(uint32_t) * 6) * ring->anchorSize;
     }
-    ring->nodes = NULL;
-    
-    // Clean up the items
-    int x;
-    for(x = 0; x < ring->numItems; x++) {
-        free(ring->items[x]);
+    return HASH_RING_OK;
+}
+
+/**
+ * The bucket, out of numBuckets, of key with jump consistent hashing (Lamping and Veach).
+ * Each step draws the next bucket the key would jump to as buckets are added, until it
+ * is past the last one.
+ */
+static inline uint32_t hash_ring_jump(uint64_t key, uint32_t numBuckets) {
+    int64_t bucket = -1, next = 0;
+    while(next < numBuckets) {
+        bucket = next;
+        key = key * 2862933555777941757ULL + 1;
+        next = (int64_t)((bucket + 1) * ((double)(1LL << 31) / (double)((key >> 33) + 1)));
     }
-    if(ring->items != NULL) free(ring->items);
-    
-    free(ring);
+    return (uint32_t)bucket;
 }
 
-static int hash_ring_hash(hash_ring_t *ring, uint8_t *data, uint8_t dataLen, uint64_t *hash) {
-    if(ring->hash_fn == HASH_FUNCTION_MD5) {
-        uint8_t digest[16];
-        md5_state_t state;
-        md5_init(&state);
-        
-        md5_append(&state, (md5_byte_t*)data, dataLen);
-        md5_finish(&state, (md5_byte_t*)&digest);
+/**
+ * Rehashes a key's number (the splitmix64 finalizer), for the further nodes of
+ * hash_ring_find_nodes in HASH_RING_MODE_JUMP and the probes of HASH_RING_MODE_MULTIPROBE.
+ * Jump hashing the next number from its own generator would only give a later step of the
+ * same walk.
+ */
+static inline uint64_t hash_ring_rehash(uint64_t key) {
+    key += 0x9e3779b97f4a7c15ULL;
+    key = (key ^ (key >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    key = (key ^ (key >> 27)) * 0x94d049bb133111ebULL;
+    return key ^ (key >> 31);
+}
 
-        if(ring->mode == HASH_RING_MODE_LIBMEMCACHED_COMPAT) {
-            uint32_t low = (digest[3] << 24 | digest[2] << 16 | digest[1] << 8 | digest[0]);
-            uint64_t keyInt;
-            keyInt = low;
-            *hash = keyInt;
-            return 0;
-        }
-        else {
-            uint32_t low = (digest[11] << 24 | digest[10] << 16 | digest[9] << 8 | digest[8]);
-            uint32_t high = (digest[15] << 24 | digest[14] << 16 | digest[13] << 8 | digest[12]);
-            uint64_t keyInt;
-            
-            keyInt = high;
-            keyInt <<= 32;
-            keyInt &= 0xffffffff00000000LLU;
-            keyInt |= low;
-            
-            *hash = keyInt;
-            
-            return 0;
-        }
+/**
+ * Maps num to [0, n) with its top bits, so that the 32-bit numbers of HASH_FUNCTION_CRC32C,
+ * which are shifted up, are spread over the range too.
+ */
+static inline uint32_t hash_ring_reduce(uint64_t num, uint32_t n) {
+    return (uint32_t)(((unsigned __int128)num * n) >> 64);
+}
+
+/**
+ * The Maglev table entry of num.
+ */
+static inline uint32_t hash_ring_maglev_entry(hash_ring_t *ring, uint64_t num) {
+    return hash_ring_reduce(num, ring->maglevSize);
+}
+
+/**
+ * The node of num with AnchorHash. While num's bucket b is removed, num is rehashed with
+ * b to one of the anchorRemoved[b] buckets that were left when b was removed, and the
+ * successors of that bucket are followed to one that was still held after b.
+ */
+static inline hash_ring_node_t *hash_ring_anchor_node(hash_ring_t *ring, uint64_t num) {
+    const uint32_t *removed = ring->anchorRemoved, *next = ring->anchorNext;
+    uint32_t bucket = hash_ring_reduce(num, ring->anchorSize);
+
+    while(removed[bucket] > 0) {
+        uint32_t h = hash_ring_reduce(hash_ring_rehash(num ^ ((uint64_t)bucket << 32)), removed[bucket]);
+        while(removed[h] >= removed[bucket]) h = next[h];
+        bucket = h;
     }
-    else if(ring->hash_fn == HASH_FUNCTION_SHA1) {
-        SHA1Context sha1_ctx;
+    return ring->anchorNodes[bucket];
+}
 
-        SHA1Reset(&sha1_ctx);
-        SHA1Input(&sha1_ctx, data, dataLen);
-        if(SHA1Result(&sha1_ctx) != 1) {
-            return -1;
-        }
-        
-        uint64_t keyInt = sha1_ctx.Message_Digest[3];
-        keyInt <<= 32;
-        keyInt |= sha1_ctx.Message_Digest[4];
-        *hash = keyInt;
-        return 0;
+/**
+ * The node of num in the modes that keep no items. The ring must not be empty.
+ */
+static inline hash_ring_node_t *hash_ring_itemless_node(hash_ring_t *ring, uint64_t num) {
+    if(ring->mode == HASH_RING_MODE_JUMP) return ring->nodeTable[hash_ring_jump(num, ring->numNodes)];
+    if(ring->mode == HASH_RING_MODE_RENDEZVOUS) return ring->nodeTable[rendezvous_best(ring->seeds, ring->numNodes, num)];
+    if(ring->mode == HASH_RING_MODE_ANCHOR) return hash_ring_anchor_node(ring, num);
+    return ring->nodeTable[ring->maglevTable[hash_ring_maglev_entry(ring, num)]];
+}
+
+/**
+ * Returns the index of the next highest item for num.
+ * The ring must not be empty.
+ */
+static uint32_t hash_ring_find_next_highest_index(hash_ring_t *ring, uint64_t num) {
+    if(ring->frozenItems != NULL) return hash_ring_find_next_highest_frozen(ring, num);
+
+    uint64_t key = hash_ring_key(ring, num);
+    uint32_t index;
+    if(ring->index != NULL) {
+        // Only the items sharing the key's top bits need to be searched
+        uint64_t bucket = key >> hash_ring_index_shift(ring, ring->indexBits);
+        uint32_t start = ring->index[bucket];
+        index = hash_ring_upper_bound(ring, start, ring->index[bucket + 1] - start, key);
     }
     else {
-        return -1;
+        index = hash_ring_upper_bound(ring, 0, ring->numItems, key);
     }
+
+    // Past the end of the ring, return the first item
+    return index == ring->numItems ? 0 : index;
 }
 
-void hash_ring_print(hash_ring_t *ring) {
-    if(ring == NULL) return;
-    int x, y;
-    
-    printf("----------------------------------------\n");
-    printf("hash_ring\n\n");
-    printf("numReplicas:%8d\n", ring->numReplicas);
-    printf("Nodes: \n\n");
-    
-    ll_t *cur = ring->nodes;
-    x = 0;
-    while(cur != NULL) {
-        printf("%d: ", x);
-        
-        hash_ring_node_t *node = (hash_ring_node_t*)cur->data;
-        
-        for(y = 0; y < node->nameLen; y++) {
-            printf("%c", node->name[y]);
-        }
-        printf("\n");
-        cur = cur->next;
-        x++;
-    }
-    printf("\n");
-    printf("Items (%d): \n\n", ring->numItems);
-    
-    for(x = 0; x < ring->numItems; x++) {
-        hash_ring_item_t *item = ring->items[x];
-        printf("%" PRIu64 " : ", item->number);
-        for(y = 0; y < item->node->nameLen; y++) {
-            printf("%c", item->node->name[y]);
-        }
-        printf("\n");
+hash_ring_item_t *hash_ring_find_next_highest_item(hash_ring_t *ring, uint64_t num, hash_ring_item_t *item) {
+    if(ring == NULL || item == NULL || ring->numNodes == 0) return NULL;
+
+    if(!hash_ring_has_items(ring)) {
+        item->node = hash_ring_itemless_node(ring, num);
+        item->number = num;
+        return item;
     }
+
+    uint32_t index = hash_ring_find_index(ring, num);
+    item->node = ring->nodeTable[hash_ring_item_node(ring, index)];
+    item->number = hash_ring_item_number(ring, index);
+    return item;
+}
+
+hash_ring_node_t *hash_ring_find_node(hash_ring_t *ring, uint8_t *key, uint32_t keyLen) {
+    if(ring == NULL || key == NULL || keyLen <= 0) return NULL;
+    if(ring->numNodes == 0) return NULL;
     
-    printf("\n");
-    printf("----------------------------------------\n");
+    uint64_t keyInt;
     
+    if(hash_ring_hash(ring, key, keyLen, &keyInt) == -1) return NULL;
+    if(!hash_ring_has_items(ring)) return hash_ring_itemless_node(ring, keyInt);
+    return ring->nodeTable[hash_ring_item_node(ring, hash_ring_find_index(ring, keyInt))];
 }
 
-int hash_ring_add_items(hash_ring_t *ring, hash_ring_node_t *node) {
-    int x;
- 
-    char concat_buf[8];
-    int concat_len;
-    uint64_t keyInt;
+hash_ring_node_t *hash_ring_find_node_bounded(hash_ring_t *ring, uint8_t *key, uint32_t keyLen) {
+    if(ring == NULL || key == NULL || keyLen <= 0 || ring->numItems == 0) return NULL;
 
-    // Resize the items array
-    void *resized = realloc(ring->items, (sizeof(hash_ring_item_t*) * ring->numNodes * ring->numReplicas));
-    if(resized == NULL) {
-        return HASH_RING_ERR;
-    }
-    ring->items = (hash_ring_item_t**)resized;
-    for(x = 0; x < ring->numReplicas; x++) {
-        if(ring->mode == HASH_RING_MODE_LIBMEMCACHED_COMPAT) {
-            concat_len = snprintf(concat_buf, sizeof(concat_buf), "-%d", x);
-        }
-        else {
-            concat_len = snprintf(concat_buf, sizeof(concat_buf), "%d", x);
-        }
+    uint64_t keyInt;
+    if(hash_ring_hash(ring, key, keyLen, &keyInt) == -1) return NULL;
 
-        uint8_t *data = (uint8_t*)malloc(concat_len + node->nameLen);
-        memcpy(data, node->name, node->nameLen);
-        memcpy(data + node->nameLen, &concat_buf, concat_len);
+    // The key counts towards the total the capacities come from. A node's load is under
+    // its capacity when load * numItems < loadFactor * total * numReplicas, which leaves
+    // the division out so a capacity that is a whole number isn't rounded up past it.
+    uint64_t total = __atomic_add_fetch(&ring->totalLoad, 1, __ATOMIC_RELAXED);
+    double scaledTotal = ring->loadFactor * (double)total;
+    double numItems = ring->numItems;
 
-        if(hash_ring_hash(ring, data, concat_len + node->nameLen, &keyInt) == -1) {
-            free(data);
-            return HASH_RING_ERR;
+    uint32_t first = hash_ring_find_index(ring, keyInt), index = first, x;
+    hash_ring_node_t *node;
+    for(x = 0; x < ring->numItems; x++) {
+        node = ring->nodeTable[hash_ring_item_node(ring, index)];
+        uint64_t load = __atomic_load_n(&node->load, __ATOMIC_RELAXED);
+        while((double)load * numItems < scaledTotal * node->numReplicas) {
+            if(__atomic_compare_exchange_n(&node->load, &load, load + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                return node;
+            }
         }
-        free(data);
-        
-        hash_ring_item_t *item = (hash_ring_item_t*)malloc(sizeof(hash_ring_item_t));
-        item->node = node;
-        item->number = keyInt;
-        
-        ring->items[(ring->numNodes - 1) * ring->numReplicas + x] = item;
+
+        // Walk clockwise around the ring
+        if(++index == ring->numItems) index = 0;
     }
 
-    ring->numItems += ring->numReplicas;
+    // The capacities add up to more than the total, so every node can only be full if
+    // other threads changed the loads during the walk. Use the key's own node.
+    node = ring->nodeTable[hash_ring_item_node(ring, first)];
+    __atomic_add_fetch(&node->load, 1, __ATOMIC_RELAXED);
+    return node;
+}
+
+int hash_ring_release_load(hash_ring_t *ring, hash_ring_node_t *node) {
+    if(ring == NULL || node == NULL) return HASH_RING_ERR;
+
+    uint64_t load = __atomic_load_n(&node->load, __ATOMIC_RELAXED);
+    do {
+        if(load == 0) return HASH_RING_ERR;
+    } while(!__atomic_compare_exchange_n(&node->load, &load, load - 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    __atomic_sub_fetch(&ring->totalLoad, 1, __ATOMIC_RELAXED);
     return HASH_RING_OK;
 }
 
-static int item_sort(const void *a, const void *b) {
-    hash_ring_item_t *itemA = *(hash_ring_item_t**)a, *itemB = *(hash_ring_item_t**)b;
-    if(itemA == NULL) return 1;
-    if(itemB == NULL) return -1;
+int hash_ring_set_load_factor(hash_ring_t *ring, double factor) {
+    // Also false for NaN
+    if(ring == NULL || !(factor >= 1)) return HASH_RING_ERR;
 
-    if(itemA->number < itemB->number) {
-        return -1;
+    ring->loadFactor = factor;
+    return HASH_RING_OK;
+}
+
+/**
+ * Searches the frozen layout for a group of numbers, one tree level at a time.
+ */
+static void hash_ring_find_next_highest_frozen_batch(hash_ring_t *ring, const uint64_t *nums,
+    uint32_t numKeys, uint32_t *indexes) {
+    const uint64_t *frozenItems = ring->frozenItems;
+    uint64_t n = ring->numItems;
+    uint64_t k[HASH_RING_BATCH_GROUP];
+    uint32_t x;
+
+    // Every search goes through the complete levels of the tree, only the last level
+    // may be partially filled
+    int levels = 63 - __builtin_clzll(n + 1);
+    int level;
+
+    for(x = 0; x < numKeys; x++) {
+        k[x] = 1;
     }
-    else if(itemA->number > itemB->number) {
-        return 1;
+    for(level = 0; level < levels; level++) {
+        for(x = 0; x < numKeys; x++) {
+            k[x] = 2 * k[x] + (frozenItems[k[x]] <= nums[x]);
+            __builtin_prefetch(frozenItems + k[x] * 8);
+        }
     }
-    else {
-        return 0;
+    for(x = 0; x < numKeys; x++) {
+        uint64_t node = k[x];
+        if(node <= n) node = 2 * node + (frozenItems[node] <= nums[x]);
+        node >>= __builtin_ffsll(~node);
+        indexes[x] = ring->frozenRanks[node];
     }
 }
 
-int hash_ring_add_node(hash_ring_t *ring, uint8_t *name, uint32_t nameLen) {
-    if(ring == NULL) return HASH_RING_ERR;
-    if(hash_ring_get_node(ring, name, nameLen) != NULL) return HASH_RING_ERR;
-    if(name == NULL || nameLen <= 0) return HASH_RING_ERR;
-    hash_ring_node_t *node = (hash_ring_node_t*)malloc(sizeof(hash_ring_node_t));
-    if(node == NULL) {
-        return HASH_RING_ERR;
+/**
+ * Finds the index of the next highest item for a group of up to HASH_RING_BATCH_GROUP numbers.
+ * The ring must not be empty.
+ */
+static void hash_ring_find_next_highest_batch(hash_ring_t *ring, const uint64_t *nums,
+    uint32_t numKeys, uint32_t *indexes) {
+    uint32_t x;
+
+    // There is nothing to interleave a single search with
+    if(numKeys == 1) {
+        indexes[0] = hash_ring_find_next_highest_index(ring, nums[0]);
+        return;
     }
-    
-    node->name = (uint8_t*)malloc(nameLen);
-    if(node->name == NULL) {
-        free(node);
-        return HASH_RING_ERR;
+
+    if(ring->frozenItems != NULL) {
+        hash_ring_find_next_highest_frozen_batch(ring, nums, numKeys, indexes);
+        return;
     }
-    memcpy(node->name, name, nameLen);
-    node->nameLen = nameLen;
-    
-    ll_t *cur = (ll_t*)malloc(sizeof(ll_t));
-    if(cur == NULL) {
-        free(node->name);
-        free(node);
-        return HASH_RING_ERR;
+
+    int wide = ring->layout == HASH_RING_LAYOUT_WIDE;
+    if(ring->index != NULL) {
+        uint64_t keys[HASH_RING_BATCH_GROUP];
+        uint32_t starts[HASH_RING_BATCH_GROUP];
+        uint32_t ends[HASH_RING_BATCH_GROUP];
+        int shift = hash_ring_index_shift(ring, ring->indexBits);
+
+        for(x = 0; x < numKeys; x++) {
+            keys[x] = hash_ring_key(ring, nums[x]);
+            __builtin_prefetch(ring->index + (keys[x] >> shift));
+        }
+        for(x = 0; x < numKeys; x++) {
+            uint64_t bucket = keys[x] >> shift;
+            starts[x] = ring->index[bucket];
+            ends[x] = ring->index[bucket + 1];
+            if(wide) __builtin_prefetch(ring->items + starts[x]);
+            else __builtin_prefetch(ring->positions + starts[x]);
+        }
+        for(x = 0; x < numKeys; x++) {
+            indexes[x] = hash_ring_upper_bound(ring, starts[x], ends[x] - starts[x], keys[x]);
+        }
+    }
+    else if(wide) {
+        search_upper_bound_batch(ring->items, ring->numItems, nums, numKeys, indexes);
+    }
+    else {
+        uint32_t keys[HASH_RING_BATCH_GROUP];
+        for(x = 0; x < numKeys; x++) {
+            keys[x] = (uint32_t)hash_ring_key(ring, nums[x]);
+        }
+        search_upper_bound32_batch(ring->positions, ring->numItems, keys, numKeys, indexes);
     }
-    cur->data = node;
 
-    // Add the node
-    ll_t *tmp = ring->nodes;
-    ring->nodes = cur;
-    ring->nodes->next = tmp;
-    
-    ring->numNodes++;
-    
-    // Add the items for this node
-    if(hash_ring_add_items(ring, node) != HASH_RING_OK) {
-        hash_ring_remove_node(ring, node->name, node->nameLen);
-        return HASH_RING_ERR;
+    // Past the end of the ring, use the first item
+    for(x = 0; x < numKeys; x++) {
+        if(indexes[x] == ring->numItems) indexes[x] = 0;
     }
+}
 
-    // Sort the items
-    qsort((void**)ring->items, ring->numItems, sizeof(struct hash_ring_item_t*), item_sort);
+/**
+ * Finds the index of num's item in HASH_RING_MODE_MULTIPROBE. The key is probed numProbes
+ * times, at num and then at its successive rehashes. The probes are searched together
+ * and the item closest after any of them wins, the earliest probe's on a tie.
+ */
+static uint32_t hash_ring_find_multiprobe_index(hash_ring_t *ring, uint64_t num) {
+    uint64_t probes[HASH_RING_BATCH_GROUP], bestDistance = UINT64_MAX;
+    uint32_t indexes[HASH_RING_BATCH_GROUP], best = 0, done, groupSize, x;
 
-    return HASH_RING_OK;
+    for(done = 0; done < ring->numProbes; done += groupSize) {
+        groupSize = ring->numProbes - done < HASH_RING_BATCH_GROUP ? ring->numProbes - done : HASH_RING_BATCH_GROUP;
+        for(x = 0; x < groupSize; x++) {
+            probes[x] = num;
+            num = hash_ring_rehash(num);
+        }
+        hash_ring_find_next_highest_batch(ring, probes, groupSize, indexes);
+
+        // The distance wraps around past the last item
+        for(x = 0; x < groupSize; x++) {
+            uint64_t distance = hash_ring_item_number(ring, indexes[x]) - probes[x];
+            if(distance < bestDistance) {
+                bestDistance = distance;
+                best = indexes[x];
+            }
+        }
+    }
+    return best;
 }
 
-int hash_ring_remove_node(hash_ring_t *ring, uint8_t *name, uint32_t nameLen) {
-    if(ring == NULL || name == NULL || nameLen <= 0) return HASH_RING_ERR;
+/**
+ * Returns the index of the item num maps to, the next highest item or, in
+ * HASH_RING_MODE_MULTIPROBE, the closest item after any of its probes.
+ * The ring must not be empty.
+ */
+static uint32_t hash_ring_find_index(hash_ring_t *ring, uint64_t num) {
+    if(ring->mode == HASH_RING_MODE_MULTIPROBE) return hash_ring_find_multiprobe_index(ring, num);
+    return hash_ring_find_next_highest_index(ring, num);
+}
 
-    hash_ring_node_t *node;
-    ll_t *next, *prev = NULL, *cur = ring->nodes;
-    
-    while(cur != NULL) {
-        node = (hash_ring_node_t*)cur->data;
-        if(node->nameLen == nameLen  &&
-            memcmp(node->name, name, nameLen) == 0) {
-                
-                // Node found, remove it
-                next = cur->next;
-                free(node->name);
-                
-                if(prev == NULL) {
-                    ring->nodes = next;
-                }
-                else {
-                    prev->next = next;
-                }
-                
-                int x;
-                // Remove all items for this node and mark them as NULL
-                for(x = 0; x < ring->numItems; x++) {
-                    if(ring->items[x]->node == node) {
-                        free(ring->items[x]);
-                        ring->items[x] = NULL;
-                    }
-                }
-                
-                // By re-sorting, all the NULLs will be at the end of the array
-                // Then the numItems is reset and that memory is no longer used
-                qsort((void**)ring->items, ring->numItems, sizeof(struct hash_ring_item_t*), item_sort);
-                ring->numItems -= ring->numReplicas;
-                
-                free(node);
-                free(cur);
-                
-                ring->numNodes--;
-                
-                return HASH_RING_OK;
+/**
+ * Finds the nodes of numKeys numbers in the modes that keep no items. Maglev lookups
+ * prefetch all of their table entries first, jump and rendezvous hashing only compute.
+ */
+static void hash_ring_find_itemless_batch(hash_ring_t *ring, const uint64_t *nums, uint32_t numKeys,
+    hash_ring_node_t *nodes[]) {
+    uint32_t x;
+    if(ring->mode == HASH_RING_MODE_MAGLEV) {
+        uint32_t entries[HASH_RING_BATCH_GROUP];
+        uint32_t group, groupSize;
+        for(group = 0; group < numKeys; group += groupSize) {
+            groupSize = numKeys - group < HASH_RING_BATCH_GROUP ? numKeys - group : HASH_RING_BATCH_GROUP;
+            for(x = 0; x < groupSize; x++) {
+                entries[x] = hash_ring_maglev_entry(ring, nums[group + x]);
+                __builtin_prefetch(ring->maglevTable + entries[x]);
+            }
+            for(x = 0; x < groupSize; x++) {
+                nodes[group + x] = ring->nodeTable[ring->maglevTable[entries[x]]];
+            }
         }
-        
-        prev = cur;
-        cur = prev->next;
+        return;
+    }
+    for(x = 0; x < numKeys; x++) {
+        nodes[x] = hash_ring_itemless_node(ring, nums[x]);
     }
-    
-    return HASH_RING_ERR;
 }
 
-hash_ring_node_t *hash_ring_get_node(hash_ring_t *ring, uint8_t *name, uint32_t nameLen) {
-    if(ring == NULL || name == NULL || nameLen <= 0) return NULL;
-    
-    ll_t *cur = ring->nodes;
-    while(cur != NULL) {
-        hash_ring_node_t *node = (hash_ring_node_t*)cur->data;
-        // Check if the nameLen is the same as well as the name
-        if(node->nameLen == nameLen && 
-            memcmp(node->name, name, nameLen) == 0) {
-                return node;
+int hash_ring_find_nodes_batch(hash_ring_t *ring, uint8_t *keys[], uint32_t keyLens[],
+    uint32_t numKeys, hash_ring_node_t *nodes[]) {
+    if(ring == NULL || ring->numNodes == 0) return HASH_RING_ERR;
+
+    uint64_t nums[HASH_RING_BATCH_GROUP];
+    uint32_t indexes[HASH_RING_BATCH_GROUP];
+    uint32_t group, x;
+
+    for(group = 0; group < numKeys; group += HASH_RING_BATCH_GROUP) {
+        uint32_t groupSize = numKeys - group < HASH_RING_BATCH_GROUP ? numKeys - group : HASH_RING_BATCH_GROUP;
+
+        for(x = 0; x < groupSize; x++) {
+            if(keys[group + x] == NULL || keyLens[group + x] <= 0) return HASH_RING_ERR;
+        }
+        if(hash_ring_hash_multi(ring, keys + group, keyLens + group, groupSize, nums) == -1) {
+            return HASH_RING_ERR;
+        }
+
+        if(!hash_ring_has_items(ring)) {
+            hash_ring_find_itemless_batch(ring, nums, groupSize, nodes + group);
+            continue;
+        }
+        if(ring->mode == HASH_RING_MODE_MULTIPROBE) {
+            // Each key's probes are already searched together
+            for(x = 0; x < groupSize; x++) {
+                indexes[x] = hash_ring_find_multiprobe_index(ring, nums[x]);
+            }
+        }
+        else {
+            hash_ring_find_next_highest_batch(ring, nums, groupSize, indexes);
+        }
+        for(x = 0; x < groupSize; x++) {
+            nodes[group + x] = ring->nodeTable[hash_ring_item_node(ring, indexes[x])];
         }
-        cur = cur->next;
     }
-    
-    return NULL;
+
+    return HASH_RING_OK;
 }
 
-hash_ring_item_t *hash_ring_find_next_highest_item(hash_ring_t *ring, uint64_t num) {
-    if(ring->numItems == 0) return NULL;
-    
-    int min = 0;
-    int max = ring->numItems - 1;
-    hash_ring_item_t *item = NULL;
+int hash_ring_find_nodes_batch_hashed(hash_ring_t *ring, uint64_t nums[], uint32_t numKeys,
+    hash_ring_node_t *nodes[]) {
+    if(ring == NULL || ring->numNodes == 0) return HASH_RING_ERR;
 
-    while(1) {
-        if(min > max) {
-            if(min == ring->numItems) {
-                // Past the end of the ring, return the first item
-                return ring->items[0];
-            }
-            else {
-                // Return the next highest item
-                return ring->items[min];
+    uint32_t indexes[HASH_RING_BATCH_GROUP];
+    uint32_t group, x;
+
+    if(!hash_ring_has_items(ring)) {
+        hash_ring_find_itemless_batch(ring, nums, numKeys, nodes);
+        return HASH_RING_OK;
+    }
+
+    for(group = 0; group < numKeys; group += HASH_RING_BATCH_GROUP) {
+        uint32_t groupSize = numKeys - group < HASH_RING_BATCH_GROUP ? numKeys - group : HASH_RING_BATCH_GROUP;
+
+        if(ring->mode == HASH_RING_MODE_MULTIPROBE) {
+            // Each key's probes are already searched together
+            for(x = 0; x < groupSize; x++) {
+                indexes[x] = hash_ring_find_multiprobe_index(ring, nums[group + x]);
             }
         }
-        
-        int midpointIndex = (min + max) / 2;
-        item = ring->items[midpointIndex];
-
-        if(item->number > num) {
-            // Key is in the lower half
-            max = midpointIndex - 1;
+        else {
+            hash_ring_find_next_highest_batch(ring, nums + group, groupSize, indexes);
         }
-        else if(item->number <= num) {
-            // Key is in the upper half
-            min = midpointIndex + 1;
+        for(x = 0; x < groupSize; x++) {
+            nodes[group + x] = ring->nodeTable[hash_ring_item_node(ring, indexes[x])];
         }
     }
-    
-    return NULL;
+
+    return HASH_RING_OK;
 }
 
-hash_ring_node_t *hash_ring_find_node(hash_ring_t *ring, uint8_t *key, uint32_t keyLen) {
-    if(ring == NULL || key == NULL || keyLen <= 0) return NULL;
-    
-    uint64_t keyInt;
-    
-    if(hash_ring_hash(ring, key, keyLen, &keyInt) == -1) return NULL;
-    hash_ring_item_t *item = hash_ring_find_next_highest_item(ring, keyInt);
-    if(item == NULL) {
-        return NULL;
-    }
-    else {
-        return item->node;
+/**
+ * hash_ring_find_nodes in HASH_RING_MODE_RENDEZVOUS. The nodes are scored a block at a time
+ * and the num best are kept in nodes, highest score first, by insertion. Nodes that tie
+ * keep their nodeTable order, as they do for hash_ring_find_node.
+ */
+static int hash_ring_find_nodes_rendezvous(hash_ring_t *ring, uint64_t key, hash_ring_node_t *nodes[],
+    uint32_t num) {
+    uint64_t scores[HASH_RING_RENDEZVOUS_BLOCK], bestScores[HASH_RING_RENDEZVOUS_BLOCK];
+    uint64_t *best = num <= HASH_RING_RENDEZVOUS_BLOCK ? bestScores : (uint64_t*)malloc(sizeof(uint64_t) * num);
+    if(best == NULL) return -1;
+
+    uint32_t first, count = 0, x;
+    for(first = 0; first < ring->numNodes; first += HASH_RING_RENDEZVOUS_BLOCK) {
+        uint32_t blockSize = ring->numNodes - first < HASH_RING_RENDEZVOUS_BLOCK ?
+            ring->numNodes - first : HASH_RING_RENDEZVOUS_BLOCK;
+        rendezvous_score_all(ring->seeds + first, blockSize, key, scores);
+
+        for(x = 0; x < blockSize; x++) {
+            uint64_t score = scores[x];
+            if(count == num && score <= best[num - 1]) continue;
+
+            uint32_t pos = count < num ? count++ : num - 1;
+            while(pos > 0 && best[pos - 1] < score) {
+                best[pos] = best[pos - 1];
+                nodes[pos] = nodes[pos - 1];
+                pos--;
+            }
+            best[pos] = score;
+            nodes[pos] = ring->nodeTable[first + x];
+        }
     }
+
+    if(best != bestScores) free(best);
+    return (int)num;
 }
 
 /*
@@ -395,34 +2099,66 @@ int hash_ring_find_nodes(
         hash_ring_node_t *nodes[],
         uint32_t num) {
 
+    if(ring == NULL || ring->numNodes == 0) return -1;
+
     // the number of nodes we're going to return is either the number of nodes
     // requested, or the number of nodes available
     int ret = ring->numNodes < num ? ring->numNodes : num;
+    if(ret == 0) return 0;
 
     uint64_t keyInt;
     if(hash_ring_hash(ring, key, keyLen, &keyInt) == -1) return -1;
+    if(ring->mode == HASH_RING_MODE_RENDEZVOUS) return hash_ring_find_nodes_rendezvous(ring, keyInt, nodes, ret);
 
-    hash_ring_item_t *item;
+    hash_ring_node_t *node;
+    int jump = ring->mode == HASH_RING_MODE_JUMP || ring->mode == HASH_RING_MODE_ANCHOR;
+    int maglev = ring->mode == HASH_RING_MODE_MAGLEV;
+    uint32_t index = jump ? 0 : maglev ? hash_ring_maglev_entry(ring, keyInt) :
+        hash_ring_find_index(ring, keyInt);
     int x = 0;
     int seen;
     int i;
 
+    if(!jump && !maglev && ring->successors != NULL && (uint32_t)ret <= ring->numSuccessors) {
+        // The table already has the distinct nodes from every item on
+        const uint32_t *row = ring->successors + (size_t)index * ring->successorWidth;
+        for(x = 0; x < ret; x++) {
+            nodes[x] = ring->nodeTable[row[x]];
+        }
+        return ret;
+    }
+
     while(1) {
-        item = hash_ring_find_next_highest_item(ring, keyInt);
-        if(item == NULL) return -1;
-        keyInt = item->number;
+        if(jump) {
+            // each rehash of the key picks another bucket
+            node = hash_ring_itemless_node(ring, keyInt);
+            keyInt = hash_ring_rehash(keyInt);
+        }
+        else if(maglev) {
+            // walk the table, every node owns some of its entries
+            node = ring->nodeTable[ring->maglevTable[index]];
+            index++;
+            if(index == ring->maglevSize) index = 0;
+        }
+        else {
+            node = ring->nodeTable[hash_ring_item_node(ring, index)];
+
+            // walk clockwise around the ring
+            index++;
+            if(index == ring->numItems) index = 0;
+        }
 
         // if we've already included this node, skip it
         seen = 0;
         for(i=0; i<x; i++) {
-            if(item->node == nodes[i]) {
+            if(node == nodes[i]) {
                 seen = 1;
                 break;
             }
         }
         if(seen) continue;
 
-        nodes[x] = item->node;
+        nodes[x] = node;
         x++;
         if(x == ret) break;
     }
@@ -433,12 +2169,19 @@ int hash_ring_find_nodes(
 int hash_ring_set_mode(hash_ring_t *ring, HASH_MODE mode) {
     if(ring == NULL) return HASH_RING_ERR;
 
+    // Nodes in the modes without items can't be turned into items or back
+    if(ring->numNodes > 0 && mode != ring->mode &&
+        (!hash_ring_has_items(ring) || !hash_ring_mode_has_items(mode))) {
+        return HASH_RING_ERR;
+    }
+
     if(mode == HASH_RING_MODE_LIBMEMCACHED_COMPAT) {
         if(ring->hash_fn != HASH_FUNCTION_MD5) return HASH_RING_ERR;
         ring->mode = mode;
         return HASH_RING_OK;
     }
-    else if(mode == HASH_RING_MODE_NORMAL) {
+    else if(mode == HASH_RING_MODE_NORMAL || mode == HASH_RING_MODE_JUMP || mode == HASH_RING_MODE_MAGLEV ||
+        mode == HASH_RING_MODE_RENDEZVOUS || mode == HASH_RING_MODE_MULTIPROBE || mode == HASH_RING_MODE_ANCHOR) {
         ring->mode = mode;
         return HASH_RING_OK;
     }
@@ -447,3 +2190,66 @@ int hash_ring_set_mode(hash_ring_t *ring, HASH_MODE mode) {
         return HASH_RING_ERR;
     }
 }
+
+int hash_ring_set_layout(hash_ring_t *ring, HASH_LAYOUT layout) {
+    if(ring == NULL || ring->numNodes > 0) return HASH_RING_ERR;
+    if(layout != HASH_RING_LAYOUT_WIDE && layout != HASH_RING_LAYOUT_COMPACT32 &&
+        layout != HASH_RING_LAYOUT_COMPACT16) return HASH_RING_ERR;
+
+    // An empty ring may still have items allocated by a failed add
+    hash_ring_resize_items(ring, 0);
+    ring->layout = layout;
+    return HASH_RING_OK;
+}
+
+int hash_ring_set_maglev_size(hash_ring_t *ring, uint32_t minSize) {
+    if(ring == NULL || ring->numNodes > 0 || minSize < 2 || minSize > HASH_RING_MAX_MAGLEV_SIZE) return HASH_RING_ERR;
+
+    // Any step through a prime sized table visits every entry
+    uint32_t size = minSize, x;
+    while(1) {
+        for(x = 2; (uint64_t)x * x <= size && size % x != 0; x++);
+        if((uint64_t)x * x > size) break;
+        size++;
+    }
+
+    if(ring->maglevTable != NULL) free(ring->maglevTable);
+    ring->maglevTable = NULL;
+    ring->maglevSize = size;
+    return HASH_RING_OK;
+}
+
+int hash_ring_set_probes(hash_ring_t *ring, uint32_t numProbes) {
+    if(ring == NULL || numProbes == 0 || numProbes > HASH_RING_MAX_PROBES) return HASH_RING_ERR;
+
+    ring->numProbes = numProbes;
+    return HASH_RING_OK;
+}
+
+int hash_ring_set_anchor_size(hash_ring_t *ring, uint32_t size) {
+    if(ring == NULL || ring->numNodes > 0 || size == 0 || size > HASH_RING_MAX_ANCHOR_SIZE) return HASH_RING_ERR;
+
+    if(ring->anchorNodes != NULL) free(ring->anchorNodes);
+    ring->anchorNodes = NULL;
+    ring->anchorSize = size;
+    return HASH_RING_OK;
+}
+
+int hash_ring_set_successors(hash_ring_t *ring, uint32_t width) {
+    if(ring == NULL || width > HASH_RING_MAX_SUCCESSORS) return HASH_RING_ERR;
+
+    if(ring->successors != NULL) free(ring->successors);
+    ring->successors = NULL;
+    ring->successorWidth = 0;
+    ring->numSuccessors = 0;
+    if(width == 0 || ring->numItems == 0) {
+        ring->successorWidth = width;
+        return HASH_RING_OK;
+    }
+
+    ring->successors = (uint32_t*)malloc(sizeof(uint32_t) * width * (size_t)ring->numItems);
+    if(ring->successors == NULL) return HASH_RING_ERR;
+    ring->successorWidth = width;
+    hash_ring_build_successors(ring);
+    return HASH_RING_OK;
+}
@@ -18,6 +18,7 @@
 #ifndef HASH_RING_H
 #define HASH_RING_H
 
+#include <stddef.h>
 #include <stdint.h>
 
 #define HASH_RING_OK 0
@@ -26,8 +27,69 @@
 #define HASH_FUNCTION_SHA1 1
 #define HASH_FUNCTION_MD5 2
 
+/**
+ * Non-cryptographic hash functions. These are much cheaper than MD5 or SHA1 for short keys.
+ *
+ * HASH_FUNCTION_XXH3 uses the 64-bit XXH3 hash.
+ * HASH_FUNCTION_MURMUR3 uses the first 64 bits (h1) of MurmurHash3_x64_128 with a seed of 0.
+ * HASH_FUNCTION_CRC32C uses CRC-32C, computed with the SSE4.2 crc32 instruction when available.
+ * CRC-32C only gives 32 bits, they are used as the high 32 bits of the number so that items
+ * are spread over the whole ring.
+ */
+#define HASH_FUNCTION_XXH3 3
+#define HASH_FUNCTION_MURMUR3 4
+#define HASH_FUNCTION_CRC32C 5
+
 #define HASH_RING_DEBUG 1
 
+/**
+ * The default limit on the number of bits used by a ring's prefix index.
+ * See hash_ring_set_max_index_bits.
+ */
+#define HASH_RING_DEFAULT_MAX_INDEX_BITS 24
+
+/**
+ * The most threads a ring may build with. See hash_ring_set_threads.
+ */
+#define HASH_RING_MAX_THREADS 64
+
+/**
+ * The default capacity factor of bounded load lookups. See hash_ring_set_load_factor.
+ */
+#define HASH_RING_DEFAULT_LOAD_FACTOR 1.25
+
+/**
+ * The default number of entries in the table of a HASH_RING_MODE_MAGLEV ring, a prime.
+ */
+#define HASH_RING_DEFAULT_MAGLEV_SIZE 65537
+
+/**
+ * The largest table hash_ring_set_maglev_size accepts.
+ */
+#define HASH_RING_MAX_MAGLEV_SIZE (1u << 30)
+
+/**
+ * The default number of buckets of a HASH_RING_MODE_ANCHOR ring, the most nodes it can have.
+ */
+#define HASH_RING_DEFAULT_ANCHOR_SIZE 1024
+
+/**
+ * The most buckets hash_ring_set_anchor_size accepts.
+ */
+#define HASH_RING_MAX_ANCHOR_SIZE (1u << 28)
+
+/**
+ * The default and largest number of probes per lookup of HASH_RING_MODE_MULTIPROBE.
+ * 21 probes give a peak to average load of about 1.05.
+ */
+#define HASH_RING_DEFAULT_PROBES 21
+#define HASH_RING_MAX_PROBES 1024
+
+/**
+ * The most distinct nodes hash_ring_set_successors keeps for each item.
+ */
+#define HASH_RING_MAX_SUCCESSORS 8
+
 /**
  * This will do the hashing in the standard hash-ring way. See the README
  */
@@ -41,12 +103,100 @@
  */
 #define HASH_RING_MODE_LIBMEMCACHED_COMPAT 2
 
+/**
+ * Nodes are numbered buckets, in the order they were added, and keys are mapped to them
+ * with jump consistent hashing (Lamping and Veach). The ring keeps no items, so it uses
+ * no memory beyond the nodes and lookups touch nothing but the nodeTable. Only the last
+ * node added can be removed, and nodes can't be weighted.
+ *
+ * Bounded load lookups aren't supported, hash_ring_find_node_bounded returns NULL.
+ */
+#define HASH_RING_MODE_JUMP 3
+
+/**
+ * Keys are mapped to nodes with a Maglev lookup table (Eisenbud et al.). Every node fills
+ * the table's entries in the order of its own permutation of them, taking turns, so each
+ * node owns about as many entries as any other and a key's node is one table entry. The
+ * table is rebuilt whenever nodes are added or removed, and only depends on the set of
+ * nodes, not the order they were added in. The ring keeps no items and nodes can't be
+ * weighted.
+ *
+ * Bounded load lookups aren't supported, hash_ring_find_node_bounded returns NULL.
+ *
+ * @see hash_ring_set_maglev_size
+ */
+#define HASH_RING_MODE_MAGLEV 4
+
+/**
+ * Keys are mapped to nodes with rendezvous (highest random weight) hashing. Every node
+ * has a seed, its name hashed with the ring's hash function, and a key goes to the node
+ * whose seed scores highest with it. The scores are computed with SIMD, see rendezvous.h.
+ * A lookup scores every node, so this suits rings of up to a few hundred nodes. Any node
+ * can be removed, which only moves the keys it had. The ring keeps no items and nodes
+ * can't be weighted.
+ *
+ * hash_ring_find_nodes returns the num highest scoring nodes, best first. Removing a node
+ * drops it from every key's list without reordering the rest.
+ *
+ * Bounded load lookups aren't supported, hash_ring_find_node_bounded returns NULL.
+ */
+#define HASH_RING_MODE_RENDEZVOUS 5
+
+/**
+ * Multi-probe consistent hashing (Appleton and O'Reilly). Nodes are placed on the ring
+ * as in HASH_RING_MODE_NORMAL, but a key is looked up numProbes times, at its number and
+ * at successive rehashes of it, and goes to the item closest after any of its probes.
+ * Probing spreads the keys about as evenly as many replicas do, so a ring with
+ * numReplicas = 1 balances nearly as well as one with 160 replicas, for a fraction of
+ * the memory, at the cost of numProbes searches per lookup.
+ *
+ * With 1 probe the ring gives the same nodes as in HASH_RING_MODE_NORMAL.
+ *
+ * @see hash_ring_set_probes
+ */
+#define HASH_RING_MODE_MULTIPROBE 6
+
+/**
+ * Keys are mapped to nodes with AnchorHash (Mendelson et al.). The ring has a fixed set of
+ * anchorSize buckets, each node holds one of them and the rest are removed. A key hashes
+ * to a bucket, and while that bucket is removed it rehashes among the buckets that were
+ * still there when it was removed. Any node can be removed or added in O(1) time, a
+ * removal only moves the keys of the removed node, and keys are spread evenly without
+ * replicas. Lookups take a few steps more as more buckets are removed, about
+ * 1 + ln(anchorSize / numNodes) on average.
+ *
+ * A new node takes the bucket removed last, so a node added back right after it was
+ * removed gets its keys back. The ring keeps no items and nodes can't be weighted.
+ *
+ * Bounded load lookups aren't supported, hash_ring_find_node_bounded returns NULL.
+ *
+ * @see hash_ring_set_anchor_size
+ */
+#define HASH_RING_MODE_ANCHOR 7
+
 typedef uint8_t HASH_MODE;
 
-typedef struct ll_t {
-    void *data;
-    struct ll_t *next;
-} ll_t;
+/**
+ * Each item is a 64-bit number and a 32-bit node index, 12 bytes. This is the default.
+ */
+#define HASH_RING_LAYOUT_WIDE 1
+
+/**
+ * Each item is a 32-bit position and a 32-bit node index, 8 bytes. The position is the
+ * top 32 bits of the item's number, or the whole number in
+ * HASH_RING_MODE_LIBMEMCACHED_COMPAT, whose numbers are 32 bits.
+ */
+#define HASH_RING_LAYOUT_COMPACT32 2
+
+/**
+ * Each item is a 32-bit position and a 16-bit node index, 6 bytes. The ring can hold
+ * at most HASH_RING_COMPACT16_MAX_NODES nodes.
+ */
+#define HASH_RING_LAYOUT_COMPACT16 3
+
+#define HASH_RING_COMPACT16_MAX_NODES 65536
+
+typedef uint8_t HASH_LAYOUT;
 
 typedef uint8_t HASH_FUNCTION;
 
@@ -60,10 +210,22 @@ typedef uint8_t HASH_FUNCTION;
 typedef struct hash_ring_node_t {
     uint8_t *name;
     uint32_t nameLen;
+
+    /* The position of this node in the ring's nodeTable */
+    uint32_t index;
+
+    /* The number of items the node has in the ring */
+    uint32_t numReplicas;
+
+    /* The keys assigned to the node by hash_ring_find_node_bounded and not yet released */
+    uint64_t load;
 } hash_ring_node_t;
 
 /**
  * Nodes have many items, each item has a number derived from the node's name.
+ *
+ * The ring does not store items in this form, it is only used to return a
+ * single item to callers of hash_ring_find_next_highest_item.
  */
 typedef struct hash_ring_item_t {
     hash_ring_node_t *node;
@@ -73,26 +235,133 @@ typedef struct hash_ring_item_t {
 } hash_ring_item_t;
 
 /**
- * This structure contains an array with the ring's items, as well as
- * a list of nodes. A node appears in the ring numReplicas times.
+ * This structure contains the ring's items, as well as
+ * its nodes. A node appears in the ring numReplicas times, unless it was given a
+ * weight, see hash_ring_add_node_weighted.
+ *
+ * Items are stored as two parallel arrays so that searching the ring only
+ * touches the contiguous array of numbers.
  */
+struct arena_t;
+
 typedef struct hash_ring_t {
     uint32_t numReplicas;
     
-    /* List of nodes in the ring */
-    ll_t *nodes;
-    
     /* The number of nodes in the ring */
     uint32_t numNodes;
+
+    /**
+     * The nodes in the ring, indexed by hash_ring_node_t.index. The first numNodes
+     * entries are used, there is room for (nodeSlotsMask + 1) / 2.
+     */
+    hash_ring_node_t **nodeTable;
+
+    /**
+     * Open addressing table of the nodes by name, with linear probing.
+     * Each slot holds the low 32 bits of the name's hash in its high half and the
+     * node's index + 1 in its low half, 0 is an empty slot. There are
+     * nodeSlotsMask + 1 slots, a power of two, and at most half are used.
+     */
+    uint64_t *nodeSlots;
+    uint32_t nodeSlotsMask;
     
+    /* How the items are stored, one of the HASH_RING_LAYOUT_* values */
+    HASH_LAYOUT layout;
+
+    /**
+     * The number of each item in the ring 
+     * This array is sorted ascending, items with the same number are in the
+     * order their nodes were added.
+     * In the compact layouts items is NULL and positions holds the items' 32-bit
+     * positions instead, in the same order.
+     */
+    uint64_t *items;
+    uint32_t *positions;
+
     /**
-     * Array of items in the ring 
-     * This array is sorted ascending
+     * itemNodes[x] is the nodeTable index of the node that owns items[x]. In
+     * HASH_RING_LAYOUT_COMPACT16 itemNodes is NULL and itemNodes16 holds the indexes.
      */
-    hash_ring_item_t **items;
+    uint32_t *itemNodes;
+    uint16_t *itemNodes16;
     
     /* The number of items in the ring */
     uint32_t numItems;
+
+    /**
+     * When the ring is frozen, frozenItems holds a copy of items in Eytzinger
+     * (breadth first) order, starting at index 1. frozenRanks[k] is the index
+     * into items of frozenItems[k]. Both are NULL when the ring isn't frozen.
+     */
+    uint64_t *frozenItems;
+    uint32_t *frozenRanks;
+
+    /**
+     * Prefix index over items. The items whose top indexBits bits are b are
+     * items[index[b]] up to, but not including, items[index[b + 1]].
+     * index is NULL and indexBits is 0 when the ring has no index.
+     */
+    uint32_t *index;
+    uint8_t indexBits;
+
+    /* The most bits the prefix index may use */
+    uint8_t maxIndexBits;
+
+    /* The number of threads hash_ring_add_nodes may use */
+    uint32_t numThreads;
+
+    /* The keys assigned by hash_ring_find_node_bounded and not yet released */
+    uint64_t totalLoad;
+
+    /* The capacity factor of bounded load lookups */
+    double loadFactor;
+
+    /**
+     * In HASH_RING_MODE_MAGLEV, the nodeTable index of the node owning each of the
+     * maglevSize entries of the lookup table. maglevSize is a prime.
+     */
+    uint32_t *maglevTable;
+    uint32_t maglevSize;
+
+    /* In HASH_RING_MODE_RENDEZVOUS, the seed of each node, in nodeTable order */
+    uint64_t *seeds;
+
+    /* The number of times HASH_RING_MODE_MULTIPROBE probes the ring for a key */
+    uint32_t numProbes;
+
+    /**
+     * If successorWidth isn't 0, the first numSuccessors distinct nodes clockwise from each
+     * item, the item's own first, as nodeTable indexes in rows of successorWidth.
+     * numSuccessors is the smaller of successorWidth and numNodes.
+     */
+    uint32_t *successors;
+    uint32_t successorWidth;
+    uint32_t numSuccessors;
+
+    /**
+     * The anchorSize buckets of HASH_RING_MODE_ANCHOR, in one allocation starting at
+     * anchorNodes: the node holding each bucket, then the arrays of AnchorHash. For each
+     * bucket, anchorRemoved is the number of nodes left when it was removed, or 0 if it is
+     * held (A), anchorNext its successor (K), anchorLocation its place in anchorWorking
+     * (L), and anchorWorking the buckets held, by place (W). anchorStack is the stack of
+     * removed buckets (R), with anchorSize - numNodes of them, and anchorBuckets the
+     * bucket of each node in nodeTable order.
+     */
+    hash_ring_node_t **anchorNodes;
+    uint32_t *anchorRemoved;
+    uint32_t *anchorNext;
+    uint32_t *anchorLocation;
+    uint32_t *anchorWorking;
+    uint32_t *anchorStack;
+    uint32_t *anchorBuckets;
+    uint32_t anchorSize;
+
+    /* The nodes and their names are allocated from this arena */
+    struct arena_t *arena;
+
+    /* Scratch space kept between changes to the ring, scratchSize bytes */
+    void *scratch;
+    size_t scratchSize;
     
     /* The hash function to use for this ring */
     HASH_FUNCTION hash_fn;
@@ -109,7 +378,8 @@ typedef struct hash_ring_t {
  * (numReplicas * N).
  *
  * @param[in] numReplicas The number of replicas
- * @param[in] hash_fn The hash function to use. HASH_FUNCTION_SHA1 or HASH_FUNCTION_MD5
+ * @param[in] hash_fn The hash function to use. HASH_FUNCTION_SHA1, HASH_FUNCTION_MD5, HASH_FUNCTION_XXH3,
+ *                    HASH_FUNCTION_MURMUR3 or HASH_FUNCTION_CRC32C
  *
  * @returns a new hash ring or NULL if it couldn't be created.
  */
@@ -122,6 +392,14 @@ hash_ring_t *hash_ring_create(uint32_t numReplicas, HASH_FUNCTION hash_fn);
 void hash_ring_free(hash_ring_t *ring);
 
 
+/**
+ * Returns a copy of the ring, with its own copies of the nodes. The copy is not frozen
+ * and shares nothing with ring, so either can be changed or freed without affecting the other.
+ *
+ * @returns the copy, or NULL if ring is NULL or memory couldn't be allocated.
+ */
+hash_ring_t *hash_ring_copy(hash_ring_t *ring);
+
 /**
  * Adds a node into the ring. The node is specified by passing an opaque
  * array of bytes in the name parameter. The name should be used consistently for clients using the ring.
@@ -133,6 +411,51 @@ void hash_ring_free(hash_ring_t *ring);
  */
 int hash_ring_add_node(hash_ring_t *ring, uint8_t *name, uint32_t nameLen);
 
+/**
+ * Adds numNodes nodes to the ring at once. names[x] and nameLens[x] are the name of each
+ * node, as for hash_ring_add_node.
+ *
+ * The items are sized once, all replicas are hashed and then the new items are sorted and
+ * merged into the ring in a single pass, which is much faster than adding the nodes one at
+ * a time.
+ *
+ * @returns HASH_RING_OK if the nodes were added. HASH_RING_ERR if a name is empty, a node
+ * is already in the ring or repeated in names, or an error occurred. In that case none of
+ * the nodes are added.
+ */
+int hash_ring_add_nodes(hash_ring_t *ring, uint8_t *names[], uint32_t nameLens[], uint32_t numNodes);
+
+/**
+ * Adds a node with a weight, which scales its share of the ring. The node is given
+ * weight * numReplicas replicas, rounded to the nearest whole number and at least 1, so a
+ * node of weight 2 gets about twice as many keys as one added with hash_ring_add_node.
+ *
+ * @returns HASH_RING_OK if the node was added, HASH_RING_ERR if the weight isn't positive,
+ * the ring is in a mode without items (jump, Maglev, rendezvous or anchor) or an error occurred.
+ */
+int hash_ring_add_node_weighted(hash_ring_t *ring, uint8_t *name, uint32_t nameLen, double weight);
+
+/**
+ * Changes the weight of a node in the ring, see hash_ring_add_node_weighted. Only the
+ * replicas past the smaller of the old and new replica counts are added or removed, so
+ * only keys that move to or from this node change nodes.
+ *
+ * @returns HASH_RING_OK if the weight was set, HASH_RING_ERR if the node isn't in the ring,
+ * the weight isn't positive, the ring is in a mode without items or an error occurred.
+ */
+int hash_ring_set_node_weight(hash_ring_t *ring, uint8_t *name, uint32_t nameLen, double weight);
+
+/**
+ * Creates a new hash ring with the given mode and adds numNodes nodes with hash_ring_add_nodes.
+ *
+ * @see hash_ring_create
+ * @see hash_ring_set_mode
+ *
+ * @returns a new hash ring or NULL if it couldn't be created.
+ */
+hash_ring_t *hash_ring_create_from_nodes(uint8_t *names[], uint32_t nameLens[], uint32_t numNodes,
+    uint32_t numReplicas, HASH_FUNCTION hash_fn, HASH_MODE mode);
+
 
 /**
  * Gets the node specified by name from the ring.
@@ -150,26 +473,170 @@ hash_ring_node_t *hash_ring_get_node(hash_ring_t *ring, uint8_t *name, uint32_t
  */
 hash_ring_node_t *hash_ring_find_node(hash_ring_t *ring, uint8_t *key, uint32_t keyLen);
 
+/**
+ * Finds a node for the key with consistent hashing with bounded loads (Mirrokni, Thorup
+ * and Zadimoghaddam). The search walks clockwise from the key's position to the first
+ * node whose load is under its capacity, which is
+ *
+ *     ceil(loadFactor * (totalLoad + 1) * node->numReplicas / numItems)
+ *
+ * so no node gets more than loadFactor times its share of the keys. The key is assigned
+ * to the node, adding one to its load, until hash_ring_release_load is called for it.
+ *
+ * Loads are counted with atomic operations, threads may look up and release keys on the
+ * same ring at once. Loads belong to the ring: hash_ring_copy copies them, but keys
+ * assigned by the old ring afterwards aren't counted by the copy.
+ *
+ * @returns the node, or NULL if the ring is empty or an error occurred.
+ */
+hash_ring_node_t *hash_ring_find_node_bounded(hash_ring_t *ring, uint8_t *key, uint32_t keyLen);
+
+/**
+ * Releases a key assigned to node by hash_ring_find_node_bounded.
+ *
+ * @returns HASH_RING_OK, or HASH_RING_ERR if the node has no load.
+ */
+int hash_ring_release_load(hash_ring_t *ring, hash_ring_node_t *node);
+
+/**
+ * Sets the capacity factor of bounded load lookups, HASH_RING_DEFAULT_LOAD_FACTOR by
+ * default. Lower factors spread the load more evenly but move more keys away from their
+ * consistent hashing nodes.
+ *
+ * @returns HASH_RING_OK, or HASH_RING_ERR if factor is less than 1.
+ */
+int hash_ring_set_load_factor(hash_ring_t *ring, double factor);
+
 /**
  * Finds the set of num nodes by hashing the given key and searching the ring.
  * Returns the number of nodes found, or -1 if there is an error
+ *
+ * In HASH_RING_MODE_JUMP and HASH_RING_MODE_ANCHOR the first node is the key's own and
+ * each of the others is the node of a rehash of the key, skipping nodes already found. In HASH_RING_MODE_MAGLEV
+ * they are the owners of the key's table entry and the entries after it, and in
+ * HASH_RING_MODE_RENDEZVOUS the nodes with the highest scores.
+ *
+ * With a successor table at least num wide the nodes are copied from the table instead
+ * of walking the ring, see hash_ring_set_successors.
  */
 int hash_ring_find_nodes(hash_ring_t *ring, uint8_t *key, uint32_t keyLen, hash_ring_node_t *nodes[], uint32_t num);
 
+/**
+ * Finds the node for each of numKeys keys, storing the node for keys[x] in nodes[x].
+ *
+ * This gives the same nodes as calling hash_ring_find_node for every key, but the
+ * searches for different keys are interleaved so that their cache misses overlap.
+ * It is faster for large rings and many keys.
+ *
+ * @returns HASH_RING_OK if the nodes were found, or HASH_RING_ERR if the ring is empty
+ * or a key couldn't be hashed.
+ */
+int hash_ring_find_nodes_batch(hash_ring_t *ring, uint8_t *keys[], uint32_t keyLens[],
+    uint32_t numKeys, hash_ring_node_t *nodes[]);
+
+/**
+ * The same as hash_ring_find_nodes_batch for keys that have already been hashed onto the
+ * ring, nums[x] is located on the ring as it is by hash_ring_find_next_highest_item.
+ */
+int hash_ring_find_nodes_batch_hashed(hash_ring_t *ring, uint64_t nums[], uint32_t numKeys,
+    hash_ring_node_t *nodes[]);
+
 /**
  * Find the next highest item for the given num.
  * This function is invoked by hash_ring_find_node to locate a key on the ring. If you want to do your own hashing on 
  * the keys, you might call this function, but probably not.
+ *
+ * In HASH_RING_MODE_JUMP, HASH_RING_MODE_MAGLEV, HASH_RING_MODE_RENDEZVOUS and
+ * HASH_RING_MODE_ANCHOR there are no items, item->number is num itself. In HASH_RING_MODE_MULTIPROBE the item is the closest
+ * one after any of num's probes.
+ *
+ * @param[out] item Filled in with the node and number of the item that was found.
+ *
+ * @returns item, or NULL if the ring is empty.
  */
-hash_ring_item_t *hash_ring_find_next_highest_item(hash_ring_t *ring, uint64_t num);
+hash_ring_item_t *hash_ring_find_next_highest_item(hash_ring_t *ring, uint64_t num, hash_ring_item_t *item);
 
 /**
  * Removes a node from the ring. 
  * 
- * @returns HASH_RING_OK if the node was removed, or HASH_RING_ERR if it does not exist.
+ * @returns HASH_RING_OK if the node was removed, or HASH_RING_ERR if it does not exist or,
+ * in HASH_RING_MODE_JUMP, isn't the last node added.
  */
 int hash_ring_remove_node(hash_ring_t *ring, uint8_t *name, uint32_t nameLen);
 
+/**
+ * Freezes the ring for lookups.
+ *
+ * The ring's items are copied into a cache friendly search layout that is used by
+ * hash_ring_find_node, hash_ring_find_nodes and hash_ring_find_next_highest_item.
+ * Lookups return exactly the same results as they do on an unfrozen ring.
+ *
+ * Adding or removing a node unfreezes the ring, call this again once the ring
+ * has been modified.
+ *
+ * @returns HASH_RING_OK if the ring was frozen, HASH_RING_ERR if an error occurred.
+ */
+int hash_ring_freeze(hash_ring_t *ring);
+
+/**
+ * Memory used by a ring, in bytes.
+ */
+typedef struct hash_ring_stats_t {
+    /* The items and itemNodes arrays */
+    uint64_t itemBytes;
+
+    /* The prefix index */
+    uint64_t indexBytes;
+
+    /* The frozen search layout */
+    uint64_t frozenBytes;
+
+    /* The table of distinct successors */
+    uint64_t successorBytes;
+
+    /* The nodes, their names and the tables of nodes */
+    uint64_t nodeBytes;
+
+    /**
+     * The lookup table of HASH_RING_MODE_MAGLEV, the seeds of HASH_RING_MODE_RENDEZVOUS or
+     * the buckets of HASH_RING_MODE_ANCHOR
+     */
+    uint64_t tableBytes;
+} hash_ring_stats_t;
+
+/**
+ * Fills in stats with the memory used by the ring.
+ *
+ * @returns HASH_RING_OK, or HASH_RING_ERR if ring or stats is NULL.
+ */
+int hash_ring_get_stats(hash_ring_t *ring, hash_ring_stats_t *stats);
+
+/**
+ * Limits the size of the ring's prefix index.
+ *
+ * The ring keeps an index keyed by the top bits of an item's number, so that a search
+ * only has to look at the few items that share the key's top bits. The number of bits
+ * is chosen from numItems, to give about 2 items per bucket, and is capped by maxBits.
+ * The index uses 4 * (2 ^ bits) bytes, setting maxBits to 0 turns it off.
+ *
+ * The default is HASH_RING_DEFAULT_MAX_INDEX_BITS.
+ *
+ * @returns HASH_RING_OK if the limit was set, or HASH_RING_ERR if maxBits is greater than 31.
+ */
+int hash_ring_set_max_index_bits(hash_ring_t *ring, uint8_t maxBits);
+
+/**
+ * Sets the number of threads hash_ring_add_nodes uses to hash the new nodes' replicas
+ * and sort them. Batches too small to gain from threads are still done on the calling
+ * thread. The ring is byte for byte the same however many threads build it.
+ *
+ * The default is 1, all of the work is done on the calling thread.
+ *
+ * @returns HASH_RING_OK if the number was set, or HASH_RING_ERR if numThreads is 0 or
+ * greater than HASH_RING_MAX_THREADS.
+ */
+int hash_ring_set_threads(hash_ring_t *ring, uint32_t numThreads);
+
 /**
  * Print the hash ring to stdout.
  */
@@ -178,7 +645,9 @@ void hash_ring_print(hash_ring_t *ring);
 /**
  * Sets the mode for hashing.
  *
- * This should be set after creating a ring and before adding nodes.
+ * This should be set after creating a ring and before adding nodes. The mode can't be
+ * changed to or from HASH_RING_MODE_JUMP, HASH_RING_MODE_MAGLEV, HASH_RING_MODE_RENDEZVOUS or
+ * HASH_RING_MODE_ANCHOR once the ring has nodes.
  *
  * If mode is set to HASH_RING_MODE_LIBMEMCACHED_COMPAT then the hash function must be HASH_FUNCTION_MD5 or this
  * call will fail.
@@ -190,4 +659,149 @@ void hash_ring_print(hash_ring_t *ring);
  */
 int hash_ring_set_mode(hash_ring_t *ring, HASH_MODE mode);
 
+/**
+ * Sets how the ring stores its items, one of the HASH_RING_LAYOUT_* values.
+ *
+ * The compact layouts use 8 or 6 bytes per item instead of 12, so twice as many items
+ * fit in the cache and each search compares twice as many per vector. In
+ * HASH_RING_MODE_NORMAL they only keep the top 32 bits of each number, so keys that
+ * fall between two items with the same top 32 bits may map to a different node than
+ * in the wide layout. A ring in a compact layout is never frozen, hash_ring_freeze
+ * leaves it as it is.
+ *
+ * @returns HASH_RING_OK if the layout was set, or HASH_RING_ERR if the layout is
+ * unknown or the ring already has nodes.
+ */
+int hash_ring_set_layout(hash_ring_t *ring, HASH_LAYOUT layout);
+
+/**
+ * Sets the size of the lookup table of a HASH_RING_MODE_MAGLEV ring to the smallest prime
+ * that is at least minSize. The default is HASH_RING_DEFAULT_MAGLEV_SIZE entries. Larger
+ * tables spread the keys more evenly and move fewer keys when nodes change, the ring
+ * can't have more nodes than entries. A key's entry is picked with the top bits of its
+ * number.
+ *
+ * @returns HASH_RING_OK if the size was set, or HASH_RING_ERR if the ring already has
+ * nodes or minSize is less than 2 or greater than HASH_RING_MAX_MAGLEV_SIZE.
+ */
+int hash_ring_set_maglev_size(hash_ring_t *ring, uint32_t minSize);
+
+/**
+ * Sets the number of probes per lookup of HASH_RING_MODE_MULTIPROBE, the default is
+ * HASH_RING_DEFAULT_PROBES. More probes balance the nodes more evenly but make lookups
+ * slower, the peak to average load is about 1 + 1 / numProbes.
+ *
+ * @returns HASH_RING_OK if the number was set, or HASH_RING_ERR if numProbes is 0 or
+ * greater than HASH_RING_MAX_PROBES.
+ */
+int hash_ring_set_probes(hash_ring_t *ring, uint32_t numProbes);
+
+/**
+ * Sets the number of buckets of a HASH_RING_MODE_ANCHOR ring, the most nodes it can ever
+ * have. The default is HASH_RING_DEFAULT_ANCHOR_SIZE. The buckets take 28 bytes each
+ * whatever the number of nodes, and lookups take a little longer the more of them have
+ * no node.
+ *
+ * @returns HASH_RING_OK if the size was set, or HASH_RING_ERR if the ring already has
+ * nodes or size is 0 or greater than HASH_RING_MAX_ANCHOR_SIZE.
+ */
+int hash_ring_set_anchor_size(hash_ring_t *ring, uint32_t size);
+
+/**
+ * Keeps a table of the first width distinct nodes clockwise from every item, so that
+ * hash_ring_find_nodes for up to width nodes is one search and a copy instead of a walk
+ * around the ring. The table takes width * 4 bytes per item. It is kept up to date as
+ * nodes are added, removed and weighted, only rewriting the items whose nodes change,
+ * so it suits frozen rings with replica sets of a few nodes. A width of 0 drops the
+ * table. The modes without items don't use it.
+ *
+ * @returns HASH_RING_OK if the table was built or dropped, or HASH_RING_ERR if width is
+ * greater than HASH_RING_MAX_SUCCESSORS or memory couldn't be allocated.
+ */
+int hash_ring_set_successors(hash_ring_t *ring, uint32_t width);
+
+/**
+ * A ring shared between threads. Readers look up keys without taking locks, writers
+ * change a copy of the ring and publish it in place of the current one.
+ *
+ * A reader registers once with hash_ring_shared_register, then brackets each use of the
+ * ring with hash_ring_shared_read_begin and hash_ring_shared_read_end. The ring and the
+ * nodes found in it stay valid until hash_ring_shared_read_end, even if a writer publishes
+ * a new ring in the meantime, and must not be changed.
+ *
+ * A writer calls hash_ring_shared_write_begin for a private copy of the current ring,
+ * changes it and passes it to hash_ring_shared_publish. Writers take turns.
+ *
+ * Replaced rings are freed by later writers once every reader that might still be using
+ * them has called hash_ring_shared_read_end (epoch based reclamation).
+ */
+typedef struct hash_ring_shared_t hash_ring_shared_t;
+
+/**
+ * Shares ring between threads, the shared ring takes ownership of it. Up to maxReaders
+ * threads may be registered as readers at once.
+ *
+ * @returns the shared ring, or NULL if ring is NULL, maxReaders is 0 or memory couldn't
+ * be allocated.
+ */
+hash_ring_shared_t *hash_ring_shared_create(hash_ring_t *ring, uint32_t maxReaders);
+
+/**
+ * Frees the shared ring and every ring it holds. No thread may be reading or writing.
+ */
+void hash_ring_shared_free(hash_ring_shared_t *shared);
+
+/**
+ * Registers the calling thread as a reader.
+ *
+ * @returns the reader's id, or HASH_RING_ERR if maxReaders readers are already registered.
+ */
+int hash_ring_shared_register(hash_ring_shared_t *shared);
+
+/**
+ * Gives back a reader id from hash_ring_shared_register. The reader must not be reading.
+ */
+void hash_ring_shared_unregister(hash_ring_shared_t *shared, int reader);
+
+/**
+ * Starts a read and returns the current ring. This is a store and a load, it never
+ * blocks. Reads by the same reader can't be nested.
+ */
+hash_ring_t *hash_ring_shared_read_begin(hash_ring_shared_t *shared, int reader);
+
+/**
+ * Ends a read, after which the ring from hash_ring_shared_read_begin may be freed.
+ */
+void hash_ring_shared_read_end(hash_ring_shared_t *shared, int reader);
+
+/**
+ * Waits for other writers to finish and returns a copy of the current ring to change.
+ * The copy must be passed to hash_ring_shared_publish or hash_ring_shared_abort.
+ *
+ * @returns the copy, or NULL if memory couldn't be allocated, in which case there is
+ * nothing to publish or abort.
+ */
+hash_ring_t *hash_ring_shared_write_begin(hash_ring_shared_t *shared);
+
+/**
+ * Replaces the current ring with ring, which must come from hash_ring_shared_write_begin,
+ * and frees the replaced rings that are no longer being read.
+ *
+ * @returns HASH_RING_OK if ring was published. HASH_RING_ERR if memory couldn't be
+ * allocated, in which case ring is freed and the current ring stays.
+ */
+int hash_ring_shared_publish(hash_ring_shared_t *shared, hash_ring_t *ring);
+
+/**
+ * Abandons a write, freeing ring, which must come from hash_ring_shared_write_begin.
+ */
+void hash_ring_shared_abort(hash_ring_shared_t *shared, hash_ring_t *ring);
+
+/**
+ * Frees the replaced rings that are no longer being read and returns how many are still
+ * waiting for readers. Waits for writers like hash_ring_shared_write_begin, so it must
+ * not be called during a write.
+ */
+uint32_t hash_ring_shared_pending(hash_ring_shared_t *shared);
+
 #endif
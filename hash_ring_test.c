@@ -19,11 +19,26 @@
 #include <string.h>
 #include <assert.h>
 #include <stdlib.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <pthread.h>
 
 #include "hash_ring.h"
+#include "search.h"
+#include "xxhash.h"
+#include "murmur3.h"
+#include "crc32c.h"
+#include "cpu.h"
+#include "md5.h"
+#include "sha1.h"
+#include "sort.h"
+#include "arena.h"
+#include "rendezvous.h"
 
 #ifdef __APPLE__
 #include <mach/mach_time.h>
+#else
+#include <time.h>
 #endif
 
 static uint64_t opStartTime = 0;
@@ -36,7 +51,55 @@ void testKnownNextHighestItemOnRing();
 void testKnownSlotsOnRing();
 void testKnownMultipleSlotsOnRing();
 void testRingSorted();
+void testFrozenRing();
+void testSearchKernels();
+void testPrefixIndex();
+void testBatchLookup();
+void testHashFunctions();
+void testMultiBufferHashes();
+void testSHA1Implementations();
+void testShortHashes();
+void testNodeTable();
+void testBulkAdd();
+void testIncrementalUpdates();
+void testSort();
+void testParallelBuild();
+void testSharedRing();
+void testArena();
+void testCompactLayouts();
+void testWeightedNodes();
+void testBoundedLoads();
+void testJumpMode();
+void testMaglevMode();
+void testRendezvousKernels();
+void testRendezvousMode();
+void testMultiProbeMode();
+void testAnchorMode();
+void testAnchorChurn();
+void testSuccessorTable();
 void runBenchmark();
+void runSearchBenchmark();
+void runSearchKernelBenchmark();
+void runBatchBenchmark();
+void runHashBenchmark();
+void runMultiBufferHashBenchmark();
+void runSHA1Benchmark();
+void runShortHashBenchmark();
+void runNodeBenchmark();
+void runBuildBenchmark();
+void runChurnBenchmark();
+void runSortBenchmark();
+void runThreadBenchmark();
+void runSharedBenchmark();
+void runArenaBenchmark();
+void runLayoutBenchmark();
+void runBoundedLoadBenchmark();
+void runJumpBenchmark();
+void runMaglevBenchmark();
+void runRendezvousBenchmark();
+void runMultiProbeBenchmark();
+void runAnchorBenchmark();
+void runSuccessorBenchmark();
 void testLibmemcachedCompat();
 
 void startTiming();
@@ -52,8 +115,56 @@ int main(int argc, char **argv) {
     testEmptyRingSearchReturnsNull();
     testKnownSlotsOnRing();
     testKnownMultipleSlotsOnRing();
+    testFrozenRing();
+    testSearchKernels();
+    testPrefixIndex();
+    testBatchLookup();
+    testHashFunctions();
+    testMultiBufferHashes();
+    testSHA1Implementations();
+    testShortHashes();
+    testNodeTable();
+    testBulkAdd();
+    testIncrementalUpdates();
+    testSort();
+    testParallelBuild();
+    testSharedRing();
+    testArena();
+    testCompactLayouts();
+    testWeightedNodes();
+    testBoundedLoads();
+    testJumpMode();
+    testMaglevMode();
+    testRendezvousKernels();
+    testRendezvousMode();
+    testMultiProbeMode();
+    testAnchorMode();
+    testAnchorChurn();
+    testSuccessorTable();
     
     runBenchmark();
+    runSearchBenchmark();
+    runSearchKernelBenchmark();
+    runBatchBenchmark();
+    runHashBenchmark();
+    runMultiBufferHashBenchmark();
+    runSHA1Benchmark();
+    runShortHashBenchmark();
+    runNodeBenchmark();
+    runBuildBenchmark();
+    runChurnBenchmark();
+    runSortBenchmark();
+    runThreadBenchmark();
+    runSharedBenchmark();
+    runArenaBenchmark();
+    runLayoutBenchmark();
+    runBoundedLoadBenchmark();
+    runJumpBenchmark();
+    runMaglevBenchmark();
+    runRendezvousBenchmark();
+    runMultiProbeBenchmark();
+    runAnchorBenchmark();
+    runSuccessorBenchmark();
     
     return 0;
 }
@@ -61,6 +172,10 @@ int main(int argc, char **argv) {
 void startTiming() {
 #ifdef __APPLE__
     opStartTime = mach_absolute_time();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    opStartTime = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
 #endif
 }
 
@@ -78,7 +193,9 @@ uint64_t endTiming() {
     
     return duration;
 #else
-    return 0;
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec) - opStartTime;
 #endif
 }
 
@@ -89,6 +206,34 @@ void fillRandomBytes(uint8_t *bytes, uint32_t num) {
     }
 }
 
+/**
+ * MD5 through md5_init, md5_append and md5_finish, as digest words.
+ */
+void streamingMD5(const uint8_t *data, uint32_t len, md5_word_t abcd[4]) {
+    md5_state_t state;
+    md5_byte_t digest[16];
+    int x;
+
+    md5_init(&state);
+    md5_append(&state, data, len);
+    md5_finish(&state, digest);
+    for(x = 0; x < 4; x++) {
+        abcd[x] = digest[x * 4] | digest[x * 4 + 1] << 8 | digest[x * 4 + 2] << 16 | (md5_word_t)digest[x * 4 + 3] << 24;
+    }
+}
+
+/**
+ * SHA1 through SHA1Reset, SHA1Input and SHA1Result.
+ */
+void streamingSHA1(const uint8_t *data, uint32_t len, unsigned digest[5]) {
+    SHA1Context context;
+
+    SHA1Reset(&context);
+    SHA1Input(&context, data, len);
+    assert(SHA1Result(&context) == 1);
+    memcpy(digest, context.Message_Digest, sizeof(context.Message_Digest));
+}
+
 void addNodes(hash_ring_t *ring, int numNodes) {
     int x;
     uint8_t nodeName[16];
@@ -114,10 +259,19 @@ void generateKeys(uint8_t *keys, int numKeys, int keySize) {
     printf("done\n");
 }
 
+char *hashFunctionName(HASH_FUNCTION hash_fn) {
+    switch(hash_fn) {
+        case HASH_FUNCTION_MD5: return "MD5";
+        case HASH_FUNCTION_SHA1: return "SHA1";
+        case HASH_FUNCTION_XXH3: return "XXH3";
+        case HASH_FUNCTION_MURMUR3: return "MURMUR3";
+        case HASH_FUNCTION_CRC32C: return "CRC32C";
+    }
+    return NULL;
+}
+
 void runBench(HASH_FUNCTION hash_fn, int numReplicas, int numNodes, int numKeys, int keySize) {
-    char *hash = NULL;
-    if(hash_fn == HASH_FUNCTION_MD5) hash = "MD5";
-    else if(hash_fn == HASH_FUNCTION_SHA1) hash = "SHA1";
+    char *hash = hashFunctionName(hash_fn);
     
     printf("----------------------------------------------------\n");
     printf("bench (%s): replicas = %d, nodes = %d, keys: %d, ring size: %d\n", hash, numReplicas, numNodes, numKeys, numReplicas * numNodes);
@@ -192,236 +346,3944 @@ void runBenchmark() {
     runBench(hash_fn, 2048, 128, 1000, 16);
 }
 
-void testRingSorting(int num) {
-    printf("Test that the ring is sorted [%d item(s)]...\n", num);
-    hash_ring_t *ring = hash_ring_create(num, HASH_FUNCTION_SHA1);
-    char *slotA = "slotA";
-    
-    assert(hash_ring_add_node(ring, (uint8_t*)slotA, strlen(slotA)) == HASH_RING_OK);
-    int x;
-    uint64_t cur = 0;
-    for(x = 0; x < ring->numItems; x++) {
-        assert(ring->items[x]->number > cur);
-        cur = ring->items[x]->number;
+/**
+ * Lookups per second for each hash function at several key lengths, on a ring
+ * small enough that the cost of hashing the key dominates.
+ */
+void runHashBenchmark() {
+    HASH_FUNCTION hashFunctions[] = {HASH_FUNCTION_SHA1, HASH_FUNCTION_MD5, HASH_FUNCTION_XXH3,
+        HASH_FUNCTION_MURMUR3, HASH_FUNCTION_CRC32C};
+    int keySizes[] = {8, 16, 64, 256};
+    int numKeys = 10000;
+    int times = 20;
+    int x, y, f, k;
+
+    printf("----------------------------------------------------\n");
+    printf("hash function bench: replicas = 128, nodes = 16, keys: %d\n", numKeys);
+    printf("----------------------------------------------------\n");
+
+    uint8_t *keys = (uint8_t*)malloc(256 * numKeys);
+    fillRandomBytes(keys, 256 * numKeys);
+
+    for(f = 0; f < sizeof(hashFunctions) / sizeof(hashFunctions[0]); f++) {
+        hash_ring_t *ring = hash_ring_create(128, hashFunctions[f]);
+        addNodes(ring, 16);
+
+        printf("%-8s", hashFunctionName(hashFunctions[f]));
+        for(k = 0; k < sizeof(keySizes) / sizeof(keySizes[0]); k++) {
+            uint64_t total = 0;
+            for(y = 0; y < times; y++) {
+                startTiming();
+                for(x = 0; x < numKeys; x++) {
+                    assert(hash_ring_find_node(ring, keys + (256 * x), keySizes[k]) != NULL);
+                }
+                total += endTiming();
+            }
+            printf("  %3dB: %10.0f lookups/sec", keySizes[k],
+                (double)numKeys * times * 1000000000 / (double)total);
+        }
+        printf("\n");
+
+        hash_ring_free(ring);
     }
-    
-    hash_ring_free(ring);
-}
 
-void testRingSorted() {
-    testRingSorting(1);
-    testRingSorting(2);
-    testRingSorting(3);
-    testRingSorting(5);
-    testRingSorting(64);
-    testRingSorting(256);
-    testRingSorting(1024);
-    testRingSorting(10000);
-    testRingSorting(100000);
-    testRingSorting(1000000);
+    free(keys);
 }
 
-void testEmptyRingItemSearchReturnsNull() {
-    printf("Test empty ring search returns null item...\n");
-    hash_ring_t *ring = hash_ring_create(8, HASH_FUNCTION_SHA1);
-    
-    assert(hash_ring_find_next_highest_item(ring, 0) == NULL);
-    
-    hash_ring_free(ring);
-}
+/**
+ * Time per message for the multi-buffer MD5 and SHA1 kernels, and the time to add a node
+ * with 1024 replicas, which hashes the replicas with the best kernel.
+ */
+void runMultiBufferHashBenchmark() {
+    uint32_t features = cpu_features();
+    int numMessages = 64;
+    int times = 20000;
+    int x, y, len;
+    uint8_t *messages = (uint8_t*)malloc(256 * numMessages);
+    const uint8_t *data[64];
+    unsigned int lens[64];
+    md5_word_t md5Digests[64][4];
+    unsigned sha1Digests[64][5];
+    int lengths[] = {16, 24, 64};
 
-void testEmptyRingSearchReturnsNull() {
-    printf("Test empty ring search returns null node...\n");
-    hash_ring_t *ring = hash_ring_create(8, HASH_FUNCTION_SHA1);
-    char *key = "key";
-    assert(hash_ring_find_node(ring, (uint8_t*)key, strlen(key)) == NULL);
-    
-    hash_ring_free(ring);
-}
+    printf("----------------------------------------------------\n");
+    printf("multi-buffer hash bench: %d messages per call\n", numMessages);
+    printf("----------------------------------------------------\n");
 
-void testKnownSlotsOnRing() {
-    printf("Test getting known nodes on ring...\n");
-    hash_ring_t *ring = hash_ring_create(8, HASH_FUNCTION_SHA1);
-    char *slotA = "slotA";
-    char *slotB = "slotB";
-    
-    char *keyA = "keyA";
-    char *keyB = "keyBBBB";
-    char *keyC = "keyB_";
-    
-    hash_ring_node_t *node;
-    
-    assert(hash_ring_add_node(ring, (uint8_t*)slotA, strlen(slotA)) == HASH_RING_OK);
-    assert(hash_ring_add_node(ring, (uint8_t*)slotB, strlen(slotB)) == HASH_RING_OK);
-    
-    node = hash_ring_find_node(ring, (uint8_t*)keyA, strlen(keyA));
-    assert(node != NULL && node->nameLen == strlen(slotA) && memcmp(node->name, slotA, strlen(slotA)) == 0);
-    
-    node = hash_ring_find_node(ring, (uint8_t*)keyB, strlen(keyB));
-    assert(node != NULL && node->nameLen == strlen(slotA) && memcmp(node->name, slotA, strlen(slotA)) == 0);
-    
-    node = hash_ring_find_node(ring, (uint8_t*)keyC, strlen(keyC));
-    assert(node != NULL && node->nameLen == strlen(slotB) && memcmp(node->name, slotB, strlen(slotB)) == 0);
+    fillRandomBytes(messages, 256 * numMessages);
+    for(len = 0; len < sizeof(lengths) / sizeof(lengths[0]); len++) {
+        for(x = 0; x < numMessages; x++) {
+            data[x] = messages + 256 * x;
+            lens[x] = lengths[len];
+        }
 
-    hash_ring_free(ring);
+        for(x = 0; x < 3; x++) {
+            if(x == 1 && !(features & CPU_AVX2)) continue;
+            if(x == 2 && !(features & CPU_AVX512F)) continue;
+            char *name = x == 0 ? "scalar" : (x == 1 ? "avx2" : "avx512");
+
+            startTiming();
+            for(y = 0; y < times; y++) {
+                if(x == 0) md5_multi_scalar(data, lens, numMessages, md5Digests);
+                else if(x == 1) md5_multi_avx2(data, lens, numMessages, md5Digests);
+                else md5_multi_avx512(data, lens, numMessages, md5Digests);
+            }
+            uint64_t md5Time = endTiming();
+
+            startTiming();
+            for(y = 0; y < times; y++) {
+                if(x == 0) SHA1MultiScalar(data, lens, numMessages, sha1Digests);
+                else if(x == 1) SHA1MultiAVX2(data, lens, numMessages, sha1Digests);
+                else SHA1MultiAVX512(data, lens, numMessages, sha1Digests);
+            }
+            uint64_t sha1Time = endTiming();
+
+            printf("%3dB %-7s MD5: %6.1fns/message, SHA1: %6.1fns/message\n", lengths[len], name,
+                (double)md5Time / (times * numMessages), (double)sha1Time / (times * numMessages));
+        }
+    }
+    free(messages);
+
+    HASH_FUNCTION hashFunctions[] = {HASH_FUNCTION_MD5, HASH_FUNCTION_SHA1};
+    for(x = 0; x < 2; x++) {
+        uint8_t name[16];
+        uint64_t total = 0;
+        for(y = 0; y < 256; y++) {
+            hash_ring_t *ring = hash_ring_create(1024, hashFunctions[x]);
+            fillRandomBytes(name, sizeof(name));
+            startTiming();
+            hash_ring_add_node(ring, name, sizeof(name));
+            total += endTiming();
+            hash_ring_free(ring);
+        }
+        printf("add_node (%s), 1024 replicas: %.2fus/node\n", hashFunctionName(hashFunctions[x]),
+            (double)total / 256 / 1000);
+    }
 }
 
-void testKnownMultipleSlotsOnRing() {
-    printf("\n\nTest getting multiple known nodes on ring...\n\n");
+/**
+ * HASH_FUNCTION_SHA1 lookups/sec and ring build time with each SHA-1 block implementation.
+ */
+void runSHA1Benchmark() {
+    int impl, x, y;
+    int numKeys = 10000;
+    int times = 20;
+    int defaultImpl = SHA1GetImplementation();
+    uint8_t *keys = (uint8_t*)malloc(64 * numKeys);
+    fillRandomBytes(keys, 64 * numKeys);
 
-    hash_ring_t *ring = hash_ring_create(8, HASH_FUNCTION_SHA1);
-    char *slotA = "slotA";
-    char *slotB = "slotB";
-    char *slotC = "slotC";
+    printf("----------------------------------------------------\n");
+    printf("SHA1 bench: replicas = 128, nodes = 16, keys: %d, default: %s\n", numKeys,
+        SHA1ImplementationName(defaultImpl));
+    printf("----------------------------------------------------\n");
 
-    // hashes to a low number
-    char *keyA = "keyA";
-    // hashes to high number
-    char *keyB = "keyB*_*_*_";
+    for(impl = 0; impl < SHA1_NUM_IMPLEMENTATIONS; impl++) {
+        if(SHA1SetImplementation(impl) != 0) continue;
 
-    int x;
-    hash_ring_node_t *nodes[3];
+        uint8_t name[16];
+        startTiming();
+        hash_ring_t *ring = hash_ring_create(128, HASH_FUNCTION_SHA1);
+        for(x = 0; x < 16; x++) {
+            fillRandomBytes(name, sizeof(name));
+            assert(hash_ring_add_node(ring, name, sizeof(name)) == HASH_RING_OK);
+        }
+        uint64_t buildTime = endTiming();
 
-    assert(hash_ring_add_node(ring, (uint8_t*)slotA, strlen(slotA)) == HASH_RING_OK);
-    assert(hash_ring_add_node(ring, (uint8_t*)slotB, strlen(slotB)) == HASH_RING_OK);
+        printf("%-9s build: %7.1fus", SHA1ImplementationName(impl), (double)buildTime / 1000);
+        int keySizes[] = {16, 64};
+        for(y = 0; y < 2; y++) {
+            uint64_t total = 0;
+            int t;
+            for(t = 0; t < times; t++) {
+                startTiming();
+                for(x = 0; x < numKeys; x++) {
+                    assert(hash_ring_find_node(ring, keys + (64 * x), keySizes[y]) != NULL);
+                }
+                total += endTiming();
+            }
+            printf("  %2dB: %9.0f lookups/sec", keySizes[y], (double)numKeys * times * 1000000000 / (double)total);
+        }
+        printf("\n");
+        hash_ring_free(ring);
+    }
 
-    x = hash_ring_find_nodes(ring, (uint8_t*)keyA, strlen(keyA), nodes, 3);
-    assert(
-        x == 2 &&
-        nodes[0] != NULL &&
-            nodes[0]->nameLen == strlen(slotA) &&
-            memcmp(nodes[0]->name, slotA, strlen(slotA)) == 0 &&
-        nodes[1] != NULL &&
-            nodes[1]->nameLen == strlen(slotB) &&
-            memcmp(nodes[1]->name, slotB, strlen(slotB)) == 0);
+    SHA1SetImplementation(defaultImpl);
+    free(keys);
+}
 
-    x = hash_ring_find_nodes(ring, (uint8_t*)keyB, strlen(keyB), nodes, 3);
-    assert(
-        x == 2 &&
-        nodes[0] != NULL &&
-            nodes[0]->nameLen == strlen(slotB) &&
-            memcmp(nodes[0]->name, slotB, strlen(slotB)) == 0 &&
-        nodes[1] != NULL &&
-            nodes[1]->nameLen == strlen(slotA) &&
-            memcmp(nodes[1]->name, slotA, strlen(slotA)) == 0);
+/**
+ * The streaming MD5 and SHA1 interfaces against the single block md5_hash and SHA1Hash
+ * for short keys, and the MD5 and SHA1 lookup rates that result.
+ */
+void runShortHashBenchmark() {
+    int lengths[] = {8, 16, 32, 55};
+    int times = 1000000;
+    int x, y;
+    uint8_t data[64];
+    md5_word_t abcd[4];
+    unsigned digest[5];
 
-    assert(hash_ring_add_node(ring, (uint8_t*)slotC, strlen(slotC)) == HASH_RING_OK);
+    printf("----------------------------------------------------\n");
+    printf("short key hash bench\n");
+    printf("----------------------------------------------------\n");
 
-    x = hash_ring_find_nodes(ring, (uint8_t*)keyA, strlen(keyA), nodes, 3);
-    assert(
-        x == 3 &&
-        nodes[0] != NULL &&
-            nodes[0]->nameLen == strlen(slotC) &&
-            memcmp(nodes[0]->name, slotC, strlen(slotC)) == 0 &&
-        nodes[1] != NULL &&
-            nodes[1]->nameLen == strlen(slotA) &&
-            memcmp(nodes[1]->name, slotA, strlen(slotA)) == 0 &&
-        nodes[2] != NULL &&
-            nodes[2]->nameLen == strlen(slotB) &&
-            memcmp(nodes[2]->name, slotB, strlen(slotB)) == 0);
+    fillRandomBytes(data, sizeof(data));
+    for(x = 0; x < sizeof(lengths) / sizeof(lengths[0]); x++) {
+        uint64_t results[4];
 
-    x = hash_ring_find_nodes(ring, (uint8_t*)keyB, strlen(keyB), nodes, 3);
-    assert(
-        x == 3 &&
-        nodes[0] != NULL &&
-            nodes[0]->nameLen == strlen(slotC) &&
-            memcmp(nodes[0]->name, slotC, strlen(slotC)) == 0 &&
-        nodes[1] != NULL &&
-            nodes[1]->nameLen == strlen(slotB) &&
-            memcmp(nodes[1]->name, slotB, strlen(slotB)) == 0 &&
-        nodes[2] != NULL &&
-            nodes[2]->nameLen == strlen(slotA) &&
-            memcmp(nodes[2]->name, slotA, strlen(slotA)) == 0);
+        startTiming();
+        for(y = 0; y < times; y++) {
+            data[0] = y;
+            streamingMD5(data, lengths[x], abcd);
+        }
+        results[0] = endTiming();
+        startTiming();
+        for(y = 0; y < times; y++) {
+            data[0] = y;
+            md5_hash(data, lengths[x], abcd);
+        }
+        results[1] = endTiming();
+        startTiming();
+        for(y = 0; y < times; y++) {
+            data[0] = y;
+            streamingSHA1(data, lengths[x], digest);
+        }
+        results[2] = endTiming();
+        startTiming();
+        for(y = 0; y < times; y++) {
+            data[0] = y;
+            SHA1Hash(data, lengths[x], digest);
+        }
+        results[3] = endTiming();
 
-    hash_ring_free(ring);
+        printf("%2dB MD5: streaming %6.1fns, single block %6.1fns (%.2fx)  "
+            "SHA1: streaming %6.1fns, single block %6.1fns (%.2fx)\n", lengths[x],
+            (double)results[0] / times, (double)results[1] / times, (double)results[0] / results[1],
+            (double)results[2] / times, (double)results[3] / times, (double)results[2] / results[3]);
+    }
 }
 
-void testKnownNextHighestItemOnRing() {
-    printf("Test getting next highest item on ring...\n");
-    hash_ring_t *ring = hash_ring_create(8, HASH_FUNCTION_SHA1);
-    char *slotA = "slotA";
-    char *slotB = "slotB";
-    
-    assert(hash_ring_add_node(ring, (uint8_t*)slotA, strlen(slotA)) == HASH_RING_OK);
-    assert(hash_ring_add_node(ring, (uint8_t*)slotB, strlen(slotB)) == HASH_RING_OK);
-    
-    // next highest for first item should yield the second
-    assert(hash_ring_find_next_highest_item(ring, 2351641940735260693u)->number == 2584980261350711786u);
-    
-    // number less than the first should yield the first
-    assert(hash_ring_find_next_highest_item(ring, 2351641940735260692u)->number == 2351641940735260693u);
-    
-    // number in the middle should yield the next
-    assert(hash_ring_find_next_highest_item(ring, 5908063426886290069u)->number == 6065789416862870789u);
-    
-    // number equal to the last should wrap around to the first
-    assert(hash_ring_find_next_highest_item(ring, 17675051572751928939u)->number == 2351641940735260693u);
-    
-    hash_ring_free(ring);
-}
+/* A number and the node it belongs to, sorted with qsort to check and time sort_pairs */
+typedef struct sortEntry {
+    uint64_t number;
+    uint32_t node;
+} sortEntry;
 
-void testRemoveNode() {
-    printf("Test removing a node...\n");
-    hash_ring_t *ring = hash_ring_create(1, HASH_FUNCTION_SHA1);
-    hash_ring_node_t *node;
-    char *mynode = "mynode";
-    char *mynode1 = "mynode1";
-    char *mynode2 = "mynode2";
-    char *mykey = "mykey";
-    
-    
-    assert(hash_ring_add_node(ring, (uint8_t*)mynode, strlen(mynode)) == HASH_RING_OK);
-    assert(hash_ring_add_node(ring, (uint8_t*)mynode1, strlen(mynode2)) == HASH_RING_OK);
-    assert(hash_ring_add_node(ring, (uint8_t*)mynode2, strlen(mynode2)) == HASH_RING_OK);
-    assert(ring->numNodes == 3);
-    
-    node = hash_ring_find_node(ring, (uint8_t*)mykey, strlen(mykey));
-    assert(node != NULL && node->nameLen == strlen(mynode) && memcmp(mynode, node->name, node->nameLen) == 0);
-    
-    assert(hash_ring_remove_node(ring, (uint8_t*)mynode, strlen(mynode)) == HASH_RING_OK);
-    assert(ring->numNodes == 2);
-    
-    assert(hash_ring_get_node(ring, (uint8_t*)mynode, strlen(mynode)) == NULL);
-    
-    // remove node1, and try to search for a key that went to it before, and verify it goes to node2
-    assert(hash_ring_remove_node(ring, (uint8_t*)mynode1, strlen(mynode1)) == HASH_RING_OK);
-    assert(ring->numNodes == 1);
-    
-    node = hash_ring_find_node(ring, (uint8_t*)mykey, strlen(mykey));
-    assert(node != NULL && node->nameLen == strlen(mynode2) && memcmp(mynode2, node->name, node->nameLen) == 0);
-    
-    hash_ring_free(ring);
+int compareEntries(const void *a, const void *b) {
+    const sortEntry *entryA = (const sortEntry*)a, *entryB = (const sortEntry*)b;
+    return entryA->number < entryB->number ? -1 : (entryA->number > entryB->number ? 1 : 0);
 }
 
-void testAddMultipleTimes() {
-    printf("Test adding a node multiple times...\n");
-    hash_ring_t *ring = hash_ring_create(1, HASH_FUNCTION_SHA1);
-    assert(ring != NULL);
-    char *mynode = "mynode";
-    hash_ring_add_node(ring, (uint8_t*)mynode, strlen(mynode));
+/* Orders entries with the same number by node, which is what a stable sort gives when node is the original position */
+int compareEntriesStable(const void *a, const void *b) {
+    const sortEntry *entryA = (const sortEntry*)a, *entryB = (const sortEntry*)b;
+    int result = compareEntries(a, b);
+    return result != 0 ? result : (entryA->node < entryB->node ? -1 : (entryA->node > entryB->node ? 1 : 0));
+}
 
-    assert(ring->numNodes == 1);
-    
-    assert(hash_ring_add_node(ring, (uint8_t*)mynode, strlen(mynode)) == HASH_RING_ERR);
-    assert(ring->numNodes == 1);
-    
-    hash_ring_free(ring);
+/**
+ * Fills numbers with random numbers of the given kind: 0 for any 64 bit number, 1 for
+ * numbers from a small set so that there are many repeats, and 2 for numbers whose low
+ * 32 bits are 0, like the ones HASH_FUNCTION_CRC32C puts on the ring.
+ */
+void fillSortNumbers(uint64_t *numbers, uint32_t numItems, int kind) {
+    uint32_t x;
+    for(x = 0; x < numItems; x++) {
+        uint64_t number = ((uint64_t)rand() << 62) ^ ((uint64_t)rand() << 31) ^ (uint64_t)rand();
+        if(kind == 1) number %= 7;
+        if(kind == 2) number <<= 32;
+        numbers[x] = number;
+    }
 }
 
-void testLibmemcachedCompat() {
-    printf("Testing libmemcached compatibility mode..\n");
+/* Lookups done by a reader thread of testSharedRing or runSharedBenchmark */
+typedef struct sharedReader {
+    hash_ring_shared_t *shared;
+    pthread_rwlock_t *lock;
+    hash_ring_t *ring;
+    uint8_t *keys;
+    int numKeys;
+    int numLookups;
+    volatile int *done;
+    uint64_t found;
+} sharedReader;
 
-    // make sure the mode can't be set to libmemcached if the function is not md5
-    hash_ring_t *ring = hash_ring_create(1, HASH_FUNCTION_SHA1);
+#define SHARED_KEY_SIZE 16
+
+void *sharedReaderMain(void *arg) {
+    sharedReader *reader = (sharedReader*)arg;
+    int id = hash_ring_shared_register(reader->shared);
+    int x;
+    assert(id >= 0);
+
+    for(x = 0; x < reader->numLookups; x++) {
+        hash_ring_t *ring = hash_ring_shared_read_begin(reader->shared, id);
+        hash_ring_node_t *node = hash_ring_find_node(ring,
+            reader->keys + (x % reader->numKeys) * SHARED_KEY_SIZE, SHARED_KEY_SIZE);
+        // The node belongs to the ring read, whatever the writer has done since
+        assert(node != NULL && ring->nodeTable[node->index] == node);
+        reader->found += node->nameLen;
+        hash_ring_shared_read_end(reader->shared, id);
+    }
+
+    hash_ring_shared_unregister(reader->shared, id);
+    return NULL;
+}
+
+void *lockedReaderMain(void *arg) {
+    sharedReader *reader = (sharedReader*)arg;
+    int x;
+
+    for(x = 0; x < reader->numLookups; x++) {
+        pthread_rwlock_rdlock(reader->lock);
+        hash_ring_node_t *node = hash_ring_find_node(reader->ring,
+            reader->keys + (x % reader->numKeys) * SHARED_KEY_SIZE, SHARED_KEY_SIZE);
+        assert(node != NULL);
+        reader->found += node->nameLen;
+        pthread_rwlock_unlock(reader->lock);
+    }
+    return NULL;
+}
+
+/**
+ * Removes and adds back nodes of a shared ring until done is set, or numChanges times
+ * if done is NULL. Returns the number of rings published.
+ */
+int churnSharedRing(hash_ring_shared_t *shared, uint8_t **names, uint32_t *nameLens, int numNodes,
+    volatile int *done, int numChanges) {
+    int x;
+    for(x = 0; done != NULL ? !*done : x < numChanges; x++) {
+        int n = (x / 2 * 7) % numNodes;
+        hash_ring_t *ring = hash_ring_shared_write_begin(shared);
+        assert(ring != NULL);
+        if(x % 2 == 0) {
+            assert(hash_ring_remove_node(ring, names[n], nameLens[n]) == HASH_RING_OK);
+        }
+        else {
+            assert(hash_ring_add_node(ring, names[n], nameLens[n]) == HASH_RING_OK);
+        }
+        assert(hash_ring_shared_publish(shared, ring) == HASH_RING_OK);
+    }
+    return x;
+}
+
+/**
+ * numNodes names of the form "<prefix>-<x>", free with freeNames.
+ */
+uint8_t **makeNames(const char *prefix, int numNodes, uint32_t **nameLens) {
+    uint8_t **names = (uint8_t**)malloc(sizeof(uint8_t*) * numNodes);
+    *nameLens = (uint32_t*)malloc(sizeof(uint32_t) * numNodes);
+    int x;
+    for(x = 0; x < numNodes; x++) {
+        names[x] = (uint8_t*)malloc(32);
+        (*nameLens)[x] = snprintf((char*)names[x], 32, "%s-%d", prefix, x);
+    }
+    return names;
+}
+
+void freeNames(uint8_t **names, uint32_t *nameLens, int numNodes) {
+    int x;
+    for(x = 0; x < numNodes; x++) {
+        free(names[x]);
+    }
+    free(names);
+    free(nameLens);
+}
+
+void runNodeBench(int numNodes, int bulk) {
+    char name[32];
+    int nameLen, x;
+
+    hash_ring_t *ring = hash_ring_create(1, HASH_FUNCTION_XXH3);
+    uint32_t *nameLens;
+    uint8_t **names = makeNames("node", numNodes, &nameLens);
+    startTiming();
+    if(bulk) {
+        assert(hash_ring_add_nodes(ring, names, nameLens, numNodes) == HASH_RING_OK);
+    }
+    else {
+        for(x = 0; x < numNodes; x++) {
+            assert(hash_ring_add_node(ring, names[x], nameLens[x]) == HASH_RING_OK);
+        }
+    }
+    uint64_t buildTime = endTiming();
+    freeNames(names, nameLens, numNodes);
+
+    startTiming();
+    for(x = 0; x < numNodes; x++) {
+        nameLen = snprintf(name, sizeof(name), "node-%d", x);
+        assert(hash_ring_get_node(ring, (uint8_t*)name, nameLen) != NULL);
+    }
+    uint64_t hitTime = endTiming();
+
+    startTiming();
+    for(x = 0; x < numNodes; x++) {
+        nameLen = snprintf(name, sizeof(name), "other-%d", x);
+        assert(hash_ring_get_node(ring, (uint8_t*)name, nameLen) == NULL);
+    }
+    uint64_t missTime = endTiming();
+
+    // Removal is linear in the ring size so only the first few thousand are timed
+    int numRemoved = numNodes < 5000 ? numNodes : 5000;
+    startTiming();
+    for(x = 0; x < numRemoved; x++) {
+        nameLen = snprintf(name, sizeof(name), "node-%d", x);
+        assert(hash_ring_remove_node(ring, (uint8_t*)name, nameLen) == HASH_RING_OK);
+    }
+    uint64_t removeTime = endTiming();
+
+    printf("nodes = %6d: build (%s) %.3fs, get_node hit %.1fns, miss %.1fns, remove_node %.2fus\n", numNodes,
+        bulk ? "bulk" : "add_node", (double)buildTime / 1000000000, (double)hitTime / numNodes, (double)missTime / numNodes,
+        (double)removeTime / numRemoved / 1000);
+    hash_ring_free(ring);
+}
+
+/**
+ * Builds rings with many nodes, one replica each, and times looking up and removing the
+ * nodes by name.
+ */
+void runNodeBenchmark() {
+    printf("----------------------------------------------------\n");
+    printf("node bench\n");
+    printf("----------------------------------------------------\n");
+
+    runNodeBench(1000, 0);
+    runNodeBench(10000, 0);
+    runNodeBench(10000, 1);
+    runNodeBench(100000, 1);
+}
+
+void runBuildBench(int numNodes, int numReplicas, int incremental) {
+    uint32_t *nameLens;
+    uint8_t **names = makeNames("server", numNodes, &nameLens);
+    int x;
+
+    uint64_t bulkTime = 0, incrementalTime = 0;
+    startTiming();
+    hash_ring_t *ring = hash_ring_create_from_nodes(names, nameLens, numNodes, numReplicas,
+        HASH_FUNCTION_MD5, HASH_RING_MODE_NORMAL);
+    bulkTime = endTiming();
+    assert(ring != NULL && ring->numItems == numNodes * numReplicas);
+    hash_ring_free(ring);
+
+    if(incremental) {
+        ring = hash_ring_create(numReplicas, HASH_FUNCTION_MD5);
+        startTiming();
+        for(x = 0; x < numNodes; x++) {
+            assert(hash_ring_add_node(ring, names[x], nameLens[x]) == HASH_RING_OK);
+        }
+        incrementalTime = endTiming();
+        hash_ring_free(ring);
+    }
+
+    printf("nodes = %5d, replicas = %3d: hash_ring_create_from_nodes %8.2fms", numNodes, numReplicas,
+        (double)bulkTime / 1000000);
+    if(incremental) {
+        printf(", hash_ring_add_node %8.2fms", (double)incrementalTime / 1000000);
+    }
+    printf("\n");
+    freeNames(names, nameLens, numNodes);
+}
+
+/**
+ * Membership changes on a ring of about a million items: removing a node and adding it back.
+ */
+void runChurnBenchmark() {
+    printf("----------------------------------------------------\n");
+    printf("churn bench\n");
+    printf("----------------------------------------------------\n");
+
+    int numNodes = 6250, numReplicas = 160, numChanges = 200, x;
+    uint32_t *nameLens;
+    uint8_t **names = makeNames("server", numNodes, &nameLens);
+    hash_ring_t *ring = hash_ring_create_from_nodes(names, nameLens, numNodes, numReplicas,
+        HASH_FUNCTION_MD5, HASH_RING_MODE_NORMAL);
+    assert(ring != NULL);
+
+    uint64_t removeTime = 0, addTime = 0;
+    for(x = 0; x < numChanges; x++) {
+        int n = (x * 7919) % numNodes;
+        startTiming();
+        assert(hash_ring_remove_node(ring, names[n], nameLens[n]) == HASH_RING_OK);
+        removeTime += endTiming();
+        startTiming();
+        assert(hash_ring_add_node(ring, names[n], nameLens[n]) == HASH_RING_OK);
+        addTime += endTiming();
+    }
+
+    printf("nodes = %d, replicas = %d, ring size: %d: remove_node %.1fus, add_node %.1fus\n",
+        numNodes, numReplicas, ring->numItems, (double)removeTime / numChanges / 1000,
+        (double)addTime / numChanges / 1000);
+
+    hash_ring_free(ring);
+    freeNames(names, nameLens, numNodes);
+}
+
+/**
+ * sort_pairs against qsort on the same random numbers and nodes.
+ */
+void runSortBenchmark() {
+    printf("----------------------------------------------------\n");
+    printf("sort bench\n");
+    printf("----------------------------------------------------\n");
+
+    uint32_t sizes[] = {10000, 1000000, 10000000};
+    int x;
+    uint32_t y;
+
+    srand(11);
+    for(x = 0; x < sizeof(sizes) / sizeof(sizes[0]); x++) {
+        uint32_t numItems = sizes[x];
+        uint64_t *numbers = (uint64_t*)malloc(sizeof(uint64_t) * numItems);
+        uint32_t *values = (uint32_t*)malloc(sizeof(uint32_t) * numItems);
+        uint64_t *tempNumbers = (uint64_t*)malloc(sizeof(uint64_t) * numItems);
+        uint32_t *tempValues = (uint32_t*)malloc(sizeof(uint32_t) * numItems);
+        sortEntry *entries = (sortEntry*)malloc(sizeof(sortEntry) * numItems);
+
+        fillSortNumbers(numbers, numItems, 0);
+        for(y = 0; y < numItems; y++) {
+            values[y] = y % 1000;
+            entries[y].number = numbers[y];
+            entries[y].node = values[y];
+        }
+
+        startTiming();
+        qsort(entries, numItems, sizeof(sortEntry), compareEntries);
+        uint64_t qsortTime = endTiming();
+
+        startTiming();
+        sort_pairs(numbers, values, numItems, tempNumbers, tempValues);
+        uint64_t radixTime = endTiming();
+
+        for(y = 0; y < numItems; y++) {
+            assert(numbers[y] == entries[y].number);
+        }
+        printf("items = %8u: qsort %9.2fms, sort_pairs %8.2fms, %.1fx\n", numItems,
+            (double)qsortTime / 1000000, (double)radixTime / 1000000, (double)qsortTime / radixTime);
+
+        free(numbers);
+        free(values);
+        free(tempNumbers);
+        free(tempValues);
+        free(entries);
+    }
+}
+
+/**
+ * Building a large MD5 ring with 1 to 32 threads.
+ */
+void runThreadBenchmark() {
+    printf("----------------------------------------------------\n");
+    printf("thread bench\n");
+    printf("----------------------------------------------------\n");
+
+    int numNodes = 10000, numReplicas = 160, x;
+    uint32_t threads[] = {1, 2, 4, 8, 16, 32};
+    uint32_t *nameLens;
+    uint8_t **names = makeNames("server", numNodes, &nameLens);
+    uint64_t serialTime = 0;
+
+    printf("nodes = %d, replicas = %d, online cpus: %ld\n", numNodes, numReplicas, sysconf(_SC_NPROCESSORS_ONLN));
+    for(x = 0; x < sizeof(threads) / sizeof(threads[0]); x++) {
+        hash_ring_t *ring = hash_ring_create(numReplicas, HASH_FUNCTION_MD5);
+        assert(hash_ring_set_threads(ring, threads[x]) == HASH_RING_OK);
+        startTiming();
+        assert(hash_ring_add_nodes(ring, names, nameLens, numNodes) == HASH_RING_OK);
+        uint64_t buildTime = endTiming();
+        if(x == 0) serialTime = buildTime;
+
+        printf("threads = %2u: %8.2fms, %.2fx\n", threads[x], (double)buildTime / 1000000,
+            (double)serialTime / buildTime);
+        hash_ring_free(ring);
+    }
+
+    freeNames(names, nameLens, numNodes);
+}
+
+void *churnSharedRingMain(void *arg) {
+    sharedReader *writer = (sharedReader*)arg;
+    uint32_t *nameLens;
+    uint8_t **names = makeNames("server", 1000, &nameLens);
+
+    writer->found = churnSharedRing(writer->shared, names, nameLens, 1000, writer->done, 0);
+    freeNames(names, nameLens, 1000);
+    return NULL;
+}
+
+void *churnLockedRingMain(void *arg) {
+    sharedReader *writer = (sharedReader*)arg;
+    uint32_t *nameLens;
+    uint8_t **names = makeNames("server", 1000, &nameLens);
+    int x;
+
+    for(x = 0; !*writer->done; x++) {
+        int n = (x / 2 * 7) % 1000;
+        pthread_rwlock_wrlock(writer->lock);
+        if(x % 2 == 0) {
+            assert(hash_ring_remove_node(writer->ring, names[n], nameLens[n]) == HASH_RING_OK);
+        }
+        else {
+            assert(hash_ring_add_node(writer->ring, names[n], nameLens[n]) == HASH_RING_OK);
+        }
+        pthread_rwlock_unlock(writer->lock);
+    }
+    writer->found = x;
+    freeNames(names, nameLens, 1000);
+    return NULL;
+}
+
+/**
+ * Lookups per second with 1 to 8 reader threads while a writer thread keeps removing and
+ * adding nodes, for a shared ring and for a ring behind a pthread_rwlock_t.
+ */
+void runSharedBenchmark() {
+    printf("----------------------------------------------------\n");
+    printf("shared ring bench\n");
+    printf("----------------------------------------------------\n");
+
+    int threadCounts[] = {1, 2, 4, 8}, numLookups = 500000, x, y, locked;
+    uint8_t *keys = (uint8_t*)malloc(10000 * SHARED_KEY_SIZE);
+    fillRandomBytes(keys, 10000 * SHARED_KEY_SIZE);
+    uint32_t *nameLens;
+    uint8_t **names = makeNames("server", 1000, &nameLens);
+
+    printf("nodes = 1000, replicas = 100, online cpus: %ld\n", sysconf(_SC_NPROCESSORS_ONLN));
+    for(locked = 0; locked < 2; locked++) {
+        for(x = 0; x < sizeof(threadCounts) / sizeof(threadCounts[0]); x++) {
+            int numThreads = threadCounts[x];
+            volatile int done = 0;
+            pthread_rwlock_t lock;
+            pthread_rwlock_init(&lock, NULL);
+
+            hash_ring_t *ring = hash_ring_create(100, HASH_FUNCTION_XXH3);
+            assert(hash_ring_add_nodes(ring, names, nameLens, 1000) == HASH_RING_OK);
+            hash_ring_shared_t *shared = locked ? NULL : hash_ring_shared_create(ring, numThreads);
+
+            sharedReader readers[9];
+            pthread_t threads[9];
+            for(y = 0; y <= numThreads; y++) {
+                memset(&readers[y], 0, sizeof(sharedReader));
+                readers[y].shared = shared;
+                readers[y].lock = &lock;
+                readers[y].ring = ring;
+                readers[y].keys = keys;
+                readers[y].numKeys = 10000;
+                readers[y].numLookups = numLookups;
+                readers[y].done = &done;
+            }
+
+            // The last one is the writer
+            startTiming();
+            for(y = 0; y < numThreads; y++) {
+                assert(pthread_create(&threads[y], NULL, locked ? lockedReaderMain : sharedReaderMain, &readers[y]) == 0);
+            }
+            assert(pthread_create(&threads[numThreads], NULL, locked ? churnLockedRingMain : churnSharedRingMain,
+                &readers[numThreads]) == 0);
+            for(y = 0; y < numThreads; y++) {
+                pthread_join(threads[y], NULL);
+            }
+            uint64_t readTime = endTiming();
+            done = 1;
+            pthread_join(threads[numThreads], NULL);
+
+            printf("%s: readers = %d, %6.2fM lookups/s, %d changes\n", locked ? "rwlock" : "shared",
+                numThreads, (double)numLookups * numThreads / readTime * 1000, (int)readers[numThreads].found);
+
+            if(shared != NULL) {
+                hash_ring_shared_free(shared);
+            }
+            else {
+                hash_ring_free(ring);
+            }
+            pthread_rwlock_destroy(&lock);
+        }
+    }
+
+    free(keys);
+    freeNames(names, nameLens, 1000);
+}
+
+/**
+ * Time to build MD5 rings with hash_ring_create_from_nodes and, where it finishes in
+ * reasonable time, one hash_ring_add_node call per node.
+ */
+void runBuildBenchmark() {
+    printf("----------------------------------------------------\n");
+    printf("build bench\n");
+    printf("----------------------------------------------------\n");
+
+    runBuildBench(100, 160, 1);
+    runBuildBench(500, 160, 1);
+    runBuildBench(2000, 160, 0);
+    runBuildBench(10000, 160, 0);
+}
+
+uint64_t randomPosition() {
+    return ((uint64_t)rand() << 62) ^ ((uint64_t)rand() << 31) ^ (uint64_t)rand();
+}
+
+/**
+ * Times hash_ring_find_next_highest_item on its own, the key hashing in runBench
+ * otherwise dominates the lookup cost.
+ */
+void runSearchBench(int numReplicas, int numNodes, int numSearches) {
+    printf("----------------------------------------------------\n");
+    printf("search bench: replicas = %d, nodes = %d, searches: %d, ring size: %d\n", numReplicas, numNodes, numSearches, numReplicas * numNodes);
+    printf("----------------------------------------------------\n");
+    hash_ring_t *ring = hash_ring_create(numReplicas, HASH_FUNCTION_MD5);
+    
+    addNodes(ring, numNodes);
+    
+    uint64_t *nums = (uint64_t*)malloc(sizeof(uint64_t) * numSearches);
+    int x;
+    for(x = 0; x < numSearches; x++) {
+        nums[x] = randomPosition();
+    }
+    
+    hash_ring_item_t item;
+    hash_ring_stats_t stats;
+    char *layouts[] = { "sorted", "indexed", "frozen" };
+    int layout;
+    for(layout = 0; layout < 3; layout++) {
+        if(layout == 0) assert(hash_ring_set_max_index_bits(ring, 0) == HASH_RING_OK);
+        if(layout == 1) assert(hash_ring_set_max_index_bits(ring, HASH_RING_DEFAULT_MAX_INDEX_BITS) == HASH_RING_OK);
+        if(layout == 2) assert(hash_ring_freeze(ring) == HASH_RING_OK);
+        
+        uint64_t sum = 0;
+        startTiming();
+        for(x = 0; x < numSearches; x++) {
+            sum += hash_ring_find_next_highest_item(ring, nums[x], &item)->number;
+        }
+        uint64_t result = endTiming();
+        
+        hash_ring_get_stats(ring, &stats);
+        printf("stats (%s): total = %.5fs, avg/search: %.1fns, searches/sec: %.0f, items: %" PRIu64 " bytes, index: %" PRIu64 " bytes, frozen: %" PRIu64 " bytes (checksum %d)\n",
+            layouts[layout],
+            (double)result / 1000000000,
+            (double)result / numSearches,
+            (double)numSearches * 1000000000 / result,
+            stats.itemBytes,
+            stats.indexBytes,
+            stats.frozenBytes,
+            (int)(sum & 0xff));
+    }
+    
+    free(nums);
+    hash_ring_free(ring);
+}
+
+void runSearchBenchmark() {
+    printf("Starting search benchmarks...\n");
+    
+    runSearchBench(128, 8, 1000000);
+    runSearchBench(128, 128, 1000000);
+    runSearchBench(128, 1024, 1000000);
+    runSearchBench(65536, 16, 1000000);
+    runSearchBench(2500000, 4, 1000000);
+}
+
+void runSearchKernelBench(int numReplicas, int numNodes, int numSearches) {
+    printf("----------------------------------------------------\n");
+    printf("search kernel bench: replicas = %d, nodes = %d, searches: %d, ring size: %d\n", numReplicas, numNodes, numSearches, numReplicas * numNodes);
+    printf("----------------------------------------------------\n");
+    hash_ring_t *ring = hash_ring_create(numReplicas, HASH_FUNCTION_MD5);
+    
+    addNodes(ring, numNodes);
+    
+    uint64_t *nums = (uint64_t*)malloc(sizeof(uint64_t) * numSearches);
+    int x;
+    for(x = 0; x < numSearches; x++) {
+        nums[x] = randomPosition();
+    }
+    
+    int kernel, defaultKernel = search_get_kernel();
+    for(kernel = 0; kernel < SEARCH_NUM_KERNELS; kernel++) {
+        if(!search_kernel_supported(kernel)) continue;
+        search_set_kernel(kernel);
+        
+        // the kernel on its own, counting a 32 item window
+        uint64_t sum = 0;
+        startTiming();
+        for(x = 0; x < numSearches; x++) {
+            switch(kernel) {
+                case SEARCH_KERNEL_SCALAR: sum += search_count_scalar(ring->items, 32, nums[x]); break;
+                case SEARCH_KERNEL_SSE42: sum += search_count_sse42(ring->items, 32, nums[x]); break;
+                case SEARCH_KERNEL_AVX2: sum += search_count_avx2(ring->items, 32, nums[x]); break;
+                case SEARCH_KERNEL_AVX512: sum += search_count_avx512(ring->items, 32, nums[x]); break;
+            }
+        }
+        uint64_t countTime = endTiming();
+        
+        startTiming();
+        for(x = 0; x < numSearches; x++) {
+            sum += search_upper_bound(ring->items, ring->numItems, nums[x]);
+        }
+        uint64_t searchTime = endTiming();
+        
+        printf("stats (%s): count 32: %.1fns, avg/search: %.1fns, searches/sec: %.0f (checksum %d)\n",
+            search_kernel_name(kernel),
+            (double)countTime / numSearches,
+            (double)searchTime / numSearches,
+            (double)numSearches * 1000000000 / searchTime,
+            (int)(sum & 0xff));
+    }
+    search_set_kernel(defaultKernel);
+    
+    free(nums);
+    hash_ring_free(ring);
+}
+
+void runSearchKernelBenchmark() {
+    printf("Starting search kernel benchmarks...\n");
+    
+    runSearchKernelBench(128, 8, 1000000);
+    runSearchKernelBench(8192, 16, 1000000);
+    runSearchKernelBench(65536, 16, 1000000);
+}
+
+void runBatchBench(int numReplicas, int numNodes, int numKeys) {
+    printf("----------------------------------------------------\n");
+    printf("batch bench: replicas = %d, nodes = %d, keys: %d, ring size: %d\n", numReplicas, numNodes, numKeys, numReplicas * numNodes);
+    printf("----------------------------------------------------\n");
+    hash_ring_t *ring = hash_ring_create(numReplicas, HASH_FUNCTION_MD5);
+    
+    addNodes(ring, numNodes);
+    
+    int keySize = 16;
+    uint8_t *keyBytes = (uint8_t*)malloc(keySize * numKeys);
+    uint8_t **keys = (uint8_t**)malloc(sizeof(uint8_t*) * numKeys);
+    uint32_t *keyLens = (uint32_t*)malloc(sizeof(uint32_t) * numKeys);
+    uint64_t *nums = (uint64_t*)malloc(sizeof(uint64_t) * numKeys);
+    hash_ring_node_t **nodes = (hash_ring_node_t**)malloc(sizeof(hash_ring_node_t*) * numKeys);
+    hash_ring_item_t item;
+    int x, y;
+    
+    for(x = 0; x < numKeys; x++) {
+        keys[x] = keyBytes + x * keySize;
+        keyLens[x] = keySize;
+        fillRandomBytes(keys[x], keySize);
+        nums[x] = randomPosition();
+    }
+    
+    char *layouts[] = { "sorted", "indexed", "frozen" };
+    int batchSizes[] = { 1, 8, 64, 1024 };
+    int layout, batch;
+    for(layout = 0; layout < 3; layout++) {
+        if(layout == 0) hash_ring_set_max_index_bits(ring, 0);
+        if(layout == 1) hash_ring_set_max_index_bits(ring, HASH_RING_DEFAULT_MAX_INDEX_BITS);
+        if(layout == 2) hash_ring_freeze(ring);
+        
+        startTiming();
+        for(x = 0; x < numKeys; x++) {
+            nodes[x] = hash_ring_find_next_highest_item(ring, nums[x], &item)->node;
+        }
+        uint64_t single = endTiming();
+        printf("stats (%s): one at a time: %.1fns/key", layouts[layout], (double)single / numKeys);
+        
+        for(batch = 0; batch < 4; batch++) {
+            startTiming();
+            for(x = 0; x < numKeys; x += batchSizes[batch]) {
+                y = numKeys - x < batchSizes[batch] ? numKeys - x : batchSizes[batch];
+                hash_ring_find_nodes_batch_hashed(ring, nums + x, y, nodes + x);
+            }
+            uint64_t result = endTiming();
+            printf(", batch %d: %.1fns/key", batchSizes[batch], (double)result / numKeys);
+        }
+        printf(" (hashed)\n");
+        
+        startTiming();
+        for(x = 0; x < numKeys; x++) {
+            nodes[x] = hash_ring_find_node(ring, keys[x], keyLens[x]);
+        }
+        single = endTiming();
+        printf("stats (%s): one at a time: %.1fns/key", layouts[layout], (double)single / numKeys);
+        
+        for(batch = 0; batch < 4; batch++) {
+            startTiming();
+            for(x = 0; x < numKeys; x += batchSizes[batch]) {
+                y = numKeys - x < batchSizes[batch] ? numKeys - x : batchSizes[batch];
+                hash_ring_find_nodes_batch(ring, keys + x, keyLens + x, y, nodes + x);
+            }
+            uint64_t result = endTiming();
+            printf(", batch %d: %.1fns/key", batchSizes[batch], (double)result / numKeys);
+        }
+        printf(" (keys)\n");
+    }
+    
+    free(keyBytes);
+    free(keys);
+    free(keyLens);
+    free(nums);
+    free(nodes);
+    hash_ring_free(ring);
+}
+
+void runBatchBenchmark() {
+    printf("Starting batch benchmarks...\n");
+    
+    runBatchBench(128, 128, 1000000);
+    runBatchBench(65536, 16, 1000000);
+}
+
+void testRingSorting(int num) {
+    printf("Test that the ring is sorted [%d item(s)]...\n", num);
+    hash_ring_t *ring = hash_ring_create(num, HASH_FUNCTION_SHA1);
+    char *slotA = "slotA";
+    
+    assert(hash_ring_add_node(ring, (uint8_t*)slotA, strlen(slotA)) == HASH_RING_OK);
+    int x;
+    uint64_t cur = 0;
+    for(x = 0; x < ring->numItems; x++) {
+        assert(ring->items[x] > cur);
+        cur = ring->items[x];
+    }
+    
+    hash_ring_free(ring);
+}
+
+void testRingSorted() {
+    testRingSorting(1);
+    testRingSorting(2);
+    testRingSorting(3);
+    testRingSorting(5);
+    testRingSorting(64);
+    testRingSorting(256);
+    testRingSorting(1024);
+    testRingSorting(10000);
+    testRingSorting(100000);
+    testRingSorting(1000000);
+}
+
+void testFrozenRingSearch(int numReplicas, int numNodes) {
+    printf("Test frozen ring search [%d replicas, %d nodes]...\n", numReplicas, numNodes);
+    hash_ring_t *ring = hash_ring_create(numReplicas, HASH_FUNCTION_SHA1);
+    hash_ring_item_t item;
+    addNodes(ring, numNodes);
+    
+    // search for every item, its neighbours, the ends of the ring and random numbers
+    int numSearches = ring->numItems * 3 + 1000 + 2;
+    uint64_t *nums = (uint64_t*)malloc(sizeof(uint64_t) * numSearches);
+    uint64_t *expected = (uint64_t*)malloc(sizeof(uint64_t) * numSearches);
+    hash_ring_node_t **expectedNodes = (hash_ring_node_t**)malloc(sizeof(hash_ring_node_t*) * numSearches);
+    int x, y = 0;
+    for(x = 0; x < ring->numItems; x++) {
+        nums[y++] = ring->items[x];
+        nums[y++] = ring->items[x] - 1;
+        nums[y++] = ring->items[x] + 1;
+    }
+    for(x = 0; x < 1000; x++) {
+        nums[y++] = randomPosition();
+    }
+    nums[y++] = 0;
+    nums[y++] = UINT64_MAX;
+    
+    for(x = 0; x < numSearches; x++) {
+        assert(hash_ring_find_next_highest_item(ring, nums[x], &item) != NULL);
+        expected[x] = item.number;
+        expectedNodes[x] = item.node;
+    }
+    
+    assert(hash_ring_freeze(ring) == HASH_RING_OK);
+    assert(ring->frozenItems != NULL);
+    for(x = 0; x < numSearches; x++) {
+        assert(hash_ring_find_next_highest_item(ring, nums[x], &item) != NULL);
+        assert(item.number == expected[x] && item.node == expectedNodes[x]);
+    }
+    
+    // rejected adds leave the ring frozen and its items alone
+    uint32_t numItems = ring->numItems;
+    hash_ring_node_t *existing = ring->nodeTable[0];
+    assert(hash_ring_add_node(ring, existing->name, existing->nameLen) == HASH_RING_ERR);
+    uint8_t *batch[] = { (uint8_t*)"new", (uint8_t*)"new" };
+    uint32_t batchLens[] = { 3, 3 };
+    assert(hash_ring_add_nodes(ring, batch, batchLens, 2) == HASH_RING_ERR);
+    batch[1] = existing->name;
+    batchLens[1] = existing->nameLen;
+    assert(hash_ring_add_nodes(ring, batch, batchLens, 2) == HASH_RING_ERR);
+    assert(ring->frozenItems != NULL && ring->numItems == numItems && ring->numNodes == numNodes);
+    assert(hash_ring_get_node(ring, (uint8_t*)"new", 3) == NULL);
+    for(x = 0; x < numSearches; x++) {
+        assert(hash_ring_find_next_highest_item(ring, nums[x], &item) != NULL);
+        assert(item.number == expected[x] && item.node == expectedNodes[x]);
+    }
+
+    // modifying the ring unfreezes it
+    char *extra = "extra";
+    assert(hash_ring_add_node(ring, (uint8_t*)extra, strlen(extra)) == HASH_RING_OK);
+    assert(ring->frozenItems == NULL);
+    
+    free(nums);
+    free(expected);
+    free(expectedNodes);
+    hash_ring_free(ring);
+}
+
+void testFrozenRing() {
+    hash_ring_t *ring = hash_ring_create(8, HASH_FUNCTION_SHA1);
+    hash_ring_item_t item;
+    assert(hash_ring_freeze(ring) == HASH_RING_OK);
+    assert(hash_ring_find_next_highest_item(ring, 0, &item) == NULL);
+    hash_ring_free(ring);
+    
+    testFrozenRingSearch(1, 1);
+    testFrozenRingSearch(1, 2);
+    testFrozenRingSearch(3, 1);
+    testFrozenRingSearch(8, 7);
+    testFrozenRingSearch(8, 8);
+    testFrozenRingSearch(8, 9);
+    testFrozenRingSearch(128, 16);
+    testFrozenRingSearch(1000, 33);
+}
+
+/**
+ * The branching binary search the ring used before the search kernels were added.
+ */
+uint32_t referenceUpperBound(const uint64_t *items, uint32_t numItems, uint64_t num) {
+    int64_t min = 0;
+    int64_t max = (int64_t)numItems - 1;
+    
+    while(min <= max) {
+        int64_t midpointIndex = (min + max) / 2;
+        if(items[midpointIndex] > num) {
+            max = midpointIndex - 1;
+        }
+        else {
+            min = midpointIndex + 1;
+        }
+    }
+    return (uint32_t)min;
+}
+
+int compareNumbers(const void *a, const void *b) {
+    uint64_t numA = *(const uint64_t*)a, numB = *(const uint64_t*)b;
+    return numA < numB ? -1 : (numA > numB ? 1 : 0);
+}
+
+int compareNumbers32(const void *a, const void *b) {
+    uint32_t numA = *(const uint32_t*)a, numB = *(const uint32_t*)b;
+    return numA < numB ? -1 : (numA > numB ? 1 : 0);
+}
+
+void testSort() {
+    printf("Test sorting ring numbers...\n");
+
+    uint32_t sizes[] = {0, 1, 2, 3, SORT_INSERTION_MAX, SORT_INSERTION_MAX + 1, 1000, 100000};
+    int x, kind;
+    uint32_t y;
+
+    srand(7);
+    for(x = 0; x < sizeof(sizes) / sizeof(sizes[0]); x++) {
+        uint32_t numItems = sizes[x];
+        uint64_t *numbers = (uint64_t*)malloc(sizeof(uint64_t) * (numItems + 1));
+        uint32_t *values = (uint32_t*)malloc(sizeof(uint32_t) * (numItems + 1));
+        uint64_t *tempNumbers = (uint64_t*)malloc(sizeof(uint64_t) * (numItems + 1));
+        uint32_t *tempValues = (uint32_t*)malloc(sizeof(uint32_t) * (numItems + 1));
+        sortEntry *entries = (sortEntry*)malloc(sizeof(sortEntry) * (numItems + 1));
+
+        for(kind = 0; kind < 3; kind++) {
+            fillSortNumbers(numbers, numItems, kind);
+            for(y = 0; y < numItems; y++) {
+                values[y] = y;
+                entries[y].number = numbers[y];
+                entries[y].node = y;
+            }
+            qsort(entries, numItems, sizeof(sortEntry), compareEntriesStable);
+
+            // With values, pairs stay together and equal numbers keep their order
+            sort_pairs(numbers, values, numItems, tempNumbers, tempValues);
+            for(y = 0; y < numItems; y++) {
+                assert(numbers[y] == entries[y].number);
+                assert(values[y] == entries[y].node);
+            }
+
+            // Without values
+            for(y = 0; y < numItems; y++) {
+                numbers[y] = entries[numItems - 1 - y].number;
+            }
+            sort_pairs(numbers, NULL, numItems, tempNumbers, NULL);
+            for(y = 0; y < numItems; y++) {
+                assert(numbers[y] == entries[y].number);
+            }
+        }
+
+        free(numbers);
+        free(values);
+        free(tempNumbers);
+        free(tempValues);
+        free(entries);
+    }
+}
+
+void testSearchKernel(int kernel) {
+    printf("Test search kernel %s...\n", search_kernel_name(kernel));
+    assert(search_set_kernel(kernel) == 0);
+    assert(search_get_kernel() == kernel);
+    
+    uint64_t items[200];
+    uint32_t numItems, x, y;
+    int round;
+    
+    // every array length up to a few windows, with and without duplicates, searched for
+    // every item, its neighbours and the ends of the number space
+    for(round = 0; round < 3; round++) {
+        for(numItems = 0; numItems <= 200; numItems++) {
+            for(x = 0; x < numItems; x++) {
+                items[x] = round == 0 ? randomPosition() : (uint64_t)(rand() % (numItems + 1));
+                if(round == 2 && x % 3 == 0) items[x] = UINT64_MAX - (rand() % 2);
+            }
+            qsort(items, numItems, sizeof(uint64_t), compareNumbers);
+            
+            for(x = 0; x < numItems * 3 + 2; x++) {
+                uint64_t num;
+                if(x == numItems * 3) num = 0;
+                else if(x == numItems * 3 + 1) num = UINT64_MAX;
+                else num = items[x / 3] + (x % 3) - 1;
+                
+                uint32_t expected = referenceUpperBound(items, numItems, num);
+                assert(search_upper_bound(items, numItems, num) == expected);
+                
+                // the kernel on its own must agree with a plain count for any window
+                for(y = 0; y <= numItems && y <= 40; y++) {
+                    uint32_t count = expected < y ? expected : y;
+                    switch(kernel) {
+                        case SEARCH_KERNEL_SCALAR: assert(search_count_scalar(items, y, num) == count); break;
+                        case SEARCH_KERNEL_SSE42: assert(search_count_sse42(items, y, num) == count); break;
+                        case SEARCH_KERNEL_AVX2: assert(search_count_avx2(items, y, num) == count); break;
+                        case SEARCH_KERNEL_AVX512: assert(search_count_avx512(items, y, num) == count); break;
+                    }
+                }
+            }
+        }
+    }
+    
+    // the same for 32-bit items, whose windows are twice as wide
+    uint32_t items32[200], indexes[200];
+    for(round = 0; round < 3; round++) {
+        for(numItems = 0; numItems <= 200; numItems++) {
+            for(x = 0; x < numItems; x++) {
+                items32[x] = round == 0 ? (uint32_t)(randomPosition() >> 32) : (uint32_t)(rand() % (numItems + 1));
+                if(round == 2 && x % 3 == 0) items32[x] = UINT32_MAX - (rand() % 2);
+            }
+            qsort(items32, numItems, sizeof(uint32_t), compareNumbers32);
+            
+            uint32_t nums32[200 * 3 + 2];
+            for(x = 0; x < numItems * 3 + 2; x++) {
+                uint32_t num;
+                if(x == numItems * 3) num = 0;
+                else if(x == numItems * 3 + 1) num = UINT32_MAX;
+                else num = items32[x / 3] + (x % 3) - 1;
+                nums32[x] = num;
+                
+                uint32_t expected = 0;
+                while(expected < numItems && items32[expected] <= num) expected++;
+                assert(search_upper_bound32(items32, numItems, num) == expected);
+                
+                for(y = 0; y <= numItems && y <= 80; y++) {
+                    uint32_t count = expected < y ? expected : y;
+                    switch(kernel) {
+                        case SEARCH_KERNEL_SCALAR: assert(search_count32_scalar(items32, y, num) == count); break;
+                        case SEARCH_KERNEL_SSE42: assert(search_count32_sse42(items32, y, num) == count); break;
+                        case SEARCH_KERNEL_AVX2: assert(search_count32_avx2(items32, y, num) == count); break;
+                        case SEARCH_KERNEL_AVX512: assert(search_count32_avx512(items32, y, num) == count); break;
+                    }
+                }
+            }
+            
+            for(x = 0; x < numItems * 3 + 2; x += 200) {
+                uint32_t numKeys = numItems * 3 + 2 - x < 200 ? numItems * 3 + 2 - x : 200;
+                search_upper_bound32_batch(items32, numItems, nums32 + x, numKeys, indexes);
+                for(y = 0; y < numKeys; y++) {
+                    assert(indexes[y] == search_upper_bound32(items32, numItems, nums32[x + y]));
+                }
+            }
+        }
+    }
+}
+
+void testSearchKernels() {
+    int kernel, defaultKernel = search_get_kernel();
+    assert(search_kernel_supported(SEARCH_KERNEL_SCALAR));
+    assert(search_set_kernel(SEARCH_NUM_KERNELS) == -1);
+    
+    for(kernel = 0; kernel < SEARCH_NUM_KERNELS; kernel++) {
+        if(search_kernel_supported(kernel)) {
+            testSearchKernel(kernel);
+        }
+        else {
+            printf("Skipping search kernel %s, not supported by this CPU\n", search_kernel_name(kernel));
+        }
+    }
+    
+    assert(search_set_kernel(defaultKernel) == 0);
+}
+
+/**
+ * Checks that searching with the prefix index gives the same items as searching without one.
+ */
+void checkPrefixIndex(hash_ring_t *ring) {
+    hash_ring_item_t item;
+    int numSearches = ring->numItems * 3 + 1000 + 2;
+    uint64_t *nums = (uint64_t*)malloc(sizeof(uint64_t) * numSearches);
+    uint64_t *expected = (uint64_t*)malloc(sizeof(uint64_t) * numSearches);
+    int x, y = 0;
+    for(x = 0; x < ring->numItems; x++) {
+        nums[y++] = ring->items[x];
+        nums[y++] = ring->items[x] - 1;
+        nums[y++] = ring->items[x] + 1;
+    }
+    for(x = 0; x < 1000; x++) {
+        nums[y++] = randomPosition();
+    }
+    nums[y++] = 0;
+    nums[y++] = UINT64_MAX;
+    
+    uint8_t maxBits = ring->maxIndexBits;
+    assert(hash_ring_set_max_index_bits(ring, 0) == HASH_RING_OK);
+    assert(ring->index == NULL);
+    for(x = 0; x < numSearches; x++) {
+        expected[x] = hash_ring_find_next_highest_item(ring, nums[x], &item)->number;
+    }
+    
+    assert(hash_ring_set_max_index_bits(ring, maxBits) == HASH_RING_OK);
+    for(x = 0; x < numSearches; x++) {
+        assert(hash_ring_find_next_highest_item(ring, nums[x], &item)->number == expected[x]);
+    }
+    
+    free(nums);
+    free(expected);
+}
+
+void testPrefixIndex() {
+    printf("Test prefix index...\n");
+    hash_ring_t *ring = hash_ring_create(32, HASH_FUNCTION_MD5);
+    hash_ring_stats_t stats;
+    char name[16];
+    int x;
+    
+    assert(hash_ring_set_max_index_bits(ring, 32) == HASH_RING_ERR);
+    
+    // rings that are too small have no index
+    assert(hash_ring_add_node(ring, (uint8_t*)"node0", 5) == HASH_RING_OK);
+    assert(ring->index == NULL);
+    assert(hash_ring_get_stats(ring, &stats) == HASH_RING_OK && stats.indexBytes == 0);
+    
+    // the index grows with the ring, and is rebuilt as nodes come and go
+    for(x = 1; x < 40; x++) {
+        snprintf(name, sizeof(name), "node%d", x);
+        assert(hash_ring_add_node(ring, (uint8_t*)name, strlen(name)) == HASH_RING_OK);
+        assert(ring->index != NULL && ring->indexBits > 0);
+        assert(ring->index[(1 << ring->indexBits)] == ring->numItems);
+        if(x % 8 == 0) checkPrefixIndex(ring);
+    }
+    assert(hash_ring_get_stats(ring, &stats) == HASH_RING_OK);
+    assert(stats.indexBytes == sizeof(uint32_t) * ((1 << ring->indexBits) + 1));
+    assert(stats.itemBytes == 12 * ring->numItems);
+    
+    for(x = 0; x < 40; x += 3) {
+        snprintf(name, sizeof(name), "node%d", x);
+        assert(hash_ring_remove_node(ring, (uint8_t*)name, strlen(name)) == HASH_RING_OK);
+        checkPrefixIndex(ring);
+    }
+    
+    // a tiny index still gives the right answers
+    assert(hash_ring_set_max_index_bits(ring, 1) == HASH_RING_OK);
+    assert(ring->indexBits == 1);
+    checkPrefixIndex(ring);
+    
+    hash_ring_free(ring);
+}
+
+void checkBatchLookup(hash_ring_t *ring, int numKeys) {
+    uint8_t *keyBytes = (uint8_t*)malloc(numKeys * 16);
+    uint8_t **keys = (uint8_t**)malloc(sizeof(uint8_t*) * numKeys);
+    uint32_t *keyLens = (uint32_t*)malloc(sizeof(uint32_t) * numKeys);
+    uint64_t *nums = (uint64_t*)malloc(sizeof(uint64_t) * numKeys);
+    hash_ring_node_t **nodes = (hash_ring_node_t**)malloc(sizeof(hash_ring_node_t*) * numKeys);
+    hash_ring_item_t item;
+    int x;
+    
+    for(x = 0; x < numKeys; x++) {
+        keyLens[x] = 1 + rand() % 16;
+        keys[x] = keyBytes + x * 16;
+        fillRandomBytes(keys[x], keyLens[x]);
+        nums[x] = x % 7 == 0 && ring->numItems > 0 ? ring->items[rand() % ring->numItems] : randomPosition();
+    }
+    nums[0] = 0;
+    if(numKeys > 1) nums[1] = UINT64_MAX;
+    
+    assert(hash_ring_find_nodes_batch(ring, keys, keyLens, numKeys, nodes) == HASH_RING_OK);
+    for(x = 0; x < numKeys; x++) {
+        assert(nodes[x] == hash_ring_find_node(ring, keys[x], keyLens[x]));
+    }
+    
+    assert(hash_ring_find_nodes_batch_hashed(ring, nums, numKeys, nodes) == HASH_RING_OK);
+    for(x = 0; x < numKeys; x++) {
+        assert(nodes[x] == hash_ring_find_next_highest_item(ring, nums[x], &item)->node);
+    }
+    
+    free(keyBytes);
+    free(keys);
+    free(keyLens);
+    free(nums);
+    free(nodes);
+}
+
+void testBatchLookup() {
+    printf("Test batch lookups...\n");
+    int sizes[][2] = { { 1, 1 }, { 3, 2 }, { 8, 8 }, { 32, 3 }, { 128, 40 }, { 1000, 17 } };
+    int x, layout;
+    
+    hash_ring_t *ring = hash_ring_create(8, HASH_FUNCTION_MD5);
+    hash_ring_node_t *node;
+    uint64_t num = 0;
+    assert(hash_ring_find_nodes_batch_hashed(ring, &num, 1, &node) == HASH_RING_ERR);
+    hash_ring_free(ring);
+    
+    for(x = 0; x < sizeof(sizes) / sizeof(sizes[0]); x++) {
+        ring = hash_ring_create(sizes[x][0], HASH_FUNCTION_MD5);
+        addNodes(ring, sizes[x][1]);
+        
+        for(layout = 0; layout < 3; layout++) {
+            if(layout == 0) hash_ring_set_max_index_bits(ring, 0);
+            if(layout == 1) hash_ring_set_max_index_bits(ring, HASH_RING_DEFAULT_MAX_INDEX_BITS);
+            if(layout == 2) hash_ring_freeze(ring);
+            
+            checkBatchLookup(ring, 1);
+            checkBatchLookup(ring, 15);
+            checkBatchLookup(ring, 16);
+            checkBatchLookup(ring, 17);
+            checkBatchLookup(ring, 1000);
+        }
+        
+        hash_ring_free(ring);
+    }
+}
+
+void testEmptyRingItemSearchReturnsNull() {
+    printf("Test empty ring search returns null item...\n");
+    hash_ring_t *ring = hash_ring_create(8, HASH_FUNCTION_SHA1);
+    
+    hash_ring_item_t item;
+    assert(hash_ring_find_next_highest_item(ring, 0, &item) == NULL);
+    
+    hash_ring_free(ring);
+}
+
+void testEmptyRingSearchReturnsNull() {
+    printf("Test empty ring search returns null node...\n");
+    hash_ring_t *ring = hash_ring_create(8, HASH_FUNCTION_SHA1);
+    char *key = "key";
+    assert(hash_ring_find_node(ring, (uint8_t*)key, strlen(key)) == NULL);
+    
+    hash_ring_free(ring);
+}
+
+void testHashFunctions() {
+    printf("Test non-cryptographic hash functions...\n");
+
+    uint8_t buf[2049];
+    int x;
+    for(x = 0; x < sizeof(buf); x++) {
+        buf[x] = (x * 7 + 3) % 251;
+    }
+
+    // reference values from XXH3_64bits()
+    assert(xxh3_64(buf, 0) == 0x2d06800538d394c2ULL);
+    assert(xxh3_64(buf, 3) == 0xa9088dda485b481cULL);
+    assert(xxh3_64(buf, 16) == 0xb8c859b0f030b585ULL);
+    assert(xxh3_64(buf, 200) == 0xa369f2930049476fULL);
+    assert(xxh3_64(buf, 300) == 0x4745d9048126a285ULL);
+    assert(xxh3_64(buf, 2049) == 0x242c61fe5ed5db14ULL);
+
+    // reference values from MurmurHash3_x64_128()
+    uint64_t out[2];
+    char *fox = "The quick brown fox jumps over the lazy dog";
+    murmur3_x64_128((uint8_t*)fox, strlen(fox), 0, out);
+    assert(out[0] == 0xe34bbc7bbc071b6cULL && out[1] == 0x7a433ca9c49a9347ULL);
+    murmur3_x64_128((uint8_t*)"hello", 5, 0, out);
+    assert(out[0] == 0xcbd8a7b341bd9b02ULL && out[1] == 0x5b1e906a48ae1d19ULL);
+    murmur3_x64_128(buf, 0, 0, out);
+    assert(out[0] == 0 && out[1] == 0);
+
+    // CRC-32C check value, the hardware and table versions must agree
+    assert(crc32c((uint8_t*)"123456789", 9) == 0xe3069283);
+    assert(crc32c_sw((uint8_t*)"123456789", 9) == 0xe3069283);
+    for(x = 0; x < sizeof(buf); x += 13) {
+        assert(crc32c(buf, x) == crc32c_sw(buf, x));
+    }
+
+    // The ring uses each function for its items. The name is longer than 255 bytes
+    // to make sure that the whole name is hashed.
+    uint8_t name[301];
+    memcpy(name, buf, 300);
+    name[300] = '0';
+
+    HASH_FUNCTION hashFunctions[] = {HASH_FUNCTION_XXH3, HASH_FUNCTION_MURMUR3, HASH_FUNCTION_CRC32C};
+    for(x = 0; x < sizeof(hashFunctions) / sizeof(hashFunctions[0]); x++) {
+        hash_ring_t *ring = hash_ring_create(1, hashFunctions[x]);
+        assert(ring != NULL);
+        assert(hash_ring_add_node(ring, name, 300) == HASH_RING_OK);
+        assert(ring->numItems == 1);
+
+        uint64_t expected;
+        if(hashFunctions[x] == HASH_FUNCTION_XXH3) {
+            expected = xxh3_64(name, 301);
+        }
+        else if(hashFunctions[x] == HASH_FUNCTION_MURMUR3) {
+            murmur3_x64_128(name, 301, 0, out);
+            expected = out[0];
+        }
+        else {
+            expected = (uint64_t)crc32c(name, 301) << 32;
+        }
+        assert(ring->items[0] == expected);
+        hash_ring_free(ring);
+
+        // lookups spread keys over all of the nodes
+        ring = hash_ring_create(64, hashFunctions[x]);
+        addNodes(ring, 4);
+        int counts[4] = {0, 0, 0, 0};
+        int y;
+        for(y = 0; y < 4000; y++) {
+            char key[32];
+            int keyLen = snprintf(key, sizeof(key), "key%d", y);
+            hash_ring_node_t *node = hash_ring_find_node(ring, (uint8_t*)key, keyLen);
+            assert(node != NULL);
+            counts[node->index]++;
+        }
+        for(y = 0; y < 4; y++) {
+            assert(counts[y] > 400);
+        }
+        hash_ring_free(ring);
+    }
+
+    assert(hash_ring_create(8, 6) == NULL);
+}
+
+void testShortHashes() {
+    printf("Test single block MD5 and SHA1...\n");
+
+    uint8_t data[200];
+    md5_word_t md5Expected[4], md5Words[4];
+    unsigned sha1Expected[5], sha1Digest[5];
+    int len, impl;
+    int defaultImpl = SHA1GetImplementation();
+
+    fillRandomBytes(data, sizeof(data));
+
+    // lengths around MD5_SHORT_MAX and SHA1_SHORT_MAX switch between the single block
+    // and the streaming code
+    for(len = 0; len < sizeof(data); len++) {
+        streamingMD5(data, len, md5Expected);
+        md5_hash(data, len, md5Words);
+        assert(memcmp(md5Expected, md5Words, sizeof(md5Words)) == 0);
+
+        for(impl = 0; impl < SHA1_NUM_IMPLEMENTATIONS; impl++) {
+            if(SHA1SetImplementation(impl) != 0) continue;
+            streamingSHA1(data, len, sha1Expected);
+            SHA1Hash(data, len, sha1Digest);
+            assert(memcmp(sha1Expected, sha1Digest, sizeof(sha1Digest)) == 0);
+        }
+    }
+
+    SHA1SetImplementation(defaultImpl);
+}
+
+void testMultiBufferHashes() {
+    printf("Test multi-buffer MD5 and SHA1...\n");
+
+    uint32_t features = cpu_features();
+    uint8_t messages[40][300];
+    const uint8_t *data[40];
+    unsigned int lens[40];
+    md5_word_t md5Expected[40][4], md5Digests[40][4];
+    unsigned sha1Expected[40][5], sha1Digests[40][5];
+    int x, n, round;
+
+    for(round = 0; round < 200; round++) {
+        // mix short keys with keys that need several blocks, and lengths that
+        // put the padding at a block boundary
+        n = rand() % 40;
+        for(x = 0; x < n; x++) {
+            lens[x] = round % 4 == 0 ? 55 + rand() % 3 : rand() % (round % 2 ? 300 : 70);
+            fillRandomBytes(messages[x], lens[x]);
+            data[x] = messages[x];
+
+            streamingMD5(data[x], lens[x], md5Expected[x]);
+
+            SHA1Context context;
+            SHA1Reset(&context);
+            SHA1Input(&context, data[x], lens[x]);
+            assert(SHA1Result(&context) == 1);
+            memcpy(sha1Expected[x], context.Message_Digest, sizeof(sha1Expected[x]));
+        }
+
+        md5_multi(data, lens, n, md5Digests);
+        assert(memcmp(md5Expected, md5Digests, sizeof(md5Digests[0]) * n) == 0);
+        SHA1Multi(data, lens, n, sha1Digests);
+        assert(memcmp(sha1Expected, sha1Digests, sizeof(sha1Digests[0]) * n) == 0);
+
+        if(features & CPU_AVX2) {
+            md5_multi_avx2(data, lens, n, md5Digests);
+            assert(memcmp(md5Expected, md5Digests, sizeof(md5Digests[0]) * n) == 0);
+            SHA1MultiAVX2(data, lens, n, sha1Digests);
+            assert(memcmp(sha1Expected, sha1Digests, sizeof(sha1Digests[0]) * n) == 0);
+        }
+        if(features & CPU_AVX512F) {
+            md5_multi_avx512(data, lens, n, md5Digests);
+            assert(memcmp(md5Expected, md5Digests, sizeof(md5Digests[0]) * n) == 0);
+            SHA1MultiAVX512(data, lens, n, sha1Digests);
+            assert(memcmp(sha1Expected, sha1Digests, sizeof(sha1Digests[0]) * n) == 0);
+        }
+    }
+
+    // RFC 1321 and FIPS 180-1 test vectors
+    data[0] = (uint8_t*)"abc";
+    lens[0] = 3;
+    md5_multi(data, lens, 1, md5Digests);
+    assert(md5Digests[0][0] == 0x98500190 && md5Digests[0][1] == 0xb04fd23c &&
+        md5Digests[0][2] == 0x7d3f96d6 && md5Digests[0][3] == 0x727fe128);
+    SHA1Multi(data, lens, 1, sha1Digests);
+    assert(sha1Digests[0][0] == 0xA9993E36 && sha1Digests[0][4] == 0x9CD0D89D);
+}
+
+void testSHA1Implementations() {
+    printf("Test SHA1 implementations...\n");
+
+    int defaultImpl = SHA1GetImplementation();
+    uint8_t data[1000];
+    unsigned expected[5];
+    SHA1Context context;
+    int impl, round;
+
+    assert(SHA1ImplementationSupported(SHA1_IMPL_PORTABLE));
+    assert(SHA1SetImplementation(SHA1_NUM_IMPLEMENTATIONS) == -1);
+
+    for(round = 0; round < 500; round++) {
+        uint32_t len = rand() % sizeof(data);
+        fillRandomBytes(data, len);
+
+        assert(SHA1SetImplementation(SHA1_IMPL_PORTABLE) == 0);
+        SHA1Reset(&context);
+        SHA1Input(&context, data, len);
+        assert(SHA1Result(&context) == 1);
+        memcpy(expected, context.Message_Digest, sizeof(expected));
+
+        for(impl = 0; impl < SHA1_NUM_IMPLEMENTATIONS; impl++) {
+            if(SHA1SetImplementation(impl) != 0) continue;
+            SHA1Reset(&context);
+            SHA1Input(&context, data, len);
+            assert(SHA1Result(&context) == 1);
+            assert(memcmp(expected, context.Message_Digest, sizeof(expected)) == 0);
+        }
+    }
+
+    // FIPS 180-1 two block test vector
+    char *message = "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq";
+    for(impl = 0; impl < SHA1_NUM_IMPLEMENTATIONS; impl++) {
+        if(SHA1SetImplementation(impl) != 0) continue;
+        SHA1Reset(&context);
+        SHA1Input(&context, (uint8_t*)message, strlen(message));
+        assert(SHA1Result(&context) == 1);
+        assert(context.Message_Digest[0] == 0x84983E44 && context.Message_Digest[1] == 0x1C3BD26E &&
+            context.Message_Digest[2] == 0xBAAE4AA1 && context.Message_Digest[3] == 0xF95129E5 &&
+            context.Message_Digest[4] == 0xE54670F1);
+    }
+
+    SHA1SetImplementation(defaultImpl);
+}
+
+void testKnownSlotsOnRing() {
+    printf("Test getting known nodes on ring...\n");
+    hash_ring_t *ring = hash_ring_create(8, HASH_FUNCTION_SHA1);
+    char *slotA = "slotA";
+    char *slotB = "slotB";
+    
+    char *keyA = "keyA";
+    char *keyB = "keyBBBB";
+    char *keyC = "keyB_";
+    
+    hash_ring_node_t *node;
+    
+    assert(hash_ring_add_node(ring, (uint8_t*)slotA, strlen(slotA)) == HASH_RING_OK);
+    assert(hash_ring_add_node(ring, (uint8_t*)slotB, strlen(slotB)) == HASH_RING_OK);
+    
+    node = hash_ring_find_node(ring, (uint8_t*)keyA, strlen(keyA));
+    assert(node != NULL && node->nameLen == strlen(slotA) && memcmp(node->name, slotA, strlen(slotA)) == 0);
+    
+    node = hash_ring_find_node(ring, (uint8_t*)keyB, strlen(keyB));
+    assert(node != NULL && node->nameLen == strlen(slotA) && memcmp(node->name, slotA, strlen(slotA)) == 0);
+    
+    node = hash_ring_find_node(ring, (uint8_t*)keyC, strlen(keyC));
+    assert(node != NULL && node->nameLen == strlen(slotB) && memcmp(node->name, slotB, strlen(slotB)) == 0);
+
+    hash_ring_free(ring);
+}
+
+void testKnownMultipleSlotsOnRing() {
+    printf("\n\nTest getting multiple known nodes on ring...\n\n");
+
+    hash_ring_t *ring = hash_ring_create(8, HASH_FUNCTION_SHA1);
+    char *slotA = "slotA";
+    char *slotB = "slotB";
+    char *slotC = "slotC";
+
+    // hashes to a low number
+    char *keyA = "keyA";
+    // hashes to high number
+    char *keyB = "keyB*_*_*_";
+
+    int x;
+    hash_ring_node_t *nodes[3];
+
+    assert(hash_ring_add_node(ring, (uint8_t*)slotA, strlen(slotA)) == HASH_RING_OK);
+    assert(hash_ring_add_node(ring, (uint8_t*)slotB, strlen(slotB)) == HASH_RING_OK);
+
+    x = hash_ring_find_nodes(ring, (uint8_t*)keyA, strlen(keyA), nodes, 3);
+    assert(
+        x == 2 &&
+        nodes[0] != NULL &&
+            nodes[0]->nameLen == strlen(slotA) &&
+            memcmp(nodes[0]->name, slotA, strlen(slotA)) == 0 &&
+        nodes[1] != NULL &&
+            nodes[1]->nameLen == strlen(slotB) &&
+            memcmp(nodes[1]->name, slotB, strlen(slotB)) == 0);
+
+    x = hash_ring_find_nodes(ring, (uint8_t*)keyB, strlen(keyB), nodes, 3);
+    assert(
+        x == 2 &&
+        nodes[0] != NULL &&
+            nodes[0]->nameLen == strlen(slotB) &&
+            memcmp(nodes[0]->name, slotB, strlen(slotB)) == 0 &&
+        nodes[1] != NULL &&
+            nodes[1]->nameLen == strlen(slotA) &&
+            memcmp(nodes[1]->name, slotA, strlen(slotA)) == 0);
+
+    assert(hash_ring_add_node(ring, (uint8_t*)slotC, strlen(slotC)) == HASH_RING_OK);
+
+    x = hash_ring_find_nodes(ring, (uint8_t*)keyA, strlen(keyA), nodes, 3);
+    assert(
+        x == 3 &&
+        nodes[0] != NULL &&
+            nodes[0]->nameLen == strlen(slotC) &&
+            memcmp(nodes[0]->name, slotC, strlen(slotC)) == 0 &&
+        nodes[1] != NULL &&
+            nodes[1]->nameLen == strlen(slotA) &&
+            memcmp(nodes[1]->name, slotA, strlen(slotA)) == 0 &&
+        nodes[2] != NULL &&
+            nodes[2]->nameLen == strlen(slotB) &&
+            memcmp(nodes[2]->name, slotB, strlen(slotB)) == 0);
+
+    x = hash_ring_find_nodes(ring, (uint8_t*)keyB, strlen(keyB), nodes, 3);
+    assert(
+        x == 3 &&
+        nodes[0] != NULL &&
+            nodes[0]->nameLen == strlen(slotC) &&
+            memcmp(nodes[0]->name, slotC, strlen(slotC)) == 0 &&
+        nodes[1] != NULL &&
+            nodes[1]->nameLen == strlen(slotB) &&
+            memcmp(nodes[1]->name, slotB, strlen(slotB)) == 0 &&
+        nodes[2] != NULL &&
+            nodes[2]->nameLen == strlen(slotA) &&
+            memcmp(nodes[2]->name, slotA, strlen(slotA)) == 0);
+
+    hash_ring_free(ring);
+}
+
+void testKnownNextHighestItemOnRing() {
+    printf("Test getting next highest item on ring...\n");
+    hash_ring_t *ring = hash_ring_create(8, HASH_FUNCTION_SHA1);
+    char *slotA = "slotA";
+    char *slotB = "slotB";
+    
+    assert(hash_ring_add_node(ring, (uint8_t*)slotA, strlen(slotA)) == HASH_RING_OK);
+    assert(hash_ring_add_node(ring, (uint8_t*)slotB, strlen(slotB)) == HASH_RING_OK);
+
+    hash_ring_item_t item;
+    
+    // next highest for first item should yield the second
+    assert(hash_ring_find_next_highest_item(ring, 2351641940735260693u, &item)->number == 2584980261350711786u);
+    
+    // number less than the first should yield the first
+    assert(hash_ring_find_next_highest_item(ring, 2351641940735260692u, &item)->number == 2351641940735260693u);
+    
+    // number in the middle should yield the next
+    assert(hash_ring_find_next_highest_item(ring, 5908063426886290069u, &item)->number == 6065789416862870789u);
+    
+    // number equal to the last should wrap around to the first
+    assert(hash_ring_find_next_highest_item(ring, 17675051572751928939u, &item)->number == 2351641940735260693u);
+    
+    hash_ring_free(ring);
+}
+
+void testNodeTable() {
+    printf("Test looking up nodes by name...\n");
+
+    hash_ring_t *ring = hash_ring_create(2, HASH_FUNCTION_MD5);
+    char name[32];
+    int nameLen, x, y;
+    int numNodes = 2000;
+    uint8_t *present = (uint8_t*)calloc(numNodes, 1);
+
+    for(x = 0; x < numNodes; x++) {
+        nameLen = snprintf(name, sizeof(name), "node-%d", x);
+        assert(hash_ring_add_node(ring, (uint8_t*)name, nameLen) == HASH_RING_OK);
+        assert(hash_ring_add_node(ring, (uint8_t*)name, nameLen) == HASH_RING_ERR);
+        present[x] = 1;
+    }
+
+    // Remove and add nodes in a random order, the table must always agree with present
+    for(y = 0; y < 20000; y++) {
+        x = rand() % numNodes;
+        nameLen = snprintf(name, sizeof(name), "node-%d", x);
+        if(present[x]) {
+            assert(hash_ring_remove_node(ring, (uint8_t*)name, nameLen) == HASH_RING_OK);
+            assert(hash_ring_remove_node(ring, (uint8_t*)name, nameLen) == HASH_RING_ERR);
+        }
+        else {
+            assert(hash_ring_add_node(ring, (uint8_t*)name, nameLen) == HASH_RING_OK);
+        }
+        present[x] = !present[x];
+
+        if(y % 1000 == 0) {
+            uint32_t count = 0;
+            for(x = 0; x < numNodes; x++) {
+                nameLen = snprintf(name, sizeof(name), "node-%d", x);
+                hash_ring_node_t *node = hash_ring_get_node(ring, (uint8_t*)name, nameLen);
+                if(present[x]) {
+                    assert(node != NULL && node->nameLen == nameLen && memcmp(node->name, name, nameLen) == 0);
+                    assert(ring->nodeTable[node->index] == node);
+                    count++;
+                }
+                else {
+                    assert(node == NULL);
+                }
+            }
+            assert(count == ring->numNodes);
+            assert(ring->numItems == ring->numNodes * 2);
+        }
+    }
+
+    // Remove everything, the ring can then be reused
+    for(x = 0; x < numNodes; x++) {
+        nameLen = snprintf(name, sizeof(name), "node-%d", x);
+        assert(hash_ring_remove_node(ring, (uint8_t*)name, nameLen) == (present[x] ? HASH_RING_OK : HASH_RING_ERR));
+    }
+    assert(ring->numNodes == 0 && ring->numItems == 0);
+    assert(hash_ring_get_node(ring, (uint8_t*)"node-0", 6) == NULL);
+    assert(hash_ring_add_node(ring, (uint8_t*)"node-0", 6) == HASH_RING_OK);
+    assert(hash_ring_get_node(ring, (uint8_t*)"node-0", 6) != NULL);
+
+    free(present);
+    hash_ring_free(ring);
+}
+
+void testBulkAdd() {
+    printf("Test adding nodes in bulk...\n");
+
+    uint32_t *nameLens;
+    uint8_t **names = makeNames("node", 300, &nameLens);
+    int x;
+
+    HASH_MODE modes[] = {HASH_RING_MODE_NORMAL, HASH_RING_MODE_LIBMEMCACHED_COMPAT};
+    for(x = 0; x < 2; x++) {
+        // A bulk built ring is the same as one built a node at a time
+        hash_ring_t *bulk = hash_ring_create_from_nodes(names, nameLens, 300, 40, HASH_FUNCTION_MD5, modes[x]);
+        hash_ring_t *ring = hash_ring_create(40, HASH_FUNCTION_MD5);
+        assert(bulk != NULL && ring != NULL);
+        assert(hash_ring_set_mode(ring, modes[x]) == HASH_RING_OK);
+        int y;
+        for(y = 0; y < 300; y++) {
+            assert(hash_ring_add_node(ring, names[y], nameLens[y]) == HASH_RING_OK);
+        }
+
+        assert(bulk->numNodes == 300 && bulk->numItems == 300 * 40);
+        assert(memcmp(bulk->items, ring->items, sizeof(uint64_t) * ring->numItems) == 0);
+        for(y = 0; y < ring->numItems; y++) {
+            assert(bulk->nodeTable[bulk->itemNodes[y]] == hash_ring_get_node(bulk,
+                ring->nodeTable[ring->itemNodes[y]]->name, ring->nodeTable[ring->itemNodes[y]]->nameLen));
+        }
+        assert(bulk->indexBits == ring->indexBits);
+
+        hash_ring_free(bulk);
+        hash_ring_free(ring);
+    }
+
+    // Adding to an existing ring
+    hash_ring_t *ring = hash_ring_create(8, HASH_FUNCTION_SHA1);
+    assert(hash_ring_add_nodes(ring, names, nameLens, 100) == HASH_RING_OK);
+    assert(hash_ring_add_nodes(ring, names + 100, nameLens + 100, 100) == HASH_RING_OK);
+    assert(hash_ring_add_nodes(ring, names, nameLens, 0) == HASH_RING_OK);
+    assert(ring->numNodes == 200 && ring->numItems == 1600);
+    for(x = 1; x < ring->numItems; x++) {
+        assert(ring->items[x - 1] <= ring->items[x]);
+    }
+
+    // Nodes already in the ring or repeated fail without changing the ring
+    uint64_t *items = (uint64_t*)malloc(sizeof(uint64_t) * ring->numItems);
+    memcpy(items, ring->items, sizeof(uint64_t) * ring->numItems);
+    assert(hash_ring_add_nodes(ring, names + 150, nameLens + 150, 100) == HASH_RING_ERR);
+    uint8_t *repeated[] = {names[250], names[251], names[250]};
+    uint32_t repeatedLens[] = {nameLens[250], nameLens[251], nameLens[250]};
+    assert(hash_ring_add_nodes(ring, repeated, repeatedLens, 3) == HASH_RING_ERR);
+    uint32_t emptyLens[] = {nameLens[250], 0};
+    assert(hash_ring_add_nodes(ring, repeated, emptyLens, 2) == HASH_RING_ERR);
+    assert(ring->numNodes == 200 && ring->numItems == 1600);
+    assert(memcmp(items, ring->items, sizeof(uint64_t) * ring->numItems) == 0);
+    assert(hash_ring_get_node(ring, names[250], nameLens[250]) == NULL);
+    assert(hash_ring_get_node(ring, names[199], nameLens[199]) != NULL);
+    free(items);
+    hash_ring_free(ring);
+
+    // libmemcached mode needs MD5
+    assert(hash_ring_create_from_nodes(names, nameLens, 10, 8, HASH_FUNCTION_SHA1,
+        HASH_RING_MODE_LIBMEMCACHED_COMPAT) == NULL);
+
+    freeNames(names, nameLens, 300);
+}
+
+/**
+ * Asserts that ring holds the same items, owned by the same nodes, with the same prefix
+ * index as a ring built in one go from its nodes.
+ */
+void assertSameAsRebuilt(hash_ring_t *ring) {
+    uint8_t **names = (uint8_t**)malloc(sizeof(uint8_t*) * (ring->numNodes + 1));
+    uint32_t *nameLens = (uint32_t*)malloc(sizeof(uint32_t) * (ring->numNodes + 1));
+    uint32_t x;
+    for(x = 0; x < ring->numNodes; x++) {
+        assert(ring->nodeTable[x]->index == x);
+        names[x] = ring->nodeTable[x]->name;
+        nameLens[x] = ring->nodeTable[x]->nameLen;
+    }
+
+    hash_ring_t *rebuilt = hash_ring_create(ring->numReplicas, ring->hash_fn);
+    assert(hash_ring_add_nodes(rebuilt, names, nameLens, ring->numNodes) == HASH_RING_OK);
+    assert(rebuilt->numItems == ring->numItems);
+    assert(ring->numItems == 0 || memcmp(rebuilt->items, ring->items, sizeof(uint64_t) * ring->numItems) == 0);
+    for(x = 0; x < ring->numItems; x++) {
+        assert(rebuilt->itemNodes[x] == ring->itemNodes[x]);
+    }
+    assert(rebuilt->indexBits == ring->indexBits);
+    if(ring->index != NULL) {
+        assert(memcmp(rebuilt->index, ring->index, sizeof(uint32_t) * ((1 << ring->indexBits) + 1)) == 0);
+    }
+
+    hash_ring_free(rebuilt);
+    free(names);
+    free(nameLens);
+}
+
+void testIncrementalUpdates() {
+    printf("Test adding and removing nodes one at a time...\n");
+
+    uint32_t *nameLens;
+    uint8_t **names = makeNames("node", 64, &nameLens);
+    uint8_t member[64] = {0};
+    int x;
+
+    // Fewer than 10 replicas, or "node-2" replica 10 and "node-21" replica 0 are the same
+    // item, and items with the same number are ordered by when their nodes were added
+    srand(42);
+    hash_ring_t *ring = hash_ring_create(9, HASH_FUNCTION_MD5);
+    for(x = 0; x < 2000; x++) {
+        int n = rand() % 64;
+        if(member[n]) {
+            assert(hash_ring_remove_node(ring, names[n], nameLens[n]) == HASH_RING_OK);
+        }
+        else {
+            assert(hash_ring_add_node(ring, names[n], nameLens[n]) == HASH_RING_OK);
+        }
+        member[n] = !member[n];
+        if(x % 50 == 0) {
+            assertSameAsRebuilt(ring);
+        }
+    }
+    assertSameAsRebuilt(ring);
+
+    // Removing every node gives back the items
+    for(x = 0; x < 64; x++) {
+        if(member[x]) assert(hash_ring_remove_node(ring, names[x], nameLens[x]) == HASH_RING_OK);
+    }
+    assert(ring->numNodes == 0 && ring->numItems == 0 && ring->items == NULL && ring->index == NULL);
+    assert(hash_ring_add_node(ring, names[0], nameLens[0]) == HASH_RING_OK);
+    assertSameAsRebuilt(ring);
+    hash_ring_free(ring);
+
+    // Growing past the point where the index gets more buckets, then shrinking back
+    ring = hash_ring_create(5, HASH_FUNCTION_XXH3);
+    for(x = 0; x < 64; x++) {
+        assert(hash_ring_add_node(ring, names[x], nameLens[x]) == HASH_RING_OK);
+        assertSameAsRebuilt(ring);
+    }
+    for(x = 0; x < 64; x += 2) {
+        assert(hash_ring_remove_node(ring, names[x], nameLens[x]) == HASH_RING_OK);
+        assertSameAsRebuilt(ring);
+    }
+    hash_ring_free(ring);
+
+    freeNames(names, nameLens, 64);
+}
+
+void testParallelBuild() {
+    printf("Test building rings with threads...\n");
+
+    uint32_t numItems = 300000, threads[] = {2, 3, 8, 64}, x, y;
+    int kind;
+    uint64_t *numbers = (uint64_t*)malloc(sizeof(uint64_t) * numItems);
+    uint64_t *parallelNumbers = (uint64_t*)malloc(sizeof(uint64_t) * numItems);
+    uint64_t *tempNumbers = (uint64_t*)malloc(sizeof(uint64_t) * numItems);
+    uint32_t *values = (uint32_t*)malloc(sizeof(uint32_t) * numItems);
+    uint32_t *parallelValues = (uint32_t*)malloc(sizeof(uint32_t) * numItems);
+    uint32_t *tempValues = (uint32_t*)malloc(sizeof(uint32_t) * numItems);
+
+    // The parallel sort gives the same result as the serial one
+    srand(3);
+    for(kind = 0; kind < 3; kind++) {
+        fillSortNumbers(numbers, numItems, kind);
+        for(x = 0; x < numItems; x++) {
+            values[x] = x;
+        }
+        for(y = 0; y < sizeof(threads) / sizeof(threads[0]); y++) {
+            memcpy(parallelNumbers, numbers, sizeof(uint64_t) * numItems);
+            memcpy(parallelValues, values, sizeof(uint32_t) * numItems);
+            sort_pairs_parallel(parallelNumbers, parallelValues, numItems, tempNumbers, tempValues, threads[y]);
+            if(y == 0) {
+                sort_pairs(numbers, values, numItems, tempNumbers, tempValues);
+            }
+            assert(memcmp(numbers, parallelNumbers, sizeof(uint64_t) * numItems) == 0);
+            assert(memcmp(values, parallelValues, sizeof(uint32_t) * numItems) == 0);
+        }
+    }
+    free(numbers);
+    free(parallelNumbers);
+    free(tempNumbers);
+    free(values);
+    free(parallelValues);
+    free(tempValues);
+
+    // Rings built with threads are byte for byte the same as ones built without
+    uint32_t *nameLens;
+    uint8_t **names = makeNames("node", 500, &nameLens);
+    HASH_FUNCTION functions[] = {HASH_FUNCTION_MD5, HASH_FUNCTION_SHA1, HASH_FUNCTION_CRC32C};
+    int fn;
+    for(fn = 0; fn < 3; fn++) {
+        hash_ring_t *ring = hash_ring_create(100, functions[fn]);
+        assert(hash_ring_add_nodes(ring, names, nameLens, 500) == HASH_RING_OK);
+
+        for(y = 0; y < sizeof(threads) / sizeof(threads[0]); y++) {
+            // In one go, and a first batch then a second that is merged in
+            hash_ring_t *parallel = hash_ring_create(100, functions[fn]);
+            hash_ring_t *merged = hash_ring_create(100, functions[fn]);
+            assert(hash_ring_set_threads(parallel, threads[y]) == HASH_RING_OK);
+            assert(hash_ring_set_threads(merged, threads[y]) == HASH_RING_OK);
+            assert(hash_ring_add_nodes(parallel, names, nameLens, 500) == HASH_RING_OK);
+            assert(hash_ring_add_nodes(merged, names, nameLens, 100) == HASH_RING_OK);
+            assert(hash_ring_add_nodes(merged, names + 100, nameLens + 100, 400) == HASH_RING_OK);
+
+            hash_ring_t *rings[] = {parallel, merged};
+            for(x = 0; x < 2; x++) {
+                assert(rings[x]->numItems == ring->numItems && rings[x]->indexBits == ring->indexBits);
+                assert(memcmp(rings[x]->items, ring->items, sizeof(uint64_t) * ring->numItems) == 0);
+                assert(memcmp(rings[x]->itemNodes, ring->itemNodes, sizeof(uint32_t) * ring->numItems) == 0);
+                assert(memcmp(rings[x]->index, ring->index, sizeof(uint32_t) * ((1 << ring->indexBits) + 1)) == 0);
+            }
+            hash_ring_free(parallel);
+            hash_ring_free(merged);
+        }
+        hash_ring_free(ring);
+    }
+    freeNames(names, nameLens, 500);
+
+    hash_ring_t *ring = hash_ring_create(1, HASH_FUNCTION_MD5);
+    assert(hash_ring_set_threads(ring, 0) == HASH_RING_ERR);
+    assert(hash_ring_set_threads(ring, HASH_RING_MAX_THREADS + 1) == HASH_RING_ERR);
+    assert(hash_ring_set_threads(ring, HASH_RING_MAX_THREADS) == HASH_RING_OK);
+    assert(hash_ring_set_threads(NULL, 1) == HASH_RING_ERR);
+    hash_ring_free(ring);
+}
+
+void testSharedRing() {
+    printf("Test sharing a ring between threads...\n");
+
+    uint32_t *nameLens;
+    uint8_t **names = makeNames("node", 50, &nameLens);
+    hash_ring_t *ring = hash_ring_create(16, HASH_FUNCTION_XXH3);
+    assert(hash_ring_add_nodes(ring, names, nameLens, 50) == HASH_RING_OK);
+
+    assert(hash_ring_shared_create(NULL, 4) == NULL);
+    assert(hash_ring_shared_create(ring, 0) == NULL);
+    hash_ring_shared_t *shared = hash_ring_shared_create(ring, 4);
+    assert(shared != NULL);
+
+    // Readers get an id each, up to the limit
+    int ids[5], x;
+    for(x = 0; x < 4; x++) {
+        ids[x] = hash_ring_shared_register(shared);
+        assert(ids[x] >= 0);
+    }
+    assert(hash_ring_shared_register(shared) == HASH_RING_ERR);
+    hash_ring_shared_unregister(shared, ids[3]);
+    ids[3] = hash_ring_shared_register(shared);
+    assert(ids[3] >= 0);
+
+    // A ring being read is kept until the read ends
+    hash_ring_t *read = hash_ring_shared_read_begin(shared, ids[0]);
+    assert(read == ring);
+    hash_ring_t *copy = hash_ring_shared_write_begin(shared);
+    assert(copy != NULL && copy != ring);
+    assert(copy->numItems == ring->numItems && memcmp(copy->items, ring->items, sizeof(uint64_t) * ring->numItems) == 0);
+    assert(hash_ring_remove_node(copy, names[0], nameLens[0]) == HASH_RING_OK);
+    assert(hash_ring_shared_publish(shared, copy) == HASH_RING_OK);
+    assert(hash_ring_shared_pending(shared) == 1);
+    assert(hash_ring_get_node(read, names[0], nameLens[0]) != NULL);
+    assert(read->numItems == 50 * 16);
+
+    // New reads see the new ring
+    hash_ring_t *next = hash_ring_shared_read_begin(shared, ids[1]);
+    assert(next == copy && hash_ring_get_node(next, names[0], nameLens[0]) == NULL);
+    hash_ring_shared_read_end(shared, ids[1]);
+
+    hash_ring_shared_read_end(shared, ids[0]);
+    assert(hash_ring_shared_pending(shared) == 0);
+
+    // Abandoned writes change nothing
+    copy = hash_ring_shared_write_begin(shared);
+    assert(hash_ring_remove_node(copy, names[1], nameLens[1]) == HASH_RING_OK);
+    hash_ring_shared_abort(shared, copy);
+    next = hash_ring_shared_read_begin(shared, ids[2]);
+    assert(hash_ring_get_node(next, names[1], nameLens[1]) != NULL);
+    hash_ring_shared_read_end(shared, ids[2]);
+    for(x = 0; x < 4; x++) {
+        hash_ring_shared_unregister(shared, ids[x]);
+    }
+
+    // Readers on other threads while the ring keeps changing
+    uint8_t *keys = (uint8_t*)malloc(1000 * SHARED_KEY_SIZE);
+    fillRandomBytes(keys, 1000 * SHARED_KEY_SIZE);
+    pthread_t threads[4];
+    sharedReader readers[4];
+    for(x = 0; x < 4; x++) {
+        memset(&readers[x], 0, sizeof(sharedReader));
+        readers[x].shared = shared;
+        readers[x].keys = keys;
+        readers[x].numKeys = 1000;
+        readers[x].numLookups = 50000;
+        assert(pthread_create(&threads[x], NULL, sharedReaderMain, &readers[x]) == 0);
+    }
+    churnSharedRing(shared, names + 1, nameLens + 1, 49, NULL, 400);
+    for(x = 0; x < 4; x++) {
+        pthread_join(threads[x], NULL);
+    }
+    assert(hash_ring_shared_pending(shared) == 0);
+
+    hash_ring_shared_free(shared);
+    free(keys);
+    freeNames(names, nameLens, 50);
+}
+
+void testRemoveNode() {
+    printf("Test removing a node...\n");
+    hash_ring_t *ring = hash_ring_create(1, HASH_FUNCTION_SHA1);
+    hash_ring_node_t *node;
+    char *mynode = "mynode";
+    char *mynode1 = "mynode1";
+    char *mynode2 = "mynode2";
+    char *mykey = "mykey";
+    
+    
+    assert(hash_ring_add_node(ring, (uint8_t*)mynode, strlen(mynode)) == HASH_RING_OK);
+    assert(hash_ring_add_node(ring, (uint8_t*)mynode1, strlen(mynode2)) == HASH_RING_OK);
+    assert(hash_ring_add_node(ring, (uint8_t*)mynode2, strlen(mynode2)) == HASH_RING_OK);
+    assert(ring->numNodes == 3);
+    
+    node = hash_ring_find_node(ring, (uint8_t*)mykey, strlen(mykey));
+    assert(node != NULL && node->nameLen == strlen(mynode) && memcmp(mynode, node->name, node->nameLen) == 0);
+    
+    assert(hash_ring_remove_node(ring, (uint8_t*)mynode, strlen(mynode)) == HASH_RING_OK);
+    assert(ring->numNodes == 2);
+    
+    assert(hash_ring_get_node(ring, (uint8_t*)mynode, strlen(mynode)) == NULL);
+    assert(ring->numItems == 2);
+    
+    // every remaining item must belong to a node that is still in the ring
+    int x;
+    for(x = 0; x < ring->numItems; x++) {
+        assert(ring->itemNodes[x] < ring->numNodes);
+        assert(ring->nodeTable[ring->itemNodes[x]]->index == ring->itemNodes[x]);
+        if(x > 0) assert(ring->items[x - 1] < ring->items[x]);
+    }
+    
+    // remove node1, and try to search for a key that went to it before, and verify it goes to node2
+    assert(hash_ring_remove_node(ring, (uint8_t*)mynode1, strlen(mynode1)) == HASH_RING_OK);
+    assert(ring->numNodes == 1);
+    
+    node = hash_ring_find_node(ring, (uint8_t*)mykey, strlen(mykey));
+    assert(node != NULL && node->nameLen == strlen(mynode2) && memcmp(mynode2, node->name, node->nameLen) == 0);
+    
+    hash_ring_free(ring);
+}
+
+void testAddMultipleTimes() {
+    printf("Test adding a node multiple times...\n");
+    hash_ring_t *ring = hash_ring_create(1, HASH_FUNCTION_SHA1);
+    assert(ring != NULL);
+    char *mynode = "mynode";
+    hash_ring_add_node(ring, (uint8_t*)mynode, strlen(mynode));
+
+    assert(ring->numNodes == 1);
+    
+    assert(hash_ring_add_node(ring, (uint8_t*)mynode, strlen(mynode)) == HASH_RING_ERR);
+    assert(ring->numNodes == 1);
+    
+    hash_ring_free(ring);
+}
+
+void testLibmemcachedCompat() {
+    printf("Testing libmemcached compatibility mode..\n");
+
+    // make sure the mode can't be set to libmemcached if the function is not md5
+    hash_ring_t *ring = hash_ring_create(1, HASH_FUNCTION_SHA1);
     assert(hash_ring_set_mode(ring, HASH_RING_MODE_LIBMEMCACHED_COMPAT) == HASH_RING_ERR);
     hash_ring_free(ring);
 
-    ring = hash_ring_create(1, HASH_FUNCTION_MD5);
-    assert(hash_ring_set_mode(ring, HASH_RING_MODE_LIBMEMCACHED_COMPAT) == HASH_RING_OK);
+    ring = hash_ring_create(1, HASH_FUNCTION_MD5);
+    assert(hash_ring_set_mode(ring, HASH_RING_MODE_LIBMEMCACHED_COMPAT) == HASH_RING_OK);
+
+    /**
+     * TODO - Add tests to make sure libmemcached compat hashes correctly.
+     */
+
+    hash_ring_free(ring);
+}
+
+void testArena() {
+    printf("Test allocating nodes from an arena...\n");
+
+    arena_t arena;
+    arena_init(&arena);
+    int x;
+
+    // Given back blocks are reused by blocks of the same size class
+    uint8_t *a = (uint8_t*)arena_alloc(&arena, 40);
+    uint8_t *b = (uint8_t*)arena_alloc(&arena, 40);
+    assert(a != NULL && b != NULL && a != b);
+    assert(((uintptr_t)a % ARENA_ALIGN) == 0 && ((uintptr_t)b % ARENA_ALIGN) == 0);
+    memset(a, 1, 40);
+    memset(b, 2, 40);
+    arena_release(&arena, a, 40);
+    assert(arena_alloc(&arena, 33) == a);
+    assert(b[39] == 2);
+
+    // Large blocks get their own chunk and are reused by anything that fits
+    uint8_t *large = (uint8_t*)arena_alloc(&arena, 10000);
+    assert(large != NULL && ((uintptr_t)large % ARENA_ALIGN) == 0);
+    memset(large, 3, 10000);
+    arena_release(&arena, large, 10000);
+    assert(arena_alloc(&arena, 5000) == large);
+
+    // Lots of small blocks come from a few chunks
+    for(x = 0; x < 10000; x++) {
+        uint8_t *block = (uint8_t*)arena_alloc(&arena, 48);
+        assert(block != NULL);
+        memset(block, x, 48);
+    }
+    assert(arena.numMallocs < 20);
+    arena_free(&arena);
+    assert(arena.bytes == 0);
+
+    // Nodes with names of every length, including ones too long for the arena's size
+    // classes and for the stack buffer replica names are built in
+    hash_ring_t *ring = hash_ring_create(8, HASH_FUNCTION_MD5);
+    hash_ring_t *copy;
+    int nameLens[] = {1, 15, 100, 1000, 1100, 4090, 5000};
+    int numLens = sizeof(nameLens) / sizeof(nameLens[0]);
+    uint8_t *name = (uint8_t*)malloc(5000);
+    for(x = 0; x < numLens; x++) {
+        memset(name, 'a' + x, nameLens[x]);
+        assert(hash_ring_add_node(ring, name, nameLens[x]) == HASH_RING_OK);
+    }
+    copy = hash_ring_copy(ring);
+    assert(copy != NULL);
+    for(x = 0; x < numLens; x++) {
+        memset(name, 'a' + x, nameLens[x]);
+        hash_ring_node_t *node = hash_ring_get_node(copy, name, nameLens[x]);
+        assert(node != NULL && node->nameLen == nameLens[x] && memcmp(node->name, name, nameLens[x]) == 0);
+        assert(node != hash_ring_get_node(ring, name, nameLens[x]));
+    }
+    assert(copy->numItems == ring->numItems);
+    assert(memcmp(copy->items, ring->items, sizeof(uint64_t) * ring->numItems) == 0);
+
+    // Removing and adding the nodes again reuses their memory and gives the same ring
+    hash_ring_stats_t before, after;
+    hash_ring_get_stats(ring, &before);
+    for(x = 0; x < numLens; x++) {
+        memset(name, 'a' + x, nameLens[x]);
+        assert(hash_ring_remove_node(ring, name, nameLens[x]) == HASH_RING_OK);
+    }
+    assert(ring->numItems == 0);
+    for(x = 0; x < numLens; x++) {
+        memset(name, 'a' + x, nameLens[x]);
+        assert(hash_ring_add_node(ring, name, nameLens[x]) == HASH_RING_OK);
+    }
+    hash_ring_get_stats(ring, &after);
+    assert(after.nodeBytes == before.nodeBytes);
+    assert(copy->numItems == ring->numItems);
+    assert(memcmp(copy->items, ring->items, sizeof(uint64_t) * ring->numItems) == 0);
+
+    free(name);
+    hash_ring_free(copy);
+    hash_ring_free(ring);
+}
+
+void runArenaBenchmark() {
+    printf("----------------------------------------------------\n");
+    printf("arena bench\n");
+    printf("----------------------------------------------------\n");
+
+    int numNodes = 10000, numReplicas = 160;
+    uint32_t *nameLens;
+    uint8_t **names = makeNames("server", numNodes, &nameLens);
+
+    startTiming();
+    hash_ring_t *ring = hash_ring_create_from_nodes(names, nameLens, numNodes, numReplicas,
+        HASH_FUNCTION_MD5, HASH_RING_MODE_NORMAL);
+    uint64_t buildTime = endTiming();
+    assert(ring != NULL);
+
+    hash_ring_stats_t stats;
+    hash_ring_get_stats(ring, &stats);
+
+    startTiming();
+    hash_ring_t *copy = hash_ring_copy(ring);
+    uint64_t copyTime = endTiming();
+    assert(copy != NULL);
+
+    startTiming();
+    hash_ring_free(copy);
+    uint64_t freeTime = endTiming();
+
+    printf("nodes = %d, replicas = %d: build %.1fms, copy %.2fms, free %.3fms, node memory %" PRIu64 " bytes\n",
+        numNodes, numReplicas, (double)buildTime / 1000000, (double)copyTime / 1000000,
+        (double)freeTime / 1000000, stats.nodeBytes);
+
+    hash_ring_free(ring);
+    freeNames(names, nameLens, numNodes);
+}
+
+/**
+ * Checks that a compact ring finds the same nodes as a wide ring of the same nodes.
+ * In HASH_RING_MODE_NORMAL only the top 32 bits of the numbers are kept, which is
+ * allowed to change the node of keys that share their top 32 bits with an item.
+ */
+void assertSameAsWide(hash_ring_t *compact, hash_ring_t *wide) {
+    hash_ring_item_t compactItem, wideItem;
+    hash_ring_node_t *batch[64];
+    uint64_t nums[64];
+    int x, y;
+    int exact = compact->mode == HASH_RING_MODE_LIBMEMCACHED_COMPAT;
+
+    assert(compact->numItems == wide->numItems && compact->numNodes == wide->numNodes);
+    for(x = 0; x < 20000; x += 64) {
+        for(y = 0; y < 64; y++) {
+            nums[y] = exact ? randomPosition() >> 32 : randomPosition();
+            assert(hash_ring_find_next_highest_item(compact, nums[y], &compactItem) != NULL);
+            assert(hash_ring_find_next_highest_item(wide, nums[y], &wideItem) != NULL);
+            if(exact) {
+                assert(compactItem.number == wideItem.number);
+            }
+            else if((wideItem.number >> 32) == (nums[y] >> 32)) {
+                continue;
+            }
+            else {
+                assert(compactItem.number == (wideItem.number & 0xffffffff00000000ULL));
+            }
+            assert(compactItem.node->nameLen == wideItem.node->nameLen &&
+                memcmp(compactItem.node->name, wideItem.node->name, wideItem.node->nameLen) == 0);
+        }
+        assert(hash_ring_find_nodes_batch_hashed(compact, nums, 64, batch) == HASH_RING_OK);
+        for(y = 0; y < 64; y++) {
+            assert(hash_ring_find_next_highest_item(compact, nums[y], &compactItem)->node == batch[y]);
+        }
+    }
+}
+
+void testCompactLayouts() {
+    printf("Test compact ring layouts...\n");
+
+    HASH_LAYOUT layouts[] = { HASH_RING_LAYOUT_COMPACT32, HASH_RING_LAYOUT_COMPACT16 };
+    HASH_MODE modes[] = { HASH_RING_MODE_NORMAL, HASH_RING_MODE_LIBMEMCACHED_COMPAT };
+    int numNodes = 200, numReplicas = 50, l, m, x;
+    uint32_t *nameLens;
+    uint8_t **names = makeNames("compact", numNodes, &nameLens);
+    hash_ring_stats_t stats;
+
+    for(l = 0; l < 2; l++) {
+        for(m = 0; m < 2; m++) {
+            hash_ring_t *wide = hash_ring_create_from_nodes(names, nameLens, numNodes, numReplicas,
+                HASH_FUNCTION_MD5, modes[m]);
+            hash_ring_t *ring = hash_ring_create(numReplicas, HASH_FUNCTION_MD5);
+            assert(hash_ring_set_mode(ring, modes[m]) == HASH_RING_OK);
+            assert(hash_ring_set_layout(ring, layouts[l]) == HASH_RING_OK);
+            assert(hash_ring_add_nodes(ring, names, nameLens, numNodes) == HASH_RING_OK);
+            assert(hash_ring_set_layout(ring, HASH_RING_LAYOUT_WIDE) == HASH_RING_ERR);
+            assert(ring->items == NULL && ring->positions != NULL);
+            for(x = 1; x < ring->numItems; x++) {
+                assert(ring->positions[x - 1] <= ring->positions[x]);
+            }
+
+            hash_ring_get_stats(ring, &stats);
+            assert(stats.itemBytes == (layouts[l] == HASH_RING_LAYOUT_COMPACT32 ? 8 : 6) * ring->numItems);
+            assertSameAsWide(ring, wide);
+
+            // Without a prefix index, and the ring is left as it is by a freeze
+            assert(hash_ring_set_max_index_bits(ring, 0) == HASH_RING_OK);
+            assertSameAsWide(ring, wide);
+            assert(hash_ring_set_max_index_bits(ring, HASH_RING_DEFAULT_MAX_INDEX_BITS) == HASH_RING_OK);
+            assert(hash_ring_freeze(ring) == HASH_RING_OK && ring->frozenItems == NULL);
+
+            // Changing the nodes keeps both rings in step
+            for(x = 0; x < 40; x++) {
+                int n = (x * 37) % numNodes;
+                assert(hash_ring_remove_node(ring, names[n], nameLens[n]) == HASH_RING_OK);
+                assert(hash_ring_remove_node(wide, names[n], nameLens[n]) == HASH_RING_OK);
+                if(x % 2 == 0) {
+                    assert(hash_ring_add_node(ring, names[n], nameLens[n]) == HASH_RING_OK);
+                    assert(hash_ring_add_node(wide, names[n], nameLens[n]) == HASH_RING_OK);
+                }
+            }
+            assertSameAsWide(ring, wide);
+
+            hash_ring_t *copy = hash_ring_copy(ring);
+            assert(copy != NULL && copy->layout == ring->layout);
+            assertSameAsWide(copy, wide);
+            hash_ring_free(copy);
+
+            hash_ring_free(ring);
+            hash_ring_free(wide);
+        }
+    }
+    freeNames(names, nameLens, numNodes);
+
+    // The 16-bit layout can't index more than HASH_RING_COMPACT16_MAX_NODES nodes
+    numNodes = HASH_RING_COMPACT16_MAX_NODES + 1;
+    names = makeNames("n", numNodes, &nameLens);
+    hash_ring_t *ring = hash_ring_create(1, HASH_FUNCTION_CRC32C);
+    assert(hash_ring_set_layout(ring, 0) == HASH_RING_ERR);
+    assert(hash_ring_set_layout(ring, HASH_RING_LAYOUT_COMPACT16) == HASH_RING_OK);
+    assert(hash_ring_add_nodes(ring, names, nameLens, numNodes) == HASH_RING_ERR);
+    assert(ring->numNodes == 0);
+    assert(hash_ring_add_nodes(ring, names, nameLens, numNodes - 1) == HASH_RING_OK);
+    assert(hash_ring_add_node(ring, names[numNodes - 1], nameLens[numNodes - 1]) == HASH_RING_ERR);
+    assert(hash_ring_remove_node(ring, names[0], nameLens[0]) == HASH_RING_OK);
+    assert(hash_ring_add_node(ring, names[numNodes - 1], nameLens[numNodes - 1]) == HASH_RING_OK);
+    hash_ring_node_t *node = hash_ring_find_node(ring, (uint8_t*)"key", 3);
+    assert(node != NULL && ring->nodeTable[node->index] == node);
+    hash_ring_free(ring);
+    freeNames(names, nameLens, numNodes);
+}
+
+void runLayoutBenchmark() {
+    printf("----------------------------------------------------\n");
+    printf("layout bench\n");
+    printf("----------------------------------------------------\n");
+
+    HASH_LAYOUT layouts[] = { HASH_RING_LAYOUT_WIDE, HASH_RING_LAYOUT_COMPACT32, HASH_RING_LAYOUT_COMPACT16 };
+    const char *layoutNames[] = { "wide", "compact32", "compact16" };
+    int numNodes = 10000, numReplicas = 160, numSearches = 1000000, l, x;
+    uint32_t *nameLens;
+    uint8_t **names = makeNames("server", numNodes, &nameLens);
+    uint64_t *nums = (uint64_t*)malloc(sizeof(uint64_t) * numSearches);
+    hash_ring_node_t **nodes = (hash_ring_node_t**)malloc(sizeof(hash_ring_node_t*) * numSearches);
+    for(x = 0; x < numSearches; x++) {
+        nums[x] = randomPosition();
+    }
+
+    for(l = 0; l < 3; l++) {
+        hash_ring_t *ring = hash_ring_create(numReplicas, HASH_FUNCTION_MD5);
+        assert(hash_ring_set_layout(ring, layouts[l]) == HASH_RING_OK);
+        assert(hash_ring_add_nodes(ring, names, nameLens, numNodes) == HASH_RING_OK);
+
+        hash_ring_stats_t stats;
+        hash_ring_get_stats(ring, &stats);
+
+        hash_ring_item_t item;
+        uint64_t sum = 0;
+        startTiming();
+        for(x = 0; x < numSearches; x++) {
+            sum += hash_ring_find_next_highest_item(ring, nums[x], &item)->number;
+        }
+        uint64_t single = endTiming();
+
+        startTiming();
+        assert(hash_ring_find_nodes_batch_hashed(ring, nums, numSearches, nodes) == HASH_RING_OK);
+        uint64_t batch = endTiming();
+
+        printf("%-9s: items = %d, items: %" PRIu64 " bytes (%.1f/item), index: %" PRIu64 " bytes, "
+            "lookup %.1fns, batched %.1fns (checksum %d)\n",
+            layoutNames[l], ring->numItems, stats.itemBytes, (double)stats.itemBytes / ring->numItems,
+            stats.indexBytes, (double)single / numSearches, (double)batch / numSearches, (int)(sum & 0xff));
+        hash_ring_free(ring);
+    }
+
+    free(nums);
+    free(nodes);
+    freeNames(names, nameLens, numNodes);
+}
+
+/**
+ * Builds a ring from scratch with the nodes of ring, in nodeTable order and with the same
+ * replica counts, and checks that the two rings have the same items.
+ */
+void assertSameAsReweighted(hash_ring_t *ring) {
+    hash_ring_t *rebuilt = hash_ring_create(ring->numReplicas, ring->hash_fn);
+    uint32_t x;
+    for(x = 0; x < ring->numNodes; x++) {
+        hash_ring_node_t *node = ring->nodeTable[x];
+        assert(hash_ring_add_node_weighted(rebuilt, node->name, node->nameLen,
+            (double)node->numReplicas / ring->numReplicas) == HASH_RING_OK);
+        assert(rebuilt->nodeTable[x]->numReplicas == node->numReplicas);
+    }
+    assert(rebuilt->numItems == ring->numItems);
+    assert(memcmp(rebuilt->items, ring->items, sizeof(uint64_t) * ring->numItems) == 0);
+    assert(memcmp(rebuilt->itemNodes, ring->itemNodes, sizeof(uint32_t) * ring->numItems) == 0);
+    hash_ring_free(rebuilt);
+}
+
+void testWeightedNodes() {
+    printf("Test weighted nodes...\n");
+
+    hash_ring_t *ring = hash_ring_create(100, HASH_FUNCTION_MD5);
+    hash_ring_node_t *nodes[4];
+    int numKeys = 100000, x;
+
+    assert(hash_ring_add_node(ring, (uint8_t*)"small", 5) == HASH_RING_OK);
+    assert(hash_ring_add_node_weighted(ring, (uint8_t*)"large", 5, 2.0) == HASH_RING_OK);
+    assert(hash_ring_add_node_weighted(ring, (uint8_t*)"half", 4, 0.5) == HASH_RING_OK);
+    assert(hash_ring_add_node_weighted(ring, (uint8_t*)"tiny", 4, 0.001) == HASH_RING_OK);
+    assert(hash_ring_add_node_weighted(ring, (uint8_t*)"zero", 4, 0) == HASH_RING_ERR);
+    assert(hash_ring_add_node_weighted(ring, (uint8_t*)"negative", 8, -1) == HASH_RING_ERR);
+    assert(hash_ring_add_node_weighted(ring, (uint8_t*)"large", 5, 1.0) == HASH_RING_ERR);
+    assert(hash_ring_get_node(ring, (uint8_t*)"small", 5)->numReplicas == 100);
+    assert(hash_ring_get_node(ring, (uint8_t*)"large", 5)->numReplicas == 200);
+    assert(hash_ring_get_node(ring, (uint8_t*)"half", 4)->numReplicas == 50);
+    assert(hash_ring_get_node(ring, (uint8_t*)"tiny", 4)->numReplicas == 1);
+    assert(ring->numItems == 351);
+    assertSameAsReweighted(ring);
+
+    // Keys are shared out about in proportion to the weights
+    hash_ring_node_t **before = (hash_ring_node_t**)malloc(sizeof(hash_ring_node_t*) * numKeys);
+    uint64_t *nums = (uint64_t*)malloc(sizeof(uint64_t) * numKeys);
+    int smallKeys = 0, largeKeys = 0;
+    for(x = 0; x < numKeys; x++) {
+        nums[x] = randomPosition();
+    }
+    assert(hash_ring_find_nodes_batch_hashed(ring, nums, numKeys, before) == HASH_RING_OK);
+    for(x = 0; x < numKeys; x++) {
+        if(before[x]->nameLen == 5 && memcmp(before[x]->name, "small", 5) == 0) smallKeys++;
+        if(before[x]->nameLen == 5 && memcmp(before[x]->name, "large", 5) == 0) largeKeys++;
+    }
+    assert(largeKeys > smallKeys * 3 / 2 && largeKeys < smallKeys * 5 / 2);
+
+    // Lowering a weight only moves keys off that node, raising one only moves keys onto it
+    hash_ring_node_t *large = hash_ring_get_node(ring, (uint8_t*)"large", 5);
+    hash_ring_item_t item;
+    assert(hash_ring_set_node_weight(ring, (uint8_t*)"large", 5, 0.75) == HASH_RING_OK);
+    assert(large->numReplicas == 75 && ring->numItems == 226);
+    assertSameAsReweighted(ring);
+    for(x = 0; x < numKeys; x++) {
+        hash_ring_node_t *node = hash_ring_find_next_highest_item(ring, nums[x], &item)->node;
+        assert(before[x] == large || node == before[x]);
+        before[x] = node;
+    }
+
+    hash_ring_node_t *half = hash_ring_get_node(ring, (uint8_t*)"half", 4);
+    assert(hash_ring_set_node_weight(ring, (uint8_t*)"half", 4, 3.0) == HASH_RING_OK);
+    assert(half->numReplicas == 300 && ring->numItems == 476);
+    assertSameAsReweighted(ring);
+    for(x = 0; x < numKeys; x++) {
+        hash_ring_node_t *node = hash_ring_find_next_highest_item(ring, nums[x], &item)->node;
+        assert(node == half || node == before[x]);
+    }
+    assert(hash_ring_set_node_weight(ring, (uint8_t*)"half", 4, 3.0) == HASH_RING_OK);
+    assert(hash_ring_set_node_weight(ring, (uint8_t*)"half", 4, 0) == HASH_RING_ERR);
+    assert(hash_ring_set_node_weight(ring, (uint8_t*)"missing", 7, 1.0) == HASH_RING_ERR);
+    assert(ring->numItems == 476);
+
+    // Every node is still found once by hash_ring_find_nodes
+    assert(hash_ring_find_nodes(ring, (uint8_t*)"key", 3, nodes, 4) == 4);
+    for(x = 0; x < 4; x++) {
+        assert(nodes[x] != nodes[(x + 1) % 4] && nodes[x] != nodes[(x + 2) % 4]);
+    }
+
+    // Removing a node moves the last node, which has a different number of replicas,
+    // into its place
+    assert(hash_ring_remove_node(ring, (uint8_t*)"small", 5) == HASH_RING_OK);
+    assert(ring->numItems == 376 && ring->nodeTable[0]->numReplicas == 1);
+    assertSameAsReweighted(ring);
+    assert(hash_ring_remove_node(ring, (uint8_t*)"half", 4) == HASH_RING_OK);
+    assertSameAsReweighted(ring);
+    assert(ring->numItems == 76);
+
+    // A compact ring gives the same nodes as a wide one with the same weights
+    hash_ring_t *compact = hash_ring_create(100, HASH_FUNCTION_MD5);
+    assert(hash_ring_set_layout(compact, HASH_RING_LAYOUT_COMPACT16) == HASH_RING_OK);
+    for(x = 0; x < ring->numNodes; x++) {
+        assert(hash_ring_add_node(compact, ring->nodeTable[x]->name, ring->nodeTable[x]->nameLen) == HASH_RING_OK);
+        assert(hash_ring_set_node_weight(compact, ring->nodeTable[x]->name, ring->nodeTable[x]->nameLen,
+            (double)ring->nodeTable[x]->numReplicas / 100) == HASH_RING_OK);
+    }
+    assertSameAsWide(compact, ring);
+    hash_ring_free(compact);
+
+    free(before);
+    free(nums);
+    hash_ring_free(ring);
+}
+
+typedef struct boundedWorker {
+    hash_ring_t *ring;
+    uint8_t **keys;
+    uint32_t *keyLens;
+    int numKeys;
+} boundedWorker;
+
+void *boundedWorkerMain(void *arg) {
+    boundedWorker *worker = (boundedWorker*)arg;
+    hash_ring_node_t *assigned[64];
+    int x, y;
+    for(x = 0; x < worker->numKeys; x += 64) {
+        for(y = 0; y < 64; y++) {
+            assigned[y] = hash_ring_find_node_bounded(worker->ring, worker->keys[(x + y) % worker->numKeys],
+                worker->keyLens[(x + y) % worker->numKeys]);
+            assert(assigned[y] != NULL);
+        }
+        for(y = 0; y < 64; y++) {
+            assert(hash_ring_release_load(worker->ring, assigned[y]) == HASH_RING_OK);
+        }
+    }
+    return NULL;
+}
+
+uint64_t ceilLoad(double load) {
+    uint64_t result = (uint64_t)load;
+    return result < load ? result + 1 : result;
+}
+
+/**
+ * Checks that the node loads add up to the ring's total and returns the highest.
+ */
+uint64_t maxNodeLoad(hash_ring_t *ring) {
+    uint64_t total = 0, max = 0;
+    uint32_t x;
+    for(x = 0; x < ring->numNodes; x++) {
+        total += ring->nodeTable[x]->load;
+        if(ring->nodeTable[x]->load > max) max = ring->nodeTable[x]->load;
+    }
+    assert(total == ring->totalLoad);
+    return max;
+}
+
+void testBoundedLoads() {
+    printf("Test bounded load lookups...\n");
+
+    int numNodes = 10, numReplicas = 100, numKeys = 10000, x;
+    uint32_t *nameLens, *keyLens;
+    uint8_t **names = makeNames("server", numNodes, &nameLens);
+    uint8_t **keys = makeNames("key", numKeys, &keyLens);
+    hash_ring_node_t **assigned = (hash_ring_node_t**)malloc(sizeof(hash_ring_node_t*) * numKeys);
+    hash_ring_t *ring = hash_ring_create_from_nodes(names, nameLens, numNodes, numReplicas,
+        HASH_FUNCTION_MD5, HASH_RING_MODE_NORMAL);
+
+    assert(hash_ring_find_node_bounded(NULL, keys[0], keyLens[0]) == NULL);
+    assert(hash_ring_set_load_factor(ring, 0.5) == HASH_RING_ERR);
+    assert(hash_ring_release_load(ring, ring->nodeTable[0]) == HASH_RING_ERR);
+
+    // Nothing is loaded yet, so the first key goes to its consistent hashing node
+    assigned[0] = hash_ring_find_node_bounded(ring, keys[0], keyLens[0]);
+    assert(assigned[0] == hash_ring_find_node(ring, keys[0], keyLens[0]));
+    assert(assigned[0]->load == 1 && ring->totalLoad == 1);
+    assert(hash_ring_release_load(ring, assigned[0]) == HASH_RING_OK);
+    assert(assigned[0]->load == 0 && ring->totalLoad == 0);
+
+    // No node ever gets more than the factor times its share
+    double factors[] = { 1.25, 1.0 };
+    int f;
+    for(f = 0; f < 2; f++) {
+        assert(hash_ring_set_load_factor(ring, factors[f]) == HASH_RING_OK);
+        for(x = 0; x < numKeys; x++) {
+            assigned[x] = hash_ring_find_node_bounded(ring, keys[x], keyLens[x]);
+            assert(assigned[x] != NULL);
+            assert(maxNodeLoad(ring) <= ceilLoad(factors[f] * (x + 1) / numNodes));
+        }
+        for(x = 0; x < numKeys; x++) {
+            assert(hash_ring_release_load(ring, assigned[x]) == HASH_RING_OK);
+        }
+        assert(maxNodeLoad(ring) == 0 && ring->totalLoad == 0);
+    }
+
+    // A node's capacity follows its weight
+    assert(hash_ring_set_node_weight(ring, names[0], nameLens[0], 3.0) == HASH_RING_OK);
+    for(x = 0; x < numKeys; x++) {
+        assigned[x] = hash_ring_find_node_bounded(ring, keys[x], keyLens[x]);
+    }
+    hash_ring_node_t *heavy = hash_ring_get_node(ring, names[0], nameLens[0]);
+    assert(heavy->load <= ceilLoad(1.0 * numKeys * 300 / ring->numItems));
+    assert(heavy->load > (uint64_t)maxNodeLoad(ring) / 2);
+
+    // Removing a node drops its keys, the copy of a ring has the same loads
+    hash_ring_t *copy = hash_ring_copy(ring);
+    assert(copy->totalLoad == ring->totalLoad && copy->loadFactor == ring->loadFactor);
+    assert(copy->nodeTable[3]->load == ring->nodeTable[3]->load);
+    uint64_t load = ring->nodeTable[3]->load;
+    assert(hash_ring_remove_node(ring, names[3], nameLens[3]) == HASH_RING_OK);
+    assert(ring->totalLoad == numKeys - load);
+    maxNodeLoad(ring);
+    hash_ring_free(copy);
+    hash_ring_free(ring);
+
+    // Threads looking up and releasing keys at once leave every load at 0
+    ring = hash_ring_create_from_nodes(names, nameLens, numNodes, numReplicas,
+        HASH_FUNCTION_MD5, HASH_RING_MODE_NORMAL);
+    boundedWorker workers[4];
+    pthread_t threads[4];
+    for(x = 0; x < 4; x++) {
+        workers[x].ring = ring;
+        workers[x].keys = keys;
+        workers[x].keyLens = keyLens;
+        workers[x].numKeys = numKeys;
+        assert(pthread_create(&threads[x], NULL, boundedWorkerMain, &workers[x]) == 0);
+    }
+    for(x = 0; x < 4; x++) {
+        pthread_join(threads[x], NULL);
+    }
+    assert(maxNodeLoad(ring) == 0 && ring->totalLoad == 0);
+    hash_ring_free(ring);
+
+    free(assigned);
+    freeNames(names, nameLens, numNodes);
+    freeNames(keys, keyLens, numKeys);
+}
+
+/**
+ * Fills ids with numbers in [0, numIds) drawn from a Zipf distribution with exponent 1.
+ */
+void fillZipf(uint32_t *ids, int count, uint32_t numIds) {
+    double *cdf = (double*)malloc(sizeof(double) * numIds);
+    double sum = 0;
+    uint32_t x;
+    for(x = 0; x < numIds; x++) {
+        sum += 1.0 / (x + 1);
+        cdf[x] = sum;
+    }
+    int y;
+    for(y = 0; y < count; y++) {
+        double u = ((double)rand() * ((double)RAND_MAX + 1) + rand()) / (((double)RAND_MAX + 1) * ((double)RAND_MAX + 1)) * sum;
+        uint32_t low = 0, high = numIds - 1;
+        while(low < high) {
+            uint32_t mid = (low + high) / 2;
+            if(cdf[mid] < u) low = mid + 1;
+            else high = mid;
+        }
+        ids[y] = low;
+    }
+    free(cdf);
+}
+
+void runBoundedLoadBenchmark() {
+    printf("----------------------------------------------------\n");
+    printf("bounded load bench\n");
+    printf("----------------------------------------------------\n");
+
+    // Requests for Zipf distributed keys, each held by its node until window more
+    // requests have arrived
+    int numNodes = 100, numReplicas = 160, numKeys = 100000, numRequests = 1000000, window = 10000, x;
+    uint32_t *nameLens, *keyLens;
+    uint8_t **names = makeNames("server", numNodes, &nameLens);
+    uint8_t **keys = makeNames("key", numKeys, &keyLens);
+    uint32_t *ids = (uint32_t*)malloc(sizeof(uint32_t) * numRequests);
+    hash_ring_node_t **held = (hash_ring_node_t**)malloc(sizeof(hash_ring_node_t*) * window);
+    uint64_t *loads = (uint64_t*)calloc(numNodes, sizeof(uint64_t));
+    fillZipf(ids, numRequests, numKeys);
+
+    hash_ring_t *ring = hash_ring_create_from_nodes(names, nameLens, numNodes, numReplicas,
+        HASH_FUNCTION_MD5, HASH_RING_MODE_NORMAL);
+    double mean = (double)window / numNodes;
+
+    // Plain consistent hashing, counting the loads here
+    uint64_t max = 0, y;
+    startTiming();
+    for(x = 0; x < numRequests; x++) {
+        if(x >= window) loads[held[x % window]->index]--;
+        hash_ring_node_t *node = hash_ring_find_node(ring, keys[ids[x]], keyLens[ids[x]]);
+        held[x % window] = node;
+        if(++loads[node->index] > max && x >= window) max = loads[node->index];
+    }
+    uint64_t plainTime = endTiming();
+    printf("consistent hashing: max/mean load %.2f, %.1fns/lookup\n", max / mean, (double)plainTime / numRequests);
+
+    double factors[] = { 1.5, 1.25, 1.1 };
+    int f;
+    for(f = 0; f < 3; f++) {
+        assert(hash_ring_set_load_factor(ring, factors[f]) == HASH_RING_OK);
+        max = 0;
+        startTiming();
+        for(x = 0; x < numRequests; x++) {
+            if(x >= window) hash_ring_release_load(ring, held[x % window]);
+            hash_ring_node_t *node = hash_ring_find_node_bounded(ring, keys[ids[x]], keyLens[ids[x]]);
+            held[x % window] = node;
+            if(node->load > max && x >= window) max = node->load;
+        }
+        uint64_t boundedTime = endTiming();
+        printf("bounded loads, factor %.2f: max/mean load %.2f, %.1fns/lookup and release\n",
+            factors[f], max / mean, (double)boundedTime / numRequests);
+        for(y = 0; y < (uint64_t)window && y < (uint64_t)numRequests; y++) {
+            hash_ring_release_load(ring, held[y]);
+        }
+    }
+
+    hash_ring_free(ring);
+    free(ids);
+    free(held);
+    free(loads);
+    freeNames(names, nameLens, numNodes);
+    freeNames(keys, keyLens, numKeys);
+}
+
+/**
+ * Jump consistent hashing as given in the paper.
+ */
+int32_t referenceJump(uint64_t key, int32_t numBuckets) {
+    int64_t b = -1, j = 0;
+    while(j < numBuckets) {
+        b = j;
+        key = key * 2862933555777941757ULL + 1;
+        j = (b + 1) * ((double)(1LL << 31) / (double)((key >> 33) + 1));
+    }
+    return b;
+}
+
+void testJumpMode() {
+    printf("Test jump consistent hashing mode...\n");
+
+    int numNodes = 10, numKeys = 100000, x, y;
+    uint32_t *nameLens, *keyLens;
+    uint8_t **names = makeNames("server", numNodes + 1, &nameLens);
+    uint8_t **keys = makeNames("key", numKeys, &keyLens);
+    hash_ring_node_t **before = (hash_ring_node_t**)malloc(sizeof(hash_ring_node_t*) * numKeys);
+    hash_ring_node_t **after = (hash_ring_node_t**)malloc(sizeof(hash_ring_node_t*) * numKeys);
+    hash_ring_t *ring = hash_ring_create_from_nodes(names, nameLens, numNodes, 8,
+        HASH_FUNCTION_MD5, HASH_RING_MODE_JUMP);
+    assert(ring != NULL);
+    assert(ring->numNodes == numNodes && ring->numItems == 0);
+
+    // Nodes are buckets in the order they were added
+    hash_ring_item_t item;
+    for(x = 0; x < 1000; x++) {
+        uint64_t num = randomPosition();
+        assert(hash_ring_find_next_highest_item(ring, num, &item) == &item);
+        assert(item.number == num);
+        assert(item.node->index == (uint32_t)referenceJump(num, numNodes));
+    }
+
+    // Keys are spread evenly
+    int counts[11] = { 0 };
+    for(x = 0; x < numKeys; x++) {
+        before[x] = hash_ring_find_node(ring, keys[x], keyLens[x]);
+        counts[before[x]->index]++;
+    }
+    for(x = 0; x < numNodes; x++) {
+        assert(counts[x] > numKeys / numNodes * 95 / 100 && counts[x] < numKeys / numNodes * 105 / 100);
+    }
+    assert(hash_ring_find_nodes_batch(ring, keys, keyLens, numKeys, after) == HASH_RING_OK);
+    assert(memcmp(before, after, sizeof(hash_ring_node_t*) * numKeys) == 0);
+
+    // The distinct nodes for a key start with its own node
+    hash_ring_node_t *found[11];
+    for(x = 0; x < 1000; x++) {
+        assert(hash_ring_find_nodes(ring, keys[x], keyLens[x], found, 3) == 3);
+        assert(found[0] == before[x] && found[1] != found[0] && found[2] != found[0] && found[2] != found[1]);
+    }
+    assert(hash_ring_find_nodes(ring, keys[0], keyLens[0], found, 11) == numNodes);
+    for(x = 0; x < numNodes; x++) {
+        for(y = 0; y < x; y++) {
+            assert(found[x] != found[y]);
+        }
+    }
+
+    // Adding a node only moves keys onto it, about 1 / 11 of them
+    hash_ring_t *copy = hash_ring_copy(ring);
+    assert(hash_ring_add_node(ring, names[numNodes], nameLens[numNodes]) == HASH_RING_OK);
+    int moved = 0;
+    for(x = 0; x < numKeys; x++) {
+        hash_ring_node_t *node = hash_ring_find_node(ring, keys[x], keyLens[x]);
+        if(node != before[x]) {
+            assert(node->index == (uint32_t)numNodes);
+            moved++;
+        }
+    }
+    assert(moved > numKeys / 11 * 9 / 10 && moved < numKeys / 11 * 11 / 10);
+
+    // Only the last node can be removed, which puts the keys back
+    assert(hash_ring_remove_node(ring, names[3], nameLens[3]) == HASH_RING_ERR);
+    assert(hash_ring_remove_node(ring, names[numNodes], nameLens[numNodes]) == HASH_RING_OK);
+    for(x = 0; x < numKeys; x++) {
+        assert(hash_ring_find_node(ring, keys[x], keyLens[x]) == before[x]);
+        assert(hash_ring_find_node(copy, keys[x], keyLens[x])->index == before[x]->index);
+    }
+
+    // Nodes have no items, so they can't be weighted or change modes
+    assert(hash_ring_add_node_weighted(ring, names[numNodes], nameLens[numNodes], 2.0) == HASH_RING_ERR);
+    assert(hash_ring_set_node_weight(ring, names[0], nameLens[0], 2.0) == HASH_RING_ERR);
+    assert(hash_ring_set_mode(ring, HASH_RING_MODE_NORMAL) == HASH_RING_ERR);
+    assert(hash_ring_find_node_bounded(ring, keys[0], keyLens[0]) == NULL);
+    hash_ring_stats_t stats;
+    assert(hash_ring_get_stats(ring, &stats) == HASH_RING_OK);
+    assert(stats.itemBytes == 0 && stats.indexBytes == 0);
+
+    // Emptied, the ring can change modes again
+    for(x = numNodes - 1; x >= 0; x--) {
+        assert(hash_ring_remove_node(ring, names[x], nameLens[x]) == HASH_RING_OK);
+    }
+    assert(hash_ring_find_node(ring, keys[0], keyLens[0]) == NULL);
+    assert(hash_ring_find_nodes(ring, keys[0], keyLens[0], found, 3) == -1);
+    assert(hash_ring_set_mode(ring, HASH_RING_MODE_NORMAL) == HASH_RING_OK);
+    assert(hash_ring_add_node(ring, names[0], nameLens[0]) == HASH_RING_OK);
+    assert(ring->numItems == 8);
+    assert(hash_ring_set_mode(ring, HASH_RING_MODE_JUMP) == HASH_RING_ERR);
+
+    hash_ring_free(copy);
+    hash_ring_free(ring);
+    free(before);
+    free(after);
+    freeNames(names, nameLens, numNodes + 1);
+    freeNames(keys, keyLens, numKeys);
+}
+
+void runJumpBenchmark() {
+    printf("----------------------------------------------------\n");
+    printf("jump bench\n");
+    printf("----------------------------------------------------\n");
+
+    int nodeCounts[] = { 10, 100, 1000, 10000 };
+    int numReplicas = 160, numSearches = 1000000, n, m, x;
+    uint32_t *nameLens;
+    uint8_t **names = makeNames("server", 10000, &nameLens);
+    uint64_t *nums = (uint64_t*)malloc(sizeof(uint64_t) * numSearches);
+    for(x = 0; x < numSearches; x++) {
+        nums[x] = randomPosition();
+    }
+
+    for(n = 0; n < 4; n++) {
+        for(m = 0; m < 2; m++) {
+            HASH_MODE mode = m == 0 ? HASH_RING_MODE_NORMAL : HASH_RING_MODE_JUMP;
+            hash_ring_t *ring = hash_ring_create_from_nodes(names, nameLens, nodeCounts[n], numReplicas,
+                HASH_FUNCTION_MD5, mode);
+            hash_ring_stats_t stats;
+            hash_ring_get_stats(ring, &stats);
+
+            hash_ring_item_t item;
+            uint64_t sum = 0;
+            startTiming();
+            for(x = 0; x < numSearches; x++) {
+                sum += hash_ring_find_next_highest_item(ring, nums[x], &item)->node->index;
+            }
+            uint64_t single = endTiming();
+
+            printf("nodes = %5d, %-5s: items + index %8" PRIu64 " bytes, nodes %7" PRIu64 " bytes, "
+                "lookup %.1fns (checksum %d)\n",
+                nodeCounts[n], m == 0 ? "ring" : "jump", stats.itemBytes + stats.indexBytes, stats.nodeBytes,
+                (double)single / numSearches, (int)(sum & 0xff));
+            hash_ring_free(ring);
+        }
+    }
+
+    free(nums);
+    freeNames(names, nameLens, 10000);
+}
+
+void testMaglevMode() {
+    printf("Test Maglev mode...\n");
+
+    int numNodes = 100, numKeys = 100000, x, y;
+    uint32_t *nameLens, *keyLens;
+    uint8_t **names = makeNames("server", numNodes, &nameLens);
+    uint8_t **keys = makeNames("key", numKeys, &keyLens);
+    hash_ring_node_t **before = (hash_ring_node_t**)malloc(sizeof(hash_ring_node_t*) * numKeys);
+    hash_ring_node_t **after = (hash_ring_node_t**)malloc(sizeof(hash_ring_node_t*) * numKeys);
+
+    hash_ring_t *ring = hash_ring_create(1, HASH_FUNCTION_MD5);
+    assert(hash_ring_set_maglev_size(ring, 1) == HASH_RING_ERR);
+    assert(hash_ring_set_maglev_size(ring, 10000) == HASH_RING_OK);
+    assert(ring->maglevSize == 10007);
+    assert(hash_ring_set_maglev_size(ring, 7) == HASH_RING_OK && ring->maglevSize == 7);
+    assert(hash_ring_set_mode(ring, HASH_RING_MODE_MAGLEV) == HASH_RING_OK);
+
+    // The ring can't have more nodes than entries
+    assert(hash_ring_add_nodes(ring, names, nameLens, 8) == HASH_RING_ERR);
+    assert(ring->numNodes == 0);
+    assert(hash_ring_add_nodes(ring, names, nameLens, 7) == HASH_RING_OK);
+    assert(hash_ring_add_node(ring, names[7], nameLens[7]) == HASH_RING_ERR);
+    assert(hash_ring_set_maglev_size(ring, 1000) == HASH_RING_ERR);
+    hash_ring_free(ring);
+
+    ring = hash_ring_create(1, HASH_FUNCTION_MD5);
+    assert(hash_ring_set_mode(ring, HASH_RING_MODE_MAGLEV) == HASH_RING_OK);
+    assert(hash_ring_add_nodes(ring, names, nameLens, numNodes) == HASH_RING_OK);
+    assert(ring->numItems == 0 && ring->maglevSize == HASH_RING_DEFAULT_MAGLEV_SIZE);
+    hash_ring_stats_t stats;
+    assert(hash_ring_get_stats(ring, &stats) == HASH_RING_OK);
+    assert(stats.itemBytes == 0 && stats.tableBytes == sizeof(uint32_t) * HASH_RING_DEFAULT_MAGLEV_SIZE);
+
+    // Every node owns as many entries as any other, give or take one
+    uint32_t counts[100] = { 0 };
+    for(x = 0; x < (int)ring->maglevSize; x++) {
+        counts[ring->maglevTable[x]]++;
+    }
+    for(x = 0; x < numNodes; x++) {
+        assert(counts[x] == ring->maglevSize / numNodes || counts[x] == ring->maglevSize / numNodes + 1);
+    }
+
+    // A key's node is its table entry, found the same way by every lookup
+    hash_ring_item_t item;
+    for(x = 0; x < 1000; x++) {
+        uint64_t num = randomPosition();
+        assert(hash_ring_find_next_highest_item(ring, num, &item) == &item && item.number == num);
+        assert(item.node->index == ring->maglevTable[(uint32_t)(((unsigned __int128)num * ring->maglevSize) >> 64)]);
+    }
+    for(x = 0; x < numKeys; x++) {
+        before[x] = hash_ring_find_node(ring, keys[x], keyLens[x]);
+    }
+    assert(hash_ring_find_nodes_batch(ring, keys, keyLens, numKeys, after) == HASH_RING_OK);
+    assert(memcmp(before, after, sizeof(hash_ring_node_t*) * numKeys) == 0);
+
+    hash_ring_node_t *found[5];
+    for(x = 0; x < 1000; x++) {
+        assert(hash_ring_find_nodes(ring, keys[x], keyLens[x], found, 5) == 5);
+        assert(found[0] == before[x]);
+        for(y = 1; y < 5; y++) {
+            assert(found[y] != found[y - 1] && found[y] != found[0]);
+        }
+    }
+
+    // The table only depends on the set of nodes. Nodes were added in order, so a node's
+    // index in ring and copy is the index of its name.
+    hash_ring_t *reversed = hash_ring_create(1, HASH_FUNCTION_MD5);
+    assert(hash_ring_set_mode(reversed, HASH_RING_MODE_MAGLEV) == HASH_RING_OK);
+    for(x = numNodes - 1; x >= 0; x--) {
+        assert(hash_ring_add_node(reversed, names[x], nameLens[x]) == HASH_RING_OK);
+    }
+    hash_ring_t *copy = hash_ring_copy(ring);
+    for(x = 0; x < numKeys; x++) {
+        hash_ring_node_t *node = hash_ring_find_node(reversed, keys[x], keyLens[x]);
+        assert(hash_ring_get_node(copy, node->name, node->nameLen)->index == before[x]->index);
+        assert(hash_ring_find_node(copy, keys[x], keyLens[x])->index == before[x]->index);
+    }
+
+    // Removing a node moves its keys and few others
+    assert(hash_ring_remove_node(ring, names[3], nameLens[3]) == HASH_RING_OK);
+    int moved = 0;
+    for(x = 0; x < numKeys; x++) {
+        hash_ring_node_t *node = hash_ring_find_node(copy, keys[x], keyLens[x]);
+        uint32_t index = hash_ring_get_node(copy, node->name, node->nameLen)->index;
+        node = hash_ring_find_node(ring, keys[x], keyLens[x]);
+        uint32_t newIndex = hash_ring_get_node(copy, node->name, node->nameLen)->index;
+        assert(newIndex != 3);
+        if(index != 3 && newIndex != index) moved++;
+    }
+    assert(moved < numKeys / 50);
+
+    // Adding it back gives the table from before
+    assert(hash_ring_add_node(ring, names[3], nameLens[3]) == HASH_RING_OK);
+    for(x = 0; x < numKeys; x++) {
+        hash_ring_node_t *node = hash_ring_find_node(ring, keys[x], keyLens[x]);
+        assert(hash_ring_get_node(copy, node->name, node->nameLen)->index ==
+            hash_ring_find_node(copy, keys[x], keyLens[x])->index);
+    }
+
+    assert(hash_ring_add_node_weighted(ring, names[3], nameLens[3], 2.0) == HASH_RING_ERR);
+    assert(hash_ring_set_mode(ring, HASH_RING_MODE_NORMAL) == HASH_RING_ERR);
+    assert(hash_ring_set_mode(ring, HASH_RING_MODE_JUMP) == HASH_RING_ERR);
+    assert(hash_ring_find_node_bounded(ring, keys[0], keyLens[0]) == NULL);
+
+    hash_ring_free(reversed);
+    hash_ring_free(copy);
+    hash_ring_free(ring);
+    free(before);
+    free(after);
+    freeNames(names, nameLens, numNodes);
+    freeNames(keys, keyLens, numKeys);
+}
+
+/**
+ * The fraction of nums whose node, by name, is different in ring and other.
+ */
+double movedFraction(hash_ring_t *ring, hash_ring_t *other, uint64_t *nums, int numNums) {
+    hash_ring_item_t item, otherItem;
+    int moved = 0, x;
+    for(x = 0; x < numNums; x++) {
+        hash_ring_find_next_highest_item(ring, nums[x], &item);
+        hash_ring_find_next_highest_item(other, nums[x], &otherItem);
+        if(item.node->nameLen != otherItem.node->nameLen ||
+            memcmp(item.node->name, otherItem.node->name, item.node->nameLen) != 0) moved++;
+    }
+    return (double)moved / numNums;
+}
+
+void runMaglevBenchmark() {
+    printf("----------------------------------------------------\n");
+    printf("maglev bench\n");
+    printf("----------------------------------------------------\n");
+
+    HASH_MODE modes[] = { HASH_RING_MODE_NORMAL, HASH_RING_MODE_JUMP, HASH_RING_MODE_MAGLEV };
+    const char *modeNames[] = { "ring", "jump", "maglev" };
+    int nodeCounts[] = { 100, 1000 };
+    int numReplicas = 160, numSearches = 1000000, n, m, x;
+    uint32_t *nameLens;
+    uint8_t **names = makeNames("server", 1001, &nameLens);
+    uint64_t *nums = (uint64_t*)malloc(sizeof(uint64_t) * numSearches);
+    hash_ring_node_t **nodes = (hash_ring_node_t**)malloc(sizeof(hash_ring_node_t*) * numSearches);
+    for(x = 0; x < numSearches; x++) {
+        nums[x] = randomPosition();
+    }
+
+    for(n = 0; n < 2; n++) {
+        int numNodes = nodeCounts[n];
+        for(m = 0; m < 3; m++) {
+            startTiming();
+            hash_ring_t *ring = hash_ring_create_from_nodes(names, nameLens, numNodes, numReplicas,
+                HASH_FUNCTION_MD5, modes[m]);
+            uint64_t build = endTiming();
+
+            hash_ring_item_t item;
+            uint64_t sum = 0;
+            startTiming();
+            for(x = 0; x < numSearches; x++) {
+                sum += hash_ring_find_next_highest_item(ring, nums[x], &item)->node->index;
+            }
+            uint64_t single = endTiming();
+            startTiming();
+            assert(hash_ring_find_nodes_batch_hashed(ring, nums, numSearches, nodes) == HASH_RING_OK);
+            uint64_t batch = endTiming();
+
+            // Keys moved by adding a node, and by removing one, the last for jump
+            hash_ring_t *changed = hash_ring_copy(ring);
+            assert(hash_ring_add_node(changed, names[numNodes], nameLens[numNodes]) == HASH_RING_OK);
+            double added = movedFraction(ring, changed, nums, numSearches);
+            hash_ring_free(changed);
+            changed = hash_ring_copy(ring);
+            int removed = modes[m] == HASH_RING_MODE_JUMP ? numNodes - 1 : numNodes / 2;
+            assert(hash_ring_remove_node(changed, names[removed], nameLens[removed]) == HASH_RING_OK);
+            double removedMoved = movedFraction(ring, changed, nums, numSearches);
+            hash_ring_free(changed);
+
+            printf("nodes = %4d, %-6s: build %8.1fus, lookup %5.1fns, batched %5.1fns, "
+                "moved on add %.4f, on remove %.4f (ideal %.4f, %.4f) (checksum %d)\n",
+                numNodes, modeNames[m], (double)build / 1000, (double)single / numSearches,
+                (double)batch / numSearches, added, removedMoved, 1.0 / (numNodes + 1), 1.0 / numNodes,
+                (int)(sum & 0xff));
+            hash_ring_free(ring);
+        }
+    }
+
+    free(nums);
+    free(nodes);
+    freeNames(names, nameLens, 1001);
+}
+
+void testRendezvousKernels() {
+    int kernel, defaultKernel = rendezvous_get_kernel();
+    assert(rendezvous_kernel_supported(RENDEZVOUS_KERNEL_SCALAR));
+    assert(rendezvous_set_kernel(RENDEZVOUS_NUM_KERNELS) == -1);
+
+    uint64_t seeds[70], scores[70];
+    uint32_t numSeeds, x, y;
+    for(x = 0; x < 70; x++) {
+        seeds[x] = randomPosition();
+    }
+
+    for(kernel = 0; kernel < RENDEZVOUS_NUM_KERNELS; kernel++) {
+        if(!rendezvous_kernel_supported(kernel)) {
+            printf("Skipping rendezvous kernel %s, not supported by this CPU\n", rendezvous_kernel_name(kernel));
+            continue;
+        }
+        printf("Test rendezvous kernel %s...\n", rendezvous_kernel_name(kernel));
+        assert(rendezvous_set_kernel(kernel) == 0);
+
+        // Every length, to cover the partial vectors at the end
+        for(numSeeds = 1; numSeeds <= 70; numSeeds++) {
+            for(y = 0; y < 20; y++) {
+                uint64_t key = randomPosition();
+                rendezvous_score_all(seeds, numSeeds, key, scores);
+                for(x = 0; x < numSeeds; x++) {
+                    assert(scores[x] == rendezvous_score(key, seeds[x]));
+                }
+                assert(rendezvous_best(seeds, numSeeds, key) == rendezvous_best_scalar(seeds, numSeeds, key));
+                assert(scores[rendezvous_best(seeds, numSeeds, key)] >= scores[y % numSeeds]);
+            }
+        }
+
+        // Repeated seeds tie, the first one wins
+        uint64_t repeated[20];
+        for(x = 0; x < 20; x++) {
+            repeated[x] = seeds[x % 5];
+        }
+        for(y = 0; y < 100; y++) {
+            assert(rendezvous_best(repeated, 20, randomPosition()) < 5);
+        }
+    }
+
+    assert(rendezvous_set_kernel(defaultKernel) == 0);
+}
+
+/**
+ * The index of node's name in the names made by makeNames.
+ */
+int nameIndex(hash_ring_node_t *node) {
+    // Node names aren't null terminated
+    int index = 0;
+    uint32_t x = node->nameLen;
+    while(x > 0 && node->name[x - 1] != '-') x--;
+    for(; x < node->nameLen; x++) {
+        index = index * 10 + (node->name[x] - '0');
+    }
+    return index;
+}
+
+void testRendezvousMode() {
+    printf("Test rendezvous mode...\n");
+
+    int numNodes = 16, numKeys = 100000, x, y;
+    uint32_t *nameLens, *keyLens;
+    uint8_t **names = makeNames("server", 100, &nameLens);
+    uint8_t **keys = makeNames("key", numKeys, &keyLens);
+    int *before = (int*)malloc(sizeof(int) * numKeys);
+    hash_ring_node_t **found = (hash_ring_node_t**)malloc(sizeof(hash_ring_node_t*) * numKeys);
+    hash_ring_node_t *top[100], *others[100];
+
+    hash_ring_t *ring = hash_ring_create_from_nodes(names, nameLens, numNodes, 1, HASH_FUNCTION_MD5,
+        HASH_RING_MODE_RENDEZVOUS);
+    assert(ring != NULL && ring->numItems == 0);
+
+    // Keys are spread evenly without any replicas
+    int counts[16] = { 0 };
+    for(x = 0; x < numKeys; x++) {
+        hash_ring_node_t *node = hash_ring_find_node(ring, keys[x], keyLens[x]);
+        before[x] = nameIndex(node);
+        counts[node->index]++;
+    }
+    for(x = 0; x < numNodes; x++) {
+        assert(counts[x] > numKeys / numNodes * 95 / 100 && counts[x] < numKeys / numNodes * 105 / 100);
+    }
+    assert(hash_ring_find_nodes_batch(ring, keys, keyLens, numKeys, found) == HASH_RING_OK);
+    for(x = 0; x < numKeys; x++) {
+        assert(nameIndex(found[x]) == before[x]);
+    }
+
+    // The best nodes come first, every node at most once
+    for(x = 0; x < 1000; x++) {
+        assert(hash_ring_find_nodes(ring, keys[x], keyLens[x], top, 20) == numNodes);
+        assert(nameIndex(top[0]) == before[x]);
+        for(y = 1; y < numNodes; y++) {
+            int z;
+            for(z = 0; z < y; z++) {
+                assert(top[y] != top[z]);
+            }
+        }
+    }
+
+    // Removing a node only moves its keys and drops it from the others' lists
+    hash_ring_t *copy = hash_ring_copy(ring);
+    assert(hash_ring_remove_node(ring, names[5], nameLens[5]) == HASH_RING_OK);
+    for(x = 0; x < numKeys; x++) {
+        int index = nameIndex(hash_ring_find_node(ring, keys[x], keyLens[x]));
+        assert(index != 5);
+        assert(before[x] == 5 || index == before[x]);
+        assert(nameIndex(hash_ring_find_node(copy, keys[x], keyLens[x])) == before[x]);
+    }
+    for(x = 0; x < 1000; x++) {
+        assert(hash_ring_find_nodes(copy, keys[x], keyLens[x], top, 4) == 4);
+        assert(hash_ring_find_nodes(ring, keys[x], keyLens[x], others, 3) == 3);
+        int z = 0;
+        for(y = 0; y < 4; y++) {
+            if(nameIndex(top[y]) == 5) continue;
+            if(z < 3) assert(others[z++] == hash_ring_get_node(ring, top[y]->name, top[y]->nameLen));
+        }
+    }
+
+    // Adding it back puts its keys back
+    assert(hash_ring_add_node(ring, names[5], nameLens[5]) == HASH_RING_OK);
+    for(x = 0; x < numKeys; x++) {
+        assert(nameIndex(hash_ring_find_node(ring, keys[x], keyLens[x])) == before[x]);
+    }
+
+    assert(hash_ring_add_node_weighted(ring, names[20], nameLens[20], 2.0) == HASH_RING_ERR);
+    assert(hash_ring_set_mode(ring, HASH_RING_MODE_NORMAL) == HASH_RING_ERR);
+    assert(hash_ring_set_mode(ring, HASH_RING_MODE_MAGLEV) == HASH_RING_ERR);
+    assert(hash_ring_find_node_bounded(ring, keys[0], keyLens[0]) == NULL);
+    hash_ring_stats_t stats;
+    assert(hash_ring_get_stats(ring, &stats) == HASH_RING_OK);
+    assert(stats.itemBytes == 0 && stats.tableBytes >= sizeof(uint64_t) * numNodes);
+    hash_ring_free(copy);
+
+    // More nodes than fit in a block, and more wanted than are kept on the stack
+    assert(hash_ring_add_nodes(ring, names + numNodes, nameLens + numNodes, 100 - numNodes) == HASH_RING_OK);
+    for(x = 0; x < 100; x++) {
+        assert(hash_ring_find_nodes(ring, keys[x], keyLens[x], top, 100) == 100);
+        assert(top[0] == hash_ring_find_node(ring, keys[x], keyLens[x]));
+        assert(hash_ring_find_nodes(ring, keys[x], keyLens[x], others, 70) == 70);
+        assert(memcmp(top, others, sizeof(hash_ring_node_t*) * 70) == 0);
+    }
+    hash_ring_free(ring);
+
+    free(before);
+    free(found);
+    freeNames(names, nameLens, 100);
+    freeNames(keys, keyLens, numKeys);
+}
 
-    /**
-     * TODO - Add tests to make sure libmemcached compat hashes correctly.
-     */
+void runRendezvousBenchmark() {
+    printf("----------------------------------------------------\n");
+    printf("rendezvous bench\n");
+    printf("----------------------------------------------------\n");
+
+    int nodeCounts[] = { 8, 16, 32, 64, 128, 512 };
+    int numSearches = 1000000, defaultKernel = rendezvous_get_kernel(), n, kernel, x;
+    uint32_t *nameLens, *keyLens;
+    uint8_t **names = makeNames("server", 512, &nameLens);
+    uint8_t **keys = makeNames("key", 1000, &keyLens);
+    uint64_t *nums = (uint64_t*)malloc(sizeof(uint64_t) * numSearches);
+    hash_ring_node_t *top[3];
+    for(x = 0; x < numSearches; x++) {
+        nums[x] = randomPosition();
+    }
+
+    for(n = 0; n < 6; n++) {
+        hash_ring_t *ring = hash_ring_create_from_nodes(names, nameLens, nodeCounts[n], 1, HASH_FUNCTION_XXH3,
+            HASH_RING_MODE_RENDEZVOUS);
+        hash_ring_t *vnodes = hash_ring_create_from_nodes(names, nameLens, nodeCounts[n], 160, HASH_FUNCTION_XXH3,
+            HASH_RING_MODE_NORMAL);
+        hash_ring_item_t item;
+        uint64_t sum = 0;
+
+        startTiming();
+        for(x = 0; x < numSearches; x++) {
+            sum += hash_ring_find_next_highest_item(vnodes, nums[x], &item)->node->index;
+        }
+        printf("nodes = %3d, vnode ring: lookup %5.1fns", nodeCounts[n], (double)endTiming() / numSearches);
+        startTiming();
+        for(x = 0; x < numSearches; x++) {
+            hash_ring_find_nodes(vnodes, keys[x % 1000], keyLens[x % 1000], top, 3);
+        }
+        printf(", top 3 %5.1fns\n", (double)endTiming() / numSearches);
+
+        for(kernel = 0; kernel < RENDEZVOUS_NUM_KERNELS; kernel++) {
+            if(rendezvous_set_kernel(kernel) != 0) continue;
+            startTiming();
+            for(x = 0; x < numSearches; x++) {
+                sum += hash_ring_find_next_highest_item(ring, nums[x], &item)->node->index;
+            }
+            uint64_t single = endTiming();
+            startTiming();
+            for(x = 0; x < numSearches; x++) {
+                hash_ring_find_nodes(ring, keys[x % 1000], keyLens[x % 1000], top, 3);
+            }
+            uint64_t top3 = endTiming();
+            printf("nodes = %3d, rendezvous %-6s: lookup %5.1fns, top 3 %5.1fns (checksum %d)\n",
+                nodeCounts[n], rendezvous_kernel_name(kernel), (double)single / numSearches,
+                (double)top3 / numSearches, (int)(sum & 0xff));
+        }
+        rendezvous_set_kernel(defaultKernel);
+        hash_ring_free(ring);
+        hash_ring_free(vnodes);
+    }
+
+    free(nums);
+    freeNames(names, nameLens, 512);
+    freeNames(keys, keyLens, 1000);
+}
+
+/**
+ * The probes of HASH_RING_MODE_MULTIPROBE, the splitmix64 finalizer.
+ */
+uint64_t referenceRehash(uint64_t key) {
+    key += 0x9e3779b97f4a7c15ULL;
+    key = (key ^ (key >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    key = (key ^ (key >> 27)) * 0x94d049bb133111ebULL;
+    return key ^ (key >> 31);
+}
+
+/**
+ * The node of num with numProbes probes, from the successors of each probe on a normal ring.
+ */
+hash_ring_node_t *referenceMultiProbe(hash_ring_t *normal, uint64_t num, uint32_t numProbes) {
+    hash_ring_item_t item;
+    hash_ring_node_t *best = NULL;
+    uint64_t bestDistance = UINT64_MAX;
+    uint32_t x;
+
+    for(x = 0; x < numProbes; x++) {
+        hash_ring_find_next_highest_item(normal, num, &item);
+        if(item.number - num < bestDistance) {
+            bestDistance = item.number - num;
+            best = item.node;
+        }
+        num = referenceRehash(num);
+    }
+    return best;
+}
+
+/**
+ * The square root by Newton's method, the tests don't link libm.
+ */
+double squareRoot(double value) {
+    double root = value > 1 ? value : 1;
+    int x;
+    for(x = 0; x < 64; x++) {
+        root = (root + value / root) / 2;
+    }
+    return root;
+}
+
+/**
+ * Counts the keys of each node for numNums numbers, and returns the peak to mean load.
+ * The standard deviation over the mean goes to spread if it isn't NULL.
+ */
+double loadPeak(hash_ring_t *ring, uint64_t *nums, int numNums, double *spread) {
+    hash_ring_node_t *found[1000];
+    uint64_t *counts = (uint64_t*)calloc(ring->numNodes, sizeof(uint64_t));
+    uint64_t peak = 0;
+    double mean = (double)numNums / ring->numNodes, variance = 0;
+    int x, y;
+
+    for(x = 0; x < numNums; x += 1000) {
+        int n = numNums - x < 1000 ? numNums - x : 1000;
+        assert(hash_ring_find_nodes_batch_hashed(ring, nums + x, n, found) == HASH_RING_OK);
+        for(y = 0; y < n; y++) {
+            counts[found[y]->index]++;
+        }
+    }
+    for(x = 0; x < ring->numNodes; x++) {
+        if(counts[x] > peak) peak = counts[x];
+        variance += (counts[x] - mean) * (counts[x] - mean);
+    }
+    if(spread != NULL) *spread = squareRoot(variance / ring->numNodes) / mean;
+    free(counts);
+    return peak / mean;
+}
+
+void testMultiProbeMode() {
+    printf("Test multi-probe mode...\n");
+
+    int numNodes = 100, numNums = 200000, x, y;
+    uint32_t *nameLens, *keyLens;
+    uint8_t **names = makeNames("server", numNodes, &nameLens);
+    uint8_t **keys = makeNames("key", 1000, &keyLens);
+    uint64_t *nums = (uint64_t*)malloc(sizeof(uint64_t) * numNums);
+    hash_ring_node_t **found = (hash_ring_node_t**)malloc(sizeof(hash_ring_node_t*) * numNums);
+    hash_ring_node_t *top[10];
+    hash_ring_item_t item;
+    for(x = 0; x < numNums; x++) {
+        nums[x] = randomPosition();
+    }
+
+    hash_ring_t *normal = hash_ring_create_from_nodes(names, nameLens, numNodes, 1, HASH_FUNCTION_XXH3,
+        HASH_RING_MODE_NORMAL);
+    hash_ring_t *ring = hash_ring_create_from_nodes(names, nameLens, numNodes, 1, HASH_FUNCTION_XXH3,
+        HASH_RING_MODE_MULTIPROBE);
+    assert(ring != NULL && ring->numItems == numNodes && ring->numProbes == HASH_RING_DEFAULT_PROBES);
+
+    assert(hash_ring_set_probes(ring, 0) == HASH_RING_ERR);
+    assert(hash_ring_set_probes(ring, HASH_RING_MAX_PROBES + 1) == HASH_RING_ERR);
+    assert(ring->numProbes == HASH_RING_DEFAULT_PROBES);
+
+    // One probe is the normal ring
+    assert(hash_ring_set_probes(ring, 1) == HASH_RING_OK);
+    for(x = 0; x < numNums; x++) {
+        assert(nameIndex(hash_ring_find_next_highest_item(ring, nums[x], &item)->node) ==
+            nameIndex(hash_ring_find_next_highest_item(normal, nums[x], &item)->node));
+    }
+    double singlePeak = loadPeak(ring, nums, numNums, NULL);
+
+    // More probes pick the closest successor of any probe, whatever the number of probes
+    uint32_t probeCounts[] = { 2, 16, 17, 21, 40 };
+    for(y = 0; y < 5; y++) {
+        assert(hash_ring_set_probes(ring, probeCounts[y]) == HASH_RING_OK);
+        assert(hash_ring_find_nodes_batch_hashed(ring, nums, numNums, found) == HASH_RING_OK);
+        for(x = 0; x < 20000; x++) {
+            int expected = nameIndex(referenceMultiProbe(normal, nums[x], probeCounts[y]));
+            assert(nameIndex(hash_ring_find_next_highest_item(ring, nums[x], &item)->node) == expected);
+            assert(nameIndex(found[x]) == expected);
+        }
+    }
+
+    // And balance the nodes far better than a single replica can
+    assert(hash_ring_set_probes(ring, 21) == HASH_RING_OK);
+    double probedPeak = loadPeak(ring, nums, numNums, NULL);
+    assert(probedPeak < 1.3 && probedPeak < singlePeak);
+
+    // Keys hash the same way in the batch, and the other nodes follow the key's own
+    assert(hash_ring_find_nodes_batch(ring, keys, keyLens, 1000, found) == HASH_RING_OK);
+    for(x = 0; x < 1000; x++) {
+        assert(found[x] == hash_ring_find_node(ring, keys[x], keyLens[x]));
+        assert(hash_ring_find_nodes(ring, keys[x], keyLens[x], top, 10) == 10);
+        assert(top[0] == found[x]);
+        for(y = 1; y < 10; y++) {
+            int z;
+            for(z = 0; z < y; z++) {
+                assert(top[y] != top[z]);
+            }
+        }
+    }
+
+    // The frozen layout and copies probe the same way
+    hash_ring_t *copy = hash_ring_copy(ring);
+    assert(copy->numProbes == 21);
+    assert(hash_ring_freeze(ring) == HASH_RING_OK);
+    for(x = 0; x < 1000; x++) {
+        assert(hash_ring_find_node(ring, keys[x], keyLens[x]) == found[x]);
+        assert(nameIndex(hash_ring_find_node(copy, keys[x], keyLens[x])) == nameIndex(found[x]));
+    }
+    hash_ring_free(copy);
+
+    // Rings keep their items, so they switch to the normal mode and back
+    assert(hash_ring_set_mode(ring, HASH_RING_MODE_NORMAL) == HASH_RING_OK);
+    for(x = 0; x < 1000; x++) {
+        assert(nameIndex(hash_ring_find_node(ring, keys[x], keyLens[x])) ==
+            nameIndex(hash_ring_find_node(normal, keys[x], keyLens[x])));
+    }
+    assert(hash_ring_set_mode(ring, HASH_RING_MODE_MULTIPROBE) == HASH_RING_OK);
+    assert(hash_ring_set_mode(ring, HASH_RING_MODE_MAGLEV) == HASH_RING_ERR);
+
+    hash_ring_free(ring);
+    hash_ring_free(normal);
+    free(nums);
+    free(found);
+    freeNames(names, nameLens, numNodes);
+    freeNames(keys, keyLens, 1000);
+}
+
+void runMultiProbeBenchmark() {
+    printf("----------------------------------------------------\n");
+    printf("multi-probe bench\n");
+    printf("----------------------------------------------------\n");
+
+    uint32_t probeCounts[] = { 1, 5, 11, 21, 41 };
+    int numNodes = 100, numSearches = 1000000, x, p;
+    uint32_t *nameLens;
+    uint8_t **names = makeNames("server", numNodes, &nameLens);
+    uint64_t *nums = (uint64_t*)malloc(sizeof(uint64_t) * numSearches);
+    hash_ring_item_t item;
+    hash_ring_stats_t stats;
+    double spread, peak;
+    uint64_t sum = 0, elapsed;
+    for(x = 0; x < numSearches; x++) {
+        nums[x] = randomPosition();
+    }
+
+    hash_ring_t *vnodes = hash_ring_create_from_nodes(names, nameLens, numNodes, 160, HASH_FUNCTION_XXH3,
+        HASH_RING_MODE_NORMAL);
+    hash_ring_get_stats(vnodes, &stats);
+    startTiming();
+    for(x = 0; x < numSearches; x++) {
+        sum += hash_ring_find_next_highest_item(vnodes, nums[x], &item)->node->index;
+    }
+    elapsed = endTiming();
+    peak = loadPeak(vnodes, nums, numSearches, &spread);
+    printf("nodes = %d, 160 replicas:     memory %7llu bytes, lookup %6.1fns, peak/mean %.3f, stddev/mean %.3f\n",
+        numNodes, (unsigned long long)(stats.itemBytes + stats.indexBytes), (double)elapsed / numSearches,
+        peak, spread);
+
+    hash_ring_t *ring = hash_ring_create_from_nodes(names, nameLens, numNodes, 1, HASH_FUNCTION_XXH3,
+        HASH_RING_MODE_MULTIPROBE);
+    hash_ring_get_stats(ring, &stats);
+    for(p = 0; p < 5; p++) {
+        hash_ring_set_probes(ring, probeCounts[p]);
+        startTiming();
+        for(x = 0; x < numSearches; x++) {
+            sum += hash_ring_find_next_highest_item(ring, nums[x], &item)->node->index;
+        }
+        elapsed = endTiming();
+        peak = loadPeak(ring, nums, numSearches, &spread);
+        printf("nodes = %d, 1 replica, k = %2u: memory %7llu bytes, lookup %6.1fns, peak/mean %.3f, stddev/mean %.3f (checksum %d)\n",
+            numNodes, probeCounts[p], (unsigned long long)(stats.itemBytes + stats.indexBytes),
+            (double)elapsed / numSearches, peak, spread, (int)(sum & 0xff));
+    }
+
+    hash_ring_free(ring);
+    hash_ring_free(vnodes);
+    free(nums);
+    freeNames(names, nameLens, numNodes);
+}
+
+void testAnchorMode() {
+    printf("Test anchor mode...\n");
+
+    int numNodes = 100, numNums = 200000, removed[] = { 37, 0, 99, 50, 12 }, x, y;
+    uint32_t *nameLens, *keyLens;
+    uint8_t **names = makeNames("server", 150, &nameLens);
+    uint8_t **keys = makeNames("key", 1000, &keyLens);
+    uint64_t *nums = (uint64_t*)malloc(sizeof(uint64_t) * numNums);
+    int *before = (int*)malloc(sizeof(int) * numNums);
+    int *current = (int*)malloc(sizeof(int) * numNums);
+    hash_ring_node_t **found = (hash_ring_node_t**)malloc(sizeof(hash_ring_node_t*) * numNums);
+    hash_ring_node_t *top[10];
+    hash_ring_item_t item;
+    for(x = 0; x < numNums; x++) {
+        nums[x] = randomPosition();
+    }
+
+    hash_ring_t *ring = hash_ring_create_from_nodes(names, nameLens, numNodes, 1, HASH_FUNCTION_XXH3,
+        HASH_RING_MODE_ANCHOR);
+    assert(ring != NULL && ring->numItems == 0 && ring->anchorSize == HASH_RING_DEFAULT_ANCHOR_SIZE);
+
+    // Keys are spread evenly without any replicas, most buckets have no node
+    assert(loadPeak(ring, nums, numNums, NULL) < 1.15);
+    assert(hash_ring_find_nodes_batch_hashed(ring, nums, numNums, found) == HASH_RING_OK);
+    for(x = 0; x < numNums; x++) {
+        before[x] = current[x] = nameIndex(found[x]);
+        assert(hash_ring_find_next_highest_item(ring, nums[x], &item)->node == found[x]);
+    }
+
+    // Any node can be removed, which only moves its own keys
+    hash_ring_t *copy = hash_ring_copy(ring);
+    for(y = 0; y < 5; y++) {
+        assert(hash_ring_remove_node(ring, names[removed[y]], nameLens[removed[y]]) == HASH_RING_OK);
+        for(x = 0; x < numNums; x++) {
+            int index = nameIndex(hash_ring_find_next_highest_item(ring, nums[x], &item)->node);
+            assert(index != removed[y]);
+            assert(current[x] == removed[y] || index == current[x]);
+            current[x] = index;
+        }
+    }
+    assert(ring->numNodes == numNodes - 5 && loadPeak(ring, nums, numNums, NULL) < 1.15);
+    for(x = 0; x < numNums; x++) {
+        assert(nameIndex(hash_ring_find_next_highest_item(copy, nums[x], &item)->node) == before[x]);
+    }
+    hash_ring_free(copy);
+
+    // Nodes added back in the reverse order get their keys back
+    for(y = 4; y >= 0; y--) {
+        assert(hash_ring_add_node(ring, names[removed[y]], nameLens[removed[y]]) == HASH_RING_OK);
+    }
+    for(x = 0; x < numNums; x++) {
+        assert(nameIndex(hash_ring_find_next_highest_item(ring, nums[x], &item)->node) == before[x]);
+    }
+
+    // New nodes only take keys from the others
+    assert(hash_ring_add_nodes(ring, names + numNodes, nameLens + numNodes, 50) == HASH_RING_OK);
+    for(x = 0; x < numNums; x++) {
+        int index = nameIndex(hash_ring_find_next_highest_item(ring, nums[x], &item)->node);
+        assert(index == before[x] || index >= numNodes);
+    }
+    assert(loadPeak(ring, nums, numNums, NULL) < 1.15);
+
+    // Keys hash the same way in the batch, and find_nodes returns distinct nodes
+    assert(hash_ring_find_nodes_batch(ring, keys, keyLens, 1000, found) == HASH_RING_OK);
+    for(x = 0; x < 1000; x++) {
+        assert(found[x] == hash_ring_find_node(ring, keys[x], keyLens[x]));
+        assert(hash_ring_find_nodes(ring, keys[x], keyLens[x], top, 10) == 10);
+        assert(top[0] == found[x]);
+        for(y = 1; y < 10; y++) {
+            int z;
+            for(z = 0; z < y; z++) {
+                assert(top[y] != top[z]);
+            }
+        }
+    }
+
+    assert(hash_ring_add_node_weighted(ring, (uint8_t*)"weighted", 8, 2.0) == HASH_RING_ERR);
+    assert(hash_ring_set_mode(ring, HASH_RING_MODE_NORMAL) == HASH_RING_ERR);
+    assert(hash_ring_set_anchor_size(ring, 4096) == HASH_RING_ERR);
+    assert(hash_ring_find_node_bounded(ring, keys[0], keyLens[0]) == NULL);
+    hash_ring_stats_t stats;
+    assert(hash_ring_get_stats(ring, &stats) == HASH_RING_OK);
+    assert(stats.itemBytes == 0 &&
+        stats.tableBytes == (sizeof(hash_ring_node_t*) + sizeof(uint32_t) * 6) * HASH_RING_DEFAULT_ANCHOR_SIZE);
+    hash_ring_free(ring);
+
+    // The ring can't have more nodes than buckets
+    ring = hash_ring_create(1, HASH_FUNCTION_XXH3);
+    assert(hash_ring_set_mode(ring, HASH_RING_MODE_ANCHOR) == HASH_RING_OK);
+    assert(hash_ring_set_anchor_size(ring, 0) == HASH_RING_ERR);
+    assert(hash_ring_set_anchor_size(ring, HASH_RING_MAX_ANCHOR_SIZE + 1) == HASH_RING_ERR);
+    assert(hash_ring_set_anchor_size(ring, 8) == HASH_RING_OK);
+    assert(hash_ring_add_nodes(ring, names, nameLens, 9) == HASH_RING_ERR);
+    assert(hash_ring_add_nodes(ring, names, nameLens, 8) == HASH_RING_OK);
+    assert(hash_ring_add_node(ring, names[8], nameLens[8]) == HASH_RING_ERR);
+    assert(hash_ring_remove_node(ring, names[3], nameLens[3]) == HASH_RING_OK);
+    assert(hash_ring_add_node(ring, names[8], nameLens[8]) == HASH_RING_OK);
+    for(x = 0; x < numNums; x++) {
+        int index = nameIndex(hash_ring_find_next_highest_item(ring, nums[x], &item)->node);
+        assert(index != 3 && index <= 8);
+    }
+    hash_ring_free(ring);
+
+    free(nums);
+    free(before);
+    free(current);
+    free(found);
+    freeNames(names, nameLens, 150);
+    freeNames(keys, keyLens, 1000);
+}
+
+/**
+ * Checks that the held buckets of an anchor ring are the first numNodes of anchorWorking,
+ * each at its own anchorLocation and holding a node.
+ */
+void checkAnchor(hash_ring_t *ring) {
+    uint32_t x, held = 0;
+    for(x = 0; x < ring->numNodes; x++) {
+        uint32_t bucket = ring->anchorWorking[x];
+        assert(ring->anchorLocation[bucket] == x);
+        assert(ring->anchorRemoved[bucket] == 0 && ring->anchorNodes[bucket] != NULL);
+    }
+    for(x = 0; x < ring->anchorSize; x++) {
+        if(ring->anchorNodes[x] != NULL) held++;
+    }
+    assert(held == ring->numNodes);
+}
+
+void testAnchorChurn() {
+    printf("Test anchor mode churn...\n");
+
+    int numNames = 80, numNums = 5000, step, x;
+    uint32_t *nameLens;
+    uint8_t **names = makeNames("server", numNames, &nameLens);
+    uint64_t *nums = (uint64_t*)malloc(sizeof(uint64_t) * numNums);
+    int *before = (int*)malloc(sizeof(int) * numNums);
+    int *inRing = (int*)calloc(numNames, sizeof(int));
+    hash_ring_item_t item;
+    for(x = 0; x < numNums; x++) {
+        nums[x] = randomPosition();
+    }
+
+    hash_ring_t *ring = hash_ring_create(1, HASH_FUNCTION_XXH3);
+    assert(hash_ring_set_mode(ring, HASH_RING_MODE_ANCHOR) == HASH_RING_OK);
+    assert(hash_ring_set_anchor_size(ring, 64) == HASH_RING_OK);
+    assert(hash_ring_add_nodes(ring, names, nameLens, 20) == HASH_RING_OK);
+    for(x = 0; x < 20; x++) {
+        inRing[x] = 1;
+    }
+    for(x = 0; x < numNums; x++) {
+        before[x] = nameIndex(hash_ring_find_next_highest_item(ring, nums[x], &item)->node);
+    }
+
+    // Nodes fail and come back in any order, each change only moves the keys it must
+    for(step = 0; step < 2000; step++) {
+        int changed = rand() % numNames;
+        int adding = !inRing[changed];
+        if(adding && ring->numNodes == ring->anchorSize) continue;
+        if(!adding && ring->numNodes == 1) continue;
+
+        if(adding) {
+            assert(hash_ring_add_node(ring, names[changed], nameLens[changed]) == HASH_RING_OK);
+        }
+        else {
+            assert(hash_ring_remove_node(ring, names[changed], nameLens[changed]) == HASH_RING_OK);
+        }
+        inRing[changed] = adding;
+        checkAnchor(ring);
+
+        for(x = 0; x < numNums; x++) {
+            int index = nameIndex(hash_ring_find_next_highest_item(ring, nums[x], &item)->node);
+            assert(inRing[index]);
+            if(adding) assert(index == before[x] || index == changed);
+            else assert(before[x] == changed ? index != changed : index == before[x]);
+            before[x] = index;
+        }
+    }
+    hash_ring_free(ring);
+
+    free(nums);
+    free(before);
+    free(inRing);
+    freeNames(names, nameLens, numNames);
+}
+
+void runAnchorBenchmark() {
+    printf("----------------------------------------------------\n");
+    printf("anchor bench\n");
+    printf("----------------------------------------------------\n");
+
+    int nodeCounts[] = { 1000, 10000, 50000 };
+    int numSearches = 1000000, maxNodes = 50000, n, x, y;
+    uint32_t anchorSize = 65536;
+    uint32_t *nameLens;
+    uint8_t **names = makeNames("server", maxNodes, &nameLens);
+    uint64_t *nums = (uint64_t*)malloc(sizeof(uint64_t) * numSearches);
+    int *order = (int*)malloc(sizeof(int) * maxNodes);
+    hash_ring_item_t item;
+    hash_ring_stats_t stats;
+    uint64_t sum = 0, elapsed;
+    for(x = 0; x < numSearches; x++) {
+        nums[x] = randomPosition();
+    }
+
+    for(n = 0; n < 3; n++) {
+        int numNodes = nodeCounts[n], numChurn = numNodes / 10;
+
+        // Nodes fail in a random order
+        for(x = 0; x < numNodes; x++) {
+            order[x] = x;
+        }
+        for(x = numNodes - 1; x > 0; x--) {
+            int other = rand() % (x + 1), temp = order[x];
+            order[x] = order[other];
+            order[other] = temp;
+        }
+
+        hash_ring_t *ring = hash_ring_create(1, HASH_FUNCTION_XXH3);
+        hash_ring_set_mode(ring, HASH_RING_MODE_ANCHOR);
+        hash_ring_set_anchor_size(ring, anchorSize);
+        startTiming();
+        hash_ring_add_nodes(ring, names, nameLens, numNodes);
+        elapsed = endTiming();
+        hash_ring_get_stats(ring, &stats);
+        printf("nodes = %5d, anchor %u buckets: build %8.3fms, memory %8llu bytes\n", numNodes, anchorSize,
+            (double)elapsed / 1000000, (unsigned long long)(stats.tableBytes + stats.nodeBytes));
+
+        // Lookups take longer as more of the buckets are removed
+        hash_ring_t *copy = hash_ring_copy(ring);
+        for(y = 0; y <= 5; y++) {
+            startTiming();
+            for(x = 0; x < numSearches; x++) {
+                sum += hash_ring_find_next_highest_item(ring, nums[x], &item)->node->index;
+            }
+            elapsed = endTiming();
+            double spread, peak = loadPeak(ring, nums, numSearches, &spread);
+            printf("nodes = %5d, %2d%% failed: lookup %5.1fns, peak/mean %.3f, stddev/mean %.3f (checksum %d)\n",
+                ring->numNodes, y * 10, (double)elapsed / numSearches, peak, spread, (int)(sum & 0xff));
+            if(y == 5) break;
+
+            startTiming();
+            for(x = y * numChurn; x < (y + 1) * numChurn; x++) {
+                hash_ring_remove_node(ring, names[order[x]], nameLens[order[x]]);
+            }
+            elapsed = endTiming();
+            if(y == 0) {
+                printf("nodes = %5d, remove %d random nodes: %6.1fns each, keys moved %.4f (ideal %.4f)\n",
+                    numNodes, numChurn, (double)elapsed / numChurn, movedFraction(copy, ring, nums, numSearches),
+                    (double)numChurn / numNodes);
+            }
+        }
+
+        // The failed nodes come back, the last to fail first
+        startTiming();
+        for(x = 5 * numChurn - 1; x >= 0; x--) {
+            hash_ring_add_node(ring, names[order[x]], nameLens[order[x]]);
+        }
+        elapsed = endTiming();
+        printf("nodes = %5d, add back %d nodes: %6.1fns each, keys moved %.4f\n", numNodes, 5 * numChurn,
+            (double)elapsed / (5 * numChurn), movedFraction(copy, ring, nums, numSearches));
+        hash_ring_free(copy);
+        hash_ring_free(ring);
+
+        // The vnode ring for comparison
+        if(numNodes > 10000) continue;
+        hash_ring_t *vnodes = hash_ring_create(160, HASH_FUNCTION_XXH3);
+        startTiming();
+        hash_ring_add_nodes(vnodes, names, nameLens, numNodes);
+        elapsed = endTiming();
+        hash_ring_get_stats(vnodes, &stats);
+        printf("nodes = %5d, 160 replicas: build %8.3fms, memory %8llu bytes\n", numNodes,
+            (double)elapsed / 1000000, (unsigned long long)(stats.itemBytes + stats.indexBytes + stats.nodeBytes));
+        startTiming();
+        for(x = 0; x < numSearches; x++) {
+            sum += hash_ring_find_next_highest_item(vnodes, nums[x], &item)->node->index;
+        }
+        elapsed = endTiming();
+        printf("nodes = %5d, 160 replicas: lookup %5.1fns (checksum %d)\n", numNodes,
+            (double)elapsed / numSearches, (int)(sum & 0xff));
+        startTiming();
+        for(x = 0; x < 100; x++) {
+            hash_ring_remove_node(vnodes, names[order[x]], nameLens[order[x]]);
+        }
+        elapsed = endTiming();
+        printf("nodes = %5d, 160 replicas: remove 100 random nodes: %.1fus each\n", numNodes,
+            (double)elapsed / 100 / 1000);
+        hash_ring_free(vnodes);
+    }
+
+    free(nums);
+    free(order);
+    freeNames(names, nameLens, maxNodes);
+}
+
+/**
+ * Checks every row of the ring's successor table against a walk around the ring.
+ */
+void checkSuccessors(hash_ring_t *ring) {
+    uint32_t expected = ring->successorWidth < ring->numNodes ? ring->successorWidth : ring->numNodes;
+    uint32_t row[HASH_RING_MAX_SUCCESSORS], x, y, z;
+    assert(ring->numSuccessors == expected);
+
+    for(x = 0; x < ring->numItems; x++) {
+        uint32_t found = 0, pos = x;
+        while(found < expected) {
+            uint32_t node = ring->itemNodes[pos];
+            for(y = 0; y < found && row[y] != node; y++);
+            if(y == found) row[found++] = node;
+            pos = pos + 1 == ring->numItems ? 0 : pos + 1;
+        }
+        for(z = 0; z < expected; z++) {
+            assert(ring->successors[(size_t)x * ring->successorWidth + z] == row[z]);
+        }
+    }
+}
+
+void testSuccessorTable() {
+    printf("Test successor table...\n");
+
+    uint32_t *nameLens, *keyLens;
+    uint8_t **names = makeNames("server", 100, &nameLens);
+    uint8_t **keys = makeNames("key", 1000, &keyLens);
+    hash_ring_node_t *found[8], *expected[8];
+    HASH_LAYOUT layouts[] = { HASH_RING_LAYOUT_WIDE, HASH_RING_LAYOUT_COMPACT32 };
+    HASH_MODE modes[] = { HASH_RING_MODE_NORMAL, HASH_RING_MODE_MULTIPROBE };
+    int l, x, y, num;
+
+    for(l = 0; l < 4; l++) {
+        hash_ring_t *ring = hash_ring_create(40, HASH_FUNCTION_XXH3);
+        hash_ring_t *plain = hash_ring_create(40, HASH_FUNCTION_XXH3);
+        assert(hash_ring_set_layout(ring, layouts[l % 2]) == HASH_RING_OK);
+        assert(hash_ring_set_layout(plain, layouts[l % 2]) == HASH_RING_OK);
+        assert(hash_ring_set_mode(ring, modes[l / 2]) == HASH_RING_OK);
+        assert(hash_ring_set_mode(plain, modes[l / 2]) == HASH_RING_OK);
+
+        // The table is kept from the first node on, even as there are fewer nodes than rows
+        assert(hash_ring_set_successors(ring, HASH_RING_MAX_SUCCESSORS + 1) == HASH_RING_ERR);
+        assert(hash_ring_set_successors(ring, 4) == HASH_RING_OK);
+        for(x = 0; x < 6; x++) {
+            assert(hash_ring_add_node(ring, names[x], nameLens[x]) == HASH_RING_OK);
+            checkSuccessors(ring);
+        }
+        assert(hash_ring_add_nodes(ring, names + 6, nameLens + 6, 44) == HASH_RING_OK);
+        assert(hash_ring_add_nodes(plain, names, nameLens, 50) == HASH_RING_OK);
+        checkSuccessors(ring);
+
+        // Nodes come and go, and change weight, rewriting only some rows
+        for(x = 0; x < 10; x++) {
+            int removed = (x * 7 + 3) % 50;
+            assert(hash_ring_remove_node(ring, names[removed], nameLens[removed]) == HASH_RING_OK);
+            assert(hash_ring_remove_node(plain, names[removed], nameLens[removed]) == HASH_RING_OK);
+            checkSuccessors(ring);
+        }
+        assert(hash_ring_add_nodes(ring, names + 50, nameLens + 50, 5) == HASH_RING_OK);
+        assert(hash_ring_add_nodes(plain, names + 50, nameLens + 50, 5) == HASH_RING_OK);
+        checkSuccessors(ring);
+        assert(hash_ring_set_node_weight(ring, names[51], nameLens[51], 3.0) == HASH_RING_OK);
+        assert(hash_ring_set_node_weight(plain, names[51], nameLens[51], 3.0) == HASH_RING_OK);
+        checkSuccessors(ring);
+        assert(hash_ring_set_node_weight(ring, names[1], nameLens[1], 0.25) == HASH_RING_OK);
+        assert(hash_ring_set_node_weight(plain, names[1], nameLens[1], 0.25) == HASH_RING_OK);
+        checkSuccessors(ring);
+        assert(hash_ring_add_node_weighted(ring, names[60], nameLens[60], 2.0) == HASH_RING_OK);
+        assert(hash_ring_add_node_weighted(plain, names[60], nameLens[60], 2.0) == HASH_RING_OK);
+        checkSuccessors(ring);
+
+        // Lookups give the same nodes as the walk, frozen or not, beyond the table too
+        for(y = 0; y < 2; y++) {
+            for(x = 0; x < 1000; x++) {
+                for(num = 1; num <= 6; num++) {
+                    assert(hash_ring_find_nodes(ring, keys[x], keyLens[x], found, num) == num);
+                    assert(hash_ring_find_nodes(plain, keys[x], keyLens[x], expected, num) == num);
+                    int z;
+                    for(z = 0; z < num; z++) {
+                        assert(nameIndex(found[z]) == nameIndex(expected[z]));
+                    }
+                }
+            }
+            assert(hash_ring_freeze(ring) == HASH_RING_OK);
+        }
+
+        hash_ring_stats_t stats;
+        assert(hash_ring_get_stats(ring, &stats) == HASH_RING_OK);
+        assert(stats.successorBytes == sizeof(uint32_t) * 4 * ring->numItems);
+        hash_ring_t *copy = hash_ring_copy(ring);
+        checkSuccessors(copy);
+        hash_ring_free(copy);
+
+        // Down to a single node, then no table at all
+        for(x = 0; x < 100; x++) {
+            if(hash_ring_get_node(ring, names[x], nameLens[x]) != NULL && ring->numNodes > 1) {
+                assert(hash_ring_remove_node(ring, names[x], nameLens[x]) == HASH_RING_OK);
+                if(ring->numNodes < 6) checkSuccessors(ring);
+            }
+        }
+        assert(hash_ring_set_successors(ring, 0) == HASH_RING_OK);
+        assert(ring->successors == NULL);
+        assert(hash_ring_get_stats(ring, &stats) == HASH_RING_OK && stats.successorBytes == 0);
+
+        hash_ring_free(ring);
+        hash_ring_free(plain);
+    }
+
+    freeNames(names, nameLens, 100);
+    freeNames(keys, keyLens, 1000);
+}
+
+void runSuccessorBenchmark() {
+    printf("----------------------------------------------------\n");
+    printf("successor table bench\n");
+    printf("----------------------------------------------------\n");
+
+    int numNodes = 1000, numSearches = 1000000, x, width;
+    uint32_t *nameLens, *keyLens;
+    uint8_t **names = makeNames("server", numNodes + 1, &nameLens);
+    uint8_t **keys = makeNames("key", 1000, &keyLens);
+    hash_ring_node_t *found[HASH_RING_MAX_SUCCESSORS];
+    hash_ring_stats_t stats;
+    uint64_t sum = 0, elapsed = 0;
+
+    hash_ring_t *ring = hash_ring_create_from_nodes(names, nameLens, numNodes, 160, HASH_FUNCTION_XXH3,
+        HASH_RING_MODE_NORMAL);
+    hash_ring_get_stats(ring, &stats);
+    printf("nodes = %d, replicas = 160: items and index %llu bytes\n", numNodes,
+        (unsigned long long)(stats.itemBytes + stats.indexBytes));
+
+    for(width = 0; width <= 5; width++) {
+        if(width == 1) continue;
+        startTiming();
+        hash_ring_set_successors(ring, width);
+        uint64_t build = endTiming();
+        hash_ring_freeze(ring);
+        hash_ring_get_stats(ring, &stats);
+
+        int num = width > 0 ? width : 2;
+        for(; num <= (width > 0 ? width : 5); num++) {
+            startTiming();
+            for(x = 0; x < numSearches; x++) {
+                sum += hash_ring_find_nodes(ring, keys[x % 1000], keyLens[x % 1000], found, num);
+            }
+            elapsed = endTiming();
+            if(width == 0) {
+                printf("no table: find %d nodes %6.1fns\n", num, (double)elapsed / numSearches);
+            }
+        }
+        if(width == 0) continue;
+
+        // Adding and removing a node only rewrites the rows around its items
+        startTiming();
+        hash_ring_add_node(ring, names[numNodes], nameLens[numNodes]);
+        uint64_t added = endTiming();
+        startTiming();
+        hash_ring_remove_node(ring, names[numNodes], nameLens[numNodes]);
+        uint64_t removed = endTiming();
+        printf("R = %d: table %8llu bytes, build %6.2fms, find %d nodes %6.1fns, add node %6.1fus, remove node %6.1fus (checksum %d)\n",
+            width, (unsigned long long)stats.successorBytes, (double)build / 1000000, width,
+            (double)elapsed / numSearches, (double)added / 1000, (double)removed / 1000, (int)(sum & 0xff));
+    }
+
+    hash_ring_set_successors(ring, 0);
+    startTiming();
+    hash_ring_add_node(ring, names[numNodes], nameLens[numNodes]);
+    elapsed = endTiming();
+    startTiming();
+    hash_ring_remove_node(ring, names[numNodes], nameLens[numNodes]);
+    printf("no table: add node %6.1fus, remove node %6.1fus\n", (double)elapsed / 1000, (double)endTiming() / 1000);
 
     hash_ring_free(ring);
+    freeNames(names, nameLens, numNodes + 1);
+    freeNames(keys, keyLens, 1000);
 }
+
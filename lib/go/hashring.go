@@ -26,8 +26,11 @@ import "unsafe"
 import "sync"
 
 const (
-	MD5  = C.HASH_FUNCTION_MD5
-	SHA1 = C.HASH_FUNCTION_SHA1
+	MD5     = C.HASH_FUNCTION_MD5
+	SHA1    = C.HASH_FUNCTION_SHA1
+	XXH3    = C.HASH_FUNCTION_XXH3
+	MURMUR3 = C.HASH_FUNCTION_MURMUR3
+	CRC32C  = C.HASH_FUNCTION_CRC32C
 )
 
 type Ring struct {
@@ -35,7 +38,7 @@ type Ring struct {
 	sync.RWMutex
 }
 
-// Construct a new hash ring. fn is MD5 or SHA1
+// Construct a new hash ring. fn is MD5, SHA1, XXH3, MURMUR3 or CRC32C
 func New(numReplicas int, fn C.HASH_FUNCTION) *Ring {
 	return &Ring{ptr: C.hash_ring_create(C.uint32_t(numReplicas), fn)}
 }
@@ -120,8 +120,8 @@ public class HashRing {
      *
      */
     public long findNextHighestItem(long number) throws HashRingException {
-        ItemStructure item = CLibrary.INSTANCE.hash_ring_find_next_highest_item(ringPointer, number);
-        if(item == null) {
+        ItemStructure item = new ItemStructure();
+        if(CLibrary.INSTANCE.hash_ring_find_next_highest_item(ringPointer, number, item) == null) {
             throw new HashRingException("Failed to find next highest item");
         }
         
@@ -147,7 +147,10 @@ public class HashRing {
      */
     public enum HashFunction {
         SHA1((char)1),
-        MD5((char)2);
+        MD5((char)2),
+        XXH3((char)3),
+        MURMUR3((char)4),
+        CRC32C((char)5);
         
         private final char type;
         HashFunction(char type) {
@@ -182,7 +185,7 @@ public class HashRing {
         void hash_ring_free(Pointer ring);
         int hash_ring_add_node(Pointer ring, String node, int nodeLength);
         int hash_ring_remove_node(Pointer ring, String node, int nodeLength);
-        ItemStructure hash_ring_find_next_highest_item(Pointer ring, long number);
+        Pointer hash_ring_find_next_highest_item(Pointer ring, long number, ItemStructure item);
         NodeStructure hash_ring_find_node(Pointer ring, String key, int keyLength);
         void hash_ring_print(Pointer ring);
     }
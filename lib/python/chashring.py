@@ -28,6 +28,9 @@ class HashRingException(Exception):
 class HashFunction:
     SHA1 = 1
     MD5 = 2
+    XXH3 = 3
+    MURMUR3 = 4
+    CRC32C = 5
 
 NODE_NAME_ARGTYPES = (ctypes.c_void_p, ctypes.c_char_p, ctypes.c_int)
 HASH_RING_NODE_POINTER = ctypes.POINTER(HashRingNode)
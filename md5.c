@@ -52,6 +52,7 @@
  */
 
 #include "md5.h"
+#include "cpu.h"
 #include <string.h>
 
 #undef BYTE_ORDER	/* 1 = big-endian, -1 = little-endian, 0 = unknown */
@@ -379,3 +380,295 @@ md5_finish(md5_state_t *pms, md5_byte_t digest[16])
     for (i = 0; i < 16; ++i)
 	digest[i] = (md5_byte_t)(pms->abcd[i >> 2] >> ((i & 3) << 3));
 }
+
+void
+md5_hash(const md5_byte_t *data, unsigned int nbytes, md5_word_t abcd[4])
+{
+    md5_state_t state;
+
+    md5_init(&state);
+    if (nbytes <= MD5_SHORT_MAX) {
+	/*
+	 * The padded message fits in one block, build it directly
+	 * instead of going through md5_append and md5_finish.
+	 */
+	md5_byte_t block[64];
+	unsigned int bits = nbytes << 3;
+
+	memcpy(block, data, nbytes);
+	block[nbytes] = 0x80;
+	memset(block + nbytes + 1, 0, 55 - nbytes);
+	block[56] = (md5_byte_t)bits;
+	block[57] = (md5_byte_t)(bits >> 8);
+	memset(block + 58, 0, 6);
+	md5_process(&state, block);
+    } else {
+	md5_byte_t digest[16];
+
+	md5_append(&state, data, nbytes);
+	md5_finish(&state, digest);
+    }
+    memcpy(abcd, state.abcd, sizeof(state.abcd));
+}
+
+/*
+ * Multi-buffer MD5. The AVX2 and AVX-512 kernels hash 8 or 16
+ * independent messages at once, one message per 32-bit lane. Each
+ * lane is padded on its own and lanes that have run out of blocks
+ * keep their state, so the digests are the same as md5_finish gives.
+ */
+
+static const md5_word_t md5_multi_t[64] = {
+    T1, T2, T3, T4, T5, T6, T7, T8, T9, T10, T11, T12, T13, T14, T15, T16,
+    T17, T18, T19, T20, T21, T22, T23, T24, T25, T26, T27, T28, T29, T30, T31, T32,
+    T33, T34, T35, T36, T37, T38, T39, T40, T41, T42, T43, T44, T45, T46, T47, T48,
+    T49, T50, T51, T52, T53, T54, T55, T56, T57, T58, T59, T60, T61, T62, T63, T64
+};
+
+#define MD5_MULTI_F(x, y, z) (((x) & (y)) | (~(x) & (z)))
+#define MD5_MULTI_G(x, y, z) (((x) & (z)) | ((y) & ~(z)))
+#define MD5_MULTI_H(x, y, z) ((x) ^ (y) ^ (z))
+#define MD5_MULTI_I(x, y, z) ((y) ^ ((x) | ~(z)))
+#define MD5_MULTI_STEP(f, a, b, c, d, k, s, i)				\
+    t = a + f(b, c, d) + X[k] + md5_multi_t[i];				\
+    a = b + ((t << s) | (t >> (32 - s)))
+
+/* The number of 64 byte blocks in a padded message of len bytes. */
+#define MD5_MULTI_BLOCKS(len) (((len) + 8) / 64 + 1)
+
+/*
+ * Returns block number block of the padded message, either
+ * directly from data or built in buf.
+ */
+static const md5_byte_t *
+md5_multi_block(const md5_byte_t *data, unsigned int len, unsigned int block,
+		md5_byte_t buf[64])
+{
+    unsigned int offset = block * 64;
+    int i;
+
+    if (offset + 64 <= len)
+	return data + offset;
+    memset(buf, 0, 64);
+    if (offset < len)
+	memcpy(buf, data + offset, len - offset);
+    if (offset <= len)
+	buf[len - offset] = 0x80;
+    if (block + 1 == MD5_MULTI_BLOCKS(len)) {
+	for (i = 0; i < 8; ++i)
+	    buf[56 + i] = (md5_byte_t)(((unsigned long long)len << 3) >> (i << 3));
+    }
+    return buf;
+}
+
+void
+md5_multi_scalar(const md5_byte_t *data[], const unsigned int lens[],
+		 unsigned int n, md5_word_t digests[][4])
+{
+    unsigned int x;
+
+    for (x = 0; x < n; ++x)
+	md5_hash(data[x], lens[x], digests[x]);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+/*
+ * The kernel body, shared by the AVX2 and AVX-512 versions. VEC is
+ * a GCC vector of LANES 32-bit words, n is at most LANES.
+ */
+#define MD5_MULTI_KERNEL(VEC, LANES)					\
+    md5_word_t words[16][LANES] __attribute__((aligned(64)));		\
+    md5_word_t out[4][LANES] __attribute__((aligned(64)));		\
+    md5_byte_t buf[LANES][64];						\
+    unsigned int blocks[LANES], maxBlocks = 0, block;			\
+    unsigned int lane, i;						\
+    VEC a, b, c, d, aa, bb, cc, dd, t, active, X[16];      		\
+									\
+    for (lane = 0; lane < LANES; ++lane) {				\
+	blocks[lane] = lane < n ? MD5_MULTI_BLOCKS(lens[lane]) : 0;	\
+	if (blocks[lane] > maxBlocks)					\
+	    maxBlocks = blocks[lane];					\
+    }									\
+    a = (VEC){0} + 0x67452301;						\
+    b = (VEC){0} + 0xefcdab89;						\
+    c = (VEC){0} + 0x98badcfe;						\
+    d = (VEC){0} + 0x10325476;						\
+									\
+    for (block = 0; block < maxBlocks; ++block) {			\
+	for (lane = 0; lane < LANES; ++lane) {				\
+	    const md5_byte_t *p;					\
+	    if (block >= blocks[lane]) {				\
+		for (i = 0; i < 16; ++i)				\
+		    words[i][lane] = 0;					\
+		continue;						\
+	    }								\
+	    p = md5_multi_block(data[lane], lens[lane], block, buf[lane]); \
+	    for (i = 0; i < 16; ++i)					\
+		memcpy(&words[i][lane], p + (i << 2), 4);		\
+	}								\
+	for (i = 0; i < 16; ++i)					\
+	    memcpy(&X[i], words[i], sizeof(VEC));			\
+	for (lane = 0; lane < LANES; ++lane)				\
+	    out[0][lane] = block < blocks[lane] ? 0xffffffff : 0;	\
+	memcpy(&active, out[0], sizeof(VEC));				\
+									\
+	aa = a; bb = b; cc = c; dd = d;					\
+	MD5_MULTI_STEP(MD5_MULTI_F, a, b, c, d,  0,  7,  0);	\
+	MD5_MULTI_STEP(MD5_MULTI_F, d, a, b, c,  1, 12,  1);	\
+	MD5_MULTI_STEP(MD5_MULTI_F, c, d, a, b,  2, 17,  2);	\
+	MD5_MULTI_STEP(MD5_MULTI_F, b, c, d, a,  3, 22,  3);	\
+	MD5_MULTI_STEP(MD5_MULTI_F, a, b, c, d,  4,  7,  4);	\
+	MD5_MULTI_STEP(MD5_MULTI_F, d, a, b, c,  5, 12,  5);	\
+	MD5_MULTI_STEP(MD5_MULTI_F, c, d, a, b,  6, 17,  6);	\
+	MD5_MULTI_STEP(MD5_MULTI_F, b, c, d, a,  7, 22,  7);	\
+	MD5_MULTI_STEP(MD5_MULTI_F, a, b, c, d,  8,  7,  8);	\
+	MD5_MULTI_STEP(MD5_MULTI_F, d, a, b, c,  9, 12,  9);	\
+	MD5_MULTI_STEP(MD5_MULTI_F, c, d, a, b, 10, 17, 10);	\
+	MD5_MULTI_STEP(MD5_MULTI_F, b, c, d, a, 11, 22, 11);	\
+	MD5_MULTI_STEP(MD5_MULTI_F, a, b, c, d, 12,  7, 12);	\
+	MD5_MULTI_STEP(MD5_MULTI_F, d, a, b, c, 13, 12, 13);	\
+	MD5_MULTI_STEP(MD5_MULTI_F, c, d, a, b, 14, 17, 14);	\
+	MD5_MULTI_STEP(MD5_MULTI_F, b, c, d, a, 15, 22, 15);	\
+	MD5_MULTI_STEP(MD5_MULTI_G, a, b, c, d,  1,  5, 16);	\
+	MD5_MULTI_STEP(MD5_MULTI_G, d, a, b, c,  6,  9, 17);	\
+	MD5_MULTI_STEP(MD5_MULTI_G, c, d, a, b, 11, 14, 18);	\
+	MD5_MULTI_STEP(MD5_MULTI_G, b, c, d, a,  0, 20, 19);	\
+	MD5_MULTI_STEP(MD5_MULTI_G, a, b, c, d,  5,  5, 20);	\
+	MD5_MULTI_STEP(MD5_MULTI_G, d, a, b, c, 10,  9, 21);	\
+	MD5_MULTI_STEP(MD5_MULTI_G, c, d, a, b, 15, 14, 22);	\
+	MD5_MULTI_STEP(MD5_MULTI_G, b, c, d, a,  4, 20, 23);	\
+	MD5_MULTI_STEP(MD5_MULTI_G, a, b, c, d,  9,  5, 24);	\
+	MD5_MULTI_STEP(MD5_MULTI_G, d, a, b, c, 14,  9, 25);	\
+	MD5_MULTI_STEP(MD5_MULTI_G, c, d, a, b,  3, 14, 26);	\
+	MD5_MULTI_STEP(MD5_MULTI_G, b, c, d, a,  8, 20, 27);	\
+	MD5_MULTI_STEP(MD5_MULTI_G, a, b, c, d, 13,  5, 28);	\
+	MD5_MULTI_STEP(MD5_MULTI_G, d, a, b, c,  2,  9, 29);	\
+	MD5_MULTI_STEP(MD5_MULTI_G, c, d, a, b,  7, 14, 30);	\
+	MD5_MULTI_STEP(MD5_MULTI_G, b, c, d, a, 12, 20, 31);	\
+	MD5_MULTI_STEP(MD5_MULTI_H, a, b, c, d,  5,  4, 32);	\
+	MD5_MULTI_STEP(MD5_MULTI_H, d, a, b, c,  8, 11, 33);	\
+	MD5_MULTI_STEP(MD5_MULTI_H, c, d, a, b, 11, 16, 34);	\
+	MD5_MULTI_STEP(MD5_MULTI_H, b, c, d, a, 14, 23, 35);	\
+	MD5_MULTI_STEP(MD5_MULTI_H, a, b, c, d,  1,  4, 36);	\
+	MD5_MULTI_STEP(MD5_MULTI_H, d, a, b, c,  4, 11, 37);	\
+	MD5_MULTI_STEP(MD5_MULTI_H, c, d, a, b,  7, 16, 38);	\
+	MD5_MULTI_STEP(MD5_MULTI_H, b, c, d, a, 10, 23, 39);	\
+	MD5_MULTI_STEP(MD5_MULTI_H, a, b, c, d, 13,  4, 40);	\
+	MD5_MULTI_STEP(MD5_MULTI_H, d, a, b, c,  0, 11, 41);	\
+	MD5_MULTI_STEP(MD5_MULTI_H, c, d, a, b,  3, 16, 42);	\
+	MD5_MULTI_STEP(MD5_MULTI_H, b, c, d, a,  6, 23, 43);	\
+	MD5_MULTI_STEP(MD5_MULTI_H, a, b, c, d,  9,  4, 44);	\
+	MD5_MULTI_STEP(MD5_MULTI_H, d, a, b, c, 12, 11, 45);	\
+	MD5_MULTI_STEP(MD5_MULTI_H, c, d, a, b, 15, 16, 46);	\
+	MD5_MULTI_STEP(MD5_MULTI_H, b, c, d, a,  2, 23, 47);	\
+	MD5_MULTI_STEP(MD5_MULTI_I, a, b, c, d,  0,  6, 48);	\
+	MD5_MULTI_STEP(MD5_MULTI_I, d, a, b, c,  7, 10, 49);	\
+	MD5_MULTI_STEP(MD5_MULTI_I, c, d, a, b, 14, 15, 50);	\
+	MD5_MULTI_STEP(MD5_MULTI_I, b, c, d, a,  5, 21, 51);	\
+	MD5_MULTI_STEP(MD5_MULTI_I, a, b, c, d, 12,  6, 52);	\
+	MD5_MULTI_STEP(MD5_MULTI_I, d, a, b, c,  3, 10, 53);	\
+	MD5_MULTI_STEP(MD5_MULTI_I, c, d, a, b, 10, 15, 54);	\
+	MD5_MULTI_STEP(MD5_MULTI_I, b, c, d, a,  1, 21, 55);	\
+	MD5_MULTI_STEP(MD5_MULTI_I, a, b, c, d,  8,  6, 56);	\
+	MD5_MULTI_STEP(MD5_MULTI_I, d, a, b, c, 15, 10, 57);	\
+	MD5_MULTI_STEP(MD5_MULTI_I, c, d, a, b,  6, 15, 58);	\
+	MD5_MULTI_STEP(MD5_MULTI_I, b, c, d, a, 13, 21, 59);	\
+	MD5_MULTI_STEP(MD5_MULTI_I, a, b, c, d,  4,  6, 60);	\
+	MD5_MULTI_STEP(MD5_MULTI_I, d, a, b, c, 11, 10, 61);	\
+	MD5_MULTI_STEP(MD5_MULTI_I, c, d, a, b,  2, 15, 62);	\
+	MD5_MULTI_STEP(MD5_MULTI_I, b, c, d, a,  9, 21, 63);	\
+	a = ((aa + a) & active) | (aa & ~active);			\
+	b = ((bb + b) & active) | (bb & ~active);			\
+	c = ((cc + c) & active) | (cc & ~active);			\
+	d = ((dd + d) & active) | (dd & ~active);			\
+    }									\
+									\
+    memcpy(out[0], &a, sizeof(VEC));					\
+    memcpy(out[1], &b, sizeof(VEC));					\
+    memcpy(out[2], &c, sizeof(VEC));					\
+    memcpy(out[3], &d, sizeof(VEC));					\
+    for (lane = 0; lane < n; ++lane) {					\
+	for (i = 0; i < 4; ++i)						\
+	    digests[lane][i] = out[i][lane];				\
+    }
+
+typedef md5_word_t md5_vec8 __attribute__((vector_size(32)));
+typedef md5_word_t md5_vec16 __attribute__((vector_size(64)));
+
+__attribute__((target("avx2")))
+static void
+md5_multi_avx2_lanes(const md5_byte_t *data[], const unsigned int lens[],
+		     unsigned int n, md5_word_t digests[][4])
+{
+    MD5_MULTI_KERNEL(md5_vec8, 8)
+}
+
+__attribute__((target("avx512f")))
+static void
+md5_multi_avx512_lanes(const md5_byte_t *data[], const unsigned int lens[],
+		       unsigned int n, md5_word_t digests[][4])
+{
+    MD5_MULTI_KERNEL(md5_vec16, 16)
+}
+
+void
+md5_multi_avx2(const md5_byte_t *data[], const unsigned int lens[],
+	       unsigned int n, md5_word_t digests[][4])
+{
+    unsigned int x;
+
+    for (x = 0; x < n; x += 8)
+	md5_multi_avx2_lanes(data + x, lens + x, n - x < 8 ? n - x : 8, digests + x);
+}
+
+void
+md5_multi_avx512(const md5_byte_t *data[], const unsigned int lens[],
+		 unsigned int n, md5_word_t digests[][4])
+{
+    unsigned int x;
+
+    for (x = 0; x < n; x += 16)
+	md5_multi_avx512_lanes(data + x, lens + x, n - x < 16 ? n - x : 16, digests + x);
+}
+
+#else
+
+void
+md5_multi_avx2(const md5_byte_t *data[], const unsigned int lens[],
+	       unsigned int n, md5_word_t digests[][4])
+{
+    md5_multi_scalar(data, lens, n, digests);
+}
+
+void
+md5_multi_avx512(const md5_byte_t *data[], const unsigned int lens[],
+		 unsigned int n, md5_word_t digests[][4])
+{
+    md5_multi_scalar(data, lens, n, digests);
+}
+
+#endif
+
+void
+md5_multi(const md5_byte_t *data[], const unsigned int lens[],
+	  unsigned int n, md5_word_t digests[][4])
+{
+    uint32_t features = cpu_features();
+    unsigned int x = 0, lanes;
+
+    /* A mostly empty group of lanes is slower than the scalar code. */
+    if (features & CPU_AVX512F) {
+	for (; n - x >= 12; x += lanes) {
+	    lanes = n - x < 16 ? n - x : 16;
+	    md5_multi_avx512(data + x, lens + x, lanes, digests + x);
+	}
+    }
+    if (features & CPU_AVX2) {
+	for (; n - x >= 4; x += lanes) {
+	    lanes = n - x < 8 ? n - x : 8;
+	    md5_multi_avx2(data + x, lens + x, lanes, digests + x);
+	}
+    }
+    md5_multi_scalar(data + x, lens + x, n - x, digests + x);
+}
@@ -94,6 +94,42 @@ _declspec(dllexport)
 #endif
 void md5_finish(md5_state_t *pms, md5_byte_t digest[16]);
 
+/* The longest message that md5_hash hashes as a single block. */
+#define MD5_SHORT_MAX 55
+
+/*
+ * Hash nbytes of data in one call, abcd gets the four digest words,
+ * digest byte i is (abcd[i >> 2] >> ((i & 3) << 3)) & 0xff. Messages of
+ * up to MD5_SHORT_MAX bytes skip the streaming state entirely.
+ */
+#ifdef WIN32
+_declspec(dllexport)
+#endif
+void md5_hash(const md5_byte_t *data, unsigned int nbytes, md5_word_t abcd[4]);
+
+/*
+ * Hash n independent messages, digests[i] gets the md5_hash digest
+ * words of the lens[i] bytes at data[i]. Uses the widest multi-buffer
+ * kernel the CPU supports.
+ */
+#ifdef WIN32
+_declspec(dllexport)
+#endif
+void md5_multi(const md5_byte_t *data[], const unsigned int lens[],
+	       unsigned int n, md5_word_t digests[][4]);
+
+/*
+ * The individual md5_multi kernels. The AVX2 and AVX-512 kernels
+ * must only be called when cpu_features() reports CPU_AVX2 or
+ * CPU_AVX512F.
+ */
+void md5_multi_scalar(const md5_byte_t *data[], const unsigned int lens[],
+		      unsigned int n, md5_word_t digests[][4]);
+void md5_multi_avx2(const md5_byte_t *data[], const unsigned int lens[],
+		    unsigned int n, md5_word_t digests[][4]);
+void md5_multi_avx512(const md5_byte_t *data[], const unsigned int lens[],
+		      unsigned int n, md5_word_t digests[][4]);
+
 #ifdef __cplusplus
 }  /* end extern "C" */
 #endif
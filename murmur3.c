@@ -0,0 +1,106 @@
+/**
+ * Copyright 2015 Chris Moos
+ * 
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and 
+ * limitations under the License.
+ */
+
+/*
+ * MurmurHash3 was written by Austin Appleby, and is placed in the public domain.
+ */
+
+#include <string.h>
+
+#include "murmur3.h"
+
+#define MURMUR3_C1 0x87c37b91114253d5ULL
+#define MURMUR3_C2 0x4cf5ad432745937fULL
+
+static inline uint64_t murmur3_rotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t murmur3_read64(const uint8_t *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap64(v);
+#endif
+    return v;
+}
+
+static inline uint64_t murmur3_fmix64(uint64_t k) {
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+}
+
+void murmur3_x64_128(const uint8_t *data, uint32_t len, uint32_t seed, uint64_t out[2]) {
+    uint32_t blocks = len / 16;
+    uint64_t h1 = seed, h2 = seed;
+    uint64_t k1, k2;
+    uint32_t x;
+    
+    for(x = 0; x < blocks; x++) {
+        k1 = murmur3_read64(data + x * 16);
+        k2 = murmur3_read64(data + x * 16 + 8);
+        
+        k1 *= MURMUR3_C1; k1 = murmur3_rotl64(k1, 31); k1 *= MURMUR3_C2; h1 ^= k1;
+        h1 = murmur3_rotl64(h1, 27); h1 += h2; h1 = h1 * 5 + 0x52dce729;
+        
+        k2 *= MURMUR3_C2; k2 = murmur3_rotl64(k2, 33); k2 *= MURMUR3_C1; h2 ^= k2;
+        h2 = murmur3_rotl64(h2, 31); h2 += h1; h2 = h2 * 5 + 0x38495ab5;
+    }
+    
+    // The remaining 0-15 bytes
+    const uint8_t *tail = data + blocks * 16;
+    k1 = 0;
+    k2 = 0;
+    switch(len & 15) {
+        case 15: k2 ^= (uint64_t)tail[14] << 48;
+        case 14: k2 ^= (uint64_t)tail[13] << 40;
+        case 13: k2 ^= (uint64_t)tail[12] << 32;
+        case 12: k2 ^= (uint64_t)tail[11] << 24;
+        case 11: k2 ^= (uint64_t)tail[10] << 16;
+        case 10: k2 ^= (uint64_t)tail[9] << 8;
+        case 9: k2 ^= (uint64_t)tail[8];
+            k2 *= MURMUR3_C2; k2 = murmur3_rotl64(k2, 33); k2 *= MURMUR3_C1; h2 ^= k2;
+        case 8: k1 ^= (uint64_t)tail[7] << 56;
+        case 7: k1 ^= (uint64_t)tail[6] << 48;
+        case 6: k1 ^= (uint64_t)tail[5] << 40;
+        case 5: k1 ^= (uint64_t)tail[4] << 32;
+        case 4: k1 ^= (uint64_t)tail[3] << 24;
+        case 3: k1 ^= (uint64_t)tail[2] << 16;
+        case 2: k1 ^= (uint64_t)tail[1] << 8;
+        case 1: k1 ^= (uint64_t)tail[0];
+            k1 *= MURMUR3_C1; k1 = murmur3_rotl64(k1, 31); k1 *= MURMUR3_C2; h1 ^= k1;
+    }
+    
+    h1 ^= len;
+    h2 ^= len;
+    
+    h1 += h2;
+    h2 += h1;
+    
+    h1 = murmur3_fmix64(h1);
+    h2 = murmur3_fmix64(h2);
+    
+    h1 += h2;
+    h2 += h1;
+    
+    out[0] = h1;
+    out[1] = h2;
+}
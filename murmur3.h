@@ -0,0 +1,29 @@
+/**
+ * Copyright 2015 Chris Moos
+ * 
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and 
+ * limitations under the License.
+ */
+
+#ifndef MURMUR3_H
+#define MURMUR3_H
+
+#include <stdint.h>
+
+/**
+ * MurmurHash3_x64_128 by Austin Appleby.
+ * The 128-bit hash is stored in out[0] (h1) and out[1] (h2).
+ */
+void murmur3_x64_128(const uint8_t *data, uint32_t len, uint32_t seed, uint64_t out[2]);
+
+#endif
@@ -0,0 +1,49 @@
+/**
+ * Copyright 2015 Chris Moos
+ * 
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and 
+ * limitations under the License.
+ */
+
+#include <pthread.h>
+#include "parallel.h"
+
+typedef struct parallel_thread_t {
+    pthread_t thread;
+    parallel_job_func fn;
+    void *job;
+} parallel_thread_t;
+
+static void *parallel_thread_main(void *arg) {
+    parallel_thread_t *thread = (parallel_thread_t*)arg;
+    thread->fn(thread->job);
+    return NULL;
+}
+
+void parallel_run(parallel_job_func fn, void *jobs, size_t jobSize, uint32_t numJobs) {
+    parallel_thread_t threads[PARALLEL_MAX_JOBS];
+    int started[PARALLEL_MAX_JOBS];
+    uint32_t x;
+
+    for(x = 1; x < numJobs; x++) {
+        threads[x].fn = fn;
+        threads[x].job = (char*)jobs + jobSize * x;
+        started[x] = pthread_create(&threads[x].thread, NULL, parallel_thread_main, &threads[x]) == 0;
+        if(!started[x]) fn(threads[x].job);
+    }
+    if(numJobs > 0) fn(jobs);
+
+    for(x = 1; x < numJobs; x++) {
+        if(started[x]) pthread_join(threads[x].thread, NULL);
+    }
+}
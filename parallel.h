@@ -0,0 +1,40 @@
+/**
+ * Copyright 2015 Chris Moos
+ * 
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and 
+ * limitations under the License.
+ */
+
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* The most jobs parallel_run runs at once */
+#define PARALLEL_MAX_JOBS 64
+
+/**
+ * A job run by parallel_run, it is passed its entry in the jobs array.
+ */
+typedef void (*parallel_job_func)(void *job);
+
+/**
+ * Runs fn on each of the numJobs jobs, which are jobSize bytes apart starting at jobs,
+ * one thread per job, and waits for them all to finish. The first job runs on the
+ * calling thread, as does any job whose thread can't be started, so every job is always
+ * run. numJobs must be at most PARALLEL_MAX_JOBS.
+ */
+void parallel_run(parallel_job_func fn, void *jobs, size_t jobSize, uint32_t numJobs);
+
+#endif
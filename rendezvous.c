@@ -0,0 +1,275 @@
+/**
+ * Copyright 2015 Chris Moos
+ * 
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and 
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+
+#include "cpu.h"
+#include "rendezvous.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define RENDEZVOUS_X86 1
+#include <immintrin.h>
+#endif
+
+typedef struct rendezvous_kernel_t {
+    const char *name;
+    rendezvous_score_func score;
+    rendezvous_best_func best;
+    
+    /* The CPU_* features the kernel needs */
+    uint32_t features;
+} rendezvous_kernel_t;
+
+static const rendezvous_kernel_t kernels[RENDEZVOUS_NUM_KERNELS] = {
+    { "scalar", rendezvous_score_scalar, rendezvous_best_scalar, 0 },
+    { "avx2", rendezvous_score_avx2, rendezvous_best_avx2, CPU_AVX2 },
+    { "avx512", rendezvous_score_avx512, rendezvous_best_avx512, CPU_AVX512F }
+};
+
+/* The kernel in use, -1 until one is picked. Accessed with relaxed atomics
+ * because lookups may race with the first pick. */
+static int currentKernel = -1;
+
+void rendezvous_score_scalar(const uint64_t *seeds, uint32_t numSeeds, uint64_t key, uint64_t *scores) {
+    uint32_t x;
+    for(x = 0; x < numSeeds; x++) {
+        scores[x] = rendezvous_score(key, seeds[x]);
+    }
+}
+
+uint32_t rendezvous_best_scalar(const uint64_t *seeds, uint32_t numSeeds, uint64_t key) {
+    uint64_t bestScore = rendezvous_score(key, seeds[0]);
+    uint32_t best = 0, x;
+    for(x = 1; x < numSeeds; x++) {
+        uint64_t score = rendezvous_score(key, seeds[x]);
+        if(score > bestScore) {
+            bestScore = score;
+            best = x;
+        }
+    }
+    return best;
+}
+
+#ifdef RENDEZVOUS_X86
+
+/**
+ * Neither AVX2 nor AVX-512F has a 64-bit multiply, the low 64 bits of a * b are built from
+ * three 32-bit multiplies: lo(a) * lo(b) + ((hi(a) * lo(b) + lo(a) * hi(b)) << 32).
+ * bHigh is b >> 32.
+ */
+__attribute__((target("avx2")))
+static inline __m256i rendezvous_mul_avx2(__m256i a, __m256i b, __m256i bHigh) {
+    __m256i low = _mm256_mul_epu32(a, b);
+    __m256i cross = _mm256_add_epi64(_mm256_mul_epu32(_mm256_srli_epi64(a, 32), b), _mm256_mul_epu32(a, bHigh));
+    return _mm256_add_epi64(low, _mm256_slli_epi64(cross, 32));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i rendezvous_score_vector_avx2(__m256i key, const uint64_t *seeds) {
+    const __m256i c1 = _mm256_set1_epi64x((int64_t)0xff51afd7ed558ccdULL);
+    const __m256i c1High = _mm256_srli_epi64(c1, 32);
+    const __m256i c2 = _mm256_set1_epi64x((int64_t)0xc4ceb9fe1a85ec53ULL);
+    const __m256i c2High = _mm256_srli_epi64(c2, 32);
+
+    __m256i x = _mm256_xor_si256(key, _mm256_loadu_si256((const __m256i*)seeds));
+    x = _mm256_xor_si256(x, _mm256_srli_epi64(x, 33));
+    x = rendezvous_mul_avx2(x, c1, c1High);
+    x = _mm256_xor_si256(x, _mm256_srli_epi64(x, 33));
+    x = rendezvous_mul_avx2(x, c2, c2High);
+    return _mm256_xor_si256(x, _mm256_srli_epi64(x, 33));
+}
+
+__attribute__((target("avx2")))
+void rendezvous_score_avx2(const uint64_t *seeds, uint32_t numSeeds, uint64_t key, uint64_t *scores) {
+    const __m256i k = _mm256_set1_epi64x((int64_t)key);
+    uint32_t x;
+    for(x = 0; x + 4 <= numSeeds; x += 4) {
+        _mm256_storeu_si256((__m256i*)(scores + x), rendezvous_score_vector_avx2(k, seeds + x));
+    }
+    for(; x < numSeeds; x++) {
+        scores[x] = rendezvous_score(key, seeds[x]);
+    }
+}
+
+/**
+ * AVX2 only compares signed 64-bit integers, the best scores are kept with their sign bit
+ * flipped so that the signed comparison orders them as unsigned.
+ */
+__attribute__((target("avx2")))
+uint32_t rendezvous_best_avx2(const uint64_t *seeds, uint32_t numSeeds, uint64_t key) {
+    if(numSeeds < 8) return rendezvous_best_scalar(seeds, numSeeds, key);
+
+    const __m256i sign = _mm256_set1_epi64x((int64_t)0x8000000000000000ULL);
+    const __m256i k = _mm256_set1_epi64x((int64_t)key);
+    const __m256i four = _mm256_set1_epi64x(4);
+    __m256i indexes = _mm256_set_epi64x(3, 2, 1, 0);
+    __m256i best = _mm256_xor_si256(rendezvous_score_vector_avx2(k, seeds), sign);
+    __m256i bestIndexes = indexes;
+    uint32_t x;
+
+    // Each lane keeps the first of its best scores
+    for(x = 4; x + 4 <= numSeeds; x += 4) {
+        indexes = _mm256_add_epi64(indexes, four);
+        __m256i score = _mm256_xor_si256(rendezvous_score_vector_avx2(k, seeds + x), sign);
+        __m256i greater = _mm256_cmpgt_epi64(score, best);
+        best = _mm256_blendv_epi8(best, score, greater);
+        bestIndexes = _mm256_blendv_epi8(bestIndexes, indexes, greater);
+    }
+
+    // Spread the best score to every lane, then the lowest index among the lanes that have it
+    __m256i swapped = _mm256_permute4x64_epi64(best, 0x4e);
+    __m256i top = _mm256_blendv_epi8(best, swapped, _mm256_cmpgt_epi64(swapped, best));
+    swapped = _mm256_permute4x64_epi64(top, 0xb1);
+    top = _mm256_blendv_epi8(top, swapped, _mm256_cmpgt_epi64(swapped, top));
+    __m256i candidates = _mm256_blendv_epi8(_mm256_set1_epi64x(INT64_MAX), bestIndexes, _mm256_cmpeq_epi64(best, top));
+    swapped = _mm256_permute4x64_epi64(candidates, 0x4e);
+    candidates = _mm256_blendv_epi8(candidates, swapped, _mm256_cmpgt_epi64(candidates, swapped));
+    swapped = _mm256_permute4x64_epi64(candidates, 0xb1);
+    candidates = _mm256_blendv_epi8(candidates, swapped, _mm256_cmpgt_epi64(candidates, swapped));
+
+    uint64_t bestScore = (uint64_t)_mm256_extract_epi64(top, 0) ^ 0x8000000000000000ULL;
+    uint32_t bestIndex = (uint32_t)_mm256_extract_epi64(candidates, 0);
+    for(; x < numSeeds; x++) {
+        uint64_t score = rendezvous_score(key, seeds[x]);
+        if(score > bestScore) {
+            bestScore = score;
+            bestIndex = x;
+        }
+    }
+    return bestIndex;
+}
+
+__attribute__((target("avx512f")))
+static inline __m512i rendezvous_mul_avx512(__m512i a, __m512i b, __m512i bHigh) {
+    __m512i low = _mm512_mul_epu32(a, b);
+    __m512i cross = _mm512_add_epi64(_mm512_mul_epu32(_mm512_srli_epi64(a, 32), b), _mm512_mul_epu32(a, bHigh));
+    return _mm512_add_epi64(low, _mm512_slli_epi64(cross, 32));
+}
+
+__attribute__((target("avx512f")))
+static inline __m512i rendezvous_score_vector_avx512(__m512i key, __m512i seeds) {
+    const __m512i c1 = _mm512_set1_epi64((int64_t)0xff51afd7ed558ccdULL);
+    const __m512i c1High = _mm512_srli_epi64(c1, 32);
+    const __m512i c2 = _mm512_set1_epi64((int64_t)0xc4ceb9fe1a85ec53ULL);
+    const __m512i c2High = _mm512_srli_epi64(c2, 32);
+
+    __m512i x = _mm512_xor_si512(key, seeds);
+    x = _mm512_xor_si512(x, _mm512_srli_epi64(x, 33));
+    x = rendezvous_mul_avx512(x, c1, c1High);
+    x = _mm512_xor_si512(x, _mm512_srli_epi64(x, 33));
+    x = rendezvous_mul_avx512(x, c2, c2High);
+    return _mm512_xor_si512(x, _mm512_srli_epi64(x, 33));
+}
+
+__attribute__((target("avx512f")))
+void rendezvous_score_avx512(const uint64_t *seeds, uint32_t numSeeds, uint64_t key, uint64_t *scores) {
+    const __m512i k = _mm512_set1_epi64((int64_t)key);
+    uint32_t x;
+    
+    // The last partial vector is loaded and stored with a mask
+    for(x = 0; x < numSeeds; x += 8) {
+        __mmask8 valid = numSeeds - x >= 8 ? 0xff : (__mmask8)((1u << (numSeeds - x)) - 1);
+        __m512i score = rendezvous_score_vector_avx512(k, _mm512_maskz_loadu_epi64(valid, seeds + x));
+        _mm512_mask_storeu_epi64(scores + x, valid, score);
+    }
+}
+
+__attribute__((target("avx512f")))
+uint32_t rendezvous_best_avx512(const uint64_t *seeds, uint32_t numSeeds, uint64_t key) {
+    const __m512i k = _mm512_set1_epi64((int64_t)key);
+    const __m512i eight = _mm512_set1_epi64(8);
+    __m512i indexes = _mm512_set_epi64(7, 6, 5, 4, 3, 2, 1, 0);
+
+    // Lanes past the end have index -1 and a score of 0, they never win
+    __mmask8 valid = numSeeds >= 8 ? 0xff : (__mmask8)((1u << numSeeds) - 1);
+    __m512i best = _mm512_maskz_mov_epi64(valid,
+        rendezvous_score_vector_avx512(k, _mm512_maskz_loadu_epi64(valid, seeds)));
+    __m512i bestIndexes = _mm512_mask_mov_epi64(_mm512_set1_epi64(-1), valid, indexes);
+    uint32_t x;
+
+    // Each lane keeps the first of its best scores
+    for(x = 8; x < numSeeds; x += 8) {
+        indexes = _mm512_add_epi64(indexes, eight);
+        valid = numSeeds - x >= 8 ? 0xff : (__mmask8)((1u << (numSeeds - x)) - 1);
+        __m512i score = rendezvous_score_vector_avx512(k, _mm512_maskz_loadu_epi64(valid, seeds + x));
+        __mmask8 greater = _mm512_mask_cmpgt_epu64_mask(valid, score, best);
+        best = _mm512_mask_mov_epi64(best, greater, score);
+        bestIndexes = _mm512_mask_mov_epi64(bestIndexes, greater, indexes);
+    }
+
+    // The lowest index among the lanes with the best score
+    __mmask8 top = _mm512_cmpeq_epi64_mask(best, _mm512_set1_epi64((int64_t)_mm512_reduce_max_epu64(best)));
+    return (uint32_t)_mm512_mask_reduce_min_epu64(top, bestIndexes);
+}
+
+#else
+
+void rendezvous_score_avx2(const uint64_t *seeds, uint32_t numSeeds, uint64_t key, uint64_t *scores) {
+    rendezvous_score_scalar(seeds, numSeeds, key, scores);
+}
+
+uint32_t rendezvous_best_avx2(const uint64_t *seeds, uint32_t numSeeds, uint64_t key) {
+    return rendezvous_best_scalar(seeds, numSeeds, key);
+}
+
+void rendezvous_score_avx512(const uint64_t *seeds, uint32_t numSeeds, uint64_t key, uint64_t *scores) {
+    rendezvous_score_scalar(seeds, numSeeds, key, scores);
+}
+
+uint32_t rendezvous_best_avx512(const uint64_t *seeds, uint32_t numSeeds, uint64_t key) {
+    return rendezvous_best_scalar(seeds, numSeeds, key);
+}
+
+#endif
+
+int rendezvous_kernel_supported(int kernel) {
+    if(kernel < 0 || kernel >= RENDEZVOUS_NUM_KERNELS) return 0;
+#ifndef RENDEZVOUS_X86
+    if(kernel != RENDEZVOUS_KERNEL_SCALAR) return 0;
+#endif
+    return (cpu_features() & kernels[kernel].features) == kernels[kernel].features;
+}
+
+int rendezvous_set_kernel(int kernel) {
+    if(!rendezvous_kernel_supported(kernel)) return -1;
+    __atomic_store_n(&currentKernel, kernel, __ATOMIC_RELAXED);
+    return 0;
+}
+
+int rendezvous_get_kernel(void) {
+    int kernel = __atomic_load_n(&currentKernel, __ATOMIC_RELAXED);
+    if(kernel == -1) {
+        for(kernel = RENDEZVOUS_NUM_KERNELS - 1; kernel > RENDEZVOUS_KERNEL_SCALAR; kernel--) {
+            if(rendezvous_kernel_supported(kernel)) break;
+        }
+        __atomic_store_n(&currentKernel, kernel, __ATOMIC_RELAXED);
+    }
+    return kernel;
+}
+
+const char *rendezvous_kernel_name(int kernel) {
+    if(kernel < 0 || kernel >= RENDEZVOUS_NUM_KERNELS) return "unknown";
+    return kernels[kernel].name;
+}
+
+void rendezvous_score_all(const uint64_t *seeds, uint32_t numSeeds, uint64_t key, uint64_t *scores) {
+    kernels[rendezvous_get_kernel()].score(seeds, numSeeds, key, scores);
+}
+
+uint32_t rendezvous_best(const uint64_t *seeds, uint32_t numSeeds, uint64_t key) {
+    return kernels[rendezvous_get_kernel()].best(seeds, numSeeds, key);
+}
@@ -0,0 +1,93 @@
+/**
+ * Copyright 2015 Chris Moos
+ * 
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and 
+ * limitations under the License.
+ */
+#ifndef RENDEZVOUS_H
+#define RENDEZVOUS_H
+
+#include <stdint.h>
+
+/**
+ * Kernels that score nodes for rendezvous hashing, see rendezvous_set_kernel. Every
+ * kernel gives the same scores.
+ */
+#define RENDEZVOUS_KERNEL_SCALAR 0
+#define RENDEZVOUS_KERNEL_AVX2 1
+#define RENDEZVOUS_KERNEL_AVX512 2
+
+#define RENDEZVOUS_NUM_KERNELS 3
+
+/**
+ * The score of a node with the given seed for a key: key ^ seed run through the murmur3
+ * 64-bit finalizer. The finalizer is a bijection, so different seeds never tie.
+ */
+static inline uint64_t rendezvous_score(uint64_t key, uint64_t seed) {
+    uint64_t x = key ^ seed;
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+/**
+ * Stores the score of each of the numSeeds seeds for key in scores.
+ */
+typedef void (*rendezvous_score_func)(const uint64_t *seeds, uint32_t numSeeds, uint64_t key, uint64_t *scores);
+
+void rendezvous_score_scalar(const uint64_t *seeds, uint32_t numSeeds, uint64_t key, uint64_t *scores);
+void rendezvous_score_avx2(const uint64_t *seeds, uint32_t numSeeds, uint64_t key, uint64_t *scores);
+void rendezvous_score_avx512(const uint64_t *seeds, uint32_t numSeeds, uint64_t key, uint64_t *scores);
+
+/**
+ * Returns the index of the seed with the highest score for key, the lowest such index if
+ * seeds repeat. numSeeds must not be 0.
+ */
+typedef uint32_t (*rendezvous_best_func)(const uint64_t *seeds, uint32_t numSeeds, uint64_t key);
+
+uint32_t rendezvous_best_scalar(const uint64_t *seeds, uint32_t numSeeds, uint64_t key);
+uint32_t rendezvous_best_avx2(const uint64_t *seeds, uint32_t numSeeds, uint64_t key);
+uint32_t rendezvous_best_avx512(const uint64_t *seeds, uint32_t numSeeds, uint64_t key);
+
+/**
+ * Scores and picks the best seed with the current kernel.
+ */
+void rendezvous_score_all(const uint64_t *seeds, uint32_t numSeeds, uint64_t key, uint64_t *scores);
+uint32_t rendezvous_best(const uint64_t *seeds, uint32_t numSeeds, uint64_t key);
+
+/**
+ * Returns 1 if the kernel can run on this CPU, 0 otherwise.
+ */
+int rendezvous_kernel_supported(int kernel);
+
+/**
+ * Selects the kernel used by rendezvous_score_all and rendezvous_best.
+ * By default the fastest kernel supported by the CPU is used.
+ * @returns 0 if the kernel was selected, -1 if it isn't supported.
+ */
+int rendezvous_set_kernel(int kernel);
+
+/**
+ * Returns the kernel in use.
+ */
+int rendezvous_get_kernel(void);
+
+/**
+ * Returns a printable name for the kernel.
+ */
+const char *rendezvous_kernel_name(int kernel);
+
+#endif
@@ -0,0 +1,337 @@
+/**
+ * Copyright 2015 Chris Moos
+ * 
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and 
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "cpu.h"
+#include "search.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SEARCH_X86 1
+#include <immintrin.h>
+#endif
+
+/* The number of searches search_upper_bound_batch interleaves */
+#define SEARCH_BATCH_GROUP 16
+
+typedef struct search_kernel_t {
+    const char *name;
+    search_count_func count;
+    search_count32_func count32;
+    
+    /* The binary search stops once the range is this small, window32 for 32-bit items */
+    uint32_t window;
+    uint32_t window32;
+    
+    /* The CPU_* features the kernel needs */
+    uint32_t features;
+} search_kernel_t;
+
+static const search_kernel_t kernels[SEARCH_NUM_KERNELS] = {
+    { "scalar", search_count_scalar, search_count32_scalar, 4, 8, 0 },
+    { "sse4.2", search_count_sse42, search_count32_sse42, 8, 16, CPU_SSE42 },
+    { "avx2", search_count_avx2, search_count32_avx2, 16, 32, CPU_AVX2 },
+    { "avx512", search_count_avx512, search_count32_avx512, 32, 64, CPU_AVX512F }
+};
+
+/* The kernel in use, -1 until one is picked. Read and written with relaxed
+ * atomics since lookups may run concurrently with the first pick. */
+static int currentKernel = -1;
+
+uint32_t search_count_scalar(const uint64_t *items, uint32_t numItems, uint64_t num) {
+    uint32_t x, count = 0;
+    for(x = 0; x < numItems; x++) {
+        count += (items[x] <= num);
+    }
+    return count;
+}
+
+uint32_t search_count32_scalar(const uint32_t *items, uint32_t numItems, uint32_t num) {
+    uint32_t x, count = 0;
+    for(x = 0; x < numItems; x++) {
+        count += (items[x] <= num);
+    }
+    return count;
+}
+
+#ifdef SEARCH_X86
+
+/**
+ * SSE4.2 and AVX2 only compare signed 64-bit integers. Flipping the sign bit of
+ * both sides gives the unsigned comparison.
+ */
+#define SEARCH_SIGN_BIT ((int64_t)0x8000000000000000LL)
+#define SEARCH_SIGN_BIT32 ((int32_t)0x80000000)
+
+__attribute__((target("sse4.2,popcnt")))
+uint32_t search_count_sse42(const uint64_t *items, uint32_t numItems, uint64_t num) {
+    const __m128i sign = _mm_set1_epi64x(SEARCH_SIGN_BIT);
+    const __m128i key = _mm_xor_si128(_mm_set1_epi64x((int64_t)num), sign);
+    uint32_t x, greater = 0;
+    
+    for(x = 0; x + 2 <= numItems; x += 2) {
+        __m128i v = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(items + x)), sign);
+        greater += __builtin_popcount(_mm_movemask_pd(_mm_castsi128_pd(_mm_cmpgt_epi64(v, key))));
+    }
+    
+    uint32_t count = x - greater;
+    for(; x < numItems; x++) {
+        count += (items[x] <= num);
+    }
+    return count;
+}
+
+__attribute__((target("avx2,popcnt")))
+uint32_t search_count_avx2(const uint64_t *items, uint32_t numItems, uint64_t num) {
+    const __m256i sign = _mm256_set1_epi64x(SEARCH_SIGN_BIT);
+    const __m256i key = _mm256_xor_si256(_mm256_set1_epi64x((int64_t)num), sign);
+    uint32_t x, greater = 0;
+    
+    for(x = 0; x + 4 <= numItems; x += 4) {
+        __m256i v = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(items + x)), sign);
+        greater += __builtin_popcount(_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(v, key))));
+    }
+    
+    uint32_t count = x - greater;
+    for(; x < numItems; x++) {
+        count += (items[x] <= num);
+    }
+    return count;
+}
+
+__attribute__((target("avx512f,popcnt")))
+uint32_t search_count_avx512(const uint64_t *items, uint32_t numItems, uint64_t num) {
+    const __m512i key = _mm512_set1_epi64((int64_t)num);
+    uint32_t x, count = 0;
+    
+    // The last partial vector is loaded with a mask so nothing past the end is read
+    for(x = 0; x < numItems; x += 8) {
+        __mmask8 valid = numItems - x >= 8 ? 0xff : (__mmask8)((1u << (numItems - x)) - 1);
+        __m512i v = _mm512_maskz_loadu_epi64(valid, items + x);
+        count += __builtin_popcount(_mm512_mask_cmple_epu64_mask(valid, v, key));
+    }
+    return count;
+}
+
+__attribute__((target("sse4.2,popcnt")))
+uint32_t search_count32_sse42(const uint32_t *items, uint32_t numItems, uint32_t num) {
+    const __m128i sign = _mm_set1_epi32(SEARCH_SIGN_BIT32);
+    const __m128i key = _mm_xor_si128(_mm_set1_epi32((int32_t)num), sign);
+    uint32_t x, greater = 0;
+    
+    for(x = 0; x + 4 <= numItems; x += 4) {
+        __m128i v = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(items + x)), sign);
+        greater += __builtin_popcount(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(v, key))));
+    }
+    
+    uint32_t count = x - greater;
+    for(; x < numItems; x++) {
+        count += (items[x] <= num);
+    }
+    return count;
+}
+
+__attribute__((target("avx2,popcnt")))
+uint32_t search_count32_avx2(const uint32_t *items, uint32_t numItems, uint32_t num) {
+    const __m256i sign = _mm256_set1_epi32(SEARCH_SIGN_BIT32);
+    const __m256i key = _mm256_xor_si256(_mm256_set1_epi32((int32_t)num), sign);
+    uint32_t x, greater = 0;
+    
+    for(x = 0; x + 8 <= numItems; x += 8) {
+        __m256i v = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(items + x)), sign);
+        greater += __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(v, key))));
+    }
+    
+    uint32_t count = x - greater;
+    for(; x < numItems; x++) {
+        count += (items[x] <= num);
+    }
+    return count;
+}
+
+__attribute__((target("avx512f,popcnt")))
+uint32_t search_count32_avx512(const uint32_t *items, uint32_t numItems, uint32_t num) {
+    const __m512i key = _mm512_set1_epi32((int32_t)num);
+    uint32_t x, count = 0;
+    
+    for(x = 0; x < numItems; x += 16) {
+        __mmask16 valid = numItems - x >= 16 ? 0xffff : (__mmask16)((1u << (numItems - x)) - 1);
+        __m512i v = _mm512_maskz_loadu_epi32(valid, items + x);
+        count += __builtin_popcount(_mm512_mask_cmple_epu32_mask(valid, v, key));
+    }
+    return count;
+}
+
+#else
+
+uint32_t search_count_sse42(const uint64_t *items, uint32_t numItems, uint64_t num) {
+    return search_count_scalar(items, numItems, num);
+}
+
+uint32_t search_count_avx2(const uint64_t *items, uint32_t numItems, uint64_t num) {
+    return search_count_scalar(items, numItems, num);
+}
+
+uint32_t search_count_avx512(const uint64_t *items, uint32_t numItems, uint64_t num) {
+    return search_count_scalar(items, numItems, num);
+}
+
+uint32_t search_count32_sse42(const uint32_t *items, uint32_t numItems, uint32_t num) {
+    return search_count32_scalar(items, numItems, num);
+}
+
+uint32_t search_count32_avx2(const uint32_t *items, uint32_t numItems, uint32_t num) {
+    return search_count32_scalar(items, numItems, num);
+}
+
+uint32_t search_count32_avx512(const uint32_t *items, uint32_t numItems, uint32_t num) {
+    return search_count32_scalar(items, numItems, num);
+}
+
+#endif
+
+int search_kernel_supported(int kernel) {
+    if(kernel < 0 || kernel >= SEARCH_NUM_KERNELS) return 0;
+#ifndef SEARCH_X86
+    if(kernel != SEARCH_KERNEL_SCALAR) return 0;
+#endif
+    return (cpu_features() & kernels[kernel].features) == kernels[kernel].features;
+}
+
+int search_set_kernel(int kernel) {
+    if(!search_kernel_supported(kernel)) return -1;
+    __atomic_store_n(&currentKernel, kernel, __ATOMIC_RELAXED);
+    return 0;
+}
+
+int search_get_kernel(void) {
+    int kernel = __atomic_load_n(&currentKernel, __ATOMIC_RELAXED);
+    if(kernel == -1) {
+        for(kernel = SEARCH_NUM_KERNELS - 1; kernel > SEARCH_KERNEL_SCALAR; kernel--) {
+            if(search_kernel_supported(kernel)) break;
+        }
+        __atomic_store_n(&currentKernel, kernel, __ATOMIC_RELAXED);
+    }
+    return kernel;
+}
+
+const char *search_kernel_name(int kernel) {
+    if(kernel < 0 || kernel >= SEARCH_NUM_KERNELS) return "unknown";
+    return kernels[kernel].name;
+}
+
+uint32_t search_upper_bound(const uint64_t *items, uint32_t numItems, uint64_t num) {
+    const search_kernel_t *kernel = &kernels[search_get_kernel()];
+    const uint64_t *base = items;
+    uint32_t len = numItems;
+    
+    // The first item greater than num is always within base[0..len]
+    while(len > kernel->window) {
+        uint32_t half = len / 2;
+        
+        // Fetch both possible midpoints of the next step while this one is compared
+        __builtin_prefetch(base + half / 2);
+        __builtin_prefetch(base + half + half / 2);
+        base = (base[half] <= num) ? base + half : base;
+        len -= half;
+    }
+    
+    return (uint32_t)(base - items) + kernel->count(base, len, num);
+}
+
+void search_upper_bound_batch(const uint64_t *items, uint32_t numItems,
+    const uint64_t *nums, uint32_t numKeys, uint32_t *indexes) {
+    const search_kernel_t *kernel = &kernels[search_get_kernel()];
+    uint32_t bases[SEARCH_BATCH_GROUP];
+    uint32_t group, x;
+    
+    for(group = 0; group < numKeys; group += SEARCH_BATCH_GROUP) {
+        uint32_t groupSize = numKeys - group < SEARCH_BATCH_GROUP ? numKeys - group : SEARCH_BATCH_GROUP;
+        const uint64_t *groupNums = nums + group;
+        uint32_t len = numItems;
+        
+        for(x = 0; x < groupSize; x++) {
+            bases[x] = 0;
+        }
+        
+        // The range shrinks the same way for every search, only the bases differ
+        while(len > kernel->window) {
+            uint32_t half = len / 2;
+            uint32_t next = (len - half) / 2;
+            for(x = 0; x < groupSize; x++) {
+                uint32_t base = bases[x] + half * (items[bases[x] + half] <= groupNums[x]);
+                __builtin_prefetch(items + base + next);
+                bases[x] = base;
+            }
+            len -= half;
+        }
+        
+        for(x = 0; x < groupSize; x++) {
+            indexes[group + x] = bases[x] + kernel->count(items + bases[x], len, groupNums[x]);
+        }
+    }
+}
+
+uint32_t search_upper_bound32(const uint32_t *items, uint32_t numItems, uint32_t num) {
+    const search_kernel_t *kernel = &kernels[search_get_kernel()];
+    const uint32_t *base = items;
+    uint32_t len = numItems;
+    
+    while(len > kernel->window32) {
+        uint32_t half = len / 2;
+        
+        __builtin_prefetch(base + half / 2);
+        __builtin_prefetch(base + half + half / 2);
+        base = (base[half] <= num) ? base + half : base;
+        len -= half;
+    }
+    
+    return (uint32_t)(base - items) + kernel->count32(base, len, num);
+}
+
+void search_upper_bound32_batch(const uint32_t *items, uint32_t numItems,
+    const uint32_t *nums, uint32_t numKeys, uint32_t *indexes) {
+    const search_kernel_t *kernel = &kernels[search_get_kernel()];
+    uint32_t bases[SEARCH_BATCH_GROUP];
+    uint32_t group, x;
+    
+    for(group = 0; group < numKeys; group += SEARCH_BATCH_GROUP) {
+        uint32_t groupSize = numKeys - group < SEARCH_BATCH_GROUP ? numKeys - group : SEARCH_BATCH_GROUP;
+        const uint32_t *groupNums = nums + group;
+        uint32_t len = numItems;
+        
+        for(x = 0; x < groupSize; x++) {
+            bases[x] = 0;
+        }
+        
+        while(len > kernel->window32) {
+            uint32_t half = len / 2;
+            uint32_t next = (len - half) / 2;
+            for(x = 0; x < groupSize; x++) {
+                uint32_t base = bases[x] + half * (items[bases[x] + half] <= groupNums[x]);
+                __builtin_prefetch(items + base + next);
+                bases[x] = base;
+            }
+            len -= half;
+        }
+        
+        for(x = 0; x < groupSize; x++) {
+            indexes[group + x] = bases[x] + kernel->count32(items + bases[x], len, groupNums[x]);
+        }
+    }
+}
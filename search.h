@@ -0,0 +1,104 @@
+/**
+ * Copyright 2015 Chris Moos
+ * 
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and 
+ * limitations under the License.
+ */
+
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#include <stdint.h>
+
+/**
+ * Kernels that can finish a search, see search_set_kernel.
+ */
+#define SEARCH_KERNEL_SCALAR 0
+#define SEARCH_KERNEL_SSE42 1
+#define SEARCH_KERNEL_AVX2 2
+#define SEARCH_KERNEL_AVX512 3
+
+#define SEARCH_NUM_KERNELS 4
+
+/**
+ * Counts the items in items[0..numItems) that are less than or equal to num.
+ * When items is sorted this is the index of the first item greater than num.
+ */
+typedef uint32_t (*search_count_func)(const uint64_t *items, uint32_t numItems, uint64_t num);
+
+uint32_t search_count_scalar(const uint64_t *items, uint32_t numItems, uint64_t num);
+uint32_t search_count_sse42(const uint64_t *items, uint32_t numItems, uint64_t num);
+uint32_t search_count_avx2(const uint64_t *items, uint32_t numItems, uint64_t num);
+uint32_t search_count_avx512(const uint64_t *items, uint32_t numItems, uint64_t num);
+
+/**
+ * The same count over 32-bit items. A vector holds twice as many of them, so each
+ * kernel's window is twice as wide.
+ */
+typedef uint32_t (*search_count32_func)(const uint32_t *items, uint32_t numItems, uint32_t num);
+
+uint32_t search_count32_scalar(const uint32_t *items, uint32_t numItems, uint32_t num);
+uint32_t search_count32_sse42(const uint32_t *items, uint32_t numItems, uint32_t num);
+uint32_t search_count32_avx2(const uint32_t *items, uint32_t numItems, uint32_t num);
+uint32_t search_count32_avx512(const uint32_t *items, uint32_t numItems, uint32_t num);
+
+/**
+ * Returns the index of the first item greater than num in the sorted items array,
+ * or numItems if every item is less than or equal to num.
+ *
+ * The range is narrowed with a branch free binary search until it fits the
+ * current kernel's window, and the kernel counts the items left in the window.
+ */
+uint32_t search_upper_bound(const uint64_t *items, uint32_t numItems, uint64_t num);
+
+/**
+ * Runs search_upper_bound for each of the numKeys numbers, storing the results in indexes.
+ *
+ * The searches are run in groups, one level of every search in the group at a time, and
+ * the next level of each search is prefetched. The cache misses of the searches in a group
+ * overlap instead of being taken one after another.
+ */
+void search_upper_bound_batch(const uint64_t *items, uint32_t numItems,
+    const uint64_t *nums, uint32_t numKeys, uint32_t *indexes);
+
+/**
+ * search_upper_bound and search_upper_bound_batch for sorted 32-bit items.
+ */
+uint32_t search_upper_bound32(const uint32_t *items, uint32_t numItems, uint32_t num);
+void search_upper_bound32_batch(const uint32_t *items, uint32_t numItems,
+    const uint32_t *nums, uint32_t numKeys, uint32_t *indexes);
+
+/**
+ * Returns 1 if the kernel can run on this CPU, 0 otherwise.
+ */
+int search_kernel_supported(int kernel);
+
+/**
+ * Selects the kernel used by search_upper_bound.
+ * By default the fastest kernel supported by the CPU is used.
+ *
+ * @returns 0 if the kernel was selected, -1 if it isn't supported.
+ */
+int search_set_kernel(int kernel);
+
+/**
+ * Returns the kernel used by search_upper_bound.
+ */
+int search_get_kernel(void);
+
+/**
+ * Returns a printable name for the kernel.
+ */
+const char *search_kernel_name(int kernel);
+
+#endif
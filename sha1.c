@@ -38,7 +38,18 @@
  *
  */
 
+#include <string.h>
+
 #include "sha1.h"
+#include "cpu.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SHA1_X86 1
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#define SHA1_ARMV8 1
+#include <arm_neon.h>
+#endif
 
 /*
  *  Define the circular shift macro
@@ -51,6 +62,33 @@
 void SHA1ProcessMessageBlock(SHA1Context *);
 void SHA1PadMessage(SHA1Context *);
 
+/*
+ *  Processes one 64 octet block, updating the five digest words
+ */
+typedef void (*SHA1BlockFunc)(unsigned digest[5], const unsigned char *block);
+
+static void SHA1ProcessBlockPortable(unsigned digest[5], const unsigned char *block);
+static void SHA1ProcessBlockSHANI(unsigned digest[5], const unsigned char *block);
+static void SHA1ProcessBlockARMv8(unsigned digest[5], const unsigned char *block);
+
+typedef struct SHA1Implementation
+{
+    const char *name;
+    SHA1BlockFunc process;
+    unsigned features;          /* The CPU_* features it needs      */
+} SHA1Implementation;
+
+static const SHA1Implementation implementations[SHA1_NUM_IMPLEMENTATIONS] =
+{
+    { "portable", SHA1ProcessBlockPortable, 0 },
+    { "sha-ni", SHA1ProcessBlockSHANI, CPU_SHA },
+    { "armv8", SHA1ProcessBlockARMv8, CPU_SHA }
+};
+
+/* The implementation in use, -1 until one is picked. Accessed with relaxed
+ * atomics as hashing may run on several threads during the first pick. */
+static int currentImplementation = -1;
+
 /*  
  *  SHA1Reset
  *
@@ -185,14 +223,17 @@ void SHA1Input(     SHA1Context         *context,
 }
 
 /*  
- *  SHA1ProcessMessageBlock
+ *  SHA1ProcessBlockPortable
  *
  *  Description:
  *      This function will process the next 512 bits of the message
- *      stored in the Message_Block array.
+ *      in plain C.
  *
  *  Parameters:
- *      None.
+ *      digest: [in/out]
+ *          The five digest words.
+ *      block: [in]
+ *          The 64 octet message block.
  *
  *  Returns:
  *      Nothing.
@@ -204,7 +245,7 @@ void SHA1Input(     SHA1Context         *context,
  *         
  *
  */
-void SHA1ProcessMessageBlock(SHA1Context *context)
+static void SHA1ProcessBlockPortable(unsigned digest[5], const unsigned char *block)
 {
     const unsigned K[] =            /* Constants defined in SHA-1   */      
     {
@@ -223,10 +264,10 @@ void SHA1ProcessMessageBlock(SHA1Context *context)
      */
     for(t = 0; t < 16; t++)
     {
-        W[t] = ((unsigned) context->Message_Block[t * 4]) << 24;
-        W[t] |= ((unsigned) context->Message_Block[t * 4 + 1]) << 16;
-        W[t] |= ((unsigned) context->Message_Block[t * 4 + 2]) << 8;
-        W[t] |= ((unsigned) context->Message_Block[t * 4 + 3]);
+        W[t] = ((unsigned) block[t * 4]) << 24;
+        W[t] |= ((unsigned) block[t * 4 + 1]) << 16;
+        W[t] |= ((unsigned) block[t * 4 + 2]) << 8;
+        W[t] |= ((unsigned) block[t * 4 + 3]);
     }
 
     for(t = 16; t < 80; t++)
@@ -234,11 +275,11 @@ void SHA1ProcessMessageBlock(SHA1Context *context)
        W[t] = SHA1CircularShift(1,W[t-3] ^ W[t-8] ^ W[t-14] ^ W[t-16]);
     }
 
-    A = context->Message_Digest[0];
-    B = context->Message_Digest[1];
-    C = context->Message_Digest[2];
-    D = context->Message_Digest[3];
-    E = context->Message_Digest[4];
+    A = digest[0];
+    B = digest[1];
+    C = digest[2];
+    D = digest[3];
+    E = digest[4];
 
     for(t = 0; t < 20; t++)
     {
@@ -286,17 +327,382 @@ void SHA1ProcessMessageBlock(SHA1Context *context)
         A = temp;
     }
 
-    context->Message_Digest[0] =
-                        (context->Message_Digest[0] + A) & 0xFFFFFFFF;
-    context->Message_Digest[1] =
-                        (context->Message_Digest[1] + B) & 0xFFFFFFFF;
-    context->Message_Digest[2] =
-                        (context->Message_Digest[2] + C) & 0xFFFFFFFF;
-    context->Message_Digest[3] =
-                        (context->Message_Digest[3] + D) & 0xFFFFFFFF;
-    context->Message_Digest[4] =
-                        (context->Message_Digest[4] + E) & 0xFFFFFFFF;
+    digest[0] =
+                        (digest[0] + A) & 0xFFFFFFFF;
+    digest[1] =
+                        (digest[1] + B) & 0xFFFFFFFF;
+    digest[2] =
+                        (digest[2] + C) & 0xFFFFFFFF;
+    digest[3] =
+                        (digest[3] + D) & 0xFFFFFFFF;
+    digest[4] =
+                        (digest[4] + E) & 0xFFFFFFFF;
+}
+
+#ifdef SHA1_X86
+
+/*
+ *  SHA1ProcessBlockSHANI
+ *
+ *  Description:
+ *      Processes a block with the Intel SHA extensions. Each
+ *      sha1rnds4 does four rounds, and sha1msg1, sha1msg2 compute
+ *      the word sequence four words at a time.
+ */
+__attribute__((target("sha,sse4.1")))
+static void SHA1ProcessBlockSHANI(unsigned digest[5], const unsigned char *block)
+{
+    const __m128i MASK = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+    __m128i ABCD, ABCD_SAVE, E0, E0_SAVE, E1;
+    __m128i MSG0, MSG1, MSG2, MSG3;
+
+    ABCD = _mm_loadu_si128((const __m128i*)digest);
+    ABCD = _mm_shuffle_epi32(ABCD, 0x1B);
+    E0 = _mm_set_epi32(digest[4], 0, 0, 0);
+    ABCD_SAVE = ABCD;
+    E0_SAVE = E0;
+
+    /* Rounds 0-3 */
+    MSG0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(block + 0)), MASK);
+    E0 = _mm_add_epi32(E0, MSG0);
+    E1 = ABCD;
+    ABCD = _mm_sha1rnds4_epu32(ABCD, E0, 0);
+
+    /* Rounds 4-7 */
+    MSG1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(block + 16)), MASK);
+    E1 = _mm_sha1nexte_epu32(E1, MSG1);
+    E0 = ABCD;
+    ABCD = _mm_sha1rnds4_epu32(ABCD, E1, 0);
+    MSG0 = _mm_sha1msg1_epu32(MSG0, MSG1);
+
+    /* Rounds 8-11 */
+    MSG2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(block + 32)), MASK);
+    E0 = _mm_sha1nexte_epu32(E0, MSG2);
+    E1 = ABCD;
+    ABCD = _mm_sha1rnds4_epu32(ABCD, E0, 0);
+    MSG1 = _mm_sha1msg1_epu32(MSG1, MSG2);
+    MSG0 = _mm_xor_si128(MSG0, MSG2);
+
+    /* Rounds 12-15 */
+    MSG3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(block + 48)), MASK);
+    E1 = _mm_sha1nexte_epu32(E1, MSG3);
+    E0 = ABCD;
+    MSG0 = _mm_sha1msg2_epu32(MSG0, MSG3);
+    ABCD = _mm_sha1rnds4_epu32(ABCD, E1, 0);
+    MSG2 = _mm_sha1msg1_epu32(MSG2, MSG3);
+    MSG1 = _mm_xor_si128(MSG1, MSG3);
+
+    /* Rounds 16-19 */
+    E0 = _mm_sha1nexte_epu32(E0, MSG0);
+    E1 = ABCD;
+    MSG1 = _mm_sha1msg2_epu32(MSG1, MSG0);
+    ABCD = _mm_sha1rnds4_epu32(ABCD, E0, 0);
+    MSG3 = _mm_sha1msg1_epu32(MSG3, MSG0);
+    MSG2 = _mm_xor_si128(MSG2, MSG0);
+
+    /* Rounds 20-23 */
+    E1 = _mm_sha1nexte_epu32(E1, MSG1);
+    E0 = ABCD;
+    MSG2 = _mm_sha1msg2_epu32(MSG2, MSG1);
+    ABCD = _mm_sha1rnds4_epu32(ABCD, E1, 1);
+    MSG0 = _mm_sha1msg1_epu32(MSG0, MSG1);
+    MSG3 = _mm_xor_si128(MSG3, MSG1);
+
+    /* Rounds 24-27 */
+    E0 = _mm_sha1nexte_epu32(E0, MSG2);
+    E1 = ABCD;
+    MSG3 = _mm_sha1msg2_epu32(MSG3, MSG2);
+    ABCD = _mm_sha1rnds4_epu32(ABCD, E0, 1);
+    MSG1 = _mm_sha1msg1_epu32(MSG1, MSG2);
+    MSG0 = _mm_xor_si128(MSG0, MSG2);
+
+    /* Rounds 28-31 */
+    E1 = _mm_sha1nexte_epu32(E1, MSG3);
+    E0 = ABCD;
+    MSG0 = _mm_sha1msg2_epu32(MSG0, MSG3);
+    ABCD = _mm_sha1rnds4_epu32(ABCD, E1, 1);
+    MSG2 = _mm_sha1msg1_epu32(MSG2, MSG3);
+    MSG1 = _mm_xor_si128(MSG1, MSG3);
+
+    /* Rounds 32-35 */
+    E0 = _mm_sha1nexte_epu32(E0, MSG0);
+    E1 = ABCD;
+    MSG1 = _mm_sha1msg2_epu32(MSG1, MSG0);
+    ABCD = _mm_sha1rnds4_epu32(ABCD, E0, 1);
+    MSG3 = _mm_sha1msg1_epu32(MSG3, MSG0);
+    MSG2 = _mm_xor_si128(MSG2, MSG0);
 
+    /* Rounds 36-39 */
+    E1 = _mm_sha1nexte_epu32(E1, MSG1);
+    E0 = ABCD;
+    MSG2 = _mm_sha1msg2_epu32(MSG2, MSG1);
+    ABCD = _mm_sha1rnds4_epu32(ABCD, E1, 1);
+    MSG0 = _mm_sha1msg1_epu32(MSG0, MSG1);
+    MSG3 = _mm_xor_si128(MSG3, MSG1);
+
+    /* Rounds 40-43 */
+    E0 = _mm_sha1nexte_epu32(E0, MSG2);
+    E1 = ABCD;
+    MSG3 = _mm_sha1msg2_epu32(MSG3, MSG2);
+    ABCD = _mm_sha1rnds4_epu32(ABCD, E0, 2);
+    MSG1 = _mm_sha1msg1_epu32(MSG1, MSG2);
+    MSG0 = _mm_xor_si128(MSG0, MSG2);
+
+    /* Rounds 44-47 */
+    E1 = _mm_sha1nexte_epu32(E1, MSG3);
+    E0 = ABCD;
+    MSG0 = _mm_sha1msg2_epu32(MSG0, MSG3);
+    ABCD = _mm_sha1rnds4_epu32(ABCD, E1, 2);
+    MSG2 = _mm_sha1msg1_epu32(MSG2, MSG3);
+    MSG1 = _mm_xor_si128(MSG1, MSG3);
+
+    /* Rounds 48-51 */
+    E0 = _mm_sha1nexte_epu32(E0, MSG0);
+    E1 = ABCD;
+    MSG1 = _mm_sha1msg2_epu32(MSG1, MSG0);
+    ABCD = _mm_sha1rnds4_epu32(ABCD, E0, 2);
+    MSG3 = _mm_sha1msg1_epu32(MSG3, MSG0);
+    MSG2 = _mm_xor_si128(MSG2, MSG0);
+
+    /* Rounds 52-55 */
+    E1 = _mm_sha1nexte_epu32(E1, MSG1);
+    E0 = ABCD;
+    MSG2 = _mm_sha1msg2_epu32(MSG2, MSG1);
+    ABCD = _mm_sha1rnds4_epu32(ABCD, E1, 2);
+    MSG0 = _mm_sha1msg1_epu32(MSG0, MSG1);
+    MSG3 = _mm_xor_si128(MSG3, MSG1);
+
+    /* Rounds 56-59 */
+    E0 = _mm_sha1nexte_epu32(E0, MSG2);
+    E1 = ABCD;
+    MSG3 = _mm_sha1msg2_epu32(MSG3, MSG2);
+    ABCD = _mm_sha1rnds4_epu32(ABCD, E0, 2);
+    MSG1 = _mm_sha1msg1_epu32(MSG1, MSG2);
+    MSG0 = _mm_xor_si128(MSG0, MSG2);
+
+    /* Rounds 60-63 */
+    E1 = _mm_sha1nexte_epu32(E1, MSG3);
+    E0 = ABCD;
+    MSG0 = _mm_sha1msg2_epu32(MSG0, MSG3);
+    ABCD = _mm_sha1rnds4_epu32(ABCD, E1, 3);
+    MSG2 = _mm_sha1msg1_epu32(MSG2, MSG3);
+    MSG1 = _mm_xor_si128(MSG1, MSG3);
+
+    /* Rounds 64-67 */
+    E0 = _mm_sha1nexte_epu32(E0, MSG0);
+    E1 = ABCD;
+    MSG1 = _mm_sha1msg2_epu32(MSG1, MSG0);
+    ABCD = _mm_sha1rnds4_epu32(ABCD, E0, 3);
+    MSG3 = _mm_sha1msg1_epu32(MSG3, MSG0);
+    MSG2 = _mm_xor_si128(MSG2, MSG0);
+
+    /* Rounds 68-71 */
+    E1 = _mm_sha1nexte_epu32(E1, MSG1);
+    E0 = ABCD;
+    MSG2 = _mm_sha1msg2_epu32(MSG2, MSG1);
+    ABCD = _mm_sha1rnds4_epu32(ABCD, E1, 3);
+    MSG3 = _mm_xor_si128(MSG3, MSG1);
+
+    /* Rounds 72-75 */
+    E0 = _mm_sha1nexte_epu32(E0, MSG2);
+    E1 = ABCD;
+    MSG3 = _mm_sha1msg2_epu32(MSG3, MSG2);
+    ABCD = _mm_sha1rnds4_epu32(ABCD, E0, 3);
+
+    /* Rounds 76-79 */
+    E1 = _mm_sha1nexte_epu32(E1, MSG3);
+    E0 = ABCD;
+    ABCD = _mm_sha1rnds4_epu32(ABCD, E1, 3);
+
+    E0 = _mm_sha1nexte_epu32(E0, E0_SAVE);
+    ABCD = _mm_add_epi32(ABCD, ABCD_SAVE);
+
+    ABCD = _mm_shuffle_epi32(ABCD, 0x1B);
+    _mm_storeu_si128((__m128i*)digest, ABCD);
+    digest[4] = _mm_extract_epi32(E0, 3);
+}
+
+#else
+
+static void SHA1ProcessBlockSHANI(unsigned digest[5], const unsigned char *block)
+{
+    SHA1ProcessBlockPortable(digest, block);
+}
+
+#endif
+
+#ifdef SHA1_ARMV8
+
+/*
+ *  SHA1ProcessBlockARMv8
+ *
+ *  Description:
+ *      Processes a block with the ARMv8 cryptography extensions.
+ *      Each sha1c, sha1p or sha1m does four rounds and sha1su0,
+ *      sha1su1 compute the next four words of the word sequence.
+ */
+__attribute__((target("+crypto")))
+static void SHA1ProcessBlockARMv8(unsigned digest[5], const unsigned char *block)
+{
+    const uint32_t K[] = { 0x5A827999, 0x6ED9EBA1, 0x8F1BBCDC, 0xCA62C1D6 };
+    uint32x4_t ABCD, ABCD_SAVE, W[4], WK;
+    uint32_t E, E_NEXT;
+    int t;
+
+    ABCD = vld1q_u32(digest);
+    E = digest[4];
+    ABCD_SAVE = ABCD;
+
+    for(t = 0; t < 4; t++)
+    {
+        W[t] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(block + t * 16)));
+    }
+
+    for(t = 0; t < 20; t++)
+    {
+        WK = vaddq_u32(W[t & 3], vdupq_n_u32(K[t / 5]));
+        E_NEXT = vsha1h_u32(vgetq_lane_u32(ABCD, 0));
+        if (t < 5)
+        {
+            ABCD = vsha1cq_u32(ABCD, E, WK);
+        }
+        else if (t >= 10 && t < 15)
+        {
+            ABCD = vsha1mq_u32(ABCD, E, WK);
+        }
+        else
+        {
+            ABCD = vsha1pq_u32(ABCD, E, WK);
+        }
+        E = E_NEXT;
+
+        if (t < 16)
+        {
+            W[t & 3] = vsha1su1q_u32(vsha1su0q_u32(W[t & 3], W[(t + 1) & 3],
+                                                   W[(t + 2) & 3]),
+                                     W[(t + 3) & 3]);
+        }
+    }
+
+    vst1q_u32(digest, vaddq_u32(ABCD, ABCD_SAVE));
+    digest[4] += E;
+}
+
+#else
+
+static void SHA1ProcessBlockARMv8(unsigned digest[5], const unsigned char *block)
+{
+    SHA1ProcessBlockPortable(digest, block);
+}
+
+#endif
+
+/*
+ *  SHA1ImplementationSupported
+ *
+ *  Description:
+ *      Returns 1 if the implementation can run on this CPU.
+ */
+int SHA1ImplementationSupported(int implementation)
+{
+    if (implementation < 0 || implementation >= SHA1_NUM_IMPLEMENTATIONS)
+    {
+        return 0;
+    }
+#ifndef SHA1_X86
+    if (implementation == SHA1_IMPL_SHANI)
+    {
+        return 0;
+    }
+#endif
+#ifndef SHA1_ARMV8
+    if (implementation == SHA1_IMPL_ARMV8)
+    {
+        return 0;
+    }
+#endif
+    return (cpu_features() & implementations[implementation].features) ==
+           implementations[implementation].features;
+}
+
+/*
+ *  SHA1SetImplementation
+ *
+ *  Description:
+ *      Forces the block implementation, mostly for testing and
+ *      benchmarks. Returns 0, or -1 if it isn't supported.
+ */
+int SHA1SetImplementation(int implementation)
+{
+    if (!SHA1ImplementationSupported(implementation))
+    {
+        return -1;
+    }
+    __atomic_store_n(&currentImplementation, implementation, __ATOMIC_RELAXED);
+    return 0;
+}
+
+/*
+ *  SHA1GetImplementation
+ *
+ *  Description:
+ *      Returns the block implementation in use, picking the fastest
+ *      one that the CPU supports the first time it's called.
+ */
+int SHA1GetImplementation(void)
+{
+    int implementation = __atomic_load_n(&currentImplementation, __ATOMIC_RELAXED);
+
+    if (implementation < 0)
+    {
+        if (SHA1ImplementationSupported(SHA1_IMPL_SHANI))
+        {
+            implementation = SHA1_IMPL_SHANI;
+        }
+        else if (SHA1ImplementationSupported(SHA1_IMPL_ARMV8))
+        {
+            implementation = SHA1_IMPL_ARMV8;
+        }
+        else
+        {
+            implementation = SHA1_IMPL_PORTABLE;
+        }
+        __atomic_store_n(&currentImplementation, implementation, __ATOMIC_RELAXED);
+    }
+    return implementation;
+}
+
+const char *SHA1ImplementationName(int implementation)
+{
+    if (implementation < 0 || implementation >= SHA1_NUM_IMPLEMENTATIONS)
+    {
+        return NULL;
+    }
+    return implementations[implementation].name;
+}
+
+/*  
+ *  SHA1ProcessMessageBlock
+ *
+ *  Description:
+ *      This function will process the next 512 bits of the message
+ *      stored in the Message_Block array.
+ *
+ *  Parameters:
+ *      None.
+ *
+ *  Returns:
+ *      Nothing.
+ *
+ *  Comments:
+ *      The block is processed by the implementation that
+ *      SHA1GetImplementation picks.
+ *
+ */
+void SHA1ProcessMessageBlock(SHA1Context *context)
+{
+    implementations[SHA1GetImplementation()].process(context->Message_Digest,
+                                                     context->Message_Block);
     context->Message_Block_Index = 0;
 }
 
@@ -369,3 +775,360 @@ void SHA1PadMessage(SHA1Context *context)
 
     SHA1ProcessMessageBlock(context);
 }
+
+/*
+ *  SHA1Hash
+ *
+ *  Description:
+ *      This function hashes a whole message in one call. Messages of
+ *      up to SHA1_SHORT_MAX octets fit in one padded block, which is
+ *      built directly and processed once, skipping the octet at a
+ *      time buffering of SHA1Input and SHA1PadMessage.
+ *
+ *  Parameters:
+ *      message_array: [in]
+ *          The message to hash.
+ *      length: [in]
+ *          The length of the message in octets.
+ *      digest: [out]
+ *          The five words of the 160-bit message digest.
+ *
+ *  Returns:
+ *      Nothing.
+ *
+ */
+void SHA1Hash(const unsigned char *message_array,
+              unsigned length,
+              unsigned digest[5])
+{
+    SHA1Context context;
+
+    if (length <= SHA1_SHORT_MAX)
+    {
+        unsigned char block[64];
+        unsigned bits = length << 3;
+
+        memcpy(block, message_array, length);
+        block[length] = 0x80;
+        memset(block + length + 1, 0, 61 - length);
+        block[62] = (bits >> 8) & 0xFF;
+        block[63] = bits & 0xFF;
+
+        digest[0] = 0x67452301;
+        digest[1] = 0xEFCDAB89;
+        digest[2] = 0x98BADCFE;
+        digest[3] = 0x10325476;
+        digest[4] = 0xC3D2E1F0;
+        implementations[SHA1GetImplementation()].process(digest, block);
+        return;
+    }
+
+    SHA1Reset(&context);
+    SHA1Input(&context, message_array, length);
+    SHA1Result(&context);
+    memcpy(digest, context.Message_Digest, sizeof(context.Message_Digest));
+}
+
+/*
+ *  Multi-buffer SHA-1
+ *
+ *  The AVX2 and AVX-512 kernels hash 8 or 16 independent messages at
+ *  once, one message per 32-bit lane. Each lane is padded on its own
+ *  and lanes that have run out of blocks keep their state, so the
+ *  digests are the same as SHA1Result gives.
+ */
+
+/* The number of 64 octet blocks in a padded message of len octets */
+#define SHA1_MULTI_BLOCKS(len) (((len) + 8) / 64 + 1)
+
+/*
+ *  SHA1MultiBlock
+ *
+ *  Description:
+ *      Returns block number block of the padded message, either
+ *      directly from message_array or built in buf.
+ */
+static const unsigned char *SHA1MultiBlock(const unsigned char *message_array,
+                                           unsigned length,
+                                           unsigned block,
+                                           unsigned char buf[64])
+{
+    unsigned offset = block * 64;
+    unsigned long long bits = (unsigned long long)length << 3;
+    int i;
+
+    if (offset + 64 <= length)
+    {
+        return message_array + offset;
+    }
+
+    memset(buf, 0, 64);
+    if (offset < length)
+    {
+        memcpy(buf, message_array + offset, length - offset);
+    }
+    if (offset <= length)
+    {
+        buf[length - offset] = 0x80;
+    }
+    if (block + 1 == SHA1_MULTI_BLOCKS(length))
+    {
+        for(i = 0; i < 8; i++)
+        {
+            buf[63 - i] = (bits >> (i * 8)) & 0xFF;
+        }
+    }
+
+    return buf;
+}
+
+/*
+ *  SHA1MultiScalar
+ *
+ *  Description:
+ *      Hashes each message in turn with SHA1Input.
+ */
+void SHA1MultiScalar(const unsigned char *message_arrays[],
+                     const unsigned lengths[],
+                     unsigned n,
+                     unsigned digests[][5])
+{
+    unsigned x;
+
+    for(x = 0; x < n; x++)
+    {
+        SHA1Hash(message_arrays[x], lengths[x], digests[x]);
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#define SHA1_MULTI_ROL(bits, word) (((word) << (bits)) | ((word) >> (32 - (bits))))
+
+/*
+ *  The kernel body, shared by the AVX2 and AVX-512 versions. VEC is
+ *  a GCC vector of LANES 32-bit words and n is at most LANES.
+ */
+#define SHA1_MULTI_KERNEL(VEC, LANES)                                       \
+    unsigned words[16][LANES] __attribute__((aligned(64)));                 \
+    unsigned out[5][LANES] __attribute__((aligned(64)));                    \
+    unsigned char buf[LANES][64];                                           \
+    unsigned blocks[LANES], maxBlocks = 0, block, lane, i;                  \
+    VEC H[5], A, B, C, D, E, temp, active, W[16];                           \
+                                                                            \
+    for(lane = 0; lane < LANES; lane++)                                     \
+    {                                                                       \
+        blocks[lane] = lane < n ? SHA1_MULTI_BLOCKS(lengths[lane]) : 0;     \
+        if (blocks[lane] > maxBlocks)                                       \
+        {                                                                   \
+            maxBlocks = blocks[lane];                                       \
+        }                                                                   \
+    }                                                                       \
+    H[0] = (VEC){0} + 0x67452301;                                           \
+    H[1] = (VEC){0} + 0xEFCDAB89;                                           \
+    H[2] = (VEC){0} + 0x98BADCFE;                                           \
+    H[3] = (VEC){0} + 0x10325476;                                           \
+    H[4] = (VEC){0} + 0xC3D2E1F0;                                           \
+                                                                            \
+    for(block = 0; block < maxBlocks; block++)                              \
+    {                                                                       \
+        for(lane = 0; lane < LANES; lane++)                                 \
+        {                                                                   \
+            const unsigned char *p;                                         \
+            if (block >= blocks[lane])                                      \
+            {                                                               \
+                for(i = 0; i < 16; i++)                                     \
+                {                                                           \
+                    words[i][lane] = 0;                                     \
+                }                                                           \
+                continue;                                                   \
+            }                                                               \
+            p = SHA1MultiBlock(message_arrays[lane], lengths[lane],         \
+                               block, buf[lane]);                           \
+            for(i = 0; i < 16; i++)                                         \
+            {                                                               \
+                memcpy(&words[i][lane], p + i * 4, 4);                      \
+                words[i][lane] = __builtin_bswap32(words[i][lane]);         \
+            }                                                               \
+        }                                                                   \
+        for(i = 0; i < 16; i++)                                             \
+        {                                                                   \
+            memcpy(&W[i], words[i], sizeof(VEC));                           \
+        }                                                                   \
+        for(lane = 0; lane < LANES; lane++)                                 \
+        {                                                                   \
+            out[0][lane] = block < blocks[lane] ? 0xFFFFFFFF : 0;           \
+        }                                                                   \
+        memcpy(&active, out[0], sizeof(VEC));                               \
+                                                                            \
+        A = H[0]; B = H[1]; C = H[2]; D = H[3]; E = H[4];                   \
+        for(i = 0; i < 80; i++)                                             \
+        {                                                                   \
+            if (i >= 16)                                                    \
+            {                                                               \
+                W[i & 15] = SHA1_MULTI_ROL(1, W[(i + 13) & 15] ^            \
+                    W[(i + 8) & 15] ^ W[(i + 2) & 15] ^ W[i & 15]);         \
+            }                                                               \
+            if (i < 20)                                                     \
+            {                                                               \
+                temp = ((B & C) | (~B & D)) + 0x5A827999;                   \
+            }                                                               \
+            else if (i < 40)                                                \
+            {                                                               \
+                temp = (B ^ C ^ D) + 0x6ED9EBA1;                            \
+            }                                                               \
+            else if (i < 60)                                                \
+            {                                                               \
+                temp = ((B & C) | (B & D) | (C & D)) + 0x8F1BBCDC;          \
+            }                                                               \
+            else                                                            \
+            {                                                               \
+                temp = (B ^ C ^ D) + 0xCA62C1D6;                            \
+            }                                                               \
+            temp += SHA1_MULTI_ROL(5, A) + E + W[i & 15];                   \
+            E = D;                                                          \
+            D = C;                                                          \
+            C = SHA1_MULTI_ROL(30, B);                                      \
+            B = A;                                                          \
+            A = temp;                                                       \
+        }                                                                   \
+        H[0] = ((H[0] + A) & active) | (H[0] & ~active);                    \
+        H[1] = ((H[1] + B) & active) | (H[1] & ~active);                    \
+        H[2] = ((H[2] + C) & active) | (H[2] & ~active);                    \
+        H[3] = ((H[3] + D) & active) | (H[3] & ~active);                    \
+        H[4] = ((H[4] + E) & active) | (H[4] & ~active);                    \
+    }                                                                       \
+                                                                            \
+    for(i = 0; i < 5; i++)                                                  \
+    {                                                                       \
+        memcpy(out[i], &H[i], sizeof(VEC));                                 \
+    }                                                                       \
+    for(lane = 0; lane < n; lane++)                                         \
+    {                                                                       \
+        for(i = 0; i < 5; i++)                                              \
+        {                                                                   \
+            digests[lane][i] = out[i][lane];                                \
+        }                                                                   \
+    }
+
+typedef unsigned SHA1Vec8 __attribute__((vector_size(32)));
+typedef unsigned SHA1Vec16 __attribute__((vector_size(64)));
+
+__attribute__((target("avx2")))
+static void SHA1MultiAVX2Lanes(const unsigned char *message_arrays[],
+                               const unsigned lengths[],
+                               unsigned n,
+                               unsigned digests[][5])
+{
+    SHA1_MULTI_KERNEL(SHA1Vec8, 8)
+}
+
+__attribute__((target("avx512f")))
+static void SHA1MultiAVX512Lanes(const unsigned char *message_arrays[],
+                                 const unsigned lengths[],
+                                 unsigned n,
+                                 unsigned digests[][5])
+{
+    SHA1_MULTI_KERNEL(SHA1Vec16, 16)
+}
+
+void SHA1MultiAVX2(const unsigned char *message_arrays[],
+                   const unsigned lengths[],
+                   unsigned n,
+                   unsigned digests[][5])
+{
+    unsigned x;
+
+    for(x = 0; x < n; x += 8)
+    {
+        SHA1MultiAVX2Lanes(message_arrays + x, lengths + x,
+                           n - x < 8 ? n - x : 8, digests + x);
+    }
+}
+
+void SHA1MultiAVX512(const unsigned char *message_arrays[],
+                     const unsigned lengths[],
+                     unsigned n,
+                     unsigned digests[][5])
+{
+    unsigned x;
+
+    for(x = 0; x < n; x += 16)
+    {
+        SHA1MultiAVX512Lanes(message_arrays + x, lengths + x,
+                             n - x < 16 ? n - x : 16, digests + x);
+    }
+}
+
+#else
+
+void SHA1MultiAVX2(const unsigned char *message_arrays[],
+                   const unsigned lengths[],
+                   unsigned n,
+                   unsigned digests[][5])
+{
+    SHA1MultiScalar(message_arrays, lengths, n, digests);
+}
+
+void SHA1MultiAVX512(const unsigned char *message_arrays[],
+                     const unsigned lengths[],
+                     unsigned n,
+                     unsigned digests[][5])
+{
+    SHA1MultiScalar(message_arrays, lengths, n, digests);
+}
+
+#endif
+
+/*
+ *  SHA1Multi
+ *
+ *  Description:
+ *      This function hashes n independent messages, digests[i] gets
+ *      the Message_Digest of message_arrays[i]. It uses the widest
+ *      multi-buffer kernel that the CPU supports.
+ *
+ *  Parameters:
+ *      message_arrays: [in]
+ *          The messages to hash.
+ *      lengths: [in]
+ *          The length in octets of each message.
+ *      n: [in]
+ *          The number of messages.
+ *      digests: [out]
+ *          The 160-bit digest of each message.
+ *
+ *  Returns:
+ *      Nothing.
+ *
+ *  Comments:
+ *      A mostly empty group of lanes is slower than hashing the
+ *      messages one at a time, so the last few use SHA1MultiScalar.
+ *
+ */
+void SHA1Multi(const unsigned char *message_arrays[],
+               const unsigned lengths[],
+               unsigned n,
+               unsigned digests[][5])
+{
+    uint32_t features = cpu_features();
+    unsigned x = 0, lanes;
+
+    if (features & CPU_AVX512F)
+    {
+        for(; n - x >= 12; x += lanes)
+        {
+            lanes = n - x < 16 ? n - x : 16;
+            SHA1MultiAVX512(message_arrays + x, lengths + x, lanes, digests + x);
+        }
+    }
+    if (features & CPU_AVX2)
+    {
+        for(; n - x >= 4; x += lanes)
+        {
+            lanes = n - x < 8 ? n - x : 8;
+            SHA1MultiAVX2(message_arrays + x, lengths + x, lanes, digests + x);
+        }
+    }
+    SHA1MultiScalar(message_arrays + x, lengths + x, n - x, digests + x);
+}
@@ -42,6 +42,15 @@ typedef struct SHA1Context
     int Corrupted;              /* Is the message digest corruped?  */
 } SHA1Context;
 
+/*
+ *  SHA-1 block implementations, the fastest supported one is used
+ *  unless SHA1SetImplementation picks another.
+ */
+#define SHA1_IMPL_PORTABLE  0   /* Plain C                          */
+#define SHA1_IMPL_SHANI     1   /* Intel SHA extensions             */
+#define SHA1_IMPL_ARMV8     2   /* ARMv8 cryptography extensions    */
+#define SHA1_NUM_IMPLEMENTATIONS 3
+
 /*
  *  Function Prototypes
  */
@@ -51,4 +60,45 @@ void SHA1Input( SHA1Context *,
                 const unsigned char *,
                 unsigned);
 
+int SHA1ImplementationSupported(int);
+int SHA1SetImplementation(int);
+int SHA1GetImplementation(void);
+const char *SHA1ImplementationName(int);
+
+/*
+ *  Hash a whole message in one call, messages of up to SHA1_SHORT_MAX
+ *  octets are processed as a single block.
+ */
+#define SHA1_SHORT_MAX 55
+void SHA1Hash(const unsigned char *message_array,
+              unsigned length,
+              unsigned digest[5]);
+
+/*
+ *  Hash n independent messages at once, digests[i] is the
+ *  Message_Digest of message_arrays[i].
+ */
+void SHA1Multi(const unsigned char *message_arrays[],
+               const unsigned lengths[],
+               unsigned n,
+               unsigned digests[][5]);
+
+/*
+ *  The individual SHA1Multi kernels. SHA1MultiAVX2 and SHA1MultiAVX512
+ *  must only be called when cpu_features() reports CPU_AVX2 or
+ *  CPU_AVX512F.
+ */
+void SHA1MultiScalar(const unsigned char *message_arrays[],
+                     const unsigned lengths[],
+                     unsigned n,
+                     unsigned digests[][5]);
+void SHA1MultiAVX2(const unsigned char *message_arrays[],
+                   const unsigned lengths[],
+                   unsigned n,
+                   unsigned digests[][5]);
+void SHA1MultiAVX512(const unsigned char *message_arrays[],
+                     const unsigned lengths[],
+                     unsigned n,
+                     unsigned digests[][5]);
+
 #endif
@@ -0,0 +1,219 @@
+/**
+ * Copyright 2015 Chris Moos
+ * 
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and 
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "hash_ring.h"
+
+/**
+ * A reader's slot, on its own cache line so that readers don't slow each other down.
+ * epoch is the global epoch the reader saw when it started reading, 0 while it isn't
+ * reading.
+ */
+typedef struct hash_ring_shared_reader_t {
+    uint64_t epoch;
+    uint32_t used;
+    uint8_t padding[64 - sizeof(uint64_t) - sizeof(uint32_t)];
+} hash_ring_shared_reader_t;
+
+/* A replaced ring, freed once no reader can still be using it */
+typedef struct hash_ring_retired_t {
+    hash_ring_t *ring;
+
+    /* The global epoch when the ring was replaced */
+    uint64_t epoch;
+    struct hash_ring_retired_t *next;
+} hash_ring_retired_t;
+
+struct hash_ring_shared_t {
+    /* The current ring, read and replaced atomically */
+    hash_ring_t *ring;
+
+    /* Goes up by one each time a ring is published, starts at 1 */
+    uint64_t epoch;
+
+    hash_ring_shared_reader_t *readers;
+    uint32_t maxReaders;
+
+    /* Held from hash_ring_shared_write_begin until the new ring is published or abandoned */
+    pthread_mutex_t writeLock;
+
+    /* Rings waiting to be freed, only touched by the writer holding writeLock */
+    hash_ring_retired_t *retired;
+    uint32_t numRetired;
+};
+
+hash_ring_shared_t *hash_ring_shared_create(hash_ring_t *ring, uint32_t maxReaders) {
+    if(ring == NULL || maxReaders == 0) return NULL;
+
+    hash_ring_shared_t *shared = (hash_ring_shared_t*)malloc(sizeof(hash_ring_shared_t));
+    if(shared == NULL) return NULL;
+
+    void *readers;
+    if(posix_memalign(&readers, 64, sizeof(hash_ring_shared_reader_t) * maxReaders) != 0) {
+        free(shared);
+        return NULL;
+    }
+    if(pthread_mutex_init(&shared->writeLock, NULL) != 0) {
+        free(readers);
+        free(shared);
+        return NULL;
+    }
+
+    shared->readers = (hash_ring_shared_reader_t*)readers;
+    shared->maxReaders = maxReaders;
+    uint32_t x;
+    for(x = 0; x < maxReaders; x++) {
+        shared->readers[x].epoch = 0;
+        shared->readers[x].used = 0;
+    }
+    shared->ring = ring;
+    shared->epoch = 1;
+    shared->retired = NULL;
+    shared->numRetired = 0;
+    return shared;
+}
+
+void hash_ring_shared_free(hash_ring_shared_t *shared) {
+    if(shared == NULL) return;
+
+    while(shared->retired != NULL) {
+        hash_ring_retired_t *retired = shared->retired;
+        shared->retired = retired->next;
+        hash_ring_free(retired->ring);
+        free(retired);
+    }
+    hash_ring_free(shared->ring);
+    pthread_mutex_destroy(&shared->writeLock);
+    free(shared->readers);
+    free(shared);
+}
+
+int hash_ring_shared_register(hash_ring_shared_t *shared) {
+    if(shared == NULL) return HASH_RING_ERR;
+
+    uint32_t x;
+    for(x = 0; x < shared->maxReaders; x++) {
+        uint32_t unused = 0;
+        if(__atomic_compare_exchange_n(&shared->readers[x].used, &unused, 1, 0,
+            __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+            return (int)x;
+        }
+    }
+    return HASH_RING_ERR;
+}
+
+void hash_ring_shared_unregister(hash_ring_shared_t *shared, int reader) {
+    if(shared == NULL || reader < 0 || reader >= (int)shared->maxReaders) return;
+
+    __atomic_store_n(&shared->readers[reader].epoch, 0, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&shared->readers[reader].used, 0, __ATOMIC_RELEASE);
+}
+
+hash_ring_t *hash_ring_shared_read_begin(hash_ring_shared_t *shared, int reader) {
+    hash_ring_shared_reader_t *slot = &shared->readers[reader];
+
+    // The slot must be visible to the writer before the ring is loaded, the writer
+    // replaces the ring before it looks at the slots
+    __atomic_store_n(&slot->epoch, __atomic_load_n(&shared->epoch, __ATOMIC_SEQ_CST), __ATOMIC_SEQ_CST);
+    return __atomic_load_n(&shared->ring, __ATOMIC_SEQ_CST);
+}
+
+void hash_ring_shared_read_end(hash_ring_shared_t *shared, int reader) {
+    __atomic_store_n(&shared->readers[reader].epoch, 0, __ATOMIC_RELEASE);
+}
+
+hash_ring_t *hash_ring_shared_write_begin(hash_ring_shared_t *shared) {
+    if(shared == NULL) return NULL;
+
+    pthread_mutex_lock(&shared->writeLock);
+
+    // Only writers replace the ring, so it can't be freed while this writer copies it
+    hash_ring_t *copy = hash_ring_copy(shared->ring);
+    if(copy == NULL) {
+        pthread_mutex_unlock(&shared->writeLock);
+    }
+    return copy;
+}
+
+/**
+ * Frees the retired rings that no reader can still be using. A reader that started
+ * at or before the epoch a ring was replaced in may have loaded it.
+ */
+static void hash_ring_shared_reclaim(hash_ring_shared_t *shared) {
+    uint64_t oldest = UINT64_MAX;
+    uint32_t x;
+    for(x = 0; x < shared->maxReaders; x++) {
+        uint64_t epoch = __atomic_load_n(&shared->readers[x].epoch, __ATOMIC_SEQ_CST);
+        if(epoch != 0 && epoch < oldest) oldest = epoch;
+    }
+
+    hash_ring_retired_t **link = &shared->retired;
+    while(*link != NULL) {
+        hash_ring_retired_t *retired = *link;
+        if(retired->epoch < oldest) {
+            *link = retired->next;
+            hash_ring_free(retired->ring);
+            free(retired);
+            shared->numRetired--;
+        }
+        else {
+            link = &retired->next;
+        }
+    }
+}
+
+int hash_ring_shared_publish(hash_ring_shared_t *shared, hash_ring_t *ring) {
+    if(shared == NULL || ring == NULL) return HASH_RING_ERR;
+
+    hash_ring_retired_t *retired = (hash_ring_retired_t*)malloc(sizeof(hash_ring_retired_t));
+    if(retired == NULL) {
+        hash_ring_free(ring);
+        pthread_mutex_unlock(&shared->writeLock);
+        return HASH_RING_ERR;
+    }
+
+    // Readers from now on get the new ring, ones that started before the epoch moves
+    // on may have the old one
+    retired->ring = __atomic_exchange_n(&shared->ring, ring, __ATOMIC_SEQ_CST);
+    retired->epoch = __atomic_fetch_add(&shared->epoch, 1, __ATOMIC_SEQ_CST);
+    retired->next = shared->retired;
+    shared->retired = retired;
+    shared->numRetired++;
+
+    hash_ring_shared_reclaim(shared);
+    pthread_mutex_unlock(&shared->writeLock);
+    return HASH_RING_OK;
+}
+
+void hash_ring_shared_abort(hash_ring_shared_t *shared, hash_ring_t *ring) {
+    if(shared == NULL) return;
+
+    hash_ring_free(ring);
+    pthread_mutex_unlock(&shared->writeLock);
+}
+
+uint32_t hash_ring_shared_pending(hash_ring_shared_t *shared) {
+    if(shared == NULL) return 0;
+
+    pthread_mutex_lock(&shared->writeLock);
+    hash_ring_shared_reclaim(shared);
+    uint32_t numRetired = shared->numRetired;
+    pthread_mutex_unlock(&shared->writeLock);
+    return numRetired;
+}
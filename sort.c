@@ -15,32 +15,249 @@
  * limitations under the License.
  */
 
-#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "sort.h"
+#include "parallel.h"
 
-void bubble_sort_array(void **array, int numItems, compare_func fn) {
-    // an array of less than or equal to 1 is already sorted
-    if(numItems <= 1) return;
-    
-    void *temp;
-    int x, result;
-    while(1) {
-        int numSorts = 0;
-        for(x = 0; x < numItems; x++) {
-            if(x < (numItems - 1)) {
-                result = fn(array[x], array[x + 1]);
-                if(result > 0) {
-                    temp = array[x + 1];
-                    array[x + 1] = array[x];
-                    array[x] = temp;
-                    numSorts++;
-                }
-                else if(result < 0) {
-                    // no-op
-                }
+#define SORT_DIGITS 8
+#define SORT_DIGIT_BITS 8
+#define SORT_BUCKETS (1 << SORT_DIGIT_BITS)
+
+/* Arrays bigger than this are split on their top digit before the LSD passes */
+#define SORT_LSD_MAX (1 << 16)
+
+static void sort_insertion(uint64_t *numbers, uint32_t *values, uint32_t numItems) {
+    uint32_t x, y;
+
+    for(x = 1; x < numItems; x++) {
+        uint64_t number = numbers[x];
+        uint32_t value = values != NULL ? values[x] : 0;
+
+        // Stop at an equal number so the sort stays stable
+        for(y = x; y > 0 && numbers[y - 1] > number; y--) {
+            numbers[y] = numbers[y - 1];
+            if(values != NULL) values[y] = values[y - 1];
+        }
+        numbers[y] = number;
+        if(values != NULL) values[y] = value;
+    }
+}
+
+/**
+ * LSD radix sort on the low numDigits digits, the result ends up back in numbers.
+ */
+static void sort_lsd(uint64_t *numbers, uint32_t *values, uint32_t numItems,
+    uint64_t *tempNumbers, uint32_t *tempValues, uint32_t numDigits) {
+    // Count every digit in one pass over the numbers
+    uint32_t counts[SORT_DIGITS][SORT_BUCKETS];
+    uint32_t x, digit;
+    memset(counts, 0, sizeof(uint32_t) * SORT_BUCKETS * numDigits);
+    for(x = 0; x < numItems; x++) {
+        uint64_t number = numbers[x];
+        for(digit = 0; digit < numDigits; digit++) {
+            counts[digit][(number >> (digit * SORT_DIGIT_BITS)) & (SORT_BUCKETS - 1)]++;
+        }
+    }
+
+    uint64_t *srcNumbers = numbers, *dstNumbers = tempNumbers;
+    uint32_t *srcValues = values, *dstValues = tempValues;
+    for(digit = 0; digit < numDigits; digit++) {
+        uint32_t shift = digit * SORT_DIGIT_BITS;
+        uint32_t *count = counts[digit];
+
+        // Every number has the same digit, the pass wouldn't move anything
+        if(count[(srcNumbers[0] >> shift) & (SORT_BUCKETS - 1)] == numItems) continue;
+
+        uint32_t offsets[SORT_BUCKETS], offset = 0, bucket;
+        for(bucket = 0; bucket < SORT_BUCKETS; bucket++) {
+            offsets[bucket] = offset;
+            offset += count[bucket];
+        }
+
+        if(values != NULL) {
+            for(x = 0; x < numItems; x++) {
+                uint32_t pos = offsets[(srcNumbers[x] >> shift) & (SORT_BUCKETS - 1)]++;
+                dstNumbers[pos] = srcNumbers[x];
+                dstValues[pos] = srcValues[x];
             }
         }
-        if(numSorts == 0) break;
+        else {
+            for(x = 0; x < numItems; x++) {
+                dstNumbers[offsets[(srcNumbers[x] >> shift) & (SORT_BUCKETS - 1)]++] = srcNumbers[x];
+            }
+        }
+
+        uint64_t *swapNumbers = srcNumbers;
+        srcNumbers = dstNumbers;
+        dstNumbers = swapNumbers;
+        uint32_t *swapValues = srcValues;
+        srcValues = dstValues;
+        dstValues = swapValues;
+    }
+
+    // An odd number of passes leaves the result in the scratch space
+    if(srcNumbers != numbers) {
+        memcpy(numbers, srcNumbers, sizeof(uint64_t) * numItems);
+        if(values != NULL) memcpy(values, srcValues, sizeof(uint32_t) * numItems);
+    }
+}
+
+/**
+ * Sorts on the low numDigits digits, the result ends up back in numbers.
+ */
+static void sort_radix(uint64_t *numbers, uint32_t *values, uint32_t numItems,
+    uint64_t *tempNumbers, uint32_t *tempValues, uint32_t numDigits) {
+    if(numItems <= SORT_INSERTION_MAX) {
+        sort_insertion(numbers, values, numItems);
+        return;
+    }
+    if(numItems <= SORT_LSD_MAX || numDigits == 1) {
+        sort_lsd(numbers, values, numItems, tempNumbers, tempValues, numDigits);
+        return;
+    }
+
+    // Too big for the LSD passes to stay in cache. Split on the top digit into the scratch
+    // space first, until the buckets are small enough to sort on the other digits in cache.
+    uint32_t shift = (numDigits - 1) * SORT_DIGIT_BITS;
+    uint32_t counts[SORT_BUCKETS], offsets[SORT_BUCKETS], offset = 0, x, bucket;
+    memset(counts, 0, sizeof(counts));
+    for(x = 0; x < numItems; x++) {
+        counts[(numbers[x] >> shift) & (SORT_BUCKETS - 1)]++;
+    }
+    for(bucket = 0; bucket < SORT_BUCKETS; bucket++) {
+        offsets[bucket] = offset;
+        offset += counts[bucket];
+    }
+    for(x = 0; x < numItems; x++) {
+        uint32_t pos = offsets[(numbers[x] >> shift) & (SORT_BUCKETS - 1)]++;
+        tempNumbers[pos] = numbers[x];
+        if(values != NULL) tempValues[pos] = values[x];
+    }
+
+    // Each bucket is sorted in the scratch space, with its part of numbers as scratch,
+    // and copied back while it's still in cache
+    uint32_t start = 0;
+    for(bucket = 0; bucket < SORT_BUCKETS; bucket++) {
+        uint32_t count = counts[bucket];
+        sort_radix(tempNumbers + start, values != NULL ? tempValues + start : NULL, count,
+            numbers + start, values != NULL ? values + start : NULL, numDigits - 1);
+        memcpy(numbers + start, tempNumbers + start, sizeof(uint64_t) * count);
+        if(values != NULL) memcpy(values + start, tempValues + start, sizeof(uint32_t) * count);
+        start += count;
+    }
+}
+
+void sort_pairs(uint64_t *numbers, uint32_t *values, uint32_t numItems,
+    uint64_t *tempNumbers, uint32_t *tempValues) {
+    sort_radix(numbers, values, numItems, tempNumbers, tempValues, SORT_DIGITS);
+}
+
+/**
+ * One thread's share of sort_pairs_parallel. The thread counts and then scatters the
+ * items from start to end on their top digit, and afterwards sorts the buckets from
+ * firstBucket to lastBucket.
+ */
+typedef struct sort_job_t {
+    uint64_t *numbers;
+    uint32_t *values;
+    uint64_t *tempNumbers;
+    uint32_t *tempValues;
+    uint32_t start, end;
+    uint32_t counts[SORT_BUCKETS];
+    uint32_t offsets[SORT_BUCKETS];
+    uint32_t firstBucket, lastBucket;
+    uint32_t *bucketStarts;
+} sort_job_t;
+
+#define SORT_TOP_SHIFT ((SORT_DIGITS - 1) * SORT_DIGIT_BITS)
+
+static void sort_count_job(void *arg) {
+    sort_job_t *job = (sort_job_t*)arg;
+    uint32_t x;
+
+    memset(job->counts, 0, sizeof(job->counts));
+    for(x = job->start; x < job->end; x++) {
+        job->counts[job->numbers[x] >> SORT_TOP_SHIFT]++;
+    }
+}
+
+static void sort_scatter_job(void *arg) {
+    sort_job_t *job = (sort_job_t*)arg;
+    uint32_t x;
+
+    for(x = job->start; x < job->end; x++) {
+        uint32_t pos = job->offsets[job->numbers[x] >> SORT_TOP_SHIFT]++;
+        job->tempNumbers[pos] = job->numbers[x];
+        if(job->values != NULL) job->tempValues[pos] = job->values[x];
+    }
+}
+
+static void sort_buckets_job(void *arg) {
+    sort_job_t *job = (sort_job_t*)arg;
+    uint32_t bucket;
+
+    for(bucket = job->firstBucket; bucket < job->lastBucket; bucket++) {
+        uint32_t start = job->bucketStarts[bucket], count = job->bucketStarts[bucket + 1] - start;
+        uint32_t *values = job->values != NULL ? job->values + start : NULL;
+        uint32_t *tempValues = job->values != NULL ? job->tempValues + start : NULL;
+
+        sort_radix(job->tempNumbers + start, tempValues, count, job->numbers + start, values, SORT_DIGITS - 1);
+        memcpy(job->numbers + start, job->tempNumbers + start, sizeof(uint64_t) * count);
+        if(values != NULL) memcpy(values, tempValues, sizeof(uint32_t) * count);
+    }
+}
+
+void sort_pairs_parallel(uint64_t *numbers, uint32_t *values, uint32_t numItems,
+    uint64_t *tempNumbers, uint32_t *tempValues, uint32_t numThreads) {
+    if(numThreads > PARALLEL_MAX_JOBS) numThreads = PARALLEL_MAX_JOBS;
+    if(numThreads <= 1 || numItems <= SORT_LSD_MAX) {
+        sort_pairs(numbers, values, numItems, tempNumbers, tempValues);
+        return;
+    }
+
+    // The jobs are too big for the stack, sort on this thread if they can't be allocated
+    sort_job_t *jobs = (sort_job_t*)malloc(sizeof(sort_job_t) * numThreads);
+    if(jobs == NULL) {
+        sort_pairs(numbers, values, numItems, tempNumbers, tempValues);
+        return;
+    }
+
+    uint32_t bucketStarts[SORT_BUCKETS + 1];
+    uint32_t x, bucket;
+    for(x = 0; x < numThreads; x++) {
+        jobs[x].numbers = numbers;
+        jobs[x].values = values;
+        jobs[x].tempNumbers = tempNumbers;
+        jobs[x].tempValues = tempValues;
+        jobs[x].start = (uint32_t)((uint64_t)numItems * x / numThreads);
+        jobs[x].end = (uint32_t)((uint64_t)numItems * (x + 1) / numThreads);
+        jobs[x].bucketStarts = bucketStarts;
+    }
+
+    // Split on the top digit as sort_radix does. Within a bucket each thread's items go
+    // after those of the threads before it, so the split is stable.
+    parallel_run(sort_count_job, jobs, sizeof(sort_job_t), numThreads);
+    uint32_t offset = 0;
+    for(bucket = 0; bucket < SORT_BUCKETS; bucket++) {
+        bucketStarts[bucket] = offset;
+        for(x = 0; x < numThreads; x++) {
+            jobs[x].offsets[bucket] = offset;
+            offset += jobs[x].counts[bucket];
+        }
+    }
+    bucketStarts[SORT_BUCKETS] = numItems;
+    parallel_run(sort_scatter_job, jobs, sizeof(sort_job_t), numThreads);
+
+    // Each thread sorts a run of buckets holding about the same number of items
+    bucket = 0;
+    for(x = 0; x < numThreads; x++) {
+        uint64_t end = (uint64_t)numItems * (x + 1) / numThreads;
+        jobs[x].firstBucket = bucket;
+        while(bucket < SORT_BUCKETS && (x == numThreads - 1 || bucketStarts[bucket + 1] <= end)) bucket++;
+        jobs[x].lastBucket = bucket;
     }
+    parallel_run(sort_buckets_job, jobs, sizeof(sort_job_t), numThreads);
+
+    free(jobs);
 }
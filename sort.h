@@ -15,18 +15,33 @@
  * limitations under the License.
  */
 
-#ifndef BUBBLE_SORT_H
-#define BUBBLE_SORT_H
+#ifndef SORT_H
+#define SORT_H
+
+#include <stdint.h>
+
+/* Arrays of at most this many numbers are insertion sorted instead of radix sorted */
+#define SORT_INSERTION_MAX 64
 
 /**
- * Comparator function
- * This function should return:
- * -1 if a is less than b
- *  0 if a is equal to b
- *  1 if a is greater than b
+ * Sorts numItems numbers ascending, moving values[x] along with numbers[x] so the
+ * pairs stay together. values may be NULL to sort the numbers alone.
+ *
+ * The sort is stable, pairs with the same number keep their order. It is an LSD radix
+ * sort on 8 bit digits, skipping the digits where every number is the same, and small
+ * arrays are insertion sorted.
+ *
+ * tempNumbers and tempValues are scratch space for numItems entries each, tempValues
+ * is unused when values is NULL.
  */
-typedef int (*compare_func)(void *a, void *b);
+void sort_pairs(uint64_t *numbers, uint32_t *values, uint32_t numItems,
+    uint64_t *tempNumbers, uint32_t *tempValues);
 
-void bubble_sort_array(void **array, int numItems, compare_func fn);
+/**
+ * sort_pairs using up to numThreads threads. The result is the same as sort_pairs.
+ * Arrays too small to be worth splitting up are sorted on the calling thread.
+ */
+void sort_pairs_parallel(uint64_t *numbers, uint32_t *values, uint32_t numItems,
+    uint64_t *tempNumbers, uint32_t *tempValues, uint32_t numThreads);
 
 #endif
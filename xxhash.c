@@ -0,0 +1,237 @@
+/**
+ * Copyright 2015 Chris Moos
+ * 
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and 
+ * limitations under the License.
+ */
+
+/*
+ * XXH3 64-bit, ported from the xxHash specification by Yann Collet.
+ * Only the default secret and a seed of 0 are supported.
+ */
+
+#include <string.h>
+
+#include "xxhash.h"
+
+#define XXH_PRIME32_1 0x9E3779B1U
+#define XXH_PRIME32_2 0x85EBCA77U
+#define XXH_PRIME32_3 0xC2B2AE3DU
+
+#define XXH_PRIME64_1 0x9E3779B185EBCA87ULL
+#define XXH_PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define XXH_PRIME64_3 0x165667B19E3779F9ULL
+#define XXH_PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define XXH_PRIME64_5 0x27D4EB2F165667C5ULL
+
+#define XXH_SECRET_SIZE 192
+#define XXH_STRIPE_LEN 64
+#define XXH_SECRET_CONSUME_RATE 8
+#define XXH_ACC_NB 8
+#define XXH_MIDSIZE_MAX 240
+#define XXH_SECRET_SIZE_MIN 136
+#define XXH_SECRET_MERGEACCS_START 11
+#define XXH_SECRET_LASTACC_START 7
+#define XXH_MIDSIZE_STARTOFFSET 3
+#define XXH_MIDSIZE_LASTOFFSET 17
+
+static const uint8_t xxh_secret[XXH_SECRET_SIZE] = {
+    0xb8, 0xfe, 0x6c, 0x39, 0x23, 0xa4, 0x4b, 0xbe, 0x7c, 0x01, 0x81, 0x2c, 0xf7, 0x21, 0xad, 0x1c,
+    0xde, 0xd4, 0x6d, 0xe9, 0x83, 0x90, 0x97, 0xdb, 0x72, 0x40, 0xa4, 0xa4, 0xb7, 0xb3, 0x67, 0x1f,
+    0xcb, 0x79, 0xe6, 0x4e, 0xcc, 0xc0, 0xe5, 0x78, 0x82, 0x5a, 0xd0, 0x7d, 0xcc, 0xff, 0x72, 0x21,
+    0xb8, 0x08, 0x46, 0x74, 0xf7, 0x43, 0x24, 0x8e, 0xe0, 0x35, 0x90, 0xe6, 0x81, 0x3a, 0x26, 0x4c,
+    0x3c, 0x28, 0x52, 0xbb, 0x91, 0xc3, 0x00, 0xcb, 0x88, 0xd0, 0x65, 0x8b, 0x1b, 0x53, 0x2e, 0xa3,
+    0x71, 0x64, 0x48, 0x97, 0xa2, 0x0d, 0xf9, 0x4e, 0x38, 0x19, 0xef, 0x46, 0xa9, 0xde, 0xac, 0xd8,
+    0xa8, 0xfa, 0x76, 0x3f, 0xe3, 0x9c, 0x34, 0x3f, 0xf9, 0xdc, 0xbb, 0xc7, 0xc7, 0x0b, 0x4f, 0x1d,
+    0x8a, 0x51, 0xe0, 0x4b, 0xcd, 0xb4, 0x59, 0x31, 0xc8, 0x9f, 0x7e, 0xc9, 0xd9, 0x78, 0x73, 0x64,
+    0xea, 0xc5, 0xac, 0x83, 0x34, 0xd3, 0xeb, 0xc3, 0xc5, 0x81, 0xa0, 0xff, 0xfa, 0x13, 0x63, 0xeb,
+    0x17, 0x0d, 0xdd, 0x51, 0xb7, 0xf0, 0xda, 0x49, 0xd3, 0x16, 0x55, 0x26, 0x29, 0xd4, 0x68, 0x9e,
+    0x2b, 0x16, 0xbe, 0x58, 0x7d, 0x47, 0xa1, 0xfc, 0x8f, 0xf8, 0xb8, 0xd1, 0x7a, 0xd0, 0x31, 0xce,
+    0x45, 0xcb, 0x3a, 0x8f, 0x95, 0x16, 0x04, 0x28, 0xaf, 0xd7, 0xfb, 0xca, 0xbb, 0x4b, 0x40, 0x7e
+};
+
+static inline uint32_t xxh_read32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap32(v);
+#endif
+    return v;
+}
+
+static inline uint64_t xxh_read64(const uint8_t *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap64(v);
+#endif
+    return v;
+}
+
+static inline uint64_t xxh_mul128_fold64(uint64_t lhs, uint64_t rhs) {
+    unsigned __int128 product = (unsigned __int128)lhs * rhs;
+    return (uint64_t)product ^ (uint64_t)(product >> 64);
+}
+
+static inline uint64_t xxh_xorshift64(uint64_t v, int shift) {
+    return v ^ (v >> shift);
+}
+
+static uint64_t xxh64_avalanche(uint64_t h) {
+    h ^= h >> 33;
+    h *= XXH_PRIME64_2;
+    h ^= h >> 29;
+    h *= XXH_PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+static uint64_t xxh3_avalanche(uint64_t h) {
+    h = xxh_xorshift64(h, 37);
+    h *= 0x165667919E3779F9ULL;
+    return xxh_xorshift64(h, 32);
+}
+
+static uint64_t xxh3_rrmxmx(uint64_t h, uint64_t len) {
+    h ^= ((h << 49) | (h >> 15)) ^ ((h << 24) | (h >> 40));
+    h *= 0x9FB21C651E98DF25ULL;
+    h ^= (h >> 35) + len;
+    h *= 0x9FB21C651E98DF25ULL;
+    return xxh_xorshift64(h, 28);
+}
+
+static inline uint64_t xxh3_mix16(const uint8_t *data, const uint8_t *secret) {
+    return xxh_mul128_fold64(xxh_read64(data) ^ xxh_read64(secret),
+        xxh_read64(data + 8) ^ xxh_read64(secret + 8));
+}
+
+static uint64_t xxh3_len_0to16(const uint8_t *data, uint32_t len) {
+    if(len > 8) {
+        uint64_t lo = xxh_read64(data) ^ (xxh_read64(xxh_secret + 24) ^ xxh_read64(xxh_secret + 32));
+        uint64_t hi = xxh_read64(data + len - 8) ^ (xxh_read64(xxh_secret + 40) ^ xxh_read64(xxh_secret + 48));
+        uint64_t acc = len + __builtin_bswap64(lo) + hi + xxh_mul128_fold64(lo, hi);
+        return xxh3_avalanche(acc);
+    }
+    else if(len >= 4) {
+        uint64_t input64 = xxh_read32(data + len - 4) + ((uint64_t)xxh_read32(data) << 32);
+        uint64_t flip = xxh_read64(xxh_secret + 8) ^ xxh_read64(xxh_secret + 16);
+        return xxh3_rrmxmx(input64 ^ flip, len);
+    }
+    else if(len > 0) {
+        uint32_t combined = ((uint32_t)data[0] << 16) | ((uint32_t)data[len >> 1] << 24) |
+            (uint32_t)data[len - 1] | (len << 8);
+        uint64_t flip = xxh_read32(xxh_secret) ^ xxh_read32(xxh_secret + 4);
+        return xxh64_avalanche(combined ^ flip);
+    }
+    return xxh64_avalanche(xxh_read64(xxh_secret + 56) ^ xxh_read64(xxh_secret + 64));
+}
+
+static uint64_t xxh3_len_17to128(const uint8_t *data, uint32_t len) {
+    uint64_t acc = len * XXH_PRIME64_1;
+    
+    if(len > 32) {
+        if(len > 64) {
+            if(len > 96) {
+                acc += xxh3_mix16(data + 48, xxh_secret + 96);
+                acc += xxh3_mix16(data + len - 64, xxh_secret + 112);
+            }
+            acc += xxh3_mix16(data + 32, xxh_secret + 64);
+            acc += xxh3_mix16(data + len - 48, xxh_secret + 80);
+        }
+        acc += xxh3_mix16(data + 16, xxh_secret + 32);
+        acc += xxh3_mix16(data + len - 32, xxh_secret + 48);
+    }
+    acc += xxh3_mix16(data, xxh_secret);
+    acc += xxh3_mix16(data + len - 16, xxh_secret + 16);
+    
+    return xxh3_avalanche(acc);
+}
+
+static uint64_t xxh3_len_129to240(const uint8_t *data, uint32_t len) {
+    uint64_t acc = len * XXH_PRIME64_1;
+    uint32_t rounds = len / 16;
+    uint32_t x;
+    
+    for(x = 0; x < 8; x++) {
+        acc += xxh3_mix16(data + 16 * x, xxh_secret + 16 * x);
+    }
+    acc = xxh3_avalanche(acc);
+    
+    for(x = 8; x < rounds; x++) {
+        acc += xxh3_mix16(data + 16 * x, xxh_secret + 16 * (x - 8) + XXH_MIDSIZE_STARTOFFSET);
+    }
+    acc += xxh3_mix16(data + len - 16, xxh_secret + XXH_SECRET_SIZE_MIN - XXH_MIDSIZE_LASTOFFSET);
+    
+    return xxh3_avalanche(acc);
+}
+
+static inline void xxh3_accumulate_512(uint64_t *acc, const uint8_t *data, const uint8_t *secret) {
+    int x;
+    for(x = 0; x < XXH_ACC_NB; x++) {
+        uint64_t value = xxh_read64(data + 8 * x);
+        uint64_t key = value ^ xxh_read64(secret + 8 * x);
+        acc[x ^ 1] += value;
+        acc[x] += (uint64_t)(uint32_t)key * (key >> 32);
+    }
+}
+
+static inline void xxh3_scramble(uint64_t *acc, const uint8_t *secret) {
+    int x;
+    for(x = 0; x < XXH_ACC_NB; x++) {
+        uint64_t value = xxh_xorshift64(acc[x], 47) ^ xxh_read64(secret + 8 * x);
+        acc[x] = value * XXH_PRIME32_1;
+    }
+}
+
+static uint64_t xxh3_len_long(const uint8_t *data, uint32_t len) {
+    uint64_t acc[XXH_ACC_NB] = {
+        XXH_PRIME32_3, XXH_PRIME64_1, XXH_PRIME64_2, XXH_PRIME64_3,
+        XXH_PRIME64_4, XXH_PRIME32_2, XXH_PRIME64_5, XXH_PRIME32_1
+    };
+    uint32_t stripesPerBlock = (XXH_SECRET_SIZE - XXH_STRIPE_LEN) / XXH_SECRET_CONSUME_RATE;
+    uint32_t blockLen = XXH_STRIPE_LEN * stripesPerBlock;
+    uint32_t blocks = (len - 1) / blockLen;
+    uint32_t block, stripe;
+    
+    for(block = 0; block < blocks; block++) {
+        for(stripe = 0; stripe < stripesPerBlock; stripe++) {
+            xxh3_accumulate_512(acc, data + block * blockLen + stripe * XXH_STRIPE_LEN,
+                xxh_secret + stripe * XXH_SECRET_CONSUME_RATE);
+        }
+        xxh3_scramble(acc, xxh_secret + XXH_SECRET_SIZE - XXH_STRIPE_LEN);
+    }
+    
+    // The last partial block, then the last stripe
+    uint32_t stripes = ((len - 1) - blockLen * blocks) / XXH_STRIPE_LEN;
+    for(stripe = 0; stripe < stripes; stripe++) {
+        xxh3_accumulate_512(acc, data + blocks * blockLen + stripe * XXH_STRIPE_LEN,
+            xxh_secret + stripe * XXH_SECRET_CONSUME_RATE);
+    }
+    xxh3_accumulate_512(acc, data + len - XXH_STRIPE_LEN,
+        xxh_secret + XXH_SECRET_SIZE - XXH_STRIPE_LEN - XXH_SECRET_LASTACC_START);
+    
+    uint64_t result = len * XXH_PRIME64_1;
+    int x;
+    for(x = 0; x < 4; x++) {
+        const uint8_t *secret = xxh_secret + XXH_SECRET_MERGEACCS_START + 16 * x;
+        result += xxh_mul128_fold64(acc[2 * x] ^ xxh_read64(secret), acc[2 * x + 1] ^ xxh_read64(secret + 8));
+    }
+    return xxh3_avalanche(result);
+}
+
+uint64_t xxh3_64(const uint8_t *data, uint32_t len) {
+    if(len <= 16) return xxh3_len_0to16(data, len);
+    if(len <= 128) return xxh3_len_17to128(data, len);
+    if(len <= XXH_MIDSIZE_MAX) return xxh3_len_129to240(data, len);
+    return xxh3_len_long(data, len);
+}
@@ -0,0 +1,29 @@
+/**
+ * Copyright 2015 Chris Moos
+ * 
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and 
+ * limitations under the License.
+ */
+
+#ifndef XXHASH_H
+#define XXHASH_H
+
+#include <stdint.h>
+
+/**
+ * The 64-bit XXH3 hash of data, with the default secret and a seed of 0.
+ * The result matches XXH3_64bits() from the reference xxHash library.
+ */
+uint64_t xxh3_64(const uint8_t *data, uint32_t len);
+
+#endif